@@ -170,11 +170,14 @@ int main(int argc, char **argv) {
 			logprintf(LOG_ERR, "could not connect to pilight-daemon");
 			goto close;
 		}
+	} else if((sockfd = socket_connect_unix(SOCKET_FILE)) != -1) {
+		logprintf(LOG_DEBUG, "connected to the local pilight-daemon");
 	} else if(ssdp_seek(&ssdp_list) == -1) {
 		logprintf(LOG_NOTICE, "no pilight ssdp connections found");
 		goto close;
 	} else {
-		if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1) {
+		if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1 &&
+		   (ssdp_reseek(&ssdp_list) == -1 || (sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1)) {
 			logprintf(LOG_ERR, "could not connect to pilight-daemon");
 			goto close;
 		}
@@ -67,6 +67,11 @@
 #include "libs/pilight/core/proc.h"
 #include "libs/pilight/core/ntp.h"
 #include "libs/pilight/core/config.h"
+#include "libs/pilight/core/history.h"
+#include "libs/pilight/core/metrics.h"
+#include "libs/pilight/core/http.h"
+#include "libs/pilight/core/ping.h"
+#include "libs/pilight/core/arp.h"
 
 #ifdef EVENTS
 	#include "libs/pilight/events/events.h"
@@ -93,6 +98,46 @@ static uv_timer_t *timer_stats_req = NULL;
 static char server_name[40];
 #endif
 
+/*
+ * Filters a receiver client can set in the identify options,
+ * so it only gets the broadcasts it's interested in. E.g.:
+ *
+ * "filter": {
+ *   "protocol": [ "alecto_wx500" ],
+ *   "device": [ "weather" ],
+ *   "origin": [ "receiver" ],
+ *   "values": { "temperature": ">=20.5", "battery": 1 }
+ * }
+ *
+ * All given criteria have to match. A message matches a list
+ * when it matches any of its entries.
+ */
+#define FILTER_EQ		0
+#define FILTER_NE		1
+#define FILTER_LT		2
+#define FILTER_LE		3
+#define FILTER_GT		4
+#define FILTER_GE		5
+
+typedef struct client_predicate_t {
+	char *key;
+	int op;
+	int vartype;
+	double number_;
+	char *string_;
+	struct client_predicate_t *next;
+} client_predicate_t;
+
+typedef struct client_filter_t {
+	char **protocols;
+	int nrprotocols;
+	char **devices;
+	int nrdevices;
+	char **origins;
+	int nrorigins;
+	struct client_predicate_t *predicates;
+} client_filter_t;
+
 typedef struct clients_t {
 	char uuid[UUID_LENGTH];
 	int id;
@@ -101,6 +146,9 @@ typedef struct clients_t {
 	int core;
 	int stats;
 	int forward;
+	/* Messages are sent as CBOR instead of JSON */
+	int cbor;
+	struct client_filter_t *filter;
 	char media[8];
 	double cpu;
 	double ram;
@@ -119,6 +167,11 @@ typedef struct sendqueue_t {
 	int code[MAXPULSESTREAMLENGTH];
 	int length;
 	char uuid[UUID_LENGTH];
+	/* Scheduling, times in microseconds */
+	char *devkey;
+	int priority;
+	uint64_t queued;
+	unsigned long airtime;
 	struct sendqueue_t *next;
 } sendqueue_t;
 
@@ -130,6 +183,8 @@ typedef struct recvqueue_t {
 	int rawlen;
 	int hwtype;
 	int plslen;
+	/* Receiver, NULL for codes looped back by the sender */
+	struct hardware_t *hw;
 	struct recvqueue_t *next;
 } recvqueue_t;
 
@@ -190,8 +245,6 @@ static int sockfd = 0;
 static pthread_t logpth;
 /* While loop conditions */
 static unsigned short main_loop = 1;
-/* Reset repeats after a certain amount of time */
-static struct timeval tv;
 /* Are we running standalone */
 static int standalone = 0;
 /* Do we need to connect to a master server:port? */
@@ -243,6 +296,237 @@ static void *reason_socket_send_free(void *param) {
 	return NULL;
 }
 
+static void client_filter_free(struct client_filter_t *filter) {
+	struct client_predicate_t *tmp = NULL;
+
+	if(filter == NULL) {
+		return;
+	}
+	array_free(&filter->protocols, filter->nrprotocols);
+	array_free(&filter->devices, filter->nrdevices);
+	array_free(&filter->origins, filter->nrorigins);
+	while(filter->predicates) {
+		tmp = filter->predicates;
+		filter->predicates = filter->predicates->next;
+		FREE(tmp->key);
+		if(tmp->string_ != NULL) {
+			FREE(tmp->string_);
+		}
+		FREE(tmp);
+	}
+	FREE(filter);
+}
+
+static int client_filter_list(struct JsonNode *jlist, char ***array, int *nr) {
+	struct JsonNode *jchild = NULL;
+
+	if(jlist->tag != JSON_ARRAY) {
+		return -1;
+	}
+	jchild = json_first_child(jlist);
+	while(jchild) {
+		if(jchild->tag != JSON_STRING) {
+			return -1;
+		}
+		if((*array = REALLOC(*array, sizeof(char *)*(size_t)(*nr+1))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if(((*array)[*nr] = STRDUP(jchild->string_)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		(*nr)++;
+		jchild = jchild->next;
+	}
+	return 0;
+}
+
+static int client_filter_predicate(struct JsonNode *jvalue, struct client_predicate_t *pred) {
+	char *value = NULL, *end = NULL;
+
+	pred->op = FILTER_EQ;
+	if(jvalue->tag == JSON_NUMBER) {
+		pred->vartype = JSON_NUMBER;
+		pred->number_ = jvalue->number_;
+		return 0;
+	} else if(jvalue->tag != JSON_STRING) {
+		return -1;
+	}
+
+	value = jvalue->string_;
+	if(strncmp(value, "!=", 2) == 0) {
+		pred->op = FILTER_NE;
+		value += 2;
+	} else if(strncmp(value, "<=", 2) == 0) {
+		pred->op = FILTER_LE;
+		value += 2;
+	} else if(strncmp(value, ">=", 2) == 0) {
+		pred->op = FILTER_GE;
+		value += 2;
+	} else if(value[0] == '<') {
+		pred->op = FILTER_LT;
+		value++;
+	} else if(value[0] == '>') {
+		pred->op = FILTER_GT;
+		value++;
+	} else if(value[0] == '=') {
+		value++;
+	}
+
+	pred->number_ = strtod(value, &end);
+	if(strlen(value) > 0 && *end == '\0') {
+		pred->vartype = JSON_NUMBER;
+	} else if(pred->op == FILTER_EQ || pred->op == FILTER_NE) {
+		pred->vartype = JSON_STRING;
+		if((pred->string_ = STRDUP(value)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Compile the filter options of a client or return NULL when invalid */
+static struct client_filter_t *client_filter_compile(struct JsonNode *jfilter) {
+	struct client_filter_t *filter = NULL;
+	struct client_predicate_t *pred = NULL;
+	struct JsonNode *jchild = NULL, *jvalue = NULL;
+	int error = 0;
+
+	if(jfilter->tag != JSON_OBJECT) {
+		return NULL;
+	}
+	if((filter = MALLOC(sizeof(struct client_filter_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(filter, 0, sizeof(struct client_filter_t));
+
+	jchild = json_first_child(jfilter);
+	while(jchild && error == 0) {
+		if(strcmp(jchild->key, "protocol") == 0) {
+			error = client_filter_list(jchild, &filter->protocols, &filter->nrprotocols);
+		} else if(strcmp(jchild->key, "device") == 0) {
+			error = client_filter_list(jchild, &filter->devices, &filter->nrdevices);
+		} else if(strcmp(jchild->key, "origin") == 0) {
+			error = client_filter_list(jchild, &filter->origins, &filter->nrorigins);
+		} else if(strcmp(jchild->key, "values") == 0 && jchild->tag == JSON_OBJECT) {
+			jvalue = json_first_child(jchild);
+			while(jvalue && error == 0) {
+				if((pred = MALLOC(sizeof(struct client_predicate_t))) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				memset(pred, 0, sizeof(struct client_predicate_t));
+				if((pred->key = STRDUP(jvalue->key)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				pred->next = filter->predicates;
+				filter->predicates = pred;
+				error = client_filter_predicate(jvalue, pred);
+				jvalue = jvalue->next;
+			}
+		} else {
+			error = -1;
+		}
+		jchild = jchild->next;
+	}
+	if(error != 0) {
+		client_filter_free(filter);
+		return NULL;
+	}
+	return filter;
+}
+
+static int client_filter_list_match(char **array, int nr, const char *value) {
+	int i = 0;
+
+	if(value == NULL) {
+		return -1;
+	}
+	for(i=0;i<nr;i++) {
+		if(strcmp(array[i], value) == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Check a broadcast against the filter of a client. The devices
+ * are the ones updated by the message as returned by devices_update.
+ */
+static int client_filter_match(struct client_filter_t *filter, const char *protoname, struct JsonNode *json, struct JsonNode *jdevices) {
+	struct client_predicate_t *pred = NULL;
+	struct JsonNode *jmessage = NULL, *jvalue = NULL, *jchild = NULL;
+	char *origin = NULL;
+	double diff = 0.0;
+	int match = 0;
+
+	if(filter == NULL) {
+		return 0;
+	}
+	if(filter->nrprotocols > 0 && client_filter_list_match(filter->protocols, filter->nrprotocols, protoname) != 0) {
+		return -1;
+	}
+	if(filter->nrorigins > 0) {
+		json_find_string(json, "origin", &origin);
+		if(client_filter_list_match(filter->origins, filter->nrorigins, origin) != 0) {
+			return -1;
+		}
+	}
+	if(filter->nrdevices > 0) {
+		match = 0;
+		if(jdevices != NULL) {
+			jchild = json_first_child(jdevices);
+			while(jchild && match == 0) {
+				if(jchild->tag == JSON_STRING &&
+				   client_filter_list_match(filter->devices, filter->nrdevices, jchild->string_) == 0) {
+					match = 1;
+				}
+				jchild = jchild->next;
+			}
+		}
+		if(match == 0) {
+			return -1;
+		}
+	}
+	if(filter->predicates != NULL) {
+		if((jmessage = json_find_member(json, "message")) == NULL) {
+			return -1;
+		}
+		for(pred=filter->predicates;pred!=NULL;pred=pred->next) {
+			if((jvalue = json_find_member(jmessage, pred->key)) == NULL) {
+				return -1;
+			}
+			if(pred->vartype == JSON_STRING) {
+				if(jvalue->tag != JSON_STRING) {
+					return -1;
+				}
+				match = (strcmp(jvalue->string_, pred->string_) == 0);
+				if((pred->op == FILTER_EQ && match == 0) || (pred->op == FILTER_NE && match == 1)) {
+					return -1;
+				}
+				continue;
+			}
+			if(jvalue->tag != JSON_NUMBER) {
+				return -1;
+			}
+			diff = jvalue->number_-pred->number_;
+			switch(pred->op) {
+				case FILTER_EQ: match = (diff == 0); break;
+				case FILTER_NE: match = (diff != 0); break;
+				case FILTER_LT: match = (diff < 0); break;
+				case FILTER_LE: match = (diff <= 0); break;
+				case FILTER_GT: match = (diff > 0); break;
+				case FILTER_GE: match = (diff >= 0); break;
+			}
+			if(match == 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
 static void client_remove(int id) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -259,6 +543,7 @@ static void client_remove(int id) {
 				prevP->next = currP->next;
 			}
 
+			client_filter_free(currP->filter);
 			FREE(currP);
 			break;
 		}
@@ -309,6 +594,103 @@ static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_
 	}
 }
 
+static int client_write(struct clients_t *client, const char *out, struct JsonNode *json) {
+	if(client->cbor == 1) {
+		return socket_write_cbor(client->id, json);
+	}
+	return socket_write(client->id, out);
+}
+
+/*
+ * Nodes keep their device states in sync with the master by a
+ * stream of numbered updates. The master keeps the most recent
+ * updates, so a node that reconnects only needs the ones it
+ * missed instead of the whole configuration. The epoch tells
+ * the nodes when the numbering started over after a restart.
+ */
+#define SYNC_LOG_SIZE		256
+#define SYNC_BATCH			16
+
+static char *synclog[SYNC_LOG_SIZE];
+static unsigned long syncseq = 0;
+static unsigned long syncsent = 0;
+static double syncepoch = 0;
+
+/* Last update received from the master */
+static unsigned long nodeseq = 0;
+static double nodeepoch = 0;
+
+/* Must be called with the bcqueue_lock held */
+static void sync_log(const char *update) {
+	char **entry = &synclog[++syncseq % SYNC_LOG_SIZE];
+
+	if(*entry != NULL) {
+		FREE(*entry);
+	}
+	if((*entry = STRDUP(update)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+}
+
+/*
+ * Create a delta message of the updates after seq or return
+ * NULL when they aren't all available anymore.
+ */
+static struct JsonNode *sync_delta(unsigned long seq) {
+	struct JsonNode *jsend = NULL, *jupdates = NULL;
+
+	if(seq > syncseq || syncseq-seq > SYNC_LOG_SIZE) {
+		return NULL;
+	}
+	jsend = json_mkobject();
+	jupdates = json_mkarray();
+	json_append_member(jsend, "message", json_mkstring("delta"));
+	json_append_member(jsend, "epoch", json_mknumber(syncepoch, 0));
+	json_append_member(jsend, "seq", json_mknumber((double)syncseq, 0));
+	while(seq < syncseq) {
+		json_append_element(jupdates, json_decode(synclog[++seq % SYNC_LOG_SIZE]));
+	}
+	json_append_member(jsend, "updates", jupdates);
+	return jsend;
+}
+
+static void sync_gc(void) {
+	int i = 0;
+
+	for(i=0;i<SYNC_LOG_SIZE;i++) {
+		if(synclog[i] != NULL) {
+			FREE(synclog[i]);
+		}
+	}
+}
+
+/* Send the updates not yet streamed to the nodes */
+static void sync_flush(void) {
+	struct clients_t *tmp_clients = clients;
+	struct JsonNode *jsend = NULL;
+	char *out = NULL;
+
+	if(syncsent == syncseq) {
+		return;
+	}
+	while(tmp_clients) {
+		if(tmp_clients->forward == 1) {
+			if(out == NULL) {
+				jsend = sync_delta(syncsent);
+				out = json_stringify(jsend, NULL);
+				str_replace("%", "%%", &out);
+				json_delete(jsend);
+			}
+			socket_write(tmp_clients->id, out);
+		}
+		tmp_clients = tmp_clients->next;
+	}
+	if(out != NULL) {
+		json_free(out);
+	}
+	syncsent = syncseq;
+}
+
 void *broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -335,7 +717,7 @@ void *broadcast(void *param) {
 						if(((int)tmp < 0 && tmp_clients->core == 1) ||
 						   ((int)tmp >= 0 && tmp_clients->config == 1) ||
 							 ((int)tmp == PROCESS && tmp_clients->stats == 1)) {
-							socket_write(tmp_clients->id, conf);
+							client_write(tmp_clients, conf, bcqueue->jmessage);
 							broadcasted = 1;
 						}
 						tmp_clients = tmp_clients->next;
@@ -400,10 +782,14 @@ void *broadcast(void *param) {
 									}
 								}
 								if(match1 == 1) {
-									char *conf = json_stringify(jtmp, NULL);
-									socket_write(tmp_clients->id, conf);
-									logprintf(LOG_DEBUG, "broadcasted: %s", conf);
-									json_free(conf);
+									if(tmp_clients->cbor == 1) {
+										socket_write_cbor(tmp_clients->id, jtmp);
+									} else {
+										char *conf = json_stringify(jtmp, NULL);
+										socket_write(tmp_clients->id, conf);
+										logprintf(LOG_DEBUG, "broadcasted: %s", conf);
+										json_free(conf);
+									}
 								}
 								json_delete(jtmp);
 							}
@@ -412,7 +798,6 @@ void *broadcast(void *param) {
 						eventpool_trigger(REASON_BROADCAST_CORE, reason_broadcast_core_free, tmp);
 
 						// json_free(tmp);
-						json_delete(jret);
 					}
 
 					/* The settings objects inside the broadcast queue is only of interest for the
@@ -469,18 +854,26 @@ void *broadcast(void *param) {
 					}
 
 					/* Write the message to all receivers */
+					struct JsonNode *jdevices = NULL;
+					if(jret != NULL) {
+						jdevices = json_find_member(jret, "devices");
+					}
 					struct clients_t *tmp_clients = clients;
 					while(tmp_clients) {
-						if(tmp_clients->receiver == 1 && tmp_clients->forward == 0) {
+						if(tmp_clients->receiver == 1 && tmp_clients->forward == 0 &&
+						   client_filter_match(tmp_clients->filter, bcqueue->protoname, bcqueue->jmessage, jdevices) == 0) {
 								if(strcmp(out, "{}") != 0 && nrchilds > 1) {
-									socket_write(tmp_clients->id, out);
+									client_write(tmp_clients, out, bcqueue->jmessage);
 									broadcasted = 1;
 								}
 						}
 						tmp_clients = tmp_clients->next;
 					}
 
-					if(pilight.runmode == ADHOC && sockfd > 0) {
+					sync_log(internal);
+
+					/* Updates from the master don't need to go back */
+					if(pilight.runmode == ADHOC && sockfd > 0 && bcqueue->origin != NODE) {
 						struct JsonNode *jupdate = json_decode(internal);
 						json_append_member(jupdate, "action", json_mkstring("update"));
 						char *ret = json_stringify(jupdate, NULL);
@@ -492,11 +885,19 @@ void *broadcast(void *param) {
 					if((broadcasted == 1 || nodaemon == 1) && (strcmp(out, "{}") != 0 && nrchilds > 1)) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", out);
 					}
+					if(jret != NULL) {
+						json_delete(jret);
+					}
 					json_free(internal);
 					// json_free(out);
 					eventpool_trigger(REASON_BROADCAST_CORE, reason_broadcast_core_free, out);
 				}
 			}
+			/* Batch the updates while more are waiting */
+			if(bcqueue_number == 1 || syncseq-syncsent >= SYNC_BATCH) {
+				sync_flush();
+			}
+
 			struct bcqueue_t *tmp = bcqueue;
 			FREE(tmp->protoname);
 			json_delete(tmp->jmessage);
@@ -511,7 +912,7 @@ void *broadcast(void *param) {
 	return (void *)NULL;
 }
 
-static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
+static void receive_queue(int *raw, int rawlen, int plslen, int hwtype, struct hardware_t *hw) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	int i = 0;
@@ -530,6 +931,7 @@ static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
 			rnode->rawlen = rawlen;
 			rnode->plslen = plslen;
 			rnode->hwtype = hwtype;
+			rnode->hw = hw;
 
 			if(recvqueue_number == 0) {
 				recvqueue = rnode;
@@ -594,57 +996,322 @@ static void receive_parse_api(struct JsonNode *code, int hwtype) {
 	}
 }
 
-void *receive_parse_code(void *param) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+static int recvqueue_size(void) {
+	return recvqueue_number;
+}
 
-	pthread_mutex_lock(&recvqueue_lock);
-	while(main_loop) {
-		if(recvqueue_number > 0) {
-			pthread_mutex_lock(&recvqueue_lock);
+static int sendqueue_size(void) {
+	return sendqueue_number;
+}
 
-			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+static int bcqueue_size(void) {
+	return bcqueue_number;
+}
 
-			struct protocol_t *protocol = NULL;
-			struct protocols_t *pnode = protocols;
+/*
+ * Remotes send each code several times in a row. The repeats
+ * of a pulse train are recognized by the hardware type and the
+ * hash of the quantized frame, so they only increase a counter
+ * instead of being validated and parsed again. The decoded
+ * messages are broadcasted once the repeats stop, carrying the
+ * number of repeats received.
+ *
+ * When several receivers of the same type are configured, they
+ * pick up the same frames. These copies are merged into a single
+ * entry, so each frame is broadcasted once. The repeats are
+ * counted per receiver and the copy with the least pulse length
+ * jitter is the one that gets decoded.
+ *
+ * Codes that keep on repeating, like a button that is held
+ * down, are broadcasted anyway once they were held for
+ * RECV_REPEAT_HOLD.
+ */
+#define RECV_REPEAT_CACHE		16
+#define RECV_REPEAT_GAP			250000
+#define RECV_REPEAT_HOLD		1000000
+#define RECV_DIVERSITY			4
+
+typedef struct recvrepeat_msg_t {
+	struct protocol_t *protocol;
+	struct JsonNode *message;
+	struct recvrepeat_msg_t *next;
+} recvrepeat_msg_t;
+
+typedef struct recvrepeat_rx_t {
+	struct hardware_t *hw;
+	int copies;
+} recvrepeat_rx_t;
+
+typedef struct recvrepeat_t {
+	uint64_t hash;
+	/* First and last time seen in microseconds */
+	uint64_t first;
+	uint64_t last;
+	int hwtype;
+	int rawlen;
+	int repeats;
+	int active;
+	/* Receiver and jitter of the decoded copy */
+	struct hardware_t *best;
+	unsigned long jitter;
+	int nrreceivers;
+	struct recvrepeat_rx_t receivers[RECV_DIVERSITY];
+	struct recvrepeat_msg_t *messages;
+} recvrepeat_t;
+
+static struct recvrepeat_t recvrepeat[RECV_REPEAT_CACHE];
+static struct protocol_frame_t recvframe;
+
+static void receive_repeat_clear(struct recvrepeat_t *entry) {
+	struct recvrepeat_msg_t *tmp = NULL;
+
+	while(entry->messages) {
+		tmp = entry->messages;
+		entry->messages = entry->messages->next;
+		json_delete(tmp->message);
+		FREE(tmp);
+	}
+}
 
-			while(pnode != NULL && main_loop) {
-				protocol = pnode->listener;
+static void receive_repeat_flush(struct recvrepeat_t *entry, int broadcast) {
+	struct recvrepeat_msg_t *tmp = NULL;
 
-				if((protocol->hwtype == recvqueue->hwtype || protocol->hwtype == -1 || recvqueue->hwtype == -1) &&
-				   (protocol->parseCode != NULL && protocol->validate != NULL)) {
+	if(broadcast == 1) {
+		if(entry->best != NULL) {
+			metrics_add(&entry->best->nrbest, 1);
+		}
+		if(entry->nrreceivers == 1 && entry->receivers[0].hw != NULL) {
+			metrics_add(&entry->receivers[0].hw->nrunique, 1);
+		}
+		while(entry->messages) {
+			tmp = entry->messages;
+			tmp->protocol->message = tmp->message;
+			tmp->protocol->repeats = entry->repeats;
+			receiver_create_message(tmp->protocol);
+			entry->messages = entry->messages->next;
+			FREE(tmp);
+		}
+	} else {
+		receive_repeat_clear(entry);
+	}
+	entry->active = 0;
+}
 
-					if(recvqueue->rawlen < MAXPULSESTREAMLENGTH) {
-						protocol->raw = recvqueue->raw;
-					}
-					protocol->rawlen = recvqueue->rawlen;
+/*
+ * Broadcast the codes which weren't repeated for a while
+ * and return when the next pending one expires, or 0 when
+ * nothing is pending.
+ */
+static uint64_t receive_repeat_expire(uint64_t now) {
+	uint64_t next = 0, expires = 0;
+	int i = 0;
 
-					if(protocol->validate() == 0) {
-						logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
-						gettimeofday(&tv, NULL);
-						if(protocol->first > 0) {
-							protocol->first = protocol->second;
-						}
-						protocol->second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
-						if(protocol->first == 0) {
-							protocol->first = protocol->second;
-						}
+	for(i=0;i<RECV_REPEAT_CACHE;i++) {
+		if(recvrepeat[i].active == 0) {
+			continue;
+		}
+		expires = recvrepeat[i].last+RECV_REPEAT_GAP;
+		if(recvrepeat[i].first+RECV_REPEAT_HOLD < expires) {
+			expires = recvrepeat[i].first+RECV_REPEAT_HOLD;
+		}
+		if(now >= expires) {
+			receive_repeat_flush(&recvrepeat[i], 1);
+		} else if(next == 0 || expires < next) {
+			next = expires;
+		}
+	}
+	return next;
+}
 
-						/* Reset # of repeats after a certain delay */
-						if(((int)protocol->second-(int)protocol->first) > 500000) {
-							protocol->repeats = 0;
-						}
+static struct recvrepeat_t *receive_repeat_find(struct recvqueue_t *node, uint64_t hash) {
+	int i = 0;
 
-						protocol->repeats++;
-						if(protocol->parseCode != NULL) {
-							logprintf(LOG_DEBUG, "recevied pulse length of %d", recvqueue->plslen);
-							logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", protocol->repeats, protocol->id);
-							logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
-							protocol->parseCode();
-							receiver_create_message(protocol);
-						}
+	for(i=0;i<RECV_REPEAT_CACHE;i++) {
+		if(recvrepeat[i].active == 1 && recvrepeat[i].hash == hash &&
+		   recvrepeat[i].hwtype == node->hwtype && recvrepeat[i].rawlen == node->rawlen) {
+			return &recvrepeat[i];
+		}
+	}
+	return NULL;
+}
+
+static struct recvrepeat_t *receive_repeat_add(struct recvqueue_t *node, uint64_t hash, uint64_t now) {
+	struct recvrepeat_t *entry = NULL;
+	int i = 0;
+
+	for(i=0;i<RECV_REPEAT_CACHE;i++) {
+		if(recvrepeat[i].active == 0) {
+			entry = &recvrepeat[i];
+			break;
+		}
+		if(entry == NULL || recvrepeat[i].last < entry->last) {
+			entry = &recvrepeat[i];
+		}
+	}
+
+	/* Make room by broadcasting the oldest code early */
+	if(entry->active == 1) {
+		receive_repeat_flush(entry, 1);
+	}
+
+	entry->hash = hash;
+	entry->first = now;
+	entry->last = now;
+	entry->hwtype = node->hwtype;
+	entry->rawlen = node->rawlen;
+	entry->repeats = 0;
+	entry->active = 1;
+	entry->best = NULL;
+	entry->jitter = 0;
+	entry->nrreceivers = 0;
+	entry->messages = NULL;
+
+	return entry;
+}
+
+/*
+ * Count a copy of the frame received by the receiver of node
+ * and return its number of copies so far.
+ */
+static int receive_repeat_copy(struct recvrepeat_t *entry, struct recvqueue_t *node) {
+	int i = 0;
+
+	for(i=0;i<entry->nrreceivers;i++) {
+		if(entry->receivers[i].hw == node->hw) {
+			break;
+		}
+	}
+	if(i == entry->nrreceivers) {
+		if(i == RECV_DIVERSITY) {
+			return 0;
+		}
+		entry->receivers[i].hw = node->hw;
+		entry->receivers[i].copies = 0;
+		entry->nrreceivers++;
+	}
+	entry->receivers[i].copies++;
+	if(entry->receivers[i].copies > entry->repeats) {
+		entry->repeats = entry->receivers[i].copies;
+	}
+	return entry->receivers[i].copies;
+}
+
+/* Average deviation of the pulses in promille of the pulse length */
+static unsigned long receive_jitter(struct recvqueue_t *node) {
+	unsigned long jitter = 0;
+	int i = 0, n = 0;
+
+	if(node->plslen <= 0 || node->rawlen < 2) {
+		return 0;
+	}
+	for(i=0;i<node->rawlen-1;i++) {
+		if((n = (node->raw[i]+node->plslen/2)/node->plslen) == 0) {
+			n = 1;
+		}
+		jitter += (unsigned long)abs(node->raw[i]-n*node->plslen);
+	}
+	return (jitter*1000)/((unsigned long)node->plslen*(unsigned long)(node->rawlen-1));
+}
+
+static void receive_decode(struct recvrepeat_t *entry, struct recvqueue_t *node, unsigned long jitter) {
+	struct recvrepeat_msg_t *msg = NULL;
+	struct protocol_t *protocol = NULL;
+	struct protocols_t *pnode = protocols;
+
+	entry->best = node->hw;
+	entry->jitter = jitter;
+
+	while(pnode != NULL && main_loop) {
+		protocol = pnode->listener;
+
+		if((protocol->hwtype == node->hwtype || protocol->hwtype == -1 || node->hwtype == -1) &&
+		   (protocol->parseCode != NULL && protocol->validate != NULL)) {
+
+			if(node->rawlen < MAXPULSESTREAMLENGTH) {
+				protocol->raw = node->raw;
+			}
+			protocol->rawlen = node->rawlen;
+			protocol->frame = &recvframe;
+
+			uint64_t start = uv_hrtime();
+			int valid = protocol->validate();
+			metrics_add(&protocol->validatetime, (unsigned long)((uv_hrtime()-start)/1000));
+			metrics_add(&protocol->nrvalidate, 1);
+
+			if(valid == 0) {
+				logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
+				logprintf(LOG_DEBUG, "recevied pulse length of %d", node->plslen);
+				logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
+				start = uv_hrtime();
+				protocol->parseCode();
+				metrics_add(&protocol->parsetime, (unsigned long)((uv_hrtime()-start)/1000));
+				metrics_add(&protocol->nrparse, 1);
+
+				/* Hold the message until the repeats stopped */
+				if(protocol->message != NULL) {
+					if((msg = MALLOC(sizeof(struct recvrepeat_msg_t))) == NULL) {
+						OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 					}
+					msg->protocol = protocol;
+					msg->message = protocol->message;
+					msg->next = NULL;
+					protocol->message = NULL;
+
+					/* Keep the order of the protocols */
+					struct recvrepeat_msg_t **last = &entry->messages;
+					while(*last != NULL) {
+						last = &(*last)->next;
+					}
+					*last = msg;
+				}
+			}
+		}
+		pnode = pnode->next;
+	}
+}
+
+void *receive_parse_code(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct recvrepeat_t *entry = NULL;
+	struct timeval tp;
+	struct timespec ts;
+	uint64_t now = 0, next = 0;
+	unsigned long jitter = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&recvqueue_lock);
+	while(main_loop) {
+		now = uv_hrtime()/1000;
+		next = receive_repeat_expire(now);
+
+		if(recvqueue_number > 0) {
+			pthread_mutex_lock(&recvqueue_lock);
+
+			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+
+			/* Quantize once for all decoders */
+			protocol_frame(&recvframe, recvqueue->raw, recvqueue->rawlen, recvqueue->plslen);
+			jitter = receive_jitter(recvqueue);
+			if(recvqueue->hw != NULL) {
+				metrics_add(&recvqueue->hw->nrframes, 1);
+			}
+			if((entry = receive_repeat_find(recvqueue, recvframe.hash)) != NULL) {
+				entry->last = now;
+				if(receive_repeat_copy(entry, recvqueue) == 1 && recvqueue->hw != entry->best) {
+					logprintf(LOG_DEBUG, "caught a pulse train on another receiver");
+				} else {
+					logprintf(LOG_DEBUG, "caught repeat %d of a known pulse train", entry->repeats);
 				}
-				pnode = pnode->next;
+				/* Decode the cleanest copy of the frame */
+				if(recvqueue->hw != entry->best && jitter < entry->jitter) {
+					receive_repeat_clear(entry);
+					receive_decode(entry, recvqueue, jitter);
+				}
+			} else {
+				entry = receive_repeat_add(recvqueue, recvframe.hash, now);
+				receive_repeat_copy(entry, recvqueue);
+				receive_decode(entry, recvqueue, jitter);
 			}
 
 			struct recvqueue_t *tmp = recvqueue;
@@ -652,13 +1319,169 @@ void *receive_parse_code(void *param) {
 			FREE(tmp);
 			recvqueue_number--;
 			pthread_mutex_unlock(&recvqueue_lock);
+		} else if(next > 0) {
+			gettimeofday(&tp, NULL);
+			next -= now;
+			ts.tv_sec = tp.tv_sec + (time_t)(next / 1000000);
+			ts.tv_nsec = (tp.tv_usec + (long)(next % 1000000)) * 1000;
+			if(ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&recvqueue_signal, &recvqueue_lock, &ts);
 		} else {
 			pthread_cond_wait(&recvqueue_signal, &recvqueue_lock);
 		}
 	}
+
+	for(i=0;i<RECV_REPEAT_CACHE;i++) {
+		receive_repeat_flush(&recvrepeat[i], 0);
+	}
+
 	return (void *)NULL;
 }
 
+/*
+ * Codes are not sent in plain FIFO order. A queued code for a
+ * device is replaced by a newer one for the same device, and
+ * user requests go before API calls and rule actions. Codes
+ * that go over the air are paced by a duty cycle budget per
+ * band and leave the receiver a window after each burst.
+ */
+#define SEND_DUTY_CYCLE				10
+#define SEND_DUTY_PERIOD			3600
+#define SEND_RECEIVE_WINDOW		50
+/* Codes waiting longer than this get the highest priority */
+#define SEND_AGING						5000000
+#define SEND_BANDS						(API+2)
+
+typedef struct sendband_t {
+	uint64_t updated;
+	double budget;
+} sendband_t;
+
+static struct sendband_t sendband[SEND_BANDS];
+static uint64_t sendfree = 0;
+static int send_duty_cycle = SEND_DUTY_CYCLE;
+static int send_receive_window = SEND_RECEIVE_WINDOW;
+
+static int send_priority(enum origin_t origin) {
+	switch((int)origin) {
+		case ORIGIN_WEBSERVER:
+			return 0;
+		case ACTION:
+		case RULE:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+static struct hardware_t *send_hardware(struct protocol_t *protocol) {
+	struct conf_hardware_t *tmp_confhw = conf_hardware;
+
+	while(tmp_confhw) {
+		if(protocol->hwtype == tmp_confhw->hardware->hwtype) {
+			return tmp_confhw->hardware;
+		}
+		tmp_confhw = tmp_confhw->next;
+	}
+	return NULL;
+}
+
+/* Microseconds on air, or 0 when the code isn't sent as pulses */
+static unsigned long send_airtime(struct protocol_t *protocol, int *code, int length) {
+	struct hardware_t *hw = send_hardware(protocol);
+	unsigned long airtime = 0;
+	int i = 0;
+
+	if(hw == NULL || (hw->comtype != COMOOK && hw->comtype != COMPLSTRAIN)) {
+		return 0;
+	}
+	for(i=0;i<length;i++) {
+		airtime += (unsigned long)code[i];
+	}
+	return airtime*(unsigned long)protocol->txrpt;
+}
+
+static double send_budget(int hwtype, uint64_t now) {
+	struct sendband_t *band = &sendband[hwtype+1];
+	double max = (double)send_duty_cycle*SEND_DUTY_PERIOD*10000.0;
+
+	if(band->updated == 0) {
+		band->budget = max;
+	} else {
+		band->budget += (double)(now-band->updated)*send_duty_cycle/100.0;
+		if(band->budget > max) {
+			band->budget = max;
+		}
+	}
+	band->updated = now;
+	return band->budget;
+}
+
+/*
+ * Pick the code to send now, or return NULL and set wait to
+ * the microseconds until one may be sent.
+ */
+static struct sendqueue_t *send_schedule(uint64_t now, uint64_t *wait) {
+	struct sendqueue_t *node = NULL, *best = NULL;
+	uint64_t ready = 0, first = 0;
+	double budget = 0.0;
+	int prio = 0, bprio = 0;
+
+	for(node=sendqueue;node!=NULL;node=node->next) {
+		ready = now;
+		if(node->airtime > 0) {
+			if(sendfree > ready) {
+				ready = sendfree;
+			}
+			budget = send_budget(node->protopt->hwtype, now);
+			/* Codes larger than the whole budget go when it's full */
+			if(budget < (double)node->airtime &&
+			   budget < (double)send_duty_cycle*SEND_DUTY_PERIOD*10000.0) {
+				uint64_t refill = (uint64_t)(((double)node->airtime-budget)*100.0/send_duty_cycle);
+				if(now+refill > ready) {
+					ready = now+refill;
+				}
+			}
+		}
+		if(ready > now) {
+			if(first == 0 || ready < first) {
+				first = ready;
+			}
+			continue;
+		}
+		prio = (now-node->queued > SEND_AGING) ? 0 : node->priority;
+		if(best == NULL || prio < bprio) {
+			best = node;
+			bprio = prio;
+		}
+	}
+	if(best == NULL) {
+		*wait = first-now;
+	}
+	return best;
+}
+
+static void send_unlink(struct sendqueue_t *node) {
+	struct sendqueue_t *prev = NULL, *tmp = sendqueue;
+
+	while(tmp != NULL && tmp != node) {
+		prev = tmp;
+		tmp = tmp->next;
+	}
+	if(prev == NULL) {
+		sendqueue = node->next;
+	} else {
+		prev->next = node->next;
+	}
+	if(sendqueue_head == node) {
+		sendqueue_head = prev;
+	}
+	node->next = NULL;
+}
+
 void *send_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -675,6 +1498,18 @@ void *send_code(void *param) {
 	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
 #endif
 
+	struct sendqueue_t *node = NULL;
+	struct timeval tp;
+	struct timespec ts;
+	uint64_t now = 0, wait = 0;
+
+	if(settings_find_number("send-duty-cycle", &send_duty_cycle) != 0) {
+		send_duty_cycle = SEND_DUTY_CYCLE;
+	}
+	if(settings_find_number("send-receive-window", &send_receive_window) != 0) {
+		send_receive_window = SEND_RECEIVE_WINDOW;
+	}
+
 	pthread_mutex_lock(&sendqueue_lock);
 
 	while(main_loop) {
@@ -683,45 +1518,63 @@ void *send_code(void *param) {
 
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
+			now = uv_hrtime()/1000;
+			if((node = send_schedule(now, &wait)) == NULL) {
+				gettimeofday(&tp, NULL);
+				ts.tv_sec = tp.tv_sec + (time_t)(wait / 1000000);
+				ts.tv_nsec = (tp.tv_usec + (long)(wait % 1000000)) * 1000;
+				if(ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				/*
+				 * Drop the inner lock first, the wait only releases
+				 * one level of the recursive lock and the queue has
+				 * to stay open for new sends while we wait.
+				 */
+				pthread_mutex_unlock(&sendqueue_lock);
+				pthread_cond_timedwait(&sendqueue_signal, &sendqueue_lock, &ts);
+				continue;
+			}
+			send_unlink(node);
+
 			sending = 1;
 
-			struct protocol_t *protocol = sendqueue->protopt;
+			struct protocol_t *protocol = node->protopt;
+
+			metrics_send(protocol->hwtype, (unsigned long)(now-node->queued), node->airtime);
+			if(node->airtime > 0) {
+				sendband[protocol->hwtype+1].budget -= (double)node->airtime;
+				sendfree = now+node->airtime+(uint64_t)send_receive_window*1000;
+			}
 			struct hardware_t *hw = NULL;
 
 			struct JsonNode *message = NULL;
 
-			if(sendqueue->message != NULL && strcmp(sendqueue->message, "{}") != 0) {
-				if(json_validate(sendqueue->message) == true) {
+			if(node->message != NULL && strcmp(node->message, "{}") != 0) {
+				if(json_validate(node->message) == true) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
 					json_append_member(message, "origin", json_mkstring("sender"));
 					json_append_member(message, "protocol", json_mkstring(protocol->id));
-					json_append_member(message, "message", json_decode(sendqueue->message));
-					if(strlen(sendqueue->uuid) > 0) {
-						json_append_member(message, "uuid", json_mkstring(sendqueue->uuid));
+					json_append_member(message, "message", json_decode(node->message));
+					if(strlen(node->uuid) > 0) {
+						json_append_member(message, "uuid", json_mkstring(node->uuid));
 					}
 					json_append_member(message, "repeat", json_mknumber(1, 0));
 				}
 			}
-			if(sendqueue->settings != NULL && strcmp(sendqueue->settings, "{}") != 0) {
-				if(json_validate(sendqueue->settings) == true) {
+			if(node->settings != NULL && strcmp(node->settings, "{}") != 0) {
+				if(json_validate(node->settings) == true) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
-					json_append_member(message, "settings", json_decode(sendqueue->settings));
+					json_append_member(message, "settings", json_decode(node->settings));
 				}
 			}
 
-			struct conf_hardware_t *tmp_confhw = conf_hardware;
-			while(tmp_confhw) {
-				if(protocol->hwtype == tmp_confhw->hardware->hwtype) {
-					hw = tmp_confhw->hardware;
-					break;
-				}
-				tmp_confhw = tmp_confhw->next;
-			}
-			if(hw != NULL) {
+			if((hw = send_hardware(protocol)) != NULL) {
 #ifdef PILIGHT_DEVELOPMENT
 				if((hw->comtype == COMOOK || hw->comtype == COMPLSTRAIN) && hw->sendOOK != NULL) {
 					if(hw->receiveOOK != NULL || hw->receivePulseTrain != NULL) {
@@ -734,8 +1587,8 @@ void *send_code(void *param) {
 #endif
 					logprintf(LOG_DEBUG, "**** RAW CODE ****");
 					if(log_level_get() >= LOG_DEBUG) {
-						for(i=0;i<sendqueue->length;i++) {
-							printf("%d ", sendqueue->code[i]);
+						for(i=0;i<node->length;i++) {
+							printf("%d ", node->code[i]);
 						}
 						printf("\n");
 					}
@@ -751,8 +1604,8 @@ void *send_code(void *param) {
 					data->origin = ORIGIN_SENDER;
 					memset(&data->message, 0, 255);
 					// snprintf(data->message, 1024, "{\"message\":%s}", message);
-					data->rawlen = sendqueue->length;
-					memcpy(data->pulses, sendqueue->code, data->rawlen*sizeof(int));
+					data->rawlen = node->length;
+					memcpy(data->pulses, node->code, data->rawlen*sizeof(int));
 					data->txrpt = protocol->txrpt;
 					strncpy(data->protocol, protocol->id, 255);
 					data->hwtype = hw->hwtype;
@@ -764,15 +1617,15 @@ void *send_code(void *param) {
 					 */
 
 #ifdef PILIGHT_DEVELOPMENT
-					if(hw->sendOOK(sendqueue->code, sendqueue->length, protocol->txrpt) == 0) {
+					if(hw->sendOOK(node->code, node->length, protocol->txrpt) == 0) {
 						logprintf(LOG_DEBUG, "successfully send %s code", protocol->id);
 					} else {
 						logprintf(LOG_ERR, "failed to send code");
 					}
 #endif
 					if(strcmp(protocol->id, "raw") == 0) {
-						int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-						receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
+						int plslen = node->code[node->length-1]/PULSE_DIV;
+						receive_queue(node->code, node->length, plslen, -1, NULL);
 					}
 #ifdef PILIGHT_DEVELOPMENT
 					if(hw->receiveOOK != NULL || hw->receivePulseTrain != NULL) {
@@ -792,26 +1645,27 @@ void *send_code(void *param) {
 				}
 			} else {
 				if(strcmp(protocol->id, "raw") == 0) {
-					int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-					receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
+					int plslen = node->code[node->length-1]/PULSE_DIV;
+					receive_queue(node->code, node->length, plslen, -1, NULL);
 				}
 			}
 			if(message != NULL) {
-				broadcast_queue(sendqueue->protoname, message, sendqueue->origin);
+				broadcast_queue(node->protoname, message, node->origin);
 				json_delete(message);
 				message = NULL;
 			}
 
-			struct sendqueue_t *tmp = sendqueue;
-			if(tmp->message != NULL) {
-				FREE(tmp->message);
+			if(node->message != NULL) {
+				FREE(node->message);
 			}
-			if(tmp->settings != NULL) {
-				FREE(tmp->settings);
+			if(node->settings != NULL) {
+				FREE(node->settings);
 			}
-			FREE(tmp->protoname);
-			sendqueue = sendqueue->next;
-			FREE(tmp);
+			if(node->devkey != NULL) {
+				FREE(node->devkey);
+			}
+			FREE(node->protoname);
+			FREE(node);
 			sendqueue_number--;
 			sending = 0;
 			pthread_mutex_unlock(&sendqueue_lock);
@@ -822,8 +1676,211 @@ void *send_code(void *param) {
 	return (void *)NULL;
 }
 
-/* Send a specific code */
-static int send_queue(struct JsonNode *json, enum origin_t origin) {
+/*
+ * Most sends are the same few commands for the same devices,
+ * so the pulse trains created by the RF protocols are kept in
+ * a small LRU cache keyed on the protocol and the values of
+ * its options in the code. Protocols that don't create the
+ * same train for the same values opt out with txcache = 0.
+ */
+#define SEND_CACHE_SIZE		64
+#define SEND_CACHE_KEYLEN		1024
+
+typedef struct sendcache_t {
+	struct protocol_t *protocol;
+	char *key;
+	unsigned int hash;
+	unsigned long used;
+	int *code;
+	int length;
+	short txrpt;
+	char *message;
+} sendcache_t;
+
+static struct sendcache_t sendcache[SEND_CACHE_SIZE];
+static unsigned long sendcache_used = 0;
+
+static int send_cache_key(struct protocol_t *protocol, struct JsonNode *jcode, char *key) {
+	struct options_t *opt = protocol->options;
+	struct JsonNode *jtmp = NULL;
+	int len = 0, n = 0;
+
+	while(opt) {
+		if((jtmp = json_find_member(jcode, opt->name)) != NULL) {
+			if(jtmp->tag == JSON_STRING) {
+				n = snprintf(&key[len], (size_t)(SEND_CACHE_KEYLEN-len), "%s=s%s;", opt->name, jtmp->string_);
+			} else if(jtmp->tag == JSON_NUMBER) {
+				n = snprintf(&key[len], (size_t)(SEND_CACHE_KEYLEN-len), "%s=n%.*f;", opt->name, jtmp->decimals_, jtmp->number_);
+			} else {
+				/* Arrays and objects aren't used by the RF protocols */
+				return -1;
+			}
+			if(n < 0 || len+n >= SEND_CACHE_KEYLEN) {
+				return -1;
+			}
+			len += n;
+		}
+		opt = opt->next;
+	}
+	key[len] = '\0';
+	return 0;
+}
+
+/* Node key of the device a code is for, NULL if there is no id */
+static char *send_devkey(struct protocol_t *protocol, struct JsonNode *jcode) {
+	struct options_t *opt = protocol->options;
+	struct JsonNode *jtmp = NULL;
+	char key[SEND_CACHE_KEYLEN];
+	int len = 0, n = 0, ids = 0;
+
+	len = snprintf(key, SEND_CACHE_KEYLEN, "%s;", protocol->id);
+	while(opt) {
+		if(opt->conftype == DEVICES_ID && (jtmp = json_find_member(jcode, opt->name)) != NULL) {
+			if(jtmp->tag == JSON_STRING) {
+				n = snprintf(&key[len], (size_t)(SEND_CACHE_KEYLEN-len), "%s=s%s;", opt->name, jtmp->string_);
+			} else if(jtmp->tag == JSON_NUMBER) {
+				n = snprintf(&key[len], (size_t)(SEND_CACHE_KEYLEN-len), "%s=n%.*f;", opt->name, jtmp->decimals_, jtmp->number_);
+			} else {
+				return NULL;
+			}
+			if(n < 0 || len+n >= SEND_CACHE_KEYLEN) {
+				return NULL;
+			}
+			len += n;
+			ids++;
+		}
+		opt = opt->next;
+	}
+	if(ids == 0) {
+		return NULL;
+	}
+
+	char *devkey = NULL;
+	if((devkey = STRDUP(key)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	return devkey;
+}
+
+static void send_cache_clear(struct sendcache_t *entry) {
+	if(entry->key != NULL) {
+		FREE(entry->key);
+	}
+	if(entry->code != NULL) {
+		FREE(entry->code);
+	}
+	if(entry->message != NULL) {
+		FREE(entry->message);
+	}
+	entry->protocol = NULL;
+}
+
+static void send_cache_gc(void) {
+	int i = 0;
+
+	for(i=0;i<SEND_CACHE_SIZE;i++) {
+		send_cache_clear(&sendcache[i]);
+	}
+}
+
+/*
+ * Let the protocol create its code, or copy it from the cache.
+ * On success protocol->raw, rawlen and txrpt hold the code and
+ * message holds the stringified protocol message, or NULL.
+ */
+static int send_create_code(struct protocol_t *protocol, struct JsonNode *jcode, char **message) {
+	struct sendcache_t *entry = NULL;
+	char key[SEND_CACHE_KEYLEN], *jsonstr = NULL;
+	unsigned int hash = 2166136261U;
+	int cache = 0, i = 0;
+
+	*message = NULL;
+
+	if(protocol->txcache == 1 && (protocol->hwtype == RF433 || protocol->hwtype == RF868) &&
+	   send_cache_key(protocol, jcode, key) == 0) {
+		cache = 1;
+		for(i=0;key[i]!='\0';i++) {
+			hash = (hash ^ (unsigned char)key[i]) * 16777619U;
+		}
+		for(i=0;i<SEND_CACHE_SIZE;i++) {
+			if(sendcache[i].protocol == protocol && sendcache[i].hash == hash &&
+			   strcmp(sendcache[i].key, key) == 0) {
+				entry = &sendcache[i];
+				entry->used = ++sendcache_used;
+				memcpy(protocol->raw, entry->code, sizeof(int)*(size_t)entry->length);
+				protocol->rawlen = entry->length;
+				protocol->txrpt = entry->txrpt;
+				if(entry->message != NULL) {
+					if((*message = STRDUP(entry->message)) == NULL) {
+						OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+					}
+				}
+				return 0;
+			}
+		}
+	}
+
+	if(protocol->createCode(jcode) != 0) {
+		if(protocol->message != NULL) {
+			json_delete(protocol->message);
+			protocol->message = NULL;
+		}
+		return -1;
+	}
+
+	if(protocol->message != NULL) {
+		jsonstr = json_stringify(protocol->message, NULL);
+		json_delete(protocol->message);
+		protocol->message = NULL;
+		if(json_validate(jsonstr) == true) {
+			if((*message = STRDUP(jsonstr)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		}
+		json_free(jsonstr);
+	}
+
+	if(cache == 1 && protocol->rawlen > 0 && protocol->rawlen < MAXPULSESTREAMLENGTH) {
+		/* Replace a free or the least recently used entry */
+		entry = &sendcache[0];
+		for(i=0;i<SEND_CACHE_SIZE;i++) {
+			if(sendcache[i].protocol == NULL) {
+				entry = &sendcache[i];
+				break;
+			}
+			if(sendcache[i].used < entry->used) {
+				entry = &sendcache[i];
+			}
+		}
+		send_cache_clear(entry);
+
+		if((entry->key = STRDUP(key)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if((entry->code = MALLOC(sizeof(int)*(size_t)protocol->rawlen)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memcpy(entry->code, protocol->raw, sizeof(int)*(size_t)protocol->rawlen);
+		entry->length = protocol->rawlen;
+		entry->txrpt = protocol->txrpt;
+		if(*message != NULL) {
+			if((entry->message = STRDUP(*message)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		}
+		entry->hash = hash;
+		entry->used = ++sendcache_used;
+		entry->protocol = protocol;
+	}
+
+	return 0;
+}
+
+/*
+ * Send a specific code. When the protocol isn't known
+ * yet it's looked up by the protocol names in the code.
+ */
+static int send_queue_protocol(struct JsonNode *json, struct protocol_t *protocol, enum origin_t origin) {
 	pthread_mutex_lock(&sendqueue_lock);
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -831,8 +1888,6 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 	struct timeval tcurrent;
 	struct clients_t *tmp_clients = NULL;
 	char *uuid = NULL, *buffer = NULL;
-	/* Hold the final protocol struct */
-	struct protocol_t *protocol = NULL;
 
 #ifdef _WIN32
 	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
@@ -849,15 +1904,19 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 	struct JsonNode *jprotocols = NULL;
 	struct JsonNode *jprotocol = NULL;
 
-	buffer = json_stringify(json, NULL);
 	tmp_clients = clients;
 	while(tmp_clients) {
 		if(tmp_clients->forward == 1) {
+			if(buffer == NULL) {
+				buffer = json_stringify(json, NULL);
+			}
 			socket_write(tmp_clients->id, buffer);
 		}
 		tmp_clients = tmp_clients->next;
 	}
-	json_free(buffer);
+	if(buffer != NULL) {
+		json_free(buffer);
+	}
 
 	if((jcode = json_find_member(json, "code")) == NULL) {
 		logprintf(LOG_ERR, "sender did not send any codes");
@@ -873,6 +1932,9 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 		json_find_string(jcode, "uuid", &uuid);
 		/* If we matched a protocol and are not already sending, continue */
 		if(uuid == NULL || (uuid != NULL && strcmp(uuid, pilight_uuid) == 0)) {
+			if(protocol != NULL) {
+				match = 1;
+			}
 			jprotocol = json_first_child(jprotocols);
 			while(jprotocol && match == 0) {
 				match = 0;
@@ -895,33 +1957,55 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 			protocol->raw = raw;
 			if(match == 1 && protocol->createCode != NULL) {
 				/* Let the protocol create his code */
-				if(protocol->createCode(jcode) == 0 && main_loop == 1) {
-					if(sendqueue_number <= 1024) {
-						struct sendqueue_t *mnode = MALLOC(sizeof(struct sendqueue_t));
-						if(mnode == NULL) {
+				char *message = NULL;
+				if(send_create_code(protocol, jcode, &message) == 0 && main_loop == 1) {
+					struct sendqueue_t *mnode = NULL;
+					char *devkey = send_devkey(protocol, jcode);
+					int priority = send_priority(origin), superseded = 0;
+
+					/*
+					 * A newer code for a device that is still waiting
+					 * replaces the old one instead of being sent after it.
+					 */
+					if(devkey != NULL) {
+						for(mnode=sendqueue;mnode!=NULL;mnode=mnode->next) {
+							if(mnode->protopt == protocol && mnode->devkey != NULL && strcmp(mnode->devkey, devkey) == 0) {
+								break;
+							}
+						}
+					}
+					if(mnode != NULL) {
+						superseded = 1;
+						logprintf(LOG_DEBUG, "superseded queued %s code", protocol->id);
+						metrics_send_coalesced();
+						if(mnode->message != NULL) {
+							FREE(mnode->message);
+						}
+						FREE(mnode->settings);
+						FREE(mnode->protoname);
+						FREE(mnode->devkey);
+						if(priority < mnode->priority) {
+							mnode->priority = priority;
+						}
+					} else if(sendqueue_number <= 1024) {
+						if((mnode = MALLOC(sizeof(struct sendqueue_t))) == NULL) {
 							fprintf(stderr, "out of memory\n");
 							exit(EXIT_FAILURE);
 						}
+						mnode->next = NULL;
+						mnode->priority = priority;
+						mnode->queued = uv_hrtime()/1000;
+					}
+					if(mnode != NULL) {
 						gettimeofday(&tcurrent, NULL);
 						mnode->origin = origin;
 						mnode->id = 1000000 * (unsigned int)tcurrent.tv_sec + (unsigned int)tcurrent.tv_usec;
-						mnode->message = NULL;
-						if(protocol->message != NULL) {
-							char *jsonstr = json_stringify(protocol->message, NULL);
-							json_delete(protocol->message);
-							if(json_validate(jsonstr) == true) {
-								if((mnode->message = MALLOC(strlen(jsonstr)+1)) == NULL) {
-									fprintf(stderr, "out of memory\n");
-									exit(EXIT_FAILURE);
-								}
-								strcpy(mnode->message, jsonstr);
-							}
-							json_free(jsonstr);
-							protocol->message = NULL;
-						}
+						mnode->message = message;
 
+						mnode->devkey = devkey;
 						mnode->length = protocol->rawlen;
 						memcpy(mnode->code, protocol->raw, sizeof(int)*protocol->rawlen);
+						mnode->airtime = send_airtime(protocol, mnode->code, mnode->length);
 
 						if((mnode->protoname = MALLOC(strlen(protocol->id)+1)) == NULL) {
 							fprintf(stderr, "out of memory\n");
@@ -960,16 +2044,24 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 						} else {
 							memset(mnode->uuid, '\0', UUID_LENGTH);
 						}
-						if(sendqueue_number == 0) {
-							sendqueue = mnode;
-							sendqueue_head = mnode;
-						} else {
-							sendqueue_head->next = mnode;
-							sendqueue_head = mnode;
+						if(superseded == 0) {
+							if(sendqueue_number == 0) {
+								sendqueue = mnode;
+								sendqueue_head = mnode;
+							} else {
+								sendqueue_head->next = mnode;
+								sendqueue_head = mnode;
+							}
+							sendqueue_number++;
 						}
-						sendqueue_number++;
 					} else {
 						logprintf(LOG_ERR, "send queue full");
+						if(message != NULL) {
+							FREE(message);
+						}
+						if(devkey != NULL) {
+							FREE(devkey);
+						}
 						pthread_mutex_unlock(&sendqueue_lock);
 						return -1;
 					}
@@ -977,6 +2069,9 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 					pthread_cond_signal(&sendqueue_signal);
 					return 0;
 				} else {
+					if(message != NULL) {
+						FREE(message);
+					}
 					pthread_mutex_unlock(&sendqueue_lock);
 					return -1;
 				}
@@ -990,6 +2085,10 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 	return -1;
 }
 
+static int send_queue(struct JsonNode *json, enum origin_t origin) {
+	return send_queue_protocol(json, NULL, origin);
+}
+
 #ifdef WEBSERVER
 static void client_webserver_parse_code(int i, char buffer[BUFFER_SIZE]) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -1070,90 +2169,67 @@ static void client_webserver_parse_code(int i, char buffer[BUFFER_SIZE]) {
 }
 #endif
 
+static void control_device_value(struct JsonNode *code, char *name, struct devices_values_t *val) {
+	if(val->type == JSON_STRING) {
+		json_append_member(code, name, json_mkstring(val->string_));
+	} else if(val->type == JSON_NUMBER) {
+		json_append_member(code, name, json_mknumber(val->number_, val->decimals));
+	}
+}
+
 static int control_device(struct devices_t *dev, char *state, struct JsonNode *values, enum origin_t origin) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct devices_settings_t *sett = NULL;
-	struct devices_values_t *val = NULL;
+	struct devices_template_t *tmpl = NULL;
 	struct options_t *opt = NULL;
-	struct protocols_t *tmp_protocols = NULL;
+	struct JsonNode *jvalue = NULL;
+	int i = 0;
 
 	struct JsonNode *code = json_mkobject();
 	struct JsonNode *json = json_mkobject();
 	struct JsonNode *jprotocols = json_mkarray();
 
-	/* Check all protocol options */
-	tmp_protocols = dev->protocols;
-	while(tmp_protocols) {
-		json_append_element(jprotocols, json_mkstring(tmp_protocols->name));
-		if((opt = tmp_protocols->listener->options)) {
-			while(opt) {
-				sett = dev->settings;
-				while(sett) {
-					/* Retrieve the device id's */
-					if(strcmp(sett->name, "id") == 0) {
-						val = sett->values;
-						while(val) {
-							if((opt->conftype == DEVICES_ID)
-							   && strcmp(val->name, opt->name) == 0
-							   && json_find_member(code, opt->name) == NULL) {
-								if(val->type == JSON_STRING) {
-									json_append_member(code, val->name, json_mkstring(val->string_));
-								} else if(val->type == JSON_NUMBER) {
-									json_append_member(code, val->name, json_mknumber(val->number_, val->decimals));
-								}
-							}
-							val = val->next;
-						}
-					}
-					if(strcmp(sett->name, opt->name) == 0
-					   && opt->conftype == DEVICES_SETTING) {
-						val = sett->values;
-						if(json_find_member(code, opt->name) == NULL) {
-							if(val->type == JSON_STRING) {
-								json_append_member(code, opt->name, json_mkstring(val->string_));
-							} else if(val->type == JSON_NUMBER) {
-								json_append_member(code, opt->name, json_mknumber(val->number_, val->decimals));
-							}
-						}
-					}
-					sett = sett->next;
-				}
-				opt = opt->next;
-			}
-			while(values) {
-				opt = tmp_protocols->listener->options;
-				while(opt) {
-					if((opt->conftype == DEVICES_VALUE || opt->conftype == DEVICES_OPTIONAL)
-					   && strcmp(values->key, opt->name) == 0
-					   && json_find_member(code, opt->name) == NULL) {
-						if(values->tag == JSON_STRING) {
-							json_append_member(code, values->key, json_mkstring(values->string_));
-						} else if(values->tag == JSON_NUMBER) {
-							json_append_member(code, values->key, json_mknumber(values->number_, values->decimals_));
-						}
+	/* The id's, settings and options were resolved at config load */
+	tmpl = dev->templates;
+	while(tmpl) {
+		json_append_element(jprotocols, json_mkstring(tmpl->protocol->name));
+		for(i=0;i<tmpl->nrfields;i++) {
+			if(json_find_member(code, tmpl->names[i]) == NULL) {
+				control_device_value(code, tmpl->names[i], tmpl->values[i]);
+			}
+		}
+		jvalue = values;
+		while(jvalue) {
+			for(i=0;i<tmpl->nroptions;i++) {
+				opt = tmpl->options[i];
+				if((opt->conftype == DEVICES_VALUE || opt->conftype == DEVICES_OPTIONAL)
+				   && strcmp(jvalue->key, opt->name) == 0
+				   && json_find_member(code, opt->name) == NULL) {
+					if(jvalue->tag == JSON_STRING) {
+						json_append_member(code, jvalue->key, json_mkstring(jvalue->string_));
+					} else if(jvalue->tag == JSON_NUMBER) {
+						json_append_member(code, jvalue->key, json_mknumber(jvalue->number_, jvalue->decimals_));
 					}
-					opt = opt->next;
 				}
-				values = values->next;
 			}
+			jvalue = jvalue->next;
 		}
 		/* Send the new device state */
-		if((opt = tmp_protocols->listener->options) && state != NULL) {
-			while(opt) {
-				if(json_find_member(code, opt->name) == NULL) {
-					if(opt->conftype == DEVICES_STATE && opt->argtype == OPTION_NO_VALUE && strcmp(opt->name, state) == 0) {
+		if(state != NULL) {
+			for(i=0;i<tmpl->nroptions;i++) {
+				opt = tmpl->options[i];
+				if(opt->conftype == DEVICES_STATE && json_find_member(code, opt->name) == NULL) {
+					if(opt->argtype == OPTION_NO_VALUE && strcmp(opt->name, state) == 0) {
 						json_append_member(code, opt->name, json_mknumber(1, 0));
 						break;
-					} else if(opt->conftype == DEVICES_STATE && opt->argtype == OPTION_HAS_VALUE) {
+					} else if(opt->argtype == OPTION_HAS_VALUE) {
 						json_append_member(code, opt->name, json_mkstring(state));
 						break;
 					}
 				}
-				opt = opt->next;
 			}
 		}
-		tmp_protocols = tmp_protocols->next;
+		tmpl = tmpl->next;
 	}
 
 	/* Construct the right json object */
@@ -1165,7 +2241,7 @@ static int control_device(struct devices_t *dev, char *state, struct JsonNode *v
 	json_append_member(json, "code", code);
 	json_append_member(json, "action", json_mkstring("send"));
 
-	if(send_queue(json, origin) == 0) {
+	if(send_queue_protocol(json, dev->sender, origin) == 0) {
 		json_delete(json);
 		return 0;
 	}
@@ -1183,6 +2259,7 @@ static void socket_parse_data(int i, char *buffer) {
 	struct JsonNode *options = NULL;
 	struct clients_t *tmp_clients = NULL;
 	struct clients_t *client = NULL;
+	struct client_filter_t *filter = NULL, *old = NULL;
 	int sd = -1;
 	int addrlen = sizeof(address);
 	char *action = NULL, *media = NULL, *status = NULL;
@@ -1233,6 +2310,8 @@ static void socket_parse_data(int i, char *buffer) {
 						client->config = 0;
 						client->receiver = 0;
 						client->forward = 0;
+						client->cbor = 0;
+						client->filter = NULL;
 						client->stats = 0;
 						client->cpu = 0;
 						client->ram = 0;
@@ -1253,6 +2332,13 @@ static void socket_parse_data(int i, char *buffer) {
 					if(json_find_string(json, "uuid", &t) == 0) {
 						strcpy(client->uuid, t);
 					}
+					if(json_find_string(json, "encoding", &t) == 0) {
+						if(strcmp(t, "cbor") == 0) {
+							client->cbor = 1;
+						} else if(strcmp(t, "json") != 0) {
+							error = 1;
+						}
+					}
 					if((options = json_find_member(json, "options")) != NULL) {
 						struct JsonNode *childs = json_first_child(options);
 						while(childs) {
@@ -1291,6 +2377,12 @@ static void socket_parse_data(int i, char *buffer) {
 								} else {
 									client->forward = 0;
 								}
+							} else if(strcmp(childs->key, "filter") == 0) {
+								client_filter_free(filter);
+								if((filter = client_filter_compile(childs)) == NULL) {
+									error = 1;
+									break;
+								}
 							} else {
 							   error = 1;
 							   break;
@@ -1298,8 +2390,23 @@ static void socket_parse_data(int i, char *buffer) {
 							childs = childs->next;
 						}
 					}
+					/*
+					 * The broadcaster matches the filters while holding
+					 * the bcqueue_lock, so only swap them under it and
+					 * keep the old filter when the new one is invalid.
+					 */
+					if(error == 0 && filter != NULL) {
+						pthread_mutex_lock(&bcqueue_lock);
+						old = client->filter;
+						client->filter = filter;
+						pthread_mutex_unlock(&bcqueue_lock);
+						client_filter_free(old);
+					} else {
+						client_filter_free(filter);
+					}
 					if(exists == 0) {
 						if(error == 1) {
+							client_filter_free(client->filter);
 							FREE(client);
 						} else {
 							tmp_clients = clients;
@@ -1314,7 +2421,11 @@ static void socket_parse_data(int i, char *buffer) {
 							}
 						}
 					}
-					socket_write(sd, "{\"status\":\"success\"}");
+					if(error == 1) {
+						socket_write(sd, "{\"status\":\"failed\"}");
+					} else {
+						socket_write(sd, "{\"status\":\"success\"}");
+					}
 				} else if(strcmp(action, "send") == 0) {
 					if(send_queue(json, SENDER) == 0) {
 						socket_write(sd, "{\"status\":\"success\"}");
@@ -1427,15 +2538,33 @@ static void socket_parse_data(int i, char *buffer) {
 						}
 					}
 				} else if(strcmp(action, "request config") == 0) {
-					struct JsonNode *jsend = json_mkobject();
+					struct JsonNode *jsend = NULL;
 					struct JsonNode *jconfig = NULL;
-					if(client->forward == 1) {
-						jconfig = config_print(CONFIG_FORWARD, client->media);
-					} else {
-						jconfig = config_print(CONFIG_INTERNAL, client->media);
+					double epoch = 0, seq = 0;
+
+					pthread_mutex_lock(&bcqueue_lock);
+					/* Let nodes resume from their last update if possible */
+					if(client->forward == 1 &&
+					   json_find_number(json, "epoch", &epoch) == 0 &&
+					   json_find_number(json, "seq", &seq) == 0 &&
+					   epoch == syncepoch && seq >= 0) {
+						if((jsend = sync_delta((unsigned long)seq)) != NULL) {
+							logprintf(LOG_DEBUG, "client \"%s\" resumed from update %lu", client->uuid, (unsigned long)seq);
+						}
 					}
-					json_append_member(jsend, "message", json_mkstring("config"));
-					json_append_member(jsend, "config", jconfig);
+					if(jsend == NULL) {
+						jsend = json_mkobject();
+						if(client->forward == 1) {
+							jconfig = config_print(CONFIG_FORWARD, client->media);
+							json_append_member(jsend, "epoch", json_mknumber(syncepoch, 0));
+							json_append_member(jsend, "seq", json_mknumber((double)syncseq, 0));
+						} else {
+							jconfig = config_print(CONFIG_INTERNAL, client->media);
+						}
+						json_append_member(jsend, "message", json_mkstring("config"));
+						json_append_member(jsend, "config", jconfig);
+					}
+					pthread_mutex_unlock(&bcqueue_lock);
 					char *output = json_stringify(jsend, NULL);
 					str_replace("%", "%%", &output);
 					socket_write(sd, output);
@@ -1853,6 +2982,8 @@ static void *socket_parse_data1(int reason, void *param) {
 					client->config = 0;
 					client->receiver = 0;
 					client->forward = 0;
+					client->cbor = 0;
+					client->filter = NULL;
 					client->stats = 0;
 					client->cpu = 0;
 					strcpy(client->media, "all");
@@ -2063,7 +3194,7 @@ void *receivePulseTrain(void *param) {
 			hw->receivePulseTrain(&r);
 			plslen = r.pulses[r.length-1]/PULSE_DIV;
 			if(r.length > 0) {
-				receive_queue(r.pulses, r.length, plslen, hw->hwtype);
+				receive_queue(r.pulses, r.length, plslen, hw->hwtype, hw);
 			} else if(r.length == -1) {
 				hw->init();
 				sleep(1);
@@ -2150,10 +3281,12 @@ static void *receivePulseTrain1(int reason, void *param) {
 	if(data->hardware != NULL && data->pulses != NULL && data->length > 0) {
 #ifndef PILIGHT_REWRITE
 		int hwtype = 0;
+		struct hardware_t *hw = NULL;
 		struct conf_hardware_t *tmp_confhw = conf_hardware;
 		while(tmp_confhw) {
 			if(strcmp(tmp_confhw->hardware->id, data->hardware) == 0) {
 				hwtype = tmp_confhw->hardware->hwtype;
+				hw = tmp_confhw->hardware;
 			}
 			tmp_confhw = tmp_confhw->next;
 		}
@@ -2167,7 +3300,7 @@ static void *receivePulseTrain1(int reason, void *param) {
 #ifdef PILIGHT_REWRITE
 				receive_parse_code(data->pulses, data->length, plslen, hw->hwtype);
 #else
-				receive_queue(data->pulses, data->length, plslen, hwtype);
+				receive_queue(data->pulses, data->length, plslen, hwtype, hw);
 #endif
 			}
 #ifdef PILIGHT_REWRITE
@@ -2178,6 +3311,49 @@ static void *receivePulseTrain1(int reason, void *param) {
 	return (void *)NULL;
 }
 
+/*
+ * Apply the updates of a delta message from the master
+ * and return -1 when some of them were missed.
+ */
+static int clientize_delta(struct JsonNode *json) {
+	struct JsonNode *jupdates = NULL, *jchild = NULL;
+	char *protocol = NULL, *uuid = NULL;
+	double epoch = 0, seq = 0;
+	unsigned long first = 0, nr = 0;
+
+	if(json_find_number(json, "epoch", &epoch) != 0 ||
+	   json_find_number(json, "seq", &seq) != 0 ||
+	   (jupdates = json_find_member(json, "updates")) == NULL ||
+	   jupdates->tag != JSON_ARRAY) {
+		return -1;
+	}
+	jchild = json_first_child(jupdates);
+	while(jchild) {
+		nr++;
+		jchild = jchild->next;
+	}
+	first = (unsigned long)seq-nr+1;
+	if(epoch != nodeepoch || first > nodeseq+1) {
+		logprintf(LOG_NOTICE, "missed updates of the main pilight daemon");
+		return -1;
+	}
+
+	jchild = json_first_child(jupdates);
+	while(jchild) {
+		/* Skip the ones we've already seen, including our own */
+		if(first > nodeseq && json_find_string(jchild, "protocol", &protocol) == 0 &&
+		   (json_find_string(jchild, "uuid", &uuid) != 0 || strcmp(uuid, pilight_uuid) != 0)) {
+			broadcast_queue(protocol, jchild, NODE);
+		}
+		first++;
+		jchild = jchild->next;
+	}
+	if((unsigned long)seq > nodeseq) {
+		nodeseq = (unsigned long)seq;
+	}
+	return 0;
+}
+
 void *clientize(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -2212,7 +3388,8 @@ void *clientize(void *param) {
 			logprintf(LOG_NOTICE, "no pilight ssdp connections found");
 			continue;
 		} else {
-			if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1) {
+			if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1 &&
+			   (ssdp_reseek(&ssdp_list) == -1 || (sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1)) {
 				logprintf(LOG_ERR, "could not connect to pilight-daemon");
 				continue;
 			}
@@ -2246,6 +3423,10 @@ void *clientize(void *param) {
 
 		json = json_mkobject();
 		json_append_member(json, "action", json_mkstring("request config"));
+		if(nodeepoch > 0) {
+			json_append_member(json, "epoch", json_mknumber(nodeepoch, 0));
+			json_append_member(json, "seq", json_mknumber((double)nodeseq, 0));
+		}
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
 			json_free(output);
@@ -2263,6 +3444,9 @@ void *clientize(void *param) {
 					if(strcmp(message, "config") == 0) {
 						struct JsonNode *jconfig = NULL;
 						if((jconfig = json_find_member(json, "config")) != NULL) {
+#ifdef EVENTS
+							events_rules_lock();
+#endif
 							gui_gc();
 							devices_gc();
 #ifdef EVENTS
@@ -2289,9 +3473,25 @@ void *clientize(void *param) {
 							if(config_parse(jconfig) == EXIT_SUCCESS) {
 								logprintf(LOG_DEBUG, "loaded master configuration");
 								config_synced = 1;
+								double epoch = 0, seq = 0;
+								if(json_find_number(json, "epoch", &epoch) == 0 &&
+								   json_find_number(json, "seq", &seq) == 0) {
+									nodeepoch = epoch;
+									nodeseq = (unsigned long)seq;
+								}
 							} else {
 								logprintf(LOG_WARNING, "failed to load master configuration");
 							}
+#ifdef EVENTS
+							events_rules_unlock();
+#endif
+						}
+					} else if(strcmp(message, "delta") == 0) {
+						if(clientize_delta(json) == 0) {
+							logprintf(LOG_DEBUG, "resumed master configuration at update %lu", nodeseq);
+							config_synced = 1;
+						} else {
+							nodeepoch = 0;
 						}
 					}
 				}
@@ -2327,6 +3527,14 @@ void *clientize(void *param) {
 						   strcmp(action, "control") == 0) {
 							socket_parse_data(sockfd, array[q]);
 						}
+					} else if(json_find_string(json, "message", &message) == 0 &&
+					          strcmp(message, "delta") == 0) {
+						/* Fall back to a full resync on the next connect */
+						if(clientize_delta(json) != 0) {
+							nodeepoch = 0;
+							socket_close(sockfd);
+							sockfd = 0;
+						}
 					} else if(json_find_string(json, "origin", &origin) == 0 &&
 							json_find_string(json, "protocol", &protocol) == 0) {
 							if(strcmp(origin, "receiver") == 0 ||
@@ -2449,12 +3657,16 @@ int main_gc(void) {
 	while(clients) {
 		tmp_clients = clients;
 		clients = clients->next;
+		client_filter_free(tmp_clients->filter);
 		FREE(tmp_clients);
 	}
 	if(clients != NULL) {
 		FREE(clients);
 	}
 
+	send_cache_gc();
+	sync_gc();
+
 #ifndef _WIN32
 	if(running == 0) {
 		/* Remove the stale pid file */
@@ -2491,7 +3703,11 @@ int main_gc(void) {
 	socket_gc();
 
 	config_gc();
+	history_gc();
+	metrics_gc();
 	protocol_gc();
+	ping_gc();
+	arp_gc();
 	ntp_gc();
 	whitelist_free();
 	threads_gc();
@@ -2896,6 +4112,9 @@ int start_pilight(int argc, char **argv) {
 	}
 
 	eventpool_init(EVENTPOOL_THREADED);
+	http_init();
+	ping_init();
+	arp_init();
 	protocol_init();
 	config_init();
 
@@ -2928,6 +4147,8 @@ int start_pilight(int argc, char **argv) {
 		}
 	}
 
+	history_init();
+
 #ifdef WEBSERVER
 	#ifdef WEBSERVER_HTTPS
 	char *pemfile = NULL;
@@ -3071,6 +4292,12 @@ int start_pilight(int argc, char **argv) {
 	settings_find_number("port", &port);
 	settings_find_number("standalone", &standalone);
 
+	/*
+	 * A cache left behind by an earlier run could point
+	 * us to ourselves, so always look for a master anew.
+	 */
+	ssdp_cache_invalidate();
+
 	pilight.runmode = STANDALONE;
 	if(standalone == 0 || (master_server != NULL && master_port > 0)) {
 		if(master_server != NULL && master_port > 0) {
@@ -3133,6 +4360,10 @@ int start_pilight(int argc, char **argv) {
 	pthread_cond_init(&bcqueue_signal, NULL);
 	bcqueue_init = 1;
 
+	struct timeval tvepoch;
+	gettimeofday(&tvepoch, NULL);
+	syncepoch = (double)tvepoch.tv_sec*1000+tvepoch.tv_usec/1000;
+
 	/* Run certain daemon functions from the socket library */
 	socket_callback.client_disconnected_callback = &socket_client_disconnected;
 	socket_callback.client_connected_callback = NULL;
@@ -3155,6 +4386,14 @@ int start_pilight(int argc, char **argv) {
 	threads_register("sender", &send_code, (void *)NULL, 0);
 	threads_register("broadcaster", &broadcast, (void *)NULL, 0);
 
+	metrics_gauge("pilight_recvqueue_depth", "Number of received pulse trains waiting to be parsed", recvqueue_size);
+	metrics_gauge("pilight_sendqueue_depth", "Number of codes waiting to be sent", sendqueue_size);
+	metrics_gauge("pilight_bcqueue_depth", "Number of messages waiting to be broadcasted", bcqueue_size);
+	metrics_gauge("pilight_logqueue_depth", "Number of log lines waiting to be written", log_queue_size);
+#ifdef EVENTS
+	metrics_gauge("pilight_eventsqueue_depth", "Number of updates waiting to be evaluated by the rules", events_queue_size);
+#endif
+
 	tmp_confhw = conf_hardware;
 	while(tmp_confhw && main_loop) {
 		if(tmp_confhw->hardware->init) {
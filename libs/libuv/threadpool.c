@@ -43,6 +43,22 @@ static QUEUE exit_message;
 static QUEUE wq;
 static volatile int initialized;
 
+/*
+ * Each worker only writes its own slot, but the
+ * stats are read from other threads, so they are
+ * updated atomically. Busy time is kept in us in
+ * an unsigned long, because 32-bit platforms may
+ * lack 64-bit atomics.
+ */
+#ifdef _WIN32
+# define uv__stats_add(a, b) InterlockedExchangeAdd((LONG*)(a), (LONG)(b))
+#else
+# define uv__stats_add(a, b) __sync_fetch_and_add((a), (b))
+#endif
+
+static unsigned long busy[MAX_THREADPOOL_SIZE];
+static unsigned long jobs[MAX_THREADPOOL_SIZE];
+
 typedef struct data_t {
   int nr;
 
@@ -65,10 +81,9 @@ static void uv__cancelled(struct uv__work* w) {
 static void worker(void* arg) {
   struct uv__work* w;
   QUEUE* q;
+  uint64_t start;
 
-#ifndef _WIN32
   struct data_t *data = arg;
-#endif
 
   for (;;) {
     uv_mutex_lock(&mutex);
@@ -101,7 +116,10 @@ static void worker(void* arg) {
       clock_gettime(CLOCK_MONOTONIC, &data->timestamp.first);
     }
 #endif
+    start = uv_hrtime();
     w->work(w);
+    uv__stats_add(&busy[data->nr], (unsigned long)((uv_hrtime() - start) / 1000));
+    uv__stats_add(&jobs[data->nr], 1);
 
 #ifndef _WIN32
     if(pilight.debuglevel >= 2) {
@@ -125,9 +143,33 @@ static void worker(void* arg) {
     uv_async_send(&w->loop->wq_async);
     uv_mutex_unlock(&w->loop->wq_mutex);
   }
-#ifndef _WIN32
   free(data);
-#endif
+}
+
+
+void uv_threadpool_stats(unsigned int* nrthreads,
+                         unsigned int* nridle,
+                         uint64_t* usbusy,
+                         uint64_t* nrjobs) {
+  unsigned int i;
+
+  *nrthreads = 0;
+  *nridle = 0;
+  *usbusy = 0;
+  *nrjobs = 0;
+
+  if (initialized == 0)
+    return;
+
+  uv_mutex_lock(&mutex);
+  *nrthreads = nthreads;
+  *nridle = idle_threads;
+  uv_mutex_unlock(&mutex);
+
+  for (i = 0; i < nthreads; i++) {
+    *usbusy += (unsigned long)uv__stats_add(&busy[i], 0);
+    *nrjobs += (unsigned long)uv__stats_add(&jobs[i], 0);
+  }
 }
 
 
@@ -197,16 +239,11 @@ static void init_threads(void) {
   QUEUE_INIT(&wq);
 
   for (i = 0; i < nthreads; i++) {
-#ifndef _WIN32
     struct data_t *data = malloc(sizeof(struct data_t));
     memset(data, '\0', sizeof(struct data_t));
     data->nr = i;
     if (uv_thread_create(threads + i, worker, data))
       abort();
-#else
-    if (uv_thread_create(threads + i, worker, NULL))
-      abort();
-#endif
 	}
 
   initialized = 1;
@@ -978,6 +978,15 @@ UV_EXTERN int uv_queue_work(uv_loop_t* loop,
                             uv_work_cb work_cb,
                             uv_after_work_cb after_work_cb);
 
+/*
+ * Number of workers, idle workers and the accumulated
+ * time (in us) and number of jobs the workers were busy.
+ */
+UV_EXTERN void uv_threadpool_stats(unsigned int* nrthreads,
+                                   unsigned int* nridle,
+                                   uint64_t* busy,
+                                   uint64_t* jobs);
+
 UV_EXTERN int uv_cancel(uv_req_t* req);
 
 
@@ -37,6 +37,7 @@
 #include "../core/ssdp.h"
 #include "../core/firmware.h"
 #include "../core/datetime.h"
+#include "../core/history.h"
 
 #include "../protocols/protocol.h"
 
@@ -48,6 +49,9 @@ struct config_t *config_devices;
 
 /* Struct to store the locations */
 static struct devices_t *devices = NULL;
+/* Open addressing index of the devices by name */
+static struct devices_t **devices_hash = NULL;
+static unsigned int devices_hash_size = 0;
 
 int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNode **out) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -346,6 +350,9 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 											json_append_member(rval, sptr->name, json_mknumber(sptr->values->number_, sptr->values->decimals));
 											update = 1;
 										}
+										if(valueType == JSON_NUMBER) {
+											history_add(dptr->id, sptr->name, utct, vnumber_, vdecimals_);
+										}
 										dptr->timestamp = utct;
 									}
 									//break;
@@ -458,10 +465,34 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	return (update == 1) ? 0 : -1;
 }
 
+static unsigned int devices_hash_name(const char *name) {
+	unsigned int hash = 2166136261U;
+
+	while(*name != '\0') {
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+	}
+	return hash;
+}
+
 int devices_get(char *sid, struct devices_t **dev) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct devices_t *dptr = NULL;
+	unsigned int i = 0;
+
+	if(devices_hash != NULL) {
+		i = devices_hash_name(sid) & (devices_hash_size-1);
+		while((dptr = devices_hash[i]) != NULL) {
+			if(strcmp(dptr->id, sid) == 0) {
+				if(dev != NULL) {
+					*dev = dptr;
+				}
+				return 0;
+			}
+			i = (i+1) & (devices_hash_size-1);
+		}
+		return 1;
+	}
 
 	dptr = devices;
 	while(dptr) {
@@ -1040,7 +1071,8 @@ static int devices_check_id(int i, JsonNode *jsetting, struct devices_t *device)
 										strcpy(ctmp, jvalues->string_);
 									}
 
-									if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0) {
+									/* A config restored from a snapshot was already matched */
+									if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0 && config_from_snapshot() == 0) {
 #if !defined(__FreeBSD__) && !defined(_WIN32)
 										regex_t regex;
 										memset(&regex, '\0', sizeof(regex));
@@ -1219,7 +1251,7 @@ static int devices_check_state(int i, JsonNode *jsetting, struct devices_t *devi
 					   argument state values and values array are of the right
 					   type. This is done by checking the regex mask */
 					if(tmp_options->argtype == OPTION_HAS_VALUE) {
-						if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0) {
+						if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0 && config_from_snapshot() == 0) {
 #if !defined(__FreeBSD__) && !defined(_WIN32)
 							reti = regcomp(&regex, tmp_options->mask, REG_EXTENDED);
 							if(reti) {
@@ -1567,6 +1599,8 @@ static int devices_parse(JsonNode *root) {
 				dnode->settings = NULL;
 				dnode->next = NULL;
 				dnode->protocols = NULL;
+				dnode->templates = NULL;
+				dnode->sender = NULL;
 
 #ifdef EVENTS
 				event_action_thread_init(dnode);
@@ -1662,12 +1696,130 @@ clear:
 	return have_error;
 }
 
+static void devices_template_field(struct devices_template_t *tnode, char *name, struct devices_values_t *val) {
+	if((tnode->names = REALLOC(tnode->names, sizeof(char *)*(size_t)(tnode->nrfields+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((tnode->values = REALLOC(tnode->values, sizeof(struct devices_values_t *)*(size_t)(tnode->nrfields+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	tnode->names[tnode->nrfields] = name;
+	tnode->values[tnode->nrfields] = val;
+	tnode->nrfields++;
+}
+
+static void devices_template_option(struct devices_template_t *tnode, struct options_t *opt) {
+	if((tnode->options = REALLOC(tnode->options, sizeof(struct options_t *)*(size_t)(tnode->nroptions+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	tnode->options[tnode->nroptions++] = opt;
+}
+
+/*
+ * Do the walk over the protocol options and the device
+ * settings once, instead of on every control request.
+ */
+static void devices_compile(struct devices_t *dev) {
+	struct devices_template_t *tnode = NULL, **last = &dev->templates;
+	struct devices_settings_t *sett = NULL;
+	struct devices_values_t *val = NULL;
+	struct protocols_t *tmp_protocols = NULL, *pnode = NULL;
+	struct options_t *opt = NULL;
+
+	tmp_protocols = dev->protocols;
+	while(tmp_protocols) {
+		if((tnode = MALLOC(sizeof(struct devices_template_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memset(tnode, 0, sizeof(struct devices_template_t));
+		tnode->protocol = tmp_protocols;
+
+		opt = tmp_protocols->listener->options;
+		while(opt) {
+			sett = dev->settings;
+			while(sett) {
+				if(opt->conftype == DEVICES_ID && strcmp(sett->name, "id") == 0) {
+					val = sett->values;
+					while(val) {
+						if(strcmp(val->name, opt->name) == 0) {
+							devices_template_field(tnode, val->name, val);
+						}
+						val = val->next;
+					}
+				}
+				if(opt->conftype == DEVICES_SETTING && strcmp(sett->name, opt->name) == 0) {
+					devices_template_field(tnode, opt->name, sett->values);
+				}
+				sett = sett->next;
+			}
+			if(opt->conftype == DEVICES_VALUE || opt->conftype == DEVICES_OPTIONAL ||
+			   opt->conftype == DEVICES_STATE) {
+				devices_template_option(tnode, opt);
+			}
+			opt = opt->next;
+		}
+
+		*last = tnode;
+		last = &tnode->next;
+
+		/* The first protocol name a registered protocol knows creates the codes */
+		if(dev->sender == NULL) {
+			pnode = protocols;
+			while(pnode) {
+				if(protocol_device_exists(pnode->listener, tmp_protocols->name) == 0) {
+					dev->sender = pnode->listener;
+					break;
+				}
+				pnode = pnode->next;
+			}
+		}
+		tmp_protocols = tmp_protocols->next;
+	}
+}
+
+static void devices_index(void) {
+	struct devices_t *dptr = NULL;
+	unsigned int nr = 0, i = 0;
+
+	dptr = devices;
+	while(dptr) {
+		devices_compile(dptr);
+		nr++;
+		dptr = dptr->next;
+	}
+
+	devices_hash_size = 16;
+	while(devices_hash_size < nr*2) {
+		devices_hash_size <<= 1;
+	}
+	if((devices_hash = MALLOC(sizeof(struct devices_t *)*devices_hash_size)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(devices_hash, 0, sizeof(struct devices_t *)*devices_hash_size);
+
+	dptr = devices;
+	while(dptr) {
+		i = devices_hash_name(dptr->id) & (devices_hash_size-1);
+		while(devices_hash[i] != NULL) {
+			i = (i+1) & (devices_hash_size-1);
+		}
+		devices_hash[i] = dptr;
+		dptr = dptr->next;
+	}
+}
+
 int devices_gc(void) {
 	int i = 0;
 	struct devices_t *dtmp;
 	struct devices_settings_t *stmp;
 	struct devices_values_t *vtmp;
 	struct protocols_t *ptmp;
+	struct devices_template_t *ttmp;
+
+	if(devices_hash != NULL) {
+		FREE(devices_hash);
+		devices_hash_size = 0;
+	}
 
 	/* Free devices structure */
 	while(devices) {
@@ -1677,6 +1829,21 @@ int devices_gc(void) {
 		event_action_thread_free(dtmp);
 #endif
 
+		while(dtmp->templates) {
+			ttmp = dtmp->templates;
+			if(ttmp->names != NULL) {
+				FREE(ttmp->names);
+			}
+			if(ttmp->values != NULL) {
+				FREE(ttmp->values);
+			}
+			if(ttmp->options != NULL) {
+				FREE(ttmp->options);
+			}
+			dtmp->templates = dtmp->templates->next;
+			FREE(ttmp);
+		}
+
 		while(dtmp->settings) {
 			stmp = dtmp->settings;
 			while(stmp->values) {
@@ -1741,7 +1908,13 @@ int devices_gc(void) {
 }
 
 static int devices_read(JsonNode *root) {
+	/*
+	 * The protocol checks also set up hardware and
+	 * the initial device states, so they run even
+	 * when the config was restored from a snapshot.
+	 */
 	if(devices_parse(root) == 0 && devices_validate_settings() == 0) {
+		devices_index();
 		return 0;
 	} else {
 		return 1;
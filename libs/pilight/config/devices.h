@@ -24,6 +24,7 @@
 typedef struct devices_settings_t devices_settings_t;
 typedef struct devices_values_t devices_values_t;
 typedef struct devices_t devices_t;
+typedef struct devices_template_t devices_template_t;
 
 #include "../core/pilight.h"
 #include "../core/threads.h"
@@ -73,6 +74,23 @@ struct devices_settings_t {
 	struct devices_settings_t *next;
 };
 
+/*
+ * The parts of a send request that only depend on the
+ * configuration, compiled per device protocol at load.
+ * The values are pointers into the device settings, so
+ * updated settings are sent without recompiling.
+ */
+struct devices_template_t {
+	struct protocols_t *protocol;
+	int nrfields;
+	char **names;
+	struct devices_values_t **values;
+	/* Value, optional and state options in protocol order */
+	int nroptions;
+	struct options_t **options;
+	struct devices_template_t *next;
+};
+
 struct devices_t {
 	char *id;
 	char dev_uuid[22];
@@ -91,6 +109,9 @@ struct devices_t {
 	struct devices_settings_t *settings;
 	struct threadqueue_t **protocol_threads;
 	struct devices_t *next;
+	struct devices_template_t *templates;
+	/* Registered protocol that creates the codes */
+	struct protocol_t *sender;
 };
 
 extern struct config_t *config_devices;
@@ -94,6 +94,9 @@ void hardware_register(struct hardware_t **hw) {
 	(*hw)->maxrawlen = 0;
 	(*hw)->mingaplen = 0;
 	(*hw)->maxgaplen = 0;
+	(*hw)->nrframes = 0;
+	(*hw)->nrbest = 0;
+	(*hw)->nrunique = 0;
 
 	(*hw)->init = NULL;
 	(*hw)->deinit = NULL;
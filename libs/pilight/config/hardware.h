@@ -82,6 +82,16 @@ typedef struct hardware_t {
 	int (*gc)(void);
 	unsigned short (*settings)(JsonNode *json);
 	struct hardware_t *next;
+
+	/*
+	 * Appended so hardware modules built against
+	 * an older header keep their layout.
+	 */
+
+	/* Receiver statistics */
+	unsigned long nrframes;
+	unsigned long nrbest;
+	unsigned long nrunique;
 } hardware_t;
 
 typedef struct conf_hardware_t {
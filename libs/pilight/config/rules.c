@@ -95,6 +95,7 @@ static int rules_parse(JsonNode *root) {
 					node->devices = NULL;
 					node->actions = NULL;
 					node->nr = i;
+					memset(&node->evaluation, 0, sizeof(struct metrics_histogram_t));
 					if((node->name = MALLOC(strlen(jrules->key)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
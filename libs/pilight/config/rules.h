@@ -21,6 +21,7 @@
 
 #include "../core/json.h"
 #include "../core/config.h"
+#include "../core/metrics.h"
 #include "../events/action.h"
 
 typedef struct rules_values_t {
@@ -56,6 +57,7 @@ typedef struct rules_t {
 	struct rules_actions_t *actions;
 	struct rules_values_t *values;
 	struct rules_t *next;
+	struct metrics_histogram_t evaluation;
 } rules_t;
 
 struct config_t *config_rules;
@@ -176,7 +176,8 @@ static int settings_parse(JsonNode *root) {
 	JsonNode *jsettings = json_first_child(root);
 
 	while(jsettings) {
-		if(strcmp(jsettings->key, "port") == 0) {
+		if(strcmp(jsettings->key, "port") == 0 ||
+			strcmp(jsettings->key, "arp-scan-rate") == 0) {
 			if(jsettings->tag != JSON_NUMBER) {
 				logprintf(LOG_ERR, "config setting \"%s\" must contain a number larger than 0", jsettings->key);
 				have_error = 1;
@@ -249,9 +250,35 @@ static int settings_parse(JsonNode *root) {
 			} else {
 				settings_add_number(jsettings->key, (int)jsettings->number_);
 			}
+		} else if(strcmp(jsettings->key, "send-duty-cycle") == 0) {
+			if(jsettings->tag != JSON_NUMBER) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number from 1 till 100", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else if((int)jsettings->number_ < 1 || (int)jsettings->number_ > 100) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number from 1 till 100", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else {
+				settings_add_number(jsettings->key, (int)jsettings->number_);
+			}
+		} else if(strcmp(jsettings->key, "history-size") == 0 ||
+			strcmp(jsettings->key, "send-receive-window") == 0) {
+			if(jsettings->tag != JSON_NUMBER) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number of 0 or larger", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else if((int)jsettings->number_ < 0) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number of 0 or larger", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else {
+				settings_add_number(jsettings->key, (int)jsettings->number_);
+			}
 		} else if(strcmp(jsettings->key, "log-file") == 0
 #ifndef _WIN32		
 			|| strcmp(jsettings->key, "pid-file") == 0
+			|| strcmp(jsettings->key, "history-file") == 0
 #endif
 			|| strcmp(jsettings->key, "pem-file") == 0) {
 			if(jsettings->tag != JSON_STRING) {
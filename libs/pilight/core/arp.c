@@ -77,8 +77,15 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <assert.h>
+#include <stdint.h>
 
+#include "../../libuv/uv.h"
+#include "../config/settings.h"
+#include "pilight.h"
+#include "eventpool.h"
 #include "network.h"
+#include "common.h"
 #include "mem.h"
 #include "log.h"
 #include "arp.h"
@@ -92,17 +99,6 @@
 #define FRAMING_ETHERNET_II	0
 #define FRAMING_LLC_SNAP		1
 
-typedef struct host_entry {
-   double timeout;
-   struct in_addr addr;
-   struct timeval last_send_time;
-   unsigned short num_sent;
-   unsigned short num_recv;
-   unsigned short found;
-   unsigned char live;
-	 uint8_t mac[ETH_ALEN];
-} host_entry;
-
 typedef struct ether_hdr {
 	uint8_t dest_addr[ETH_ALEN];
 	uint8_t src_addr[ETH_ALEN];
@@ -121,55 +117,6 @@ typedef struct arp_ether_ipv4 {
 	uint32_t ar_tip;
 } arp_ether_ipv4;
 
-static struct host_entry **helist;
-static struct host_entry **cursor;
-static unsigned num_hosts = 0;
-static unsigned live_count = 0;
-
-static void advance_cursor(void) {
-	if(live_count > 0) {
-		do {
-			if(cursor == (helist+(num_hosts-1))) {
-				cursor = helist;
-			} else {
-				cursor++;
-			}
-		} while(!(*cursor)->live);
-	}
-}
-
-static void remove_host(host_entry **he) {
-  if((*he)->live == 1) {
-		(*he)->live = 0;
-		live_count--;
-		if(*he == *cursor) {
-			advance_cursor();
-		}
-	}
-}
-
-static void timeval_diff(const struct timeval *a, const struct timeval *b, struct timeval *diff) {
-	struct timeval temp;
-
-	temp.tv_sec = b->tv_sec;
-	temp.tv_usec = b->tv_usec;
-
-	if(a->tv_usec < temp.tv_usec) {
-		int nsec = (temp.tv_usec - a->tv_usec) / 1000000 + 1;
-		temp.tv_usec -= 1000000 * nsec;
-		temp.tv_sec += nsec;
-	}
-	if(a->tv_usec - temp.tv_usec > 1000000) {
-		int nsec = (a->tv_usec - temp.tv_usec) / 1000000;
-		temp.tv_usec += 1000000 * nsec;
-		temp.tv_sec -= nsec;
-	}
-
-	diff->tv_sec = a->tv_sec - temp.tv_sec;
-	diff->tv_usec = a->tv_usec - temp.tv_usec;
-}
-
-
 static void marshal_arp_pkt(unsigned char *buffer, ether_hdr *frame_hdr, arp_ether_ipv4 *arp_pkt, int *buf_siz) {
 	unsigned char *cp;
 	int packet_size;
@@ -254,39 +201,127 @@ static int unmarshal_arp_pkt(const unsigned char *buffer, size_t buf_len, ether_
 	return framing;
 }
 
-void arp_add_host(const char *host_name) {
+/*
+ * Requests are only sent to the /24 network of the
+ * capture interface, at most this many per second.
+ * The rate can be changed with the arp-scan-rate setting.
+ */
+#define ARP_RATE						100
+#define ARP_TICK						10
+#define ARP_TIMEOUT					500
+#define ARP_RETRIES					2
+#define ARP_TABLE_SIZE			256
+#define ARP_REOPEN					30000
+#define ARP_HOSTS						254
+
+typedef struct arp_table_t {
+	uint8_t mac[ETH_ALEN];
+	struct in_addr addr;
+	uint64_t seen;
+} arp_table_t;
+
+static struct arp_device_t *devices = NULL;
+static uv_mutex_t devices_lock;
+static int devices_lock_init = 0;
+
+static struct arp_table_t table[ARP_TABLE_SIZE];
+static int nrtable = 0;
+
+static pcap_t *pcap_handle = NULL;
+static uv_timer_t *timer_req = NULL;
+static uv_poll_t *poll_req = NULL;
+static uint64_t reopen = 0;
+static int rate = ARP_RATE;
+
+static uint8_t srcmac[ETH_ALEN];
+static uint32_t network = 0;
+
+/* Next address of the sweep */
+static int sweep = 1;
+
+static uint64_t arp_now(void) {
+	return uv_hrtime()/1000000;
+}
+
+static void *reason_arp_device_free(void *param) {
+	struct reason_arp_device_t *data = param;
+	FREE(data);
+	return NULL;
+}
+
+static void arp_result(struct arp_device_t *dev, int status) {
+	struct reason_arp_device_t *data = NULL;
+	int reason = REASON_ARP_FOUND_DEVICE;
+
+	switch(status) {
+		case ARP_LOST:
+			reason = REASON_ARP_LOST_DEVICE;
+			dev->present = 0;
+		break;
+		case ARP_CHANGED:
+			reason = REASON_ARP_CHANGED_DEVICE;
+		break;
+		default:
+			dev->present = 1;
+		break;
+	}
 
-	if((helist = REALLOC(helist, ((num_hosts+1) * sizeof(struct host_entry *)))) == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
+	if((data = MALLOC(sizeof(struct reason_arp_device_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
+	memset(data, 0, sizeof(struct reason_arp_device_t));
+	strncpy(data->mac, dev->mac, sizeof(data->mac)-1);
+	strncpy(data->ip, dev->ip, sizeof(data->ip)-1);
+	eventpool_trigger(reason, reason_arp_device_free, data);
+
+	if(dev->callback != NULL) {
+		dev->callback(dev, status, dev->userdata);
+	}
+}
 
-	if((helist[num_hosts] = MALLOC(sizeof(struct host_entry))) == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
+static struct arp_table_t *arp_table_find(uint8_t *mac) {
+	int i = 0;
+
+	for(i=0;i<nrtable;i++) {
+		if(memcmp(table[i].mac, mac, ETH_ALEN) == 0) {
+			return &table[i];
+		}
 	}
-	helist[num_hosts]->addr.s_addr = inet_addr(host_name);
-	helist[num_hosts]->live = 1;
-	helist[num_hosts]->timeout = 500 * 1000;	/* Convert from ms to us */
-	helist[num_hosts]->num_sent = 0;
-	helist[num_hosts]->num_recv = 0;
-	helist[num_hosts]->found = 0;
-	helist[num_hosts]->last_send_time.tv_sec = 0;
-	helist[num_hosts]->last_send_time.tv_usec = 0;
-	num_hosts++;
+	return NULL;
 }
 
-static int send_packet(pcap_t *pcap_handle, host_entry *he, struct timeval *last_packet_time, char source_mac[ETH_ALEN]) {
+static struct arp_table_t *arp_table_update(uint8_t *mac, uint32_t addr, uint64_t now) {
+	struct arp_table_t *entry = arp_table_find(mac);
+	int i = 0;
+
+	if(entry == NULL) {
+		if(nrtable < ARP_TABLE_SIZE) {
+			entry = &table[nrtable++];
+		} else {
+			/* Forget the host we haven't heard from the longest */
+			entry = &table[0];
+			for(i=1;i<nrtable;i++) {
+				if(table[i].seen < entry->seen) {
+					entry = &table[i];
+				}
+			}
+		}
+		memcpy(entry->mac, mac, ETH_ALEN);
+	}
+	entry->addr.s_addr = addr;
+	entry->seen = now;
+
+	return entry;
+}
+
+static void arp_send(uint32_t addr) {
 	struct ether_hdr frame_hdr;
 	struct arp_ether_ipv4 arpei;
 	unsigned char buf[MAX_FRAME];
-	unsigned char target_mac[ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-	unsigned char arp_tha[ETH_ALEN] = {0, 0, 0, 0, 0, 0};
 	int buflen = 0;
-	int nsent = 0;
 
-	memcpy(frame_hdr.dest_addr, target_mac, ETH_ALEN);
-	memcpy(frame_hdr.src_addr, source_mac, ETH_ALEN);
+	memset(frame_hdr.dest_addr, 0xff, ETH_ALEN);
+	memcpy(frame_hdr.src_addr, srcmac, ETH_ALEN);
 	frame_hdr.frame_type = htons(0x0806);
 
 	memset(&arpei, '\0', sizeof(arp_ether_ipv4));
@@ -295,163 +330,135 @@ static int send_packet(pcap_t *pcap_handle, host_entry *he, struct timeval *last
 	arpei.ar_hln = 6;
 	arpei.ar_pln = 4;
 	arpei.ar_op = htons(1);
-	memcpy(arpei.ar_sha, source_mac, ETH_ALEN);
-	memcpy(arpei.ar_tha, arp_tha, ETH_ALEN);
+	memcpy(arpei.ar_sha, srcmac, ETH_ALEN);
 	arpei.ar_sip = 0;
-	if(he != NULL) {
-		arpei.ar_tip = he->addr.s_addr;
-	}
+	arpei.ar_tip = addr;
 
 	marshal_arp_pkt(buf, &frame_hdr, &arpei, &buflen);
 
-	if(he == NULL) {
-		return buflen;
-	}
-
-	if(he->live == 0) {
-		logprintf(LOG_ERR, "send_packet called on non-live host");
-		return -1;
+	if(pcap_sendpacket(pcap_handle, buf, buflen) < 0) {
+		logprintf(LOG_ERR, "pcap_sendpacket: %s", pcap_geterr(pcap_handle));
 	}
+}
 
-	gettimeofday(last_packet_time, NULL);
-	he->last_send_time.tv_sec  = last_packet_time->tv_sec;
-	he->last_send_time.tv_usec = last_packet_time->tv_usec;
-	he->num_sent++;
+/*
+ * Every ARP packet on the wire updates the table, not
+ * only the replies to our own requests. Watched devices
+ * are therefore often found without asking for them.
+ */
+static void arp_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet_in) {
+	struct arp_ether_ipv4 arpei;
+	struct ether_hdr frame_hdr;
+	struct arp_device_t *dev = NULL;
+	struct arp_table_t *entry = NULL;
+	char ip[INET_ADDRSTRLEN+1];
+	size_t n = header->caplen;
 
-	nsent = pcap_sendpacket(pcap_handle, buf, buflen);
-	if(nsent < 0) {
-		logprintf(LOG_ERR, "ERROR: failed to send packet");
-		return -1;
+	if(n < ETHER_HDR_SIZE + ARP_PKT_SIZE ||
+		(packet_in[ETHER_HDR_SIZE] == 0xAA && n < ETHER_HDR_SIZE + 8 + ARP_PKT_SIZE)) {
+		return;
 	}
 
-	return buflen;
-}
-
-static struct host_entry *find_host(host_entry **he, struct in_addr *addr) {
-	host_entry **p;
-	int found = 0;
-
-	if(*he == NULL) {
-		return NULL;
+	unmarshal_arp_pkt(packet_in, n, &frame_hdr, &arpei, NULL, NULL);
+	if(ntohs(arpei.ar_hrd) != 1 || ntohs(arpei.ar_pro) != 0x0800 ||
+		arpei.ar_sip == 0 || memcmp(arpei.ar_sha, srcmac, ETH_ALEN) == 0) {
+		return;
 	}
 
-	p = he;
+	entry = arp_table_update(arpei.ar_sha, arpei.ar_sip, arp_now());
 
-  do {
-		if((*p)->addr.s_addr == addr->s_addr) {
-			found = 1;
-		} else {
-			if(p == helist) {
-				p = helist + (num_hosts-1);	/* Wrap round to end */
-			} else {
-				p--;
-			}
+	memset(ip, '\0', INET_ADDRSTRLEN+1);
+	inet_ntop(AF_INET, (void *)&entry->addr, ip, INET_ADDRSTRLEN+1);
+
+	uv_mutex_lock(&devices_lock);
+	for(dev=devices;dev!=NULL;dev=dev->next) {
+		if(memcmp(dev->hwaddr, arpei.ar_sha, ETH_ALEN) != 0) {
+			continue;
 		}
-	} while(!found && p != he);
+		dev->check = 0;
+		dev->scanning = 0;
+		dev->pending = 0;
+		if(dev->present == 0) {
+			strcpy(dev->ip, ip);
+			arp_result(dev, ARP_FOUND);
+		} else if(strcmp(dev->ip, ip) != 0) {
+			strcpy(dev->ip, ip);
+			arp_result(dev, ARP_CHANGED);
+		}
+	}
+	uv_mutex_unlock(&devices_lock);
+}
 
-	if(found == 1) {
-		return *p;
-	} else {
-		return NULL;
+static void arp_dispatch(void) {
+	if(pcap_dispatch(pcap_handle, -1, arp_packet, NULL) == -1) {
+		logprintf(LOG_ERR, "pcap_dispatch: %s", pcap_geterr(pcap_handle));
 	}
 }
 
-static void callback(u_char *args, const struct pcap_pkthdr *header, const u_char *packet_in) {
-	struct arp_ether_ipv4 arpei;
-	struct ether_hdr frame_hdr;
-	size_t n = header->caplen;
-	struct in_addr source_ip;
-	struct host_entry *temp_cursor = NULL;
+#ifndef _WIN32
+static void arp_read(uv_poll_t *req, int status, int events) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
 
-	if(n < ETHER_HDR_SIZE + ARP_PKT_SIZE) {
-		logprintf(LOG_ERR, "%d byte packet too short to decode\n", (int)n);
+	if(status < 0) {
+		logprintf(LOG_ERR, "arp_read: %s", uv_strerror(status));
 		return;
-   }
-
-	unmarshal_arp_pkt(packet_in, n, &frame_hdr, &arpei, NULL, NULL);
-	source_ip.s_addr = arpei.ar_sip;
-	temp_cursor = find_host(cursor, &source_ip);
-
-	if(temp_cursor != NULL) {
-		temp_cursor->num_recv++;
-		if(temp_cursor->live == 1) {
-			temp_cursor->found = 1;
-			memcpy(temp_cursor->mac, arpei.ar_sha, ETH_ALEN);
-		}
-		remove_host(&temp_cursor);
 	}
+	arp_dispatch();
 }
+#endif
 
-static int recvfrom_wto(long unsigned int tmo, pcap_t *pcap_handle) {
-#ifdef _WIN32
-	WaitForSingleObject(pcap_getevent(pcap_handle), (DWORD)tmo);
-#else
-	fd_set readset;
-	struct timeval to;
-	int n = 0, pcap_fd = 0;
-	if((pcap_fd = pcap_get_selectable_fd(pcap_handle)) < 0) {
-		logprintf(LOG_ERR, "pcap_fileno: %s", pcap_geterr(pcap_handle));
-		return -1;
-	}
-	FD_ZERO(&readset);
-	if(pcap_fd >= 0)
-		FD_SET(pcap_fd, &readset);
-		to.tv_sec  = (__time_t)(tmo/(long unsigned int)1000000);
-		to.tv_usec = (__suseconds_t)(tmo - (long unsigned int)((time_t)1000000 * to.tv_sec));
-		n = select(pcap_fd+1, &readset, NULL, NULL, &to);
-	if(n < 0) {
-		logprintf(LOG_ERR, "select");
-		return -1;
-	} else if (n == 0 && pcap_fd >= 0) {
-		return 1;
+static int arp_open(void) {
+	struct bpf_program filter;
+	struct in_addr addr;
+	char **devs = NULL, *if_name = NULL, error[PCAP_ERRBUF_SIZE];
+	char ip[INET_ADDRSTRLEN+1], *p = ip, mac[ETH_ALEN], *a = mac;
+	int nrdevs = 0, ret = -1;
+
+	if((nrdevs = inetdevs(&devs)) == 0) {
+		logprintf(LOG_ERR, "could not determine default network interface");
+		goto close;
 	}
-#endif
-	if(pcap_handle != NULL) {
-		if((pcap_dispatch(pcap_handle, -1, callback, NULL)) == -1) {
-			logprintf(LOG_ERR, "pcap_dispatch: %s", pcap_geterr(pcap_handle));
-			return -1;
-		}
-		return 0;
+
+	memset(&ip, '\0', INET_ADDRSTRLEN+1);
+	if(dev2ip(devs[0], &p, AF_INET) != 0 || inet_pton(AF_INET, ip, &addr) != 1) {
+		logprintf(LOG_ERR, "could not determine host ip address");
+		goto close;
 	}
-	return -1;
-}
+	network = ntohl(addr.s_addr) & 0xFFFFFF00;
 
-int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
-	struct timeval now, diff, last_packet_time;
-	pcap_t *pcap_handle = NULL;
-	unsigned long int loop_timediff = 0, host_timediff = 0;
-	unsigned long int req_interval = 0, select_timeout = 0;
-	unsigned long int cum_err = 0, interval = 0;
-	char *if_cpy = NULL, error[PCAP_ERRBUF_SIZE], *e = error;
-	int found = -1;
-	int reset_cum_err = 0, first_timeout = 1;
-	int i = 0;
+	memset(&mac, '\0', ETH_ALEN);
+	if(dev2mac(devs[0], &a) != 0 || (mac[0] == 0 && mac[1] == 0 &&
+		mac[2] == 0 && mac[3] == 0 &&
+		mac[4] == 0 && mac[5] == 0)) {
+		logprintf(LOG_ERR, "could not obtain MAC address for interface %s", devs[0]);
+		goto close;
+	}
+	memcpy(srcmac, mac, ETH_ALEN);
 
-	if((if_cpy = MALLOC(strlen(if_name)+1)) == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
+	if((if_name = STRDUP(devs[0])) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-	strcpy(if_cpy, if_name);
 
 #ifdef _WIN32
 	int match = 0;
 	pcap_if_t *alldevs = NULL, *d = NULL;
 
-	if(pcap_findalldevs(&alldevs, e) == -1){
-		logprintf(LOG_ERR, "pcap_findalldevs: %s", e);
+	if(pcap_findalldevs(&alldevs, error) == -1){
+		logprintf(LOG_ERR, "pcap_findalldevs: %s", error);
 		goto close;
 	}
 
-	d = alldevs;
-	match = 0;
 	for(d=alldevs;d;d=d->next) {
-		if(strstr(d->name, if_cpy) != NULL) {
+		if(strstr(d->name, if_name) != NULL) {
 			match = 1;
-			if((if_cpy = REALLOC(if_cpy, strlen(d->name)+1)) == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
+			if((if_name = REALLOC(if_name, strlen(d->name)+1)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 			}
-			strcpy(if_cpy, d->name);
+			strcpy(if_name, d->name);
 			break;
 		}
 	}
@@ -459,123 +466,301 @@ int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
 		pcap_freealldevs(alldevs);
 	}
 	if(match == 0) {
-		logprintf(LOG_ERR, "could not full interface name for %s", if_name);
+		logprintf(LOG_ERR, "could not full interface name for %s", devs[0]);
 		goto close;
 	}
 #endif
 
-	if((pcap_handle = pcap_open_live(if_cpy, 64, 0, 3, e)) == NULL) {
-		logprintf(LOG_ERR, "pcap_open_live: %s", e);
+	if((pcap_handle = pcap_open_live(if_name, 64, 0, 3, error)) == NULL) {
+		logprintf(LOG_ERR, "pcap_open_live: %s", error);
 		goto close;
 	}
 
-	if((pcap_setnonblock(pcap_handle, 1, e)) < 0) {
-		logprintf(LOG_ERR, "pcap_setnonblock: %s", e);
+	/*
+	 * Let the kernel drop everything but ARP
+	 * before it reaches the capture buffer.
+	 */
+	if(pcap_compile(pcap_handle, &filter, "arp", 1, 0) == -1) {
+		logprintf(LOG_ERR, "pcap_compile: %s", pcap_geterr(pcap_handle));
 		goto close;
 	}
+	if(pcap_setfilter(pcap_handle, &filter) == -1) {
+		logprintf(LOG_ERR, "pcap_setfilter: %s", pcap_geterr(pcap_handle));
+		pcap_freecode(&filter);
+		goto close;
+	}
+	pcap_freecode(&filter);
 
-	live_count = num_hosts;
-	cursor = helist;
-	last_packet_time.tv_sec=0;
-	last_packet_time.tv_usec=0;
-
-	interval = 10000;
-
-	reset_cum_err = 1;
-	req_interval = interval;
-  while(live_count > 0) {
-		gettimeofday(&now, NULL);
-    timeval_diff(&now, &last_packet_time, &diff);
-    loop_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-    if(loop_timediff >= (unsigned)req_interval) {
-			timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-			host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-			if(host_timediff >= (*cursor)->timeout) {
-				if(reset_cum_err > 0) {
-					cum_err = 0;
-					req_interval = interval;
-					reset_cum_err = 0;
-				} else {
-					cum_err += loop_timediff - interval;
-					if(req_interval >= cum_err) {
-						req_interval = req_interval - cum_err;
-					} else {
-						req_interval = 0;
-					}
-				}
-				select_timeout = req_interval;
-				if((*cursor)->num_sent >= 2) {
-					remove_host(cursor);
-					if(first_timeout > 0) {
-						timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-						host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-						while(host_timediff >= (*cursor)->timeout && live_count) {
-							if((*cursor)->live == 1) {
-								remove_host(cursor);
-							} else {
-								advance_cursor();
-							}
-							timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-							host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-						}
-						first_timeout=0;
-					}
-					gettimeofday(&last_packet_time, NULL);
-				} else {
-					if((*cursor)->num_sent > 0) {
-						(*cursor)->timeout *= 1.5;
-					}
-					if(send_packet(pcap_handle, *cursor, &last_packet_time, srcmac) == -1) {
-						goto close;
-					}
-					advance_cursor();
-				}
+	if(pcap_setnonblock(pcap_handle, 1, error) < 0) {
+		logprintf(LOG_ERR, "pcap_setnonblock: %s", error);
+		goto close;
+	}
+
+#ifndef _WIN32
+	int fd = -1;
+	if((fd = pcap_get_selectable_fd(pcap_handle)) < 0) {
+		logprintf(LOG_ERR, "pcap_get_selectable_fd: %s", pcap_geterr(pcap_handle));
+		goto close;
+	}
+
+	if((poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_poll_init(uv_default_loop(), poll_req, fd);
+	uv_poll_start(poll_req, UV_READABLE, arp_read);
+#endif
+
+	if(settings_find_number("arp-scan-rate", &rate) != 0 || rate <= 0) {
+		rate = ARP_RATE;
+	}
+
+	ret = 0;
+
+close:
+	if(ret != 0 && pcap_handle != NULL) {
+		pcap_close(pcap_handle);
+		pcap_handle = NULL;
+	}
+	if(if_name != NULL) {
+		FREE(if_name);
+	}
+	array_free(&devs, nrdevs);
+
+	return ret;
+}
+
+/*
+ * A device is first asked for at the address it was last
+ * seen on. Only when it doesn't answer there, it joins the
+ * sweep of the network. The sweep wraps around, so every
+ * device waits for exactly one round of requests no matter
+ * when it joined. Devices that weren't found by then are
+ * reported as lost.
+ */
+static void arp_tick(uv_timer_t *req) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct arp_device_t *dev = NULL;
+	struct arp_table_t *entry = NULL;
+	uint64_t now = arp_now(), wakeup = now + 1000;
+	int want = 0, batch = 0, i = 0;
+
+	if(pcap_handle == NULL) {
+		uv_mutex_lock(&devices_lock);
+		want = (devices != NULL);
+		uv_mutex_unlock(&devices_lock);
+
+		if(want == 0 || now < reopen || arp_open() != 0) {
+			if(want == 1 && now >= reopen) {
+				reopen = now + ARP_REOPEN;
+			}
+			uv_timer_start(req, arp_tick, 1000, 0);
+			return;
+		}
+		want = 0;
+	}
+
+#ifdef _WIN32
+	arp_dispatch();
+#endif
+
+	uv_mutex_lock(&devices_lock);
+	for(dev=devices;dev!=NULL;dev=dev->next) {
+		if(dev->check == 0 && dev->due <= now) {
+			/* Don't try to catch up on missed checks */
+			dev->due += (uint64_t)dev->interval;
+			if(dev->due <= now) {
+				dev->due = now + (uint64_t)dev->interval;
+			}
+			entry = arp_table_find(dev->hwaddr);
+			if(entry == NULL || dev->present == 0 || now-entry->seen >= (uint64_t)dev->interval) {
+				dev->check = now;
+				dev->deadline = now;
+				dev->tries = 0;
+			}
+		}
+		if(dev->check > 0 && dev->scanning == 0 && dev->deadline <= now) {
+			if(dev->tries < ARP_RETRIES && (entry = arp_table_find(dev->hwaddr)) != NULL) {
+				arp_send(entry->addr.s_addr);
+				dev->tries++;
+				dev->deadline = now + ARP_TIMEOUT;
 			} else {
-				select_timeout = (long unsigned int)((*cursor)->timeout - host_timediff);
-				reset_cum_err = 1;
-      }
-		} else {
-			select_timeout = req_interval - loop_timediff;
+				/* The device might have gotten another address */
+				dev->scanning = 1;
+				dev->pending = ARP_HOSTS;
+			}
+		}
+		if(dev->scanning == 1 && dev->pending == 0 && dev->deadline <= now) {
+			dev->check = 0;
+			dev->scanning = 0;
+			if(dev->present == 1) {
+				arp_result(dev, ARP_LOST);
+			}
 		}
-		if(recvfrom_wto(select_timeout, pcap_handle) == -1) {
-			goto close;
+		if(dev->pending > 0) {
+			want++;
 		}
 	}
 
-	for(i=0;i<num_hosts;i++) {
-		if(helist[i]->found == 1) {
-			char fmac[ETH_ALEN];
-			memset(fmac, '\0', ETH_ALEN);
-			sprintf(fmac, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-													helist[i]->mac[0], helist[i]->mac[1],
-													helist[i]->mac[2], helist[i]->mac[3],
-													helist[i]->mac[4], helist[i]->mac[5]);
-			if(strcmp(fmac, dstmac) == 0) {
-				memset(*ip, '\0', INET_ADDRSTRLEN+1);
-				inet_ntop(AF_INET, (void *)&(helist[i]->addr), *ip, INET_ADDRSTRLEN+1);
-				found = 1;
-				break;
+	if(want > 0) {
+		batch = (rate*ARP_TICK)/1000;
+		if(batch < 1) {
+			batch = 1;
+		}
+		for(i=0;i<batch && want > 0;i++) {
+			arp_send(htonl(network | (uint32_t)sweep));
+			sweep = (sweep % ARP_HOSTS) + 1;
+
+			for(dev=devices;dev!=NULL;dev=dev->next) {
+				if(dev->pending > 0 && --dev->pending == 0) {
+					dev->deadline = now + ARP_TIMEOUT;
+					want--;
+				}
 			}
 		}
+		if(want > 0) {
+			wakeup = now + (uint64_t)((batch*1000)/rate);
+		}
 	}
 
-close:
-	if(pcap_handle != NULL) {
-		pcap_close(pcap_handle);
+	for(dev=devices;dev!=NULL;dev=dev->next) {
+		if(dev->check == 0 && dev->due < wakeup) {
+			wakeup = dev->due;
+		}
+		if(dev->check > 0 && dev->pending == 0 && dev->deadline < wakeup) {
+			wakeup = dev->deadline;
+		}
+	}
+	uv_mutex_unlock(&devices_lock);
+
+	uv_timer_start(req, arp_tick, (wakeup > now) ? wakeup-now : 0, 0);
+}
+
+int arp_init(void) {
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "arp_init can only be called from the main thread");
+		return -1;
+		/*LCOV_EXCL_STOP*/
 	}
-	if(if_cpy != NULL) {
-		FREE(if_cpy);
+
+	if(devices_lock_init == 0) {
+		uv_mutex_init(&devices_lock);
+		devices_lock_init = 1;
 	}
-  for(i=0;i<num_hosts;i++) {
-		FREE(helist[i]);
+	sweep = 1;
+
+	/*
+	 * The capture handle is opened on the first tick
+	 * that finds devices, as most setups have none.
+	 */
+	if((timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-	FREE(helist);
-	helist = NULL;
-	num_hosts = 0;
+	uv_timer_init(uv_default_loop(), timer_req);
+	uv_timer_start(timer_req, arp_tick, 0, 0);
+
+	return 0;
+}
 
-	if(found == 1) {
+/*
+ * Devices can be added from any thread. The callback is
+ * only called from the main thread when the device was
+ * found, lost, or changed address, while the device list
+ * is locked. It must not add or remove devices itself.
+ */
+struct arp_device_t *arp_add(char *mac, int interval, void (*callback)(struct arp_device_t *dev, int status, void *userdata), void *userdata) {
+	struct arp_device_t *dev = NULL;
+	unsigned int hw[ETH_ALEN];
+	int i = 0;
+
+	if(devices_lock_init == 0) {
+		logprintf(LOG_ERR, "arp_init should be called before arp_add");
+		return NULL;
+	}
+
+	if(sscanf(mac, "%2x:%2x:%2x:%2x:%2x:%2x", &hw[0], &hw[1], &hw[2], &hw[3], &hw[4], &hw[5]) != 6) {
+		logprintf(LOG_ERR, "invalid mac address: %s", mac);
+		return NULL;
+	}
+
+	if((dev = MALLOC(sizeof(struct arp_device_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(dev, 0, sizeof(struct arp_device_t));
+
+	for(i=0;i<ETH_ALEN;i++) {
+		dev->hwaddr[i] = (uint8_t)hw[i];
+	}
+	snprintf(dev->mac, sizeof(dev->mac), "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+		hw[0], hw[1], hw[2], hw[3], hw[4], hw[5]);
+	strcpy(dev->ip, "0.0.0.0");
+	dev->interval = (interval > 0) ? interval : 1;
+	dev->due = arp_now();
+	dev->callback = callback;
+	dev->userdata = userdata;
+
+	uv_mutex_lock(&devices_lock);
+	dev->next = devices;
+	devices = dev;
+	uv_mutex_unlock(&devices_lock);
+
+	return dev;
+}
+
+void arp_remove(struct arp_device_t *dev) {
+	struct arp_device_t *currP, *prevP;
+
+	prevP = NULL;
+
+	uv_mutex_lock(&devices_lock);
+	for(currP = devices; currP != NULL; prevP = currP, currP = currP->next) {
+		if(currP == dev) {
+			if(prevP == NULL) {
+				devices = currP->next;
+			} else {
+				prevP->next = currP->next;
+			}
+
+			FREE(currP);
+			break;
+		}
+	}
+	uv_mutex_unlock(&devices_lock);
+}
+
+int arp_gc(void) {
+	struct arp_device_t *tmp = NULL;
+
+	if(devices_lock_init == 0) {
 		return 0;
-	} else {
-		return -1;
 	}
+
+	uv_mutex_lock(&devices_lock);
+	while(devices) {
+		tmp = devices;
+		devices = devices->next;
+		FREE(tmp);
+	}
+	uv_mutex_unlock(&devices_lock);
+
+	if(timer_req != NULL) {
+		uv_timer_stop(timer_req);
+	}
+	if(poll_req != NULL) {
+		uv_poll_stop(poll_req);
+	}
+	if(pcap_handle != NULL) {
+		pcap_close(pcap_handle);
+		pcap_handle = NULL;
+	}
+	nrtable = 0;
+
+	logprintf(LOG_DEBUG, "garbage collected arp library");
+	return 0;
 }
@@ -25,5 +25,49 @@
  *
  */
 
-void arp_add_host(const char *host_name);
-int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip);
+#ifndef _ARP_H_
+#define _ARP_H_
+
+#include <stdint.h>
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+#endif
+
+#define ARP_FOUND		0
+#define ARP_LOST		1
+#define ARP_CHANGED	2
+
+typedef struct arp_device_t {
+	char mac[18];
+	char ip[INET_ADDRSTRLEN+1];
+	uint8_t hwaddr[6];
+
+	/* Milliseconds between checks */
+	int interval;
+	uint64_t due;
+	int present;
+
+	/* Start of the running check, 0 when idle */
+	uint64_t check;
+	uint64_t deadline;
+	int tries;
+	int scanning;
+	/* Sweep requests left to wait for */
+	int pending;
+
+	void (*callback)(struct arp_device_t *dev, int status, void *userdata);
+	void *userdata;
+
+	struct arp_device_t *next;
+} arp_device_t;
+
+int arp_init(void);
+struct arp_device_t *arp_add(char *mac, int interval, void (*callback)(struct arp_device_t *dev, int status, void *userdata), void *userdata);
+void arp_remove(struct arp_device_t *dev);
+int arp_gc(void);
+
+#endif
@@ -89,7 +89,9 @@ int decToBinRev(int dec, int *binary) { // stores dec as binary[lsb .. msb] and
 
 unsigned long long binToDecRevUl(const int *binary, unsigned int s, unsigned int e) {
 	unsigned long long result;
-	BITS_MSB_FIRST_TO_VALUE(binary, s, e, result);
+	/* The macro counts e down past s, which wraps for an unsigned s of 0 */
+	int start = (int)s, end = (int)e;
+	BITS_MSB_FIRST_TO_VALUE(binary, start, end, result);
 	return result;
 }
 
@@ -19,6 +19,8 @@
 #ifndef _BINARY_H_
 #define _BINARY_H_
 
+#include <stdint.h>
+
 /*
  * Convert "bits" to the corresponding integer value.
  * The difference between binToDecRev[Ul]() and binToDec[Ul]() is where the most and where the least
@@ -88,4 +90,109 @@ int decToBinRevUl(unsigned long long n, int *binary);
 int binToSignedRev(const int *binary, int s, int e);    // 0<=s<=e, binary[s(msb) .. e(lsb)]
 int binToSigned(const int *binary, int s, int e);       // 0<=s<=e, binary[s(lsb) .. e(msb)]
 
+/*
+ * Bit-packed alternative to the int-per-bit buffers above.
+ * Bit i of the stream is stored at bit 63-(i%64) of word i/64,
+ * so a field read most significant bit first is a plain shift.
+ * The helpers are inline, so fields of a constant width compile
+ * down to a few shifts and masks.
+ *
+ * bitstream_msb(bs, s, e) == binToDecRevUl(binary, s, e)
+ * bitstream_lsb(bs, s, e) == binToDecUl(binary, s, e)
+ * with 0<=s<=e and e-s < 64.
+ */
+#define BITSTREAM_SIZE	512
+
+#if defined(__has_builtin)
+	#if __has_builtin(__builtin_bitreverse64)
+		#define BITSTREAM_BITREVERSE
+	#endif
+#endif
+
+typedef struct bitstream_t {
+	uint64_t words[BITSTREAM_SIZE/64];
+	int length;
+} bitstream_t;
+
+static inline void bitstream_clear(struct bitstream_t *bs) {
+	int i = 0;
+	for(i=0;i<BITSTREAM_SIZE/64;i++) {
+		bs->words[i] = 0;
+	}
+	bs->length = 0;
+}
+
+static inline void bitstream_push(struct bitstream_t *bs, int bit) {
+	if(bs->length < BITSTREAM_SIZE) {
+		if(bit != 0) {
+			bs->words[bs->length/64] |= (1ULL << (63-(bs->length%64)));
+		}
+		bs->length++;
+	}
+}
+
+static inline int bitstream_bit(const struct bitstream_t *bs, int i) {
+	return (int)((bs->words[i/64] >> (63-(i%64))) & 1);
+}
+
+static inline uint64_t bitstream_reverse(uint64_t x, int width) {
+#ifdef BITSTREAM_BITREVERSE
+	x = __builtin_bitreverse64(x);
+#else
+	x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	#if defined(__GNUC__)
+		x = __builtin_bswap64(x);
+	#else
+		x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+		x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+		x = (x >> 32) | (x << 32);
+	#endif
+#endif
+	return x >> (64-width);
+}
+
+static inline uint64_t bitstream_msb(const struct bitstream_t *bs, int s, int e) {
+	int width = e-s+1, shift = s%64;
+	uint64_t x = bs->words[s/64] << shift;
+
+	if(shift > 0 && shift+width > 64) {
+		x |= bs->words[s/64+1] >> (64-shift);
+	}
+	return x >> (64-width);
+}
+
+static inline uint64_t bitstream_lsb(const struct bitstream_t *bs, int s, int e) {
+	return bitstream_reverse(bitstream_msb(bs, s, e), e-s+1);
+}
+
+static inline int64_t bitstream_msb_signed(const struct bitstream_t *bs, int s, int e) {
+	int width = e-s+1;
+	return (int64_t)(bitstream_msb(bs, s, e) << (64-width)) >> (64-width);
+}
+
+static inline int64_t bitstream_lsb_signed(const struct bitstream_t *bs, int s, int e) {
+	int width = e-s+1;
+	return (int64_t)(bitstream_lsb(bs, s, e) << (64-width)) >> (64-width);
+}
+
+/*
+ * Store value in bits s .. e, most significant bit at s.
+ */
+static inline void bitstream_insert(struct bitstream_t *bs, int s, int e, uint64_t value) {
+	int width = e-s+1, shift = s%64;
+	uint64_t mask = (width == 64) ? ~0ULL : ((1ULL << width)-1);
+
+	value = (value & mask) << (64-width);
+	mask <<= (64-width);
+	bs->words[s/64] = (bs->words[s/64] & ~(mask >> shift)) | (value >> shift);
+	if(shift > 0 && shift+width > 64) {
+		bs->words[s/64+1] = (bs->words[s/64+1] & ~(mask << (64-shift))) | (value << (64-shift));
+	}
+	if(e >= bs->length) {
+		bs->length = e+1;
+	}
+}
+
 #endif
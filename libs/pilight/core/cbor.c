@@ -0,0 +1,428 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "cbor.h"
+#include "json.h"
+#include "mem.h"
+#include "log.h"
+
+#define CBOR_UINT		0
+#define CBOR_NEGINT	1
+#define CBOR_BYTES	2
+#define CBOR_TEXT		3
+#define CBOR_ARRAY	4
+#define CBOR_MAP		5
+#define CBOR_TAG		6
+#define CBOR_SIMPLE	7
+
+#define CBOR_FALSE		0xf4
+#define CBOR_TRUE			0xf5
+#define CBOR_NULL			0xf6
+#define CBOR_FLOAT16	0xf9
+#define CBOR_FLOAT32	0xfa
+#define CBOR_FLOAT64	0xfb
+
+#define CBOR_TAG_DECIMAL	4
+
+/*
+ * Nesting is bounded so a malicious peer
+ * can't exhaust our stack.
+ */
+#define CBOR_MAX_DEPTH	32
+
+/*
+ * Largest mantissa that can be
+ * represented exactly in a double.
+ */
+#define CBOR_MAX_MANTISSA	9007199254740992.0
+
+/*
+ * Decimal fractions with a larger exponent
+ * are rejected, the exponent becomes the
+ * number of decimals printed.
+ */
+#define CBOR_MAX_EXPONENT	20
+
+typedef struct cbor_buf_t {
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+} cbor_buf_t;
+
+static void cbor_reserve(struct cbor_buf_t *b, size_t n) {
+	if(b->len+n > b->size) {
+		while(b->len+n > b->size) {
+			b->size = (b->size == 0) ? 64 : b->size*2;
+		}
+		if((b->buf = REALLOC(b->buf, b->size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+}
+
+static void cbor_put_head(struct cbor_buf_t *b, int major, uint64_t val) {
+	cbor_reserve(b, 9);
+
+	unsigned char *p = &b->buf[b->len];
+	int i = 0, n = 0;
+
+	if(val < 24) {
+		p[0] = (major << 5) | (unsigned char)val;
+		b->len += 1;
+		return;
+	} else if(val <= 0xff) {
+		p[0] = (major << 5) | 24;
+		n = 1;
+	} else if(val <= 0xffff) {
+		p[0] = (major << 5) | 25;
+		n = 2;
+	} else if(val <= 0xffffffff) {
+		p[0] = (major << 5) | 26;
+		n = 4;
+	} else {
+		p[0] = (major << 5) | 27;
+		n = 8;
+	}
+	for(i=0;i<n;i++) {
+		p[n-i] = (unsigned char)(val >> (8*i));
+	}
+	b->len += n+1;
+}
+
+static void cbor_put_int(struct cbor_buf_t *b, int64_t val) {
+	if(val < 0) {
+		cbor_put_head(b, CBOR_NEGINT, (uint64_t)(-(val+1)));
+	} else {
+		cbor_put_head(b, CBOR_UINT, (uint64_t)val);
+	}
+}
+
+static void cbor_put_string(struct cbor_buf_t *b, const char *str) {
+	size_t l = strlen(str);
+	cbor_put_head(b, CBOR_TEXT, l);
+	cbor_reserve(b, l);
+	memcpy(&b->buf[b->len], str, l);
+	b->len += l;
+}
+
+static void cbor_put_double(struct cbor_buf_t *b, double val) {
+	uint64_t bits = 0;
+	int i = 0;
+
+	memcpy(&bits, &val, sizeof(bits));
+	cbor_reserve(b, 9);
+	b->buf[b->len++] = CBOR_FLOAT64;
+	for(i=7;i>=0;i--) {
+		b->buf[b->len++] = (unsigned char)(bits >> (8*i));
+	}
+}
+
+static void cbor_put_number(struct cbor_buf_t *b, double val, int decimals) {
+	double scaled = 0.0;
+
+	if(decimals <= 0) {
+		if(val == floor(val) && fabs(val) < CBOR_MAX_MANTISSA) {
+			cbor_put_int(b, (int64_t)val);
+		} else {
+			cbor_put_double(b, val);
+		}
+		return;
+	}
+
+	scaled = round(val * pow(10, decimals));
+	if(decimals <= CBOR_MAX_EXPONENT && fabs(scaled) < CBOR_MAX_MANTISSA) {
+		cbor_put_head(b, CBOR_TAG, CBOR_TAG_DECIMAL);
+		cbor_put_head(b, CBOR_ARRAY, 2);
+		cbor_put_int(b, -decimals);
+		cbor_put_int(b, (int64_t)scaled);
+	} else {
+		cbor_put_double(b, val);
+	}
+}
+
+static void cbor_put_node(struct cbor_buf_t *b, struct JsonNode *node) {
+	struct JsonNode *child = NULL;
+	size_t nr = 0;
+
+	switch(node->tag) {
+		case JSON_NULL:
+			cbor_reserve(b, 1);
+			b->buf[b->len++] = CBOR_NULL;
+		break;
+		case JSON_BOOL:
+			cbor_reserve(b, 1);
+			b->buf[b->len++] = (node->bool_ == true) ? CBOR_TRUE : CBOR_FALSE;
+		break;
+		case JSON_STRING:
+			cbor_put_string(b, node->string_);
+		break;
+		case JSON_NUMBER:
+			cbor_put_number(b, node->number_, node->decimals_);
+		break;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			json_foreach(child, node) {
+				nr++;
+			}
+			cbor_put_head(b, (node->tag == JSON_ARRAY) ? CBOR_ARRAY : CBOR_MAP, nr);
+			json_foreach(child, node) {
+				if(node->tag == JSON_OBJECT) {
+					cbor_put_string(b, child->key);
+				}
+				cbor_put_node(b, child);
+			}
+		break;
+	}
+}
+
+int cbor_encode(struct JsonNode *node, unsigned char **out, size_t *len) {
+	struct cbor_buf_t b;
+
+	if(node == NULL) {
+		return -1;
+	}
+
+	memset(&b, 0, sizeof(struct cbor_buf_t));
+	cbor_put_node(&b, node);
+
+	*out = b.buf;
+	*len = b.len;
+
+	return 0;
+}
+
+static int cbor_get_head(const unsigned char *in, size_t len, size_t *pos, int *major, uint64_t *val) {
+	int info = 0, n = 0, i = 0;
+
+	if(*pos >= len) {
+		return -1;
+	}
+
+	*major = in[*pos] >> 5;
+	info = in[*pos] & 0x1f;
+	(*pos)++;
+
+	if(info < 24) {
+		*val = (uint64_t)info;
+		return 0;
+	}
+	switch(info) {
+		case 24: n = 1; break;
+		case 25: n = 2; break;
+		case 26: n = 4; break;
+		case 27: n = 8; break;
+		/* Indefinite lengths are never produced by cbor_encode */
+		default:
+			return -1;
+	}
+	if(*pos+n > len) {
+		return -1;
+	}
+	*val = 0;
+	for(i=0;i<n;i++) {
+		*val = (*val << 8) | in[(*pos)++];
+	}
+	return 0;
+}
+
+static char *cbor_get_text(const unsigned char *in, size_t len, size_t *pos, uint64_t size) {
+	char *str = NULL;
+
+	if(size > len - *pos) {
+		return NULL;
+	}
+	if((str = MALLOC(size+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memcpy(str, &in[*pos], size);
+	str[size] = '\0';
+	*pos += size;
+
+	return str;
+}
+
+static int cbor_count_decimals(double val) {
+	char tmp[64], *p = NULL;
+	int decimals = 0;
+
+	snprintf(tmp, sizeof(tmp), "%.15g", val);
+	if(strchr(tmp, 'e') != NULL) {
+		return 0;
+	}
+	if((p = strchr(tmp, '.')) != NULL) {
+		while(*(++p) != '\0') {
+			decimals++;
+		}
+	}
+	return decimals;
+}
+
+static struct JsonNode *cbor_get_node(const unsigned char *in, size_t len, size_t *pos, int depth) {
+	struct JsonNode *node = NULL, *child = NULL;
+	uint64_t val = 0, i = 0;
+	int major = 0, x = 0;
+
+	if(depth > CBOR_MAX_DEPTH) {
+		return NULL;
+	}
+
+	if(*pos < len && (in[*pos] >> 5) == CBOR_SIMPLE) {
+		unsigned char type = in[(*pos)++];
+		if(type == CBOR_NULL) {
+			return json_mknull();
+		} else if(type == CBOR_TRUE) {
+			return json_mkbool(true);
+		} else if(type == CBOR_FALSE) {
+			return json_mkbool(false);
+		} else if(type == CBOR_FLOAT16 && *pos+2 <= len) {
+			int half = (in[*pos] << 8) | in[*pos+1];
+			int exp = (half >> 10) & 0x1f, mant = half & 0x3ff;
+			double d = 0.0;
+			if(exp == 0) {
+				d = ldexp(mant, -24);
+			} else if(exp != 31) {
+				d = ldexp(mant + 1024, exp - 25);
+			} else {
+				return NULL;
+			}
+			*pos += 2;
+			d = (half & 0x8000) ? -d : d;
+			return json_mknumber(d, cbor_count_decimals(d));
+		} else if(type == CBOR_FLOAT32 && *pos+4 <= len) {
+			uint32_t bits = 0;
+			float f = 0.0;
+			for(x=0;x<4;x++) {
+				bits = (bits << 8) | in[(*pos)++];
+			}
+			memcpy(&f, &bits, sizeof(f));
+			return json_mknumber((double)f, cbor_count_decimals((double)f));
+		} else if(type == CBOR_FLOAT64 && *pos+8 <= len) {
+			uint64_t bits = 0;
+			double d = 0.0;
+			for(x=0;x<8;x++) {
+				bits = (bits << 8) | in[(*pos)++];
+			}
+			memcpy(&d, &bits, sizeof(d));
+			return json_mknumber(d, cbor_count_decimals(d));
+		}
+		return NULL;
+	}
+
+	if(cbor_get_head(in, len, pos, &major, &val) != 0) {
+		return NULL;
+	}
+
+	switch(major) {
+		case CBOR_UINT:
+			return json_mknumber((double)val, 0);
+		case CBOR_NEGINT:
+			return json_mknumber(-1.0 - (double)val, 0);
+		case CBOR_TEXT: {
+			char *str = NULL;
+			if((str = cbor_get_text(in, len, pos, val)) == NULL) {
+				return NULL;
+			}
+			node = json_mkstring(str);
+			FREE(str);
+			return node;
+		}
+		case CBOR_ARRAY:
+		case CBOR_MAP:
+			node = (major == CBOR_ARRAY) ? json_mkarray() : json_mkobject();
+			for(i=0;i<val;i++) {
+				char *key = NULL;
+				if(major == CBOR_MAP) {
+					uint64_t klen = 0;
+					int kmajor = 0;
+					if(cbor_get_head(in, len, pos, &kmajor, &klen) != 0 || kmajor != CBOR_TEXT ||
+					   (key = cbor_get_text(in, len, pos, klen)) == NULL) {
+						json_delete(node);
+						return NULL;
+					}
+				}
+				if((child = cbor_get_node(in, len, pos, depth+1)) == NULL) {
+					if(key != NULL) {
+						FREE(key);
+					}
+					json_delete(node);
+					return NULL;
+				}
+				if(major == CBOR_MAP) {
+					json_append_member(node, key, child);
+					FREE(key);
+				} else {
+					json_append_element(node, child);
+				}
+			}
+			return node;
+		case CBOR_TAG: {
+			uint64_t exp = 0, mant = 0;
+			int emajor = 0, mmajor = 0;
+			double e = 0.0, m = 0.0;
+
+			if(val != CBOR_TAG_DECIMAL) {
+				/* Unknown tags are transparent */
+				return cbor_get_node(in, len, pos, depth+1);
+			}
+			if(cbor_get_head(in, len, pos, &major, &val) != 0 || major != CBOR_ARRAY || val != 2) {
+				return NULL;
+			}
+			if(cbor_get_head(in, len, pos, &emajor, &exp) != 0 ||
+			   cbor_get_head(in, len, pos, &mmajor, &mant) != 0) {
+				return NULL;
+			}
+			if((emajor != CBOR_UINT && emajor != CBOR_NEGINT) ||
+			   (mmajor != CBOR_UINT && mmajor != CBOR_NEGINT)) {
+				return NULL;
+			}
+			if((emajor == CBOR_UINT && exp > CBOR_MAX_EXPONENT) ||
+			   (emajor == CBOR_NEGINT && exp >= CBOR_MAX_EXPONENT)) {
+				return NULL;
+			}
+			e = (emajor == CBOR_NEGINT) ? -1.0 - (double)exp : (double)exp;
+			m = (mmajor == CBOR_NEGINT) ? -1.0 - (double)mant : (double)mant;
+			/*
+			 * Divide for negative exponents, multiplying by
+			 * a power of ten below one isn't exact and would
+			 * turn 3e-1 into 0.30000000000000004.
+			 */
+			if(e < 0) {
+				return json_mknumber(m / pow(10, -e), (int)-e);
+			}
+			return json_mknumber(m * pow(10, e), 0);
+		}
+		/* Byte strings have no JSON counterpart */
+		default:
+		break;
+	}
+	return NULL;
+}
+
+struct JsonNode *cbor_decode(const unsigned char *in, size_t len, size_t *read) {
+	struct JsonNode *node = NULL;
+	size_t pos = 0;
+
+	if(in == NULL || len == 0) {
+		return NULL;
+	}
+
+	if((node = cbor_get_node(in, len, &pos, 0)) == NULL) {
+		logprintf(LOG_DEBUG, "invalid or truncated cbor data");
+		return NULL;
+	}
+	if(read != NULL) {
+		*read = pos;
+	}
+	return node;
+}
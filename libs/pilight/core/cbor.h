@@ -0,0 +1,26 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _CBOR_H_
+#define _CBOR_H_
+
+#include <stddef.h>
+
+#include "json.h"
+
+/*
+ * Compact binary (RFC 7049) representation of a JsonNode tree.
+ *
+ * Numbers with decimals are written as a decimal fraction (tag 4)
+ * so the number of decimals survives a round trip, exactly like
+ * it does when going through json_stringify and json_decode.
+ */
+int cbor_encode(struct JsonNode *node, unsigned char **out, size_t *len);
+struct JsonNode *cbor_decode(const unsigned char *in, size_t len, size_t *read);
+
+#endif
@@ -25,10 +25,15 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <libgen.h>
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+#include <mbedtls/sha256.h>
 
 #include "pilight.h"
 #include "common.h"
 #include "json.h"
+#include "cbor.h"
 #include "config.h"
 #include "log.h"
 #include "../config/devices.h"
@@ -83,6 +88,165 @@ static void sort_list(int r) {
 
 /* The location of the config file */
 static char *configfile = NULL;
+/* Set while parsing a config restored from a snapshot */
+static int snapshot = 0;
+
+/*
+ * The numbers in the header are stored big endian,
+ * so a snapshot can be moved along with its config.
+ */
+typedef struct config_snapshot_header_t {
+	char magic[4];
+	unsigned char version[4];
+	unsigned char hash[32];
+	unsigned char length[4];
+} config_snapshot_header_t;
+
+static void config_snapshot_put32(unsigned char *buf, unsigned int value) {
+	buf[0] = (unsigned char)((value >> 24) & 0xff);
+	buf[1] = (unsigned char)((value >> 16) & 0xff);
+	buf[2] = (unsigned char)((value >> 8) & 0xff);
+	buf[3] = (unsigned char)(value & 0xff);
+}
+
+static unsigned int config_snapshot_get32(const unsigned char *buf) {
+	return ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16) |
+		((unsigned int)buf[2] << 8) | (unsigned int)buf[3];
+}
+
+static void config_snapshot_hash(char *content, unsigned char hash[32]) {
+	mbedtls_sha256_context ctx;
+
+	/*
+	 * The build is part of the key, because a
+	 * different set of protocols can resolve the
+	 * same config.json differently.
+	 */
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+	mbedtls_sha256_update(&ctx, (unsigned char *)content, strlen(content));
+	mbedtls_sha256_update(&ctx, (unsigned char *)PILIGHT_VERSION, strlen(PILIGHT_VERSION));
+#ifdef HASH
+	mbedtls_sha256_update(&ctx, (unsigned char *)HASH, strlen(HASH));
+#endif
+	mbedtls_sha256_finish(&ctx, hash);
+	mbedtls_sha256_free(&ctx);
+}
+
+static char *config_snapshot_file(void) {
+	char *file = NULL;
+
+	if((file = MALLOC(strlen(configfile)+strlen(CONFIG_SNAPSHOT_EXT)+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	sprintf(file, "%s%s", configfile, CONFIG_SNAPSHOT_EXT);
+
+	return file;
+}
+
+static void config_snapshot_write(char *content, struct JsonNode *root) {
+	struct config_snapshot_header_t header;
+	unsigned char *buf = NULL;
+	char *file = config_snapshot_file();
+	size_t len = 0;
+	FILE *fp = NULL;
+
+	if(cbor_encode(root, &buf, &len) != 0) {
+		FREE(file);
+		return;
+	}
+
+	memset(&header, 0, sizeof(struct config_snapshot_header_t));
+	memcpy(header.magic, CONFIG_SNAPSHOT_MAGIC, 4);
+	config_snapshot_put32(header.version, CONFIG_SNAPSHOT_VERSION);
+	config_snapshot_put32(header.length, (unsigned int)len);
+	config_snapshot_hash(content, header.hash);
+
+	if((fp = fopen(file, "wb")) == NULL) {
+		logprintf(LOG_DEBUG, "cannot write config snapshot: %s", file);
+	} else {
+		if(fwrite(&header, sizeof(struct config_snapshot_header_t), 1, fp) != 1 ||
+		   fwrite(buf, sizeof(unsigned char), len, fp) != len) {
+			logprintf(LOG_DEBUG, "cannot write config snapshot: %s", file);
+			fclose(fp);
+			unlink(file);
+		} else {
+			fclose(fp);
+		}
+	}
+	FREE(buf);
+	FREE(file);
+}
+
+static struct JsonNode *config_snapshot_read(char *content) {
+	struct config_snapshot_header_t *header = NULL;
+	struct JsonNode *root = NULL;
+	unsigned char hash[32], *data = NULL;
+	char *file = config_snapshot_file();
+	size_t size = 0, used = 0;
+	struct stat st;
+	int fd = 0;
+
+#ifdef _WIN32
+	if((fd = open(file, O_RDONLY | O_BINARY)) < 0) {
+#else
+	if((fd = open(file, O_RDONLY)) < 0) {
+#endif
+		FREE(file);
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct config_snapshot_header_t)) {
+		close(fd);
+		FREE(file);
+		return NULL;
+	}
+	size = (size_t)st.st_size;
+
+#ifndef _WIN32
+	if((data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		FREE(file);
+		return NULL;
+	}
+#else
+	if((data = MALLOC(size)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if(read(fd, data, size) != size) {
+		FREE(data);
+		close(fd);
+		FREE(file);
+		return NULL;
+	}
+#endif
+	close(fd);
+
+	header = (struct config_snapshot_header_t *)data;
+	config_snapshot_hash(content, hash);
+
+	if(memcmp(header->magic, CONFIG_SNAPSHOT_MAGIC, 4) == 0 &&
+	   config_snapshot_get32(header->version) == CONFIG_SNAPSHOT_VERSION &&
+	   config_snapshot_get32(header->length) == size - sizeof(struct config_snapshot_header_t) &&
+	   memcmp(header->hash, hash, 32) == 0) {
+		root = cbor_decode(&data[sizeof(struct config_snapshot_header_t)], size - sizeof(struct config_snapshot_header_t), &used);
+		if(root != NULL && (used != size - sizeof(struct config_snapshot_header_t) || root->tag != JSON_OBJECT)) {
+			json_delete(root);
+			root = NULL;
+		}
+	}
+	if(root == NULL) {
+		logprintf(LOG_DEBUG, "config snapshot %s is stale", file);
+	}
+
+#ifndef _WIN32
+	munmap(data, size);
+#else
+	FREE(data);
+#endif
+	FREE(file);
+
+	return root;
+}
 
 int config_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -180,10 +344,14 @@ int config_write(int level, const char *media) {
 	char *content = NULL;
 	if((content = json_stringify(root, "\t")) != NULL) {
 		fwrite(content, sizeof(char), strlen(content), fp);
+		fclose(fp);
+		/* Keep the snapshot in line with what we just wrote */
+		config_snapshot_write(content, root);
 		json_free(content);
 		json_delete(root);
+	} else {
+		fclose(fp);
 	}
-	fclose(fp);
 	return EXIT_SUCCESS;
 }
 
@@ -195,6 +363,27 @@ int config_read(void) {
 
 	/* Read JSON config file */
 	if(file_get_contents(configfile, &content) == 0) {
+		/*
+		 * When the config file didn't change since we last
+		 * wrote it, the snapshot holds the same validated
+		 * config so all text parsing and validation can be
+		 * skipped, as well as rewriting the config file.
+		 */
+		if((root = config_snapshot_read(content)) != NULL) {
+			logprintf(LOG_DEBUG, "restoring config from snapshot");
+			snapshot = 1;
+			if(config_parse(root) != EXIT_SUCCESS) {
+				snapshot = 0;
+				FREE(content);
+				json_delete(root);
+				return EXIT_FAILURE;
+			}
+			snapshot = 0;
+			json_delete(root);
+			FREE(content);
+			return EXIT_SUCCESS;
+		}
+
 		/* Validate JSON and turn into JSON object */
 		if(json_validate(content) == false) {
 			logprintf(LOG_ERR, "config is not in a valid json format");
@@ -252,6 +441,10 @@ int config_set_file(char *settfile) {
 	return EXIT_SUCCESS;
 }
 
+int config_from_snapshot(void) {
+	return snapshot;
+}
+
 char *config_get_file(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -25,6 +25,10 @@
 #define CONFIG_FORWARD	1
 #define CONFIG_USER			2
 
+#define CONFIG_SNAPSHOT_EXT			".snapshot"
+#define CONFIG_SNAPSHOT_MAGIC		"PLCS"
+#define CONFIG_SNAPSHOT_VERSION	2
+
 typedef struct config_t {
 	char *name;
 	int (*parse)(JsonNode *);
@@ -44,6 +48,7 @@ void config_register(config_t **listener, const char *name);
 int config_gc(void);
 int config_set_file(char *settfile);
 char *config_get_file(void);
+int config_from_snapshot(void);
 void config_init(void);
 
 #endif
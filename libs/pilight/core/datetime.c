@@ -130,6 +130,7 @@ extern const struct lc_timezone __timezone_utc;
 #include "tzdata.h"
 
 static void ruleset_remove_stale(struct ruleset *ruleset, int year);
+static void tzname_index(void);
 static void ruleset_get_last(struct ruleset *ruleset, int year,
 														 const struct lc_timezone_rule **last,
 														 const struct lc_timezone_rule **last_dst);
@@ -1152,13 +1153,19 @@ static int searchingtz = 0;
 static uv_mutex_t mutex_lock;
 // static pthread_mutexattr_t mutex_attr;
 static unsigned short mutex_init = 0;
+static uv_mutex_t tzcache_lock;
+static int *tzindex = NULL;
+static int *tzpolygons = NULL;
 
 void datetime_init(void) {
 	// pthread_mutexattr_init(&mutex_attr);
 	// pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
 	// pthread_mutex_init(&mutex_lock, &mutex_attr);
 	uv_mutex_init(&mutex_lock);
+	uv_mutex_init(&tzcache_lock);
 	mutex_init = 1;
+
+	tzname_index();
 }
 
 int datetime_gc(void) {
@@ -1169,10 +1176,132 @@ int datetime_gc(void) {
   usleep(10);
 #endif
 	}
+	if(tzindex != NULL) {
+		FREE(tzindex);
+	}
+	if(tzpolygons != NULL) {
+		FREE(tzpolygons);
+	}
 	logprintf(LOG_DEBUG, "garbage collected datetime library");
 	return EXIT_SUCCESS;
 }
 
+/*
+ * Test a single polygon the way the full scan always did. Only
+ * edges ending within the margin around the location are taken
+ * into account.
+ */
+static int coord2tz_match(int i, int x, int y, int margin) {
+	unsigned int n = tzdata[i].nrcoords;
+	int a = 0;
+
+	if(n > 0) {
+		int p1x = 0;
+		int p1y = 0;
+		for(a=0;a<n;a++) {
+			if(tzdata[i].coords[a][0] < p1x || ((int)p1x == 0)) {
+				p1x = tzdata[i].coords[a][0];
+			}
+			if(tzdata[i].coords[a][1] < p1y && ((int)p1y == 0)) {
+				p1y = tzdata[i].coords[a][1];
+			}
+		}
+		for(a=0;a<n+1;a++) {
+			int p2x = tzdata[i].coords[a % (int)n][0];
+			int p2y = tzdata[i].coords[a % (int)n][1];
+			if((round(p2x)-margin < round(x) && round(p2x)+margin > round(x))
+			   &&(round(p2y)-margin < round(y) && round(p2y)+margin > round(y))) {
+				int xinters = 0;
+				if(y > min(p1y, p2y)) {
+					if(y <= max(p1y, p2y)) {
+						if(x <= max(p1x, p2x)) {
+							if(p1y != p2y) {
+								xinters = (y-p1y)*(p2x-p1x)/(p2y-p1y)+p1x;
+							}
+							if(p1x == p2x || x <= xinters) {
+								return 1;
+							}
+						}
+					}
+				}
+				p1x = p2x;
+				p1y = p2y;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * A polygon can only match when one of its vertices lies
+ * within the margin around the location. The index lists
+ * the polygons with a vertex in each cell of a one degree
+ * grid, so a lookup only tests the polygons found in the
+ * cells the margin covers.
+ */
+#define TZ_CELL		10
+#define TZ_COLS		(3600/TZ_CELL+1)
+#define TZ_ROWS		(1800/TZ_CELL+1)
+
+static int coord2tz_col(int x) {
+	int col = (x+1800)/TZ_CELL;
+	return (x < -1800) ? 0 : min(col, TZ_COLS-1);
+}
+
+static int coord2tz_row(int y) {
+	int row = (y+900)/TZ_CELL;
+	return (y < -900) ? 0 : min(row, TZ_ROWS-1);
+}
+
+static int coord2tz_cmp(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+static void coord2tz_index(void) {
+	int nrtz = sizeof(tzdata)/sizeof(tzdata[0]);
+	int nrcells = TZ_COLS*TZ_ROWS, i = 0, a = 0, cell = 0;
+	int *last = NULL, *pos = NULL;
+
+	if((tzindex = MALLOC(sizeof(int)*(size_t)(nrcells+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((last = MALLOC(sizeof(int)*(size_t)nrcells)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(tzindex, 0, sizeof(int)*(size_t)(nrcells+1));
+	for(i=0;i<nrcells;i++) {
+		last[i] = -1;
+	}
+
+	for(i=0;i<nrtz;i++) {
+		for(a=0;a<tzdata[i].nrcoords;a++) {
+			cell = coord2tz_row(tzdata[i].coords[a][1])*TZ_COLS+coord2tz_col(tzdata[i].coords[a][0]);
+			if(last[cell] != i) {
+				last[cell] = i;
+				tzindex[cell+1]++;
+			}
+		}
+	}
+	for(i=0;i<nrcells;i++) {
+		tzindex[i+1] += tzindex[i];
+	}
+
+	if((tzpolygons = MALLOC(sizeof(int)*(size_t)(tzindex[nrcells]+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pos = last;
+	memcpy(pos, tzindex, sizeof(int)*(size_t)nrcells);
+	for(i=0;i<nrtz;i++) {
+		for(a=0;a<tzdata[i].nrcoords;a++) {
+			cell = coord2tz_row(tzdata[i].coords[a][1])*TZ_COLS+coord2tz_col(tzdata[i].coords[a][0]);
+			if(pos[cell] == tzindex[cell] || tzpolygons[pos[cell]-1] != i) {
+				tzpolygons[pos[cell]++] = i;
+			}
+		}
+	}
+	FREE(last);
+}
+
 char *coord2tz(double longitude, double latitude) {
 /*
 	Extra checks for graceful (early)
@@ -1182,61 +1311,59 @@ char *coord2tz(double longitude, double latitude) {
 		uv_mutex_lock(&mutex_lock);
 	}
 	searchingtz++;
-	int i = 0, a = 0, margin = 1, inside = 0;
-	int nrtz = sizeof(tzdata)/sizeof(tzdata[0]);
+	int i = 0, a = 0, margin = 1, inside = 0, row = 0, col = 0;
+	int nrcandidates = 0, *candidates = NULL;
 	char *tz = NULL;
 
+	if(tzindex == NULL) {
+		coord2tz_index();
+	}
+
 	margin *= (int)pow(10, PRECISION);
 	int y = (int)round(latitude*(int)pow(10, PRECISION));
 	int x = (int)round(longitude*(int)pow(10, PRECISION));
 
 	while(!inside && margin < (5*(int)pow(10, PRECISION))) {
-		for(i=0;i<nrtz;i++) {
-			unsigned int n = tzdata[i].nrcoords;
-			if(n > 0) {
-				int p1x = 0;
-				int p1y = 0;
-				for(a=0;a<n;a++) {
-					if(tzdata[i].coords[a][0] < p1x || ((int)p1x == 0)) {
-						p1x = tzdata[i].coords[a][0];
-					}
-					if(tzdata[i].coords[a][1] < p1y && ((int)p1y == 0)) {
-						p1y = tzdata[i].coords[a][1];
-					}
-				}
-				for(a=0;a<n+1;a++) {
-					int p2x = tzdata[i].coords[a % (int)n][0];
-					int p2y = tzdata[i].coords[a % (int)n][1];
-					if((round(p2x)-margin < round(x) && round(p2x)+margin > round(x))
-					   &&(round(p2y)-margin < round(y) && round(p2y)+margin > round(y))) {
-						int xinters = 0;
-						if(y > min(p1y, p2y)) {
-							if(y <= max(p1y, p2y)) {
-								if(x <= max(p1x, p2x)) {
-									if(p1y != p2y) {
-										xinters = (y-p1y)*(p2x-p1x)/(p2y-p1y)+p1x;
-									}
-									if(p1x == p2x || x <= xinters) {
-										tz = tzdata[i].timezone;
-										inside = 1;
-										break;
-									}
-								}
-							}
-						}
-						p1x = p2x;
-						p1y = p2y;
-					}
-				}
-				if(inside == 1) {
-					break;
+		int col1 = coord2tz_col(x-margin+1), col2 = coord2tz_col(x+margin-1);
+		int row1 = coord2tz_row(y-margin+1), row2 = coord2tz_row(y+margin-1);
+
+		nrcandidates = 0;
+		for(row=row1;row<=row2;row++) {
+			for(col=col1;col<=col2;col++) {
+				nrcandidates += tzindex[row*TZ_COLS+col+1]-tzindex[row*TZ_COLS+col];
+			}
+		}
+		if((candidates = REALLOC(candidates, sizeof(int)*(size_t)(nrcandidates+1))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		nrcandidates = 0;
+		for(row=row1;row<=row2;row++) {
+			for(col=col1;col<=col2;col++) {
+				for(a=tzindex[row*TZ_COLS+col];a<tzindex[row*TZ_COLS+col+1];a++) {
+					candidates[nrcandidates++] = tzpolygons[a];
 				}
 			}
 		}
+
+		/* Keep the order of the full scan */
+		qsort(candidates, (size_t)nrcandidates, sizeof(int), coord2tz_cmp);
+		for(i=0;i<nrcandidates;i++) {
+			if(i > 0 && candidates[i] == candidates[i-1]) {
+				continue;
+			}
+			if(coord2tz_match(candidates[i], x, y, margin) == 1) {
+				tz = tzdata[candidates[i]].timezone;
+				inside = 1;
+				break;
+			}
+		}
 		margin /= (int)pow(10, PRECISION);
 		margin++;
 		margin *= (int)pow(10, PRECISION);
 	}
+	if(candidates != NULL) {
+		FREE(candidates);
+	}
 
 	searchingtz--;
 	if(mutex_init == 1) {
@@ -1405,7 +1532,7 @@ static void ruleset_remove_stale(struct ruleset *ruleset, int year) {
 
 static const struct lc_timezone_rule *determine_applicable_rule(
 	const struct lc_timezone_rule *rules, size_t rules_count,
-	const struct tm *std, int gmtoff) {
+	const struct tm *std, int gmtoff, size_t *position) {
 	/*
 	 * Start out by picking the first standard time rule as a fallback. It
 	 * may be the case that the code below obtains no matching rule, for
@@ -1457,6 +1584,7 @@ static const struct lc_timezone_rule *determine_applicable_rule(
 		}
 		match = rule;
 	}
+	*position = i;
 	return match;
 }
 
@@ -1621,81 +1749,245 @@ int __localtime_utc(time_t timer, struct tm *tm) {
 	}
 }
 
-int localtime_l(time_t t, struct tm *result, char *timezone) {
-	size_t i = 0;
-	int x = 0;
-	/*
-	 * Require tv_nsec to be in bounds, like other functions that accept
-	 */
-	if(t < 0) {
-		return EINVAL;
+/*
+ * Timezone names are hashed to their index in the timezones
+ * table, instead of walking the list of names on every call.
+ */
+#define TZ_HASH_SIZE	2048
+#define TZ_TIME_MAX		((time_t)((((uint64_t)1) << (sizeof(time_t)*8-1))-1))
+
+static struct {
+	const char *name;
+	int index;
+} tzhash[TZ_HASH_SIZE];
+static int tzhash_init = 0;
+
+/*
+ * The offset of each timezone only changes when an era ends
+ * or a daylight saving rule starts. Per timezone we remember
+ * the span of UTC timestamps the last computed offset applies
+ * to, so most calls only have to check they fall within it.
+ */
+typedef struct tzcache_t {
+	time_t from;
+	time_t until;
+	int gmtoff;
+	int isdst;
+} tzcache_t;
+
+static struct tzcache_t tzcache[sizeof(timezones)/sizeof(timezones[0])];
+
+static unsigned int tzname_hash(const char *name) {
+	unsigned int hash = 2166136261U;
+
+	while(*name != '\0') {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
 	}
+	return hash;
+}
 
-	const char *timezone_name = timezone_names;
-	do {
-		if(strcmp(timezone, timezone_name) == 0) {
-			break;
+static int tzname_find(const char *name) {
+	unsigned int pos = tzname_hash(name) & (TZ_HASH_SIZE-1);
+
+	while(tzhash[pos].name != NULL) {
+		if(strcmp(tzhash[pos].name, name) == 0) {
+			return tzhash[pos].index;
+		}
+		pos = (pos+1) & (TZ_HASH_SIZE-1);
+	}
+	return -1;
+}
+
+static void tzname_index(void) {
+	const char *name = timezone_names;
+	unsigned int pos = 0;
+	int x = 0;
+
+	assert(sizeof(timezones)/sizeof(timezones[0]) < TZ_HASH_SIZE/2);
+
+	while(*name != '\0') {
+		if(tzname_find(name) == -1) {
+			pos = tzname_hash(name) & (TZ_HASH_SIZE-1);
+			while(tzhash[pos].name != NULL) {
+				pos = (pos+1) & (TZ_HASH_SIZE-1);
+			}
+			tzhash[pos].name = name;
+			tzhash[pos].index = x;
 		}
 		++x;
-		timezone_name += strlen(timezone_name) + 1;
-	} while(*timezone_name != '\0');
+		name += strlen(name) + 1;
+	}
+	tzhash_init = 1;
+}
 
-	/*
-	 * Obtain the last era from the timezone that does not end before the
-	 * provided timestamp.
-	 */
-	const struct lc_timezone *tz = &timezones[x];
+/*
+ * Obtain the last era from the timezone that does not end before the
+ * provided timestamp, and the span of timestamps it applies to.
+ */
+static const struct lc_timezone_era *localtime_era(const struct lc_timezone *tz, time_t t,
+																									 time_t *era_start, time_t *from, time_t *until) {
 	const struct lc_timezone_era *era = &tz->eras[0];
-	time_t era_start = 0;
-  for(i=1; i<tz->eras_count; ++i) {
+	size_t i = 0;
+
+	*era_start = 0;
+	*from = 0;
+	*until = TZ_TIME_MAX;
+	for(i=1; i<tz->eras_count; ++i) {
 		if(era->end > t) {
+			*until = era->end;
 			break;
 		}
-		era_start = era->end + era->gmtoff + era->end_save * 600;
+		*era_start = era->end + era->gmtoff + era->end_save * 600;
+		*from = era->end;
 		era = &tz->eras[i];
 	}
+	return era;
+}
 
-	int error = 0;
-  if(era->rules_count > 0) {
-		/*
-		 * Timezone has daylight saving time rules. First compute the
-		 * standard time and use that to compute the actual offset. If the
-		 * timestamp is close to the start of the era and the UTC offset got
-		 * decreased, make sure that the timestamp used for matching is set
-		 * to the start of the era. This ensures that we match the proper
-		 * DST rules.
-		 */
-		time_t timer_std = t + era->gmtoff;
+static const struct lc_timezone_rule *localtime_rule(const struct lc_timezone_era *era, time_t era_start,
+																										 time_t t, struct tm *std, size_t *position) {
+	/*
+	 * Timezone has daylight saving time rules. First compute the
+	 * standard time and use that to compute the actual offset. If the
+	 * timestamp is close to the start of the era and the UTC offset got
+	 * decreased, make sure that the timestamp used for matching is set
+	 * to the start of the era. This ensures that we match the proper
+	 * DST rules.
+	 */
+	time_t timer_std = t + era->gmtoff;
 
-		struct tm std;
-		__localtime_utc(timer_std > era_start ? timer_std : era_start, &std);
+	__localtime_utc(timer_std > era_start ? timer_std : era_start, std);
 
-		/*
-		 * Obtain applicable daylight saving time rule and recompute.
-		 */
-		const struct lc_timezone_rule *rule = determine_applicable_rule(era->rules, era->rules_count, &std, era->gmtoff);
-		int gmtoff = era->gmtoff + rule->save * 600;
+	return determine_applicable_rule(era->rules, era->rules_count, std, era->gmtoff, position);
+}
 
-		error = __localtime_utc(t + gmtoff, result);
+/*
+ * Narrow the span of the era down to the timestamps that share the
+ * daylight saving rule of t. Within a year of standard time the
+ * position in the rules of that year only moves forward, so both
+ * ends can be bisected. The rule itself can't be compared, as the
+ * one carried over from last year often applies again at its end.
+ */
+static void localtime_span(const struct lc_timezone_era *era, time_t era_start, time_t t,
+													 size_t position, const struct tm *std,
+													 time_t *from, time_t *until) {
+	struct tm tm;
+	time_t year = 0, lo = 0, hi = 0, mid = 0;
+	size_t pos = 0;
+
+	if(t + era->gmtoff <= era_start) {
+		/* Not worth caching the first moments of an era */
+		*until = *from;
+		return;
+	}
 
-		result->tm_isdst = rule->save > 0;
+	year = t + era->gmtoff - (std->tm_yday * 86400 + std->tm_hour * 3600 + std->tm_min * 60 + std->tm_sec);
+	*from = max(*from, max(year, era_start + 1) - era->gmtoff);
+	*until = min(*until, year + 365 * 86400 - era->gmtoff);
+
+	lo = *from;
+	hi = t;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		localtime_rule(era, era_start, mid, &tm, &pos);
+		if(pos == position) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	*from = lo;
+
+	lo = t + 1;
+	hi = *until;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		localtime_rule(era, era_start, mid, &tm, &pos);
+		if(pos == position) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*until = lo;
+}
 
+int localtime_l(time_t t, struct tm *result, char *timezone) {
+	const struct lc_timezone_era *era = NULL;
+	const struct lc_timezone_rule *rule = NULL;
+	struct tzcache_t *cache = NULL;
+	struct tm std;
+	time_t era_start = 0, from = 0, until = 0;
+	size_t position = 0;
+	int x = 0, gmtoff = 0, isdst = 0, hit = 0;
+	/*
+	 * Require tv_nsec to be in bounds, like other functions that accept
+	 */
+	if(t < 0) {
+		return EINVAL;
+	}
+
+	if(tzhash_init == 0) {
+		tzname_index();
+	}
+	if((x = tzname_find(timezone)) == -1) {
+		return EINVAL;
+	}
+
+	cache = &tzcache[x];
+	if(mutex_init == 1) {
+		uv_mutex_lock(&tzcache_lock);
+	}
+	if(t >= cache->from && t < cache->until) {
+		gmtoff = cache->gmtoff;
+		isdst = cache->isdst;
+		hit = 1;
+	}
+	if(mutex_init == 1) {
+		uv_mutex_unlock(&tzcache_lock);
+	}
+
+	if(hit == 0) {
+		era = localtime_era(&timezones[x], t, &era_start, &from, &until);
+		if(era->rules_count > 0) {
+			/*
+			 * Obtain applicable daylight saving time rule and recompute.
+			 */
+			rule = localtime_rule(era, era_start, t, &std, &position);
+			gmtoff = era->gmtoff + rule->save * 600;
+			isdst = rule->save > 0;
+
+			localtime_span(era, era_start, t, position, &std, &from, &until);
+		} else {
+			/*
+			 * Timezone has no daylight saving time rules. Compute local time
+			 * with timezone offset directly.
+			 */
+			gmtoff = era->gmtoff;
+			isdst = 0;
+		}
+
+		if(from < until) {
+			if(mutex_init == 1) {
+				uv_mutex_lock(&tzcache_lock);
+			}
+			cache->from = from;
+			cache->until = until;
+			cache->gmtoff = gmtoff;
+			cache->isdst = isdst;
+			if(mutex_init == 1) {
+				uv_mutex_unlock(&tzcache_lock);
+			}
+		}
+	}
+
+	int error = __localtime_utc(t + gmtoff, result);
+
+	result->tm_isdst = isdst;
 #ifndef _WIN32
-		result->tm_gmtoff = gmtoff;
-		// result->tm_zone = compute_zone_abbreviation(era, rule);
-#endif
-  } else {
-		/*
-		 * Timezone has no daylight saving time rules. Compute local time
-		 * with timezone offset directly.
-		 */
-		error = __localtime_utc(t + era->gmtoff, result);
-#ifndef _WIN32
-		result->tm_gmtoff = era->gmtoff;
-		// static const struct lc_timezone_rule rule = {};
-		// result->tm_zone = compute_zone_abbreviation(era, &rule);
+	result->tm_gmtoff = gmtoff;
 #endif
-	}
 
 	return error;
 }
@@ -32,6 +32,7 @@
 	#include <arpa/inet.h>
 	#include <poll.h>
 	#include <unistd.h>
+	#include <sys/uio.h>
 #endif
 #include <string.h>
 #include <stdlib.h>
@@ -46,11 +47,13 @@
 #include "../../libuv/uv.h"
 #include "mem.h"
 #include "network.h"
+#include "metrics.h"
 
 static uv_async_t *async_req = NULL;
 
 struct eventqueue_t {
 	int reason;
+	uint64_t triggered;
 	void *(*done)(void *);
 	void *data;
 	struct eventqueue_t *next;
@@ -69,6 +72,18 @@ static ssize_t one = 1;
 
 static struct eventpool_listener_t *eventpool_listeners = NULL;
 
+/*
+ * Drained slices are kept for reuse by the next
+ * connection, up to IOBUF_POOL_SIZE of them.
+ */
+#define IOBUF_POOL_SIZE		64
+#define IOBUF_IOV_MAX			16
+
+static uv_once_t iobuf_pool_once = UV_ONCE_INIT;
+static uv_mutex_t iobuf_pool_lock;
+static struct iobuf_slice_t *iobuf_pool = NULL;
+static int iobuf_pool_len = 0;
+
 static struct reasons_t {
 	int number;
 	char *reason;
@@ -120,6 +135,7 @@ static void fib_free(uv_work_t *req, int status) {
 static void fib(uv_work_t *req) {
 	struct threadpool_data_t *data = req->data;
 
+	metrics_eventpool(data->reason, (unsigned long)((uv_hrtime()-data->triggered)/1000));
 	data->func(data->reason, data->userdata);
 
 	int x = 0;
@@ -184,6 +200,7 @@ void eventpool_trigger(int reason, void *(*done)(void *), void *data) {
 	}
 	memset(node, 0, sizeof(struct eventqueue_t));
 	node->reason = reason;
+	node->triggered = uv_hrtime();
 	node->done = done;
 	node->data = data;
 
@@ -276,6 +293,7 @@ static void eventpool_execute(uv_async_t *handle) {
 					node[nrnodes1]->done = queue->done;
 					node[nrnodes1]->ref = ref;
 					node[nrnodes1]->reason = listeners->reason;
+					node[nrnodes1]->triggered = queue->triggered;
 					nrnodes1++;
 					if(threads == EVENTPOOL_THREADED) {
 						nrlisteners1[queue->reason]++;
@@ -293,6 +311,7 @@ static void eventpool_execute(uv_async_t *handle) {
 		for(i=0;i<nrnodes1;i++) {
 			if(threads == EVENTPOOL_NO_THREADS) {
 				nrlisteners1[node[i]->reason]++;
+				metrics_eventpool(node[i]->reason, (unsigned long)((uv_hrtime()-node[i]->triggered)/1000));
 				node[i]->func(node[i]->reason, node[i]->userdata);
 
 #ifdef _WIN32
@@ -316,6 +335,7 @@ static void eventpool_execute(uv_async_t *handle) {
 				tpdata->done = node[i]->done;
 				tpdata->ref = node[i]->ref;
 				tpdata->reason = node[i]->reason;
+				tpdata->triggered = node[i]->triggered;
 				tpdata->priority = reasons[node[i]->reason].priority;
 
 				uv_work_t *tp_work_req = MALLOC(sizeof(uv_work_t));
@@ -345,6 +365,74 @@ static void eventpool_execute(uv_async_t *handle) {
 	uv_mutex_unlock(&listeners_lock);
 }
 
+char *eventpool_reason(int reason) {
+	if(reason < 0 || reason > REASON_END) {
+		return NULL;
+	}
+	return reasons[reason].reason;
+}
+
+static void iobuf_pool_init(void) {
+	uv_mutex_init(&iobuf_pool_lock);
+}
+
+static struct iobuf_slice_t *iobuf_slice_get(void) {
+	struct iobuf_slice_t *slice = NULL;
+
+	uv_once(&iobuf_pool_once, iobuf_pool_init);
+
+	uv_mutex_lock(&iobuf_pool_lock);
+	if(iobuf_pool != NULL) {
+		slice = iobuf_pool;
+		iobuf_pool = slice->next;
+		iobuf_pool_len--;
+	}
+	uv_mutex_unlock(&iobuf_pool_lock);
+
+	if(slice == NULL) {
+		if((slice = MALLOC(sizeof(struct iobuf_slice_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	slice->start = 0;
+	slice->end = 0;
+	slice->next = NULL;
+
+	return slice;
+}
+
+static void iobuf_slice_put(struct iobuf_slice_t *slice) {
+	uv_once(&iobuf_pool_once, iobuf_pool_init);
+
+	uv_mutex_lock(&iobuf_pool_lock);
+	if(iobuf_pool_len < IOBUF_POOL_SIZE) {
+		slice->next = iobuf_pool;
+		iobuf_pool = slice;
+		iobuf_pool_len++;
+		slice = NULL;
+	}
+	uv_mutex_unlock(&iobuf_pool_lock);
+
+	if(slice != NULL) {
+		FREE(slice);
+	}
+}
+
+static void iobuf_pool_gc(void) {
+	struct iobuf_slice_t *slice = NULL;
+
+	uv_once(&iobuf_pool_once, iobuf_pool_init);
+
+	uv_mutex_lock(&iobuf_pool_lock);
+	while(iobuf_pool) {
+		slice = iobuf_pool;
+		iobuf_pool = iobuf_pool->next;
+		FREE(slice);
+	}
+	iobuf_pool_len = 0;
+	uv_mutex_unlock(&iobuf_pool_lock);
+}
+
 int eventpool_gc(void) {
 	if(lockinit == 1) {
 		uv_mutex_lock(&listeners_lock);
@@ -374,20 +462,100 @@ int eventpool_gc(void) {
 		}
 		uv_mutex_unlock(&listeners_lock);
 	}
+	iobuf_pool_gc();
 	eventpoolinit = 0;
 	return 0;
 }
 
 void iobuf_remove(struct iobuf_t *io, size_t n) {
+	struct iobuf_slice_t *slice = NULL;
+	size_t x = 0;
+
 	uv_mutex_lock(&io->lock);
   if(n > 0 && n <= io->len) {
-    memmove(io->buf, io->buf + n, io->len - n);
-    io->len -= n;
-		io->buf[io->len] = 0;
+		io->len -= n;
+		if(io->chained == 1) {
+			/*
+			 * Release fully written slices and
+			 * only advance into the first one left.
+			 */
+			while(n > 0 && io->head != NULL) {
+				slice = io->head;
+				x = slice->end - slice->start;
+				if(n < x) {
+					slice->start += n;
+					break;
+				}
+				n -= x;
+				io->head = slice->next;
+				if(io->head == NULL) {
+					io->tail = NULL;
+				}
+				io->size -= IOBUF_SLICE_SIZE;
+				iobuf_slice_put(slice);
+			}
+		} else {
+			memmove(io->buf, io->buf + n, io->len);
+			io->buf[io->len] = 0;
+		}
   }
 	uv_mutex_unlock(&io->lock);
 }
 
+/*
+ * The first contiguous part of the pending data.
+ * Used where only a single buffer can be written.
+ */
+static size_t iobuf_head(struct iobuf_t *io, char **buf) {
+	size_t len = 0;
+
+	uv_mutex_lock(&io->lock);
+	if(io->chained == 1) {
+		if(io->head != NULL) {
+			*buf = io->head->buf + io->head->start;
+			len = io->head->end - io->head->start;
+		}
+	} else {
+		*buf = io->buf;
+		len = io->len;
+	}
+	uv_mutex_unlock(&io->lock);
+
+	return len;
+}
+
+static int iobuf_send(struct iobuf_t *io, uv_os_fd_t fd) {
+#ifdef _WIN32
+	char *buf = NULL;
+	size_t len = iobuf_head(io, &buf);
+
+	return (int)send((unsigned int)fd, buf, len, 0);
+#else
+	struct iovec iov[IOBUF_IOV_MAX];
+	struct iobuf_slice_t *slice = NULL;
+	int i = 0, n = 0;
+
+	uv_mutex_lock(&io->lock);
+	if(io->chained == 1) {
+		slice = io->head;
+		while(slice != NULL && i < IOBUF_IOV_MAX) {
+			iov[i].iov_base = slice->buf + slice->start;
+			iov[i].iov_len = slice->end - slice->start;
+			slice = slice->next;
+			i++;
+		}
+	} else {
+		iov[i].iov_base = io->buf;
+		iov[i].iov_len = io->len;
+		i++;
+	}
+	n = (int)writev(fd, iov, i);
+	uv_mutex_unlock(&io->lock);
+
+	return n;
+#endif
+}
+
 static void eventpool_update_poll(uv_poll_t *req) {
 	struct uv_custom_poll_t *custom_poll_data = NULL;
 	struct iobuf_t *send_io = NULL;
@@ -429,6 +597,11 @@ static void eventpool_update_poll(uv_poll_t *req) {
 }
 
 size_t iobuf_append(struct iobuf_t *io, const void *buf, int len) {
+	struct iobuf_slice_t *slice = NULL;
+	const char *q = buf;
+	ssize_t size = 0;
+	size_t x = 0;
+	int left = len;
   char *p = NULL;
 
 	uv_mutex_lock(&io->lock);
@@ -436,16 +609,47 @@ size_t iobuf_append(struct iobuf_t *io, const void *buf, int len) {
   assert(io->len <= io->size);
 
   if(len <= 0) {
+	} else if(io->chained == 1) {
+		while(left > 0) {
+			if(io->tail == NULL || io->tail->end == IOBUF_SLICE_SIZE) {
+				slice = iobuf_slice_get();
+				if(io->tail == NULL) {
+					io->head = slice;
+				} else {
+					io->tail->next = slice;
+				}
+				io->tail = slice;
+				io->size += IOBUF_SLICE_SIZE;
+			}
+			x = IOBUF_SLICE_SIZE - io->tail->end;
+			if(x > (size_t)left) {
+				x = (size_t)left;
+			}
+			memcpy(io->tail->buf + io->tail->end, q, x);
+			io->tail->end += x;
+			q += x;
+			left -= (int)x;
+		}
+		io->len += len;
   } else if(io->len + len <= io->size) {
     memcpy(io->buf + io->len, buf, len);
     io->len += len;
-  } else if((p = REALLOC(io->buf, io->len + len + 1)) != NULL) {
-    io->buf = p;
-    memcpy(io->buf + io->len, buf, len);
-    io->len += len;
-    io->size = io->len;
   } else {
-    len = 0;
+		/*
+		 * Grow geometrically instead of to the exact
+		 * size, so a burst of appends stays linear.
+		 */
+		if((size = io->size*2) < io->len + len) {
+			size = io->len + len;
+		}
+		if((p = REALLOC(io->buf, size + 1)) != NULL) {
+			io->buf = p;
+			memcpy(io->buf + io->len, buf, len);
+			io->len += len;
+			io->size = size;
+		} else {
+			len = 0;
+		}
   }
 	uv_mutex_unlock(&io->lock);
 
@@ -467,9 +671,10 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 
 	struct uv_custom_poll_t *custom_poll_data = NULL;
 	struct iobuf_t *send_io = NULL;
-	char buffer[BUFFER_SIZE];
+	char buffer[BUFFER_SIZE], *p = NULL;
 	uv_os_fd_t fd = 0;
 	long int fromlen = 0;
+	size_t len = 0;
 	int r = 0, n = 0;
 
 	custom_poll_data = req->data;
@@ -534,6 +739,13 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 			FREE(req);
 			return;
 		}
+		/*
+		 * Resume an earlier session with this server
+		 * to skip the full handshake.
+		 */
+		if(custom_poll_data->ssl.session != NULL) {
+			mbedtls_ssl_set_session(&custom_poll_data->ssl.ctx, custom_poll_data->ssl.session);
+		}
 		// mbedtls_debug_set_threshold(2);
 		mbedtls_ssl_set_bio(&custom_poll_data->ssl.ctx, &fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 		mbedtls_ssl_conf_dbg(ssl_conf, my_debug, stdout);
@@ -570,7 +782,12 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 	if(events & UV_WRITABLE) {
 		if(send_io->len > 0) {
 			if(custom_poll_data->is_ssl == 1) {
-				n = mbedtls_ssl_write(&custom_poll_data->ssl.ctx, (unsigned char *)send_io->buf, send_io->len);
+				/*
+				 * TLS writes whole records anyway, so hand
+				 * mbedtls one slice at a time.
+				 */
+				len = iobuf_head(send_io, &p);
+				n = mbedtls_ssl_write(&custom_poll_data->ssl.ctx, (unsigned char *)p, len);
 					if(n == MBEDTLS_ERR_SSL_WANT_READ) {
 						/*LCOV_EXCL_START*/
 						custom_poll_data->doread = 1;
@@ -594,7 +811,7 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 					/*LCOV_EXCL_STOP*/
 				}
 			} else {
-				n = (int)send((unsigned int)fd, send_io->buf, send_io->len, 0);
+				n = iobuf_send(send_io, fd);
 			}
 			if(n > 0) {
 				iobuf_remove(send_io, n);
@@ -745,11 +962,19 @@ end:
 }
 
 static void iobuf_free(struct iobuf_t *iobuf) {
+	struct iobuf_slice_t *slice = NULL;
+
   if(iobuf != NULL) {
 		uv_mutex_lock(&iobuf->lock);
     if(iobuf->buf != NULL) {
 			FREE(iobuf->buf);
 		}
+		while(iobuf->head) {
+			slice = iobuf->head;
+			iobuf->head = iobuf->head->next;
+			iobuf_slice_put(slice);
+		}
+		iobuf->tail = NULL;
 		iobuf->len = iobuf->size = 0;
   }
 	uv_mutex_unlock(&iobuf->lock);
@@ -769,9 +994,12 @@ void uv_custom_poll_free(struct uv_custom_poll_t *data) {
 	FREE(data);
 }
 
-static void iobuf_init(struct iobuf_t *iobuf, size_t initial_size) {
+static void iobuf_init(struct iobuf_t *iobuf, int chained) {
   iobuf->len = iobuf->size = 0;
   iobuf->buf = NULL;
+	iobuf->chained = chained;
+	iobuf->head = NULL;
+	iobuf->tail = NULL;
 	uv_mutex_init(&iobuf->lock);
 }
 
@@ -780,8 +1008,12 @@ void uv_custom_poll_init(struct uv_custom_poll_t **custom_poll, uv_poll_t *poll,
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
 	memset(*custom_poll, '\0', sizeof(struct uv_custom_poll_t));
-	iobuf_init(&(*custom_poll)->send_iobuf, 0);
-	iobuf_init(&(*custom_poll)->recv_iobuf, 0);	
+	/*
+	 * The read callbacks expect one contiguous
+	 * buffer, so only the send side is chained.
+	 */
+	iobuf_init(&(*custom_poll)->send_iobuf, 1);
+	iobuf_init(&(*custom_poll)->recv_iobuf, 0);
 	
 	poll->data = *custom_poll;
 	(*custom_poll)->data = data;
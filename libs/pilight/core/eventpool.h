@@ -107,6 +107,7 @@ enum eventpool_threads_t {
 typedef struct threadpool_data_t {
 	int reason;
 	int priority;
+	uint64_t triggered;
 	char name[255];
 	uv_sem_t *ref;
 	void *userdata;
@@ -122,6 +123,7 @@ typedef struct threadpool_tasks_t {
 	uv_sem_t *ref;
 	int priority;
 	int reason;
+	uint64_t triggered;
 
 	struct {
 		struct timespec first;
@@ -140,10 +142,27 @@ typedef struct eventpool_listener_t {
 	struct eventpool_listener_t *next;
 } eventpool_listener_t;
 
+/*
+ * Outgoing data is kept in a chain of fixed size
+ * slices, so partial writes never move the data
+ * that is still pending.
+ */
+#define IOBUF_SLICE_SIZE	4096
+
+typedef struct iobuf_slice_t {
+	char buf[IOBUF_SLICE_SIZE];
+	size_t start;
+	size_t end;
+	struct iobuf_slice_t *next;
+} iobuf_slice_t;
+
 typedef struct iobuf_t {
   char *buf;
   ssize_t len;
   ssize_t size;
+	int chained;
+	struct iobuf_slice_t *head;
+	struct iobuf_slice_t *tail;
 	uv_mutex_t lock;
 } iobuf_t;
 
@@ -170,6 +189,7 @@ struct uv_custom_poll_t {
 		int init;
 		int handshake;
 		mbedtls_ssl_context ctx;
+		mbedtls_ssl_session *session;
 	} ssl;
 
   struct iobuf_t recv_iobuf;
@@ -180,6 +200,7 @@ void eventpool_callback(int, void *(*)(int, void *));
 void eventpool_trigger(int, void *(*)(void *), void *);
 void eventpool_init(enum eventpool_threads_t);
 int eventpool_gc(void);
+char *eventpool_reason(int);
 
 void iobuf_remove(struct iobuf_t *, size_t);
 size_t iobuf_append(struct iobuf_t *, const void *, int);
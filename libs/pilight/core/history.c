@@ -0,0 +1,448 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+
+#include "../../libuv/uv.h"
+#include "../config/settings.h"
+#include "history.h"
+#include "json.h"
+#include "mem.h"
+#include "log.h"
+
+#define HISTORY_MAGIC		"PLHS"
+#define HISTORY_VERSION	1
+
+typedef struct history_point_t {
+	unsigned int timestamp;
+	float avg;
+	float min;
+	float max;
+} history_point_t;
+
+typedef struct history_ring_t {
+	unsigned int head;
+	unsigned int count;
+
+	/* The downsampled bucket still being filled */
+	unsigned int bucket;
+	unsigned int n;
+	double sum;
+	float min;
+	float max;
+} history_ring_t;
+
+typedef struct history_series_t {
+	char device[HISTORY_NAME_LEN];
+	char name[HISTORY_NAME_LEN];
+	int decimals;
+	unsigned int used;
+	struct history_ring_t rings[3];
+	struct history_point_t raw[HISTORY_RAW_SIZE];
+	struct history_point_t minute[HISTORY_MINUTE_SIZE];
+	struct history_point_t hour[HISTORY_HOUR_SIZE];
+} history_series_t;
+
+typedef struct history_header_t {
+	char magic[4];
+	unsigned int version;
+	unsigned int nrseries;
+	unsigned int seriessize;
+} history_header_t;
+
+static struct history_header_t *header = NULL;
+static struct history_series_t *series = NULL;
+static size_t length = 0;
+static int mapped = 0;
+static int full = 0;
+static int lock_init = 0;
+static uv_mutex_t lock;
+
+/*
+ * Open addressing index of the used series on
+ * device and name. A slot holds the series
+ * number plus one so zero means empty. Series
+ * are never removed so no tombstones needed.
+ */
+static unsigned int *slots = NULL;
+static unsigned int nrslots = 0;
+static unsigned int nextfree = 0;
+
+static const char *tiers[] = { "raw", "minute", "hour" };
+static const unsigned int widths[] = { 0, 60, 3600 };
+
+static struct history_point_t *history_points(struct history_series_t *s, int tier, unsigned int *size) {
+	switch(tier) {
+		case HISTORY_MINUTE:
+			*size = HISTORY_MINUTE_SIZE;
+			return s->minute;
+		case HISTORY_HOUR:
+			*size = HISTORY_HOUR_SIZE;
+			return s->hour;
+		default:
+			*size = HISTORY_RAW_SIZE;
+			return s->raw;
+	}
+}
+
+static void history_push(struct history_series_t *s, int tier, unsigned int timestamp, float avg, float min, float max) {
+	struct history_ring_t *ring = &s->rings[tier];
+	unsigned int size = 0;
+	struct history_point_t *points = history_points(s, tier, &size);
+
+	points[ring->head].timestamp = timestamp;
+	points[ring->head].avg = avg;
+	points[ring->head].min = min;
+	points[ring->head].max = max;
+
+	ring->head = (ring->head+1) % size;
+	if(ring->count < size) {
+		ring->count++;
+	}
+}
+
+static unsigned int history_hash(const char *device, const char *name) {
+	unsigned int hash = 5381;
+
+	while(*device != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*device++;
+	}
+	hash = ((hash << 5) + hash);
+	while(*name != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+	return hash;
+}
+
+static void history_index(unsigned int i) {
+	unsigned int h = history_hash(series[i].device, series[i].name) & (nrslots-1);
+
+	while(slots[h] != 0) {
+		h = (h+1) & (nrslots-1);
+	}
+	slots[h] = i+1;
+}
+
+static struct history_series_t *history_find(const char *device, const char *name) {
+	unsigned int h = history_hash(device, name) & (nrslots-1);
+
+	while(slots[h] != 0) {
+		struct history_series_t *s = &series[slots[h]-1];
+		if(strcmp(s->device, device) == 0 && strcmp(s->name, name) == 0) {
+			return s;
+		}
+		h = (h+1) & (nrslots-1);
+	}
+	return NULL;
+}
+
+int history_init(void) {
+	unsigned int i = 0;
+	char *file = NULL;
+	int size = 0;
+
+	if(settings_find_number("history-size", &size) != 0 || size <= 0) {
+		return 0;
+	}
+
+	length = sizeof(struct history_header_t) + (size_t)size * sizeof(struct history_series_t);
+
+#ifndef _WIN32
+	if(settings_find_string("history-file", &file) == 0) {
+		int fd = 0;
+		if((fd = open(file, O_RDWR | O_CREAT, 0644)) < 0) {
+			logprintf(LOG_ERR, "cannot open history file: %s", file);
+		} else if(ftruncate(fd, (off_t)length) != 0) {
+			logprintf(LOG_ERR, "cannot resize history file: %s", file);
+			close(fd);
+		} else {
+			void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if(p == MAP_FAILED) {
+				logprintf(LOG_ERR, "cannot map history file: %s", file);
+			} else {
+				header = p;
+				mapped = 1;
+			}
+		}
+	}
+#endif
+
+	if(header == NULL) {
+		if((header = CALLOC(1, length)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	series = (struct history_series_t *)&header[1];
+
+	/*
+	 * A file written with a different layout can't be
+	 * reused. When only the number of series changed,
+	 * the series that still fit are kept.
+	 */
+	if(memcmp(header->magic, HISTORY_MAGIC, 4) != 0 ||
+	   header->version != HISTORY_VERSION ||
+	   header->seriessize != sizeof(struct history_series_t)) {
+		memset(header, 0, length);
+		memcpy(header->magic, HISTORY_MAGIC, 4);
+		header->version = HISTORY_VERSION;
+		header->seriessize = sizeof(struct history_series_t);
+	}
+	header->nrseries = (unsigned int)size;
+
+	/*
+	 * Keep the index at most half full
+	 */
+	nrslots = 1;
+	while(nrslots < header->nrseries*2) {
+		nrslots <<= 1;
+	}
+	if(slots != NULL) {
+		FREE(slots);
+	}
+	if((slots = CALLOC(nrslots, sizeof(unsigned int))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	nextfree = header->nrseries;
+
+	for(i=0;i<header->nrseries;i++) {
+		if(series[i].used == 1) {
+			/* Don't trust what we read from disk */
+			series[i].device[HISTORY_NAME_LEN-1] = '\0';
+			series[i].name[HISTORY_NAME_LEN-1] = '\0';
+			history_index(i);
+		} else if(nextfree == header->nrseries) {
+			nextfree = i;
+		}
+	}
+
+	if(lock_init == 0) {
+		uv_mutex_init(&lock);
+		lock_init = 1;
+	}
+
+	logprintf(LOG_DEBUG, "keeping history of %d values in %lu bytes", size, (unsigned long)length);
+
+	return 0;
+}
+
+int history_gc(void) {
+	if(lock_init == 0) {
+		return 0;
+	}
+
+	uv_mutex_lock(&lock);
+	if(header == NULL) {
+		uv_mutex_unlock(&lock);
+		return 0;
+	}
+#ifndef _WIN32
+	if(mapped == 1) {
+		msync(header, length, MS_SYNC);
+		munmap(header, length);
+	} else {
+		FREE(header);
+	}
+#else
+	FREE(header);
+#endif
+	header = NULL;
+	series = NULL;
+	FREE(slots);
+	nrslots = 0;
+	uv_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "garbage collected history library");
+	return 0;
+}
+
+void history_add(char *device, char *name, time_t timestamp, double value, int decimals) {
+	struct history_series_t *s = NULL;
+	unsigned int ts = (unsigned int)timestamp;
+	int tier = 0;
+
+	if(lock_init == 0 || strlen(device) >= HISTORY_NAME_LEN || strlen(name) >= HISTORY_NAME_LEN) {
+		return;
+	}
+
+	uv_mutex_lock(&lock);
+	if(header == NULL) {
+		uv_mutex_unlock(&lock);
+		return;
+	}
+	if((s = history_find(device, name)) == NULL) {
+		while(nextfree < header->nrseries && series[nextfree].used == 1) {
+			nextfree++;
+		}
+		if(nextfree >= header->nrseries) {
+			if(full == 0) {
+				logprintf(LOG_NOTICE, "history is full, increase history-size to keep more values");
+				full = 1;
+			}
+			uv_mutex_unlock(&lock);
+			return;
+		}
+		s = &series[nextfree];
+		memset(s, 0, sizeof(struct history_series_t));
+		strcpy(s->device, device);
+		strcpy(s->name, name);
+		s->used = 1;
+		history_index(nextfree++);
+	}
+	s->decimals = decimals;
+
+	history_push(s, HISTORY_RAW, ts, (float)value, (float)value, (float)value);
+
+	for(tier=HISTORY_MINUTE;tier<=HISTORY_HOUR;tier++) {
+		struct history_ring_t *ring = &s->rings[tier];
+		unsigned int bucket = ts - (ts % widths[tier]);
+
+		if(ring->n > 0 && ring->bucket != bucket) {
+			history_push(s, tier, ring->bucket, (float)(ring->sum/ring->n), ring->min, ring->max);
+			ring->n = 0;
+		}
+		if(ring->n == 0) {
+			ring->bucket = bucket;
+			ring->sum = 0;
+			ring->min = (float)value;
+			ring->max = (float)value;
+		}
+		ring->sum += value;
+		ring->n++;
+		if((float)value < ring->min) {
+			ring->min = (float)value;
+		}
+		if((float)value > ring->max) {
+			ring->max = (float)value;
+		}
+	}
+	uv_mutex_unlock(&lock);
+}
+
+static void history_append_point(struct JsonNode *jvalues, int tier, int decimals, unsigned int timestamp, double avg, double min, double max) {
+	struct JsonNode *jpoint = json_mkarray();
+
+	json_append_element(jpoint, json_mknumber(timestamp, 0));
+	json_append_element(jpoint, json_mknumber(avg, decimals));
+	if(tier != HISTORY_RAW) {
+		json_append_element(jpoint, json_mknumber(min, decimals));
+		json_append_element(jpoint, json_mknumber(max, decimals));
+	}
+	json_append_element(jvalues, jpoint);
+}
+
+int history_next(struct history_query_t *query, char **out) {
+	struct history_series_t *s = NULL;
+	struct history_point_t *points = NULL, *snap = NULL;
+	char device[HISTORY_NAME_LEN], name[HISTORY_NAME_LEN];
+	unsigned int x = 0, size = 0, nr = 0;
+	unsigned int from = (unsigned int)query->from, to = (unsigned int)query->to;
+	int t = 0, decimals = 0;
+
+	*out = NULL;
+
+	if(lock_init == 0) {
+		return -1;
+	}
+
+	uv_mutex_lock(&lock);
+	if(header == NULL) {
+		uv_mutex_unlock(&lock);
+		return -1;
+	}
+	if(query->device != NULL && query->name != NULL) {
+		if(query->next == 0) {
+			s = history_find(query->device, query->name);
+		}
+		query->next = header->nrseries;
+	} else {
+		while(query->next < header->nrseries) {
+			s = &series[query->next++];
+			if(s->used == 1 &&
+			   (query->device == NULL || strcmp(s->device, query->device) == 0) &&
+			   (query->name == NULL || strcmp(s->name, query->name) == 0)) {
+				break;
+			}
+			s = NULL;
+		}
+	}
+	if(s == NULL) {
+		uv_mutex_unlock(&lock);
+		return 0;
+	}
+
+	/*
+	 * Automatically use the most detailed
+	 * tier still going back far enough.
+	 */
+	t = query->tier;
+	if(t == HISTORY_AUTO) {
+		for(t=HISTORY_RAW;t<HISTORY_HOUR;t++) {
+			struct history_ring_t *ring = &s->rings[t];
+			points = history_points(s, t, &size);
+			if(ring->count > 0 && points[(ring->head+size-ring->count) % size].timestamp <= from) {
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Only copy the selected points while
+	 * holding the lock and format them
+	 * after releasing it.
+	 */
+	struct history_ring_t *ring = &s->rings[t];
+	points = history_points(s, t, &size);
+	if((snap = MALLOC((size+1)*sizeof(struct history_point_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	for(x=0;x<ring->count;x++) {
+		struct history_point_t *p = &points[(ring->head+size-ring->count+x) % size];
+		if(p->timestamp >= from && p->timestamp <= to) {
+			snap[nr++] = *p;
+		}
+	}
+	if(t != HISTORY_RAW && ring->n > 0 && ring->bucket >= from && ring->bucket <= to) {
+		snap[nr].timestamp = ring->bucket;
+		snap[nr].avg = (float)(ring->sum/ring->n);
+		snap[nr].min = ring->min;
+		snap[nr].max = ring->max;
+		nr++;
+	}
+	strcpy(device, s->device);
+	strcpy(name, s->name);
+	decimals = s->decimals;
+	uv_mutex_unlock(&lock);
+
+	struct JsonNode *jseries = json_mkobject();
+	struct JsonNode *jvalues = json_mkarray();
+
+	json_append_member(jseries, "device", json_mkstring(device));
+	json_append_member(jseries, "value", json_mkstring(name));
+	json_append_member(jseries, "tier", json_mkstring(tiers[t]));
+
+	for(x=0;x<nr;x++) {
+		history_append_point(jvalues, t, decimals, snap[x].timestamp, snap[x].avg, snap[x].min, snap[x].max);
+	}
+	json_append_member(jseries, "values", jvalues);
+	FREE(snap);
+
+	*out = json_stringify(jseries, NULL);
+	json_delete(jseries);
+	query->nr++;
+
+	return 1;
+}
@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <time.h>
+
+#define HISTORY_RAW			0
+#define HISTORY_MINUTE	1
+#define HISTORY_HOUR		2
+#define HISTORY_AUTO		-1
+
+/*
+ * Number of points kept per tier of a single
+ * series. Together with history-size this
+ * defines the total memory used.
+ */
+#define HISTORY_RAW_SIZE		360
+#define HISTORY_MINUTE_SIZE	1440
+#define HISTORY_HOUR_SIZE		720
+
+#define HISTORY_NAME_LEN		64
+
+/*
+ * Cursor over the series matching a query.
+ * Start with next and nr set to zero.
+ */
+typedef struct history_query_t {
+	char *device;
+	char *name;
+	time_t from;
+	time_t to;
+	int tier;
+	unsigned int next;
+	int nr;
+} history_query_t;
+
+int history_init(void);
+int history_gc(void);
+void history_add(char *device, char *name, time_t timestamp, double value, int decimals);
+int history_next(struct history_query_t *query, char **out);
+
+#endif
@@ -16,6 +16,7 @@
 #include <math.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 #include <sys/types.h>
 #ifdef _WIN32
 	#if _WIN32_WINNT < 0x0501
@@ -54,6 +55,24 @@
 #define STEP_WRITE					0
 #define STEP_READ						1
 
+/*
+ * getaddrinfo doesn't tell us the TTL of the records
+ * it resolved, so resolved hosts are cached for a
+ * fixed time. Failures are cached shorter.
+ */
+#define DNS_CACHE_SIZE			16
+#define DNS_TTL							300
+#define DNS_NEGATIVE_TTL		30
+
+/*
+ * Idle connections are kept open for the next
+ * request to the same host, unless the server
+ * announced a shorter keep-alive timeout.
+ */
+#define HTTP_POOL_SIZE			8
+#define HTTP_IDLE_TIMEOUT		30
+#define HTTP_CACHE_SIZE			8
+
 typedef struct http_clients_t {
 	uv_poll_t *req;
 	int fd;
@@ -71,6 +90,55 @@ typedef struct http_clients_t {
 struct http_clients_t *http_clients = NULL;
 static int http_lock_init = 0;
 
+typedef struct dns_cache_t {
+	char host[256];
+	char ip[INET_ADDRSTRLEN+1];
+	int found;
+	uint64_t expires;
+} dns_cache_t;
+
+typedef struct http_pool_t {
+	char *host;
+	int port;
+	int is_ssl;
+	uv_poll_t *req;
+	uint64_t expires;
+	struct http_pool_t *next;
+} http_pool_t;
+
+typedef struct http_session_t {
+	char host[256];
+	int port;
+	int valid;
+	uint64_t used;
+	mbedtls_ssl_session session;
+} http_session_t;
+
+typedef struct http_cache_t {
+	char *url;
+	char *etag;
+	char *modified;
+	char *content;
+	int size;
+	char mimetype[255];
+	uint64_t expires;
+	uint64_t used;
+} http_cache_t;
+
+static struct dns_cache_t dns_cache[DNS_CACHE_SIZE];
+static struct request_t *pending = NULL;
+static uv_async_t *async_req = NULL;
+static uv_mutex_t dns_lock;
+
+/*
+ * The pool, sessions and cache are
+ * only used from the main thread.
+ */
+static struct http_pool_t *http_pool = NULL;
+static struct http_session_t http_sessions[HTTP_POOL_SIZE];
+static struct http_cache_t http_cache[HTTP_CACHE_SIZE];
+static uv_timer_t *pool_timer = NULL;
+
 typedef struct request_t {
 	char *host;
   char *uri;
@@ -95,11 +163,25 @@ typedef struct request_t {
 	size_t bytes_read;
 
 	void (*callback)(int code, char *data, int size, char *type, void *userdata);
+
+	int keepalive;
+	int reused;
+	int idle;
+
+	int cache;
+	char *url;
+	char *etag;
+	char *modified;
+	int maxage;
+	int nostore;
+
+	struct request_t *next;
 } request_t;
 
 int done = 0;
 
 static void http_client_close(uv_poll_t *req);
+static void http_cache_drop(struct http_cache_t *entry);
 
 static void free_request(struct request_t *request) {
 	if(request->host != NULL) {
@@ -114,11 +196,21 @@ static void free_request(struct request_t *request) {
 	if(request->auth64 != NULL) {
 		FREE(request->auth64);
 	}
+	if(request->url != NULL) {
+		FREE(request->url);
+	}
+	if(request->etag != NULL) {
+		FREE(request->etag);
+	}
+	if(request->modified != NULL) {
+		FREE(request->modified);
+	}
 	FREE(request);
 }
 
 int http_gc(void) {
 	struct http_clients_t *node = NULL;
+	int i = 0;
 
 #ifdef _WIN32
 	uv_mutex_lock(&http_lock);
@@ -158,6 +250,33 @@ int http_gc(void) {
 	pthread_mutex_unlock(&http_lock);
 #endif
 
+	if(http_lock_init == 1) {
+		uv_mutex_lock(&dns_lock);
+		while(pending) {
+			struct request_t *request = pending;
+			pending = pending->next;
+			free_request(request);
+		}
+		memset(dns_cache, 0, sizeof(dns_cache));
+		uv_mutex_unlock(&dns_lock);
+	}
+
+	while(http_pool) {
+		struct http_pool_t *tmp = http_pool;
+		http_pool = http_pool->next;
+		FREE(tmp->host);
+		FREE(tmp);
+	}
+	for(i=0;i<HTTP_POOL_SIZE;i++) {
+		if(http_sessions[i].valid == 1) {
+			mbedtls_ssl_session_free(&http_sessions[i].session);
+		}
+	}
+	memset(http_sessions, 0, sizeof(http_sessions));
+	for(i=0;i<HTTP_CACHE_SIZE;i++) {
+		http_cache_drop(&http_cache[i]);
+	}
+
 	logprintf(LOG_DEBUG, "garbage collected http library");
 	return 1;
 }
@@ -221,6 +340,279 @@ static void http_client_remove(uv_poll_t *req) {
 #endif
 }
 
+static void http_pool_remove(uv_poll_t *req) {
+	struct http_pool_t *currP, *prevP;
+
+	prevP = NULL;
+
+	for(currP = http_pool; currP != NULL; prevP = currP, currP = currP->next) {
+		if(currP->req == req) {
+			if(prevP == NULL) {
+				http_pool = currP->next;
+			} else {
+				prevP->next = currP->next;
+			}
+
+			FREE(currP->host);
+			FREE(currP);
+			break;
+		}
+	}
+}
+
+static void http_pool_timeout(uv_timer_t *handle) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct http_pool_t *node = http_pool;
+	uint64_t now = uv_hrtime()/1000000000;
+
+	/*
+	 * Closing a connection removes it from
+	 * the pool, so start over after each.
+	 */
+	while(node != NULL) {
+		if(node->expires <= now) {
+			http_client_close(node->req);
+			node = http_pool;
+		} else {
+			node = node->next;
+		}
+	}
+
+	if(http_pool == NULL) {
+		uv_timer_stop(handle);
+	}
+}
+
+static int http_pool_alive(uv_poll_t *req) {
+	char c = 0;
+	int fd = -1, n = 0;
+
+	if(uv_is_closing((uv_handle_t *)req) || uv_fileno((uv_handle_t *)req, (uv_os_fd_t *)&fd) != 0) {
+		return 0;
+	}
+
+	/*
+	 * There is nothing to read from an idle connection
+	 * unless the server closed it in the meantime.
+	 */
+	n = (int)recv(fd, &c, 1, MSG_PEEK);
+#ifdef _WIN32
+	return (n < 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+	return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+#endif
+}
+
+static uv_poll_t *http_pool_get(struct request_t *request) {
+	struct http_pool_t *node = http_pool;
+	uint64_t now = uv_hrtime()/1000000000;
+	uv_poll_t *req = NULL;
+
+	while(node != NULL) {
+		if(node->port != request->port || node->is_ssl != request->is_ssl || strcmp(node->host, request->host) != 0) {
+			node = node->next;
+			continue;
+		}
+		req = node->req;
+		if(node->expires > now && http_pool_alive(req) == 1) {
+			http_pool_remove(req);
+			return req;
+		}
+		http_client_close(req);
+		node = http_pool;
+	}
+
+	return NULL;
+}
+
+static int http_pool_add(uv_poll_t *req, struct request_t *request) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct http_pool_t *node = NULL;
+	int timeout = HTTP_IDLE_TIMEOUT, nr = 0;
+
+	if(request->idle > 0 && request->idle-1 < timeout) {
+		timeout = request->idle-1;
+	}
+	for(node=http_pool;node!=NULL;node=node->next) {
+		nr++;
+	}
+	if(timeout <= 0 || nr >= HTTP_POOL_SIZE) {
+		return -1;
+	}
+
+	if((node = MALLOC(sizeof(struct http_pool_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->host = STRDUP(request->host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->port = request->port;
+	node->is_ssl = request->is_ssl;
+	node->req = req;
+	node->expires = uv_hrtime()/1000000000 + timeout;
+	node->next = http_pool;
+	http_pool = node;
+
+	/*
+	 * The poll stays readable, so we notice the
+	 * server closing the connection while idle.
+	 */
+	custom_poll_data->data = NULL;
+	custom_poll_data->doread = 0;
+	custom_poll_data->dowrite = 0;
+	iobuf_remove(&custom_poll_data->recv_iobuf, custom_poll_data->recv_iobuf.len);
+
+	if(uv_is_active((uv_handle_t *)pool_timer) == 0) {
+		uv_timer_start(pool_timer, http_pool_timeout, 1000, 1000);
+	}
+
+	return 0;
+}
+
+static mbedtls_ssl_session *http_session_get(struct request_t *request) {
+	int i = 0;
+
+	for(i=0;i<HTTP_POOL_SIZE;i++) {
+		if(http_sessions[i].valid == 1 && http_sessions[i].port == request->port &&
+		   strcmp(http_sessions[i].host, request->host) == 0) {
+			http_sessions[i].used = uv_hrtime();
+			return &http_sessions[i].session;
+		}
+	}
+
+	return NULL;
+}
+
+static void http_session_set(struct request_t *request, mbedtls_ssl_context *ctx) {
+	struct http_session_t *session = NULL;
+	int i = 0, x = 0;
+
+	if(strlen(request->host) >= sizeof(http_sessions[0].host)) {
+		return;
+	}
+
+	/*
+	 * Reuse the session of this host or
+	 * otherwise the least recently used.
+	 */
+	for(i=0;i<HTTP_POOL_SIZE;i++) {
+		if(http_sessions[i].valid == 1 && http_sessions[i].port == request->port &&
+		   strcmp(http_sessions[i].host, request->host) == 0) {
+			x = i;
+			break;
+		}
+		if(http_sessions[i].used < http_sessions[x].used) {
+			x = i;
+		}
+	}
+	session = &http_sessions[x];
+
+	if(session->valid == 1) {
+		mbedtls_ssl_session_free(&session->session);
+	}
+	mbedtls_ssl_session_init(&session->session);
+	if(mbedtls_ssl_get_session(ctx, &session->session) == 0) {
+		strcpy(session->host, request->host);
+		session->port = request->port;
+		session->used = uv_hrtime();
+		session->valid = 1;
+	} else {
+		mbedtls_ssl_session_free(&session->session);
+		memset(session, 0, sizeof(struct http_session_t));
+	}
+}
+
+static struct http_cache_t *http_cache_find(char *url) {
+	int i = 0;
+
+	for(i=0;i<HTTP_CACHE_SIZE;i++) {
+		if(http_cache[i].url != NULL && strcmp(http_cache[i].url, url) == 0) {
+			return &http_cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void http_cache_drop(struct http_cache_t *entry) {
+	if(entry->url != NULL) {
+		FREE(entry->url);
+	}
+	if(entry->etag != NULL) {
+		FREE(entry->etag);
+	}
+	if(entry->modified != NULL) {
+		FREE(entry->modified);
+	}
+	if(entry->content != NULL) {
+		FREE(entry->content);
+	}
+	memset(entry, 0, sizeof(struct http_cache_t));
+}
+
+static void http_cache_validators(struct http_cache_t *entry, struct request_t *request) {
+	uint64_t now = uv_hrtime();
+
+	if(request->etag != NULL) {
+		if(entry->etag != NULL) {
+			FREE(entry->etag);
+		}
+		entry->etag = request->etag;
+		request->etag = NULL;
+	}
+	if(request->modified != NULL) {
+		if(entry->modified != NULL) {
+			FREE(entry->modified);
+		}
+		entry->modified = request->modified;
+		request->modified = NULL;
+	}
+	entry->expires = now/1000000000 + ((request->maxage > 0) ? request->maxage : 0);
+	entry->used = now;
+}
+
+static void http_cache_store(struct request_t *request) {
+	struct http_cache_t *entry = http_cache_find(request->url);
+	int i = 0;
+
+	if(request->nostore == 1 || (request->etag == NULL && request->modified == NULL && request->maxage <= 0)) {
+		if(entry != NULL) {
+			http_cache_drop(entry);
+		}
+		return;
+	}
+
+	if(entry == NULL) {
+		entry = &http_cache[0];
+		for(i=1;i<HTTP_CACHE_SIZE;i++) {
+			if(http_cache[i].used < entry->used) {
+				entry = &http_cache[i];
+			}
+		}
+	}
+	http_cache_drop(entry);
+
+	if((entry->url = STRDUP(request->url)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((entry->content = MALLOC(request->content_len+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if(request->content != NULL) {
+		memcpy(entry->content, request->content, request->content_len);
+	}
+	entry->content[request->content_len] = '\0';
+	entry->size = (int)request->content_len;
+	strcpy(entry->mimetype, request->mimetype);
+
+	http_cache_validators(entry, request);
+}
+
 static int prepare_request(struct request_t **request, int method, char *url, const char *contype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
 	char *tok = NULL, *auth = NULL;
 	int plen = 0, len = 0, tlen = 0;
@@ -456,6 +848,7 @@ static void http_client_close(uv_poll_t *req) {
 	}
 
 	http_client_remove(req);
+	http_pool_remove(req);
 
 	if(!uv_is_closing((uv_handle_t *)req)) {
 		uv_poll_stop(req);
@@ -477,6 +870,83 @@ static void poll_close_cb(uv_poll_t *req) {
 	http_client_close(req);
 }
 
+static const char *http_header(struct connection_t *c, const char *name) {
+	int i = 0;
+
+	for(i=0;i<c->num_headers;i++) {
+		if(strcasecmp(c->http_headers[i].name, name) == 0) {
+			return c->http_headers[i].value;
+		}
+	}
+
+	return NULL;
+}
+
+static void http_cache_headers(struct request_t *request, struct connection_t *c) {
+	const char *value = NULL, *p = NULL;
+
+	if((value = http_header(c, "ETag")) != NULL) {
+		if((request->etag = STRDUP(value)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	if((value = http_header(c, "Last-Modified")) != NULL) {
+		if((request->modified = STRDUP(value)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	if((value = http_header(c, "Cache-Control")) != NULL) {
+		if(strstr(value, "no-store") != NULL) {
+			request->nostore = 1;
+		} else if(strstr(value, "no-cache") != NULL) {
+			request->maxage = 0;
+		} else if((p = strstr(value, "max-age=")) != NULL) {
+			request->maxage = atoi(&p[8]);
+		}
+	}
+}
+
+static void http_request_done(uv_poll_t *req) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct request_t *request = custom_poll_data->data;
+	struct http_cache_t *entry = NULL;
+	char *content = (request->content != NULL) ? request->content : "";
+	char *mimetype = request->mimetype;
+	int code = request->status_code, size = (int)request->content_len;
+
+	if(request->cache == 1) {
+		if(code == 304 && (entry = http_cache_find(request->url)) != NULL) {
+			http_cache_validators(entry, request);
+			code = 200;
+			content = entry->content;
+			size = entry->size;
+			mimetype = entry->mimetype;
+		} else if(code == 200) {
+			http_cache_store(request);
+		}
+	}
+
+	if(custom_poll_data->is_ssl == 1 && request->keepalive == 1 && request->reused == 0) {
+		http_session_set(request, &custom_poll_data->ssl.ctx);
+	}
+
+	/*
+	 * Park the connection before calling back, so a
+	 * follow-up request to this host can use it.
+	 */
+	if(request->keepalive == 1 && http_pool_add(req, request) == 0) {
+		if(request->callback != NULL) {
+			request->callback(code, content, size, mimetype, request->userdata);
+		}
+		free_request(request);
+	} else {
+		if(request->callback != NULL) {
+			request->callback(code, content, size, mimetype, request->userdata);
+		}
+		uv_custom_close(req);
+	}
+}
+
 static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	/*
 	 * Make sure we execute in the main thread
@@ -490,6 +960,15 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	const char *a = NULL, *b = NULL;
 	int pos = 0;
 
+	/*
+	 * An idle connection only becomes readable
+	 * when the server is closing it.
+	 */
+	if(request == NULL) {
+		uv_custom_close(req);
+		return;
+	}
+
 	if(*nread > 0) {
 		buf[*nread] = '\0';
 	}
@@ -537,20 +1016,38 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 					}
 				}
 			}
-			if(http_get_header(&c, "Content-Length") != NULL) {
-				request->content_len = atoi(http_get_header(&c, "Content-Length"));
+			if((a = http_header(&c, "Content-Length")) != NULL) {
+				request->content_len = atoi(a);
 			}
-			if(http_get_header(&c, "Transfer-Encoding") != NULL) {
-				if(strcmp(http_get_header(&c, "Transfer-Encoding"), "chunked") == 0) {
+			if((a = http_header(&c, "Transfer-Encoding")) != NULL) {
+				if(strcmp(a, "chunked") == 0) {
 					request->chunked = 1;
 				}
 			}
-			FREE(header);
-			if(*nread == 0) {
-				if(request->callback != NULL) {
-					request->callback(request->status_code, "", request->content_len, request->mimetype, request->userdata);
-					goto close;
+			if(request->status_code == 204 || request->status_code == 304) {
+				request->content_len = 0;
+				request->chunked = 0;
+			} else if(request->chunked == 0 && http_header(&c, "Content-Length") == NULL) {
+				/* The body ends when the server closes the connection */
+				request->keepalive = 0;
+			}
+			if((a = http_header(&c, "Connection")) != NULL) {
+				if(strcasecmp(a, "close") == 0) {
+					request->keepalive = 0;
 				}
+			} else if(strcmp(c.request_method, "HTTP/1.0") == 0) {
+				request->keepalive = 0;
+			}
+			if((a = http_header(&c, "Keep-Alive")) != NULL && (b = strstr(a, "timeout=")) != NULL) {
+				request->idle = atoi(&b[8]);
+			}
+			if(request->cache == 1) {
+				http_cache_headers(request, &c);
+			}
+			FREE(header);
+			if(*nread == 0 && request->chunked == 0 && request->content_len == 0) {
+				http_request_done(req);
+				return;
 			}
 		}
 		if(request->chunked == 1) {
@@ -579,10 +1076,8 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 			request->reading = 1;
 		} else if(request->content != NULL) {
 			request->content[request->content_len] = '\0';
-			if(request->callback != NULL) {
-				request->callback(request->status_code, request->content, request->content_len, request->mimetype, request->userdata);
-				goto close;
-			}
+			http_request_done(req);
+			return;
 		}
 	}
 
@@ -591,7 +1086,6 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 		return;
 	}
 
-close:
 	uv_custom_close(req);
 }
 
@@ -604,18 +1098,20 @@ static void write_cb(uv_poll_t *req) {
 
 	struct uv_custom_poll_t *custom_poll_data = req->data;
 	struct request_t *request = custom_poll_data->data;
+	struct http_cache_t *entry = NULL;
 	char *header = NULL;
 
 	switch(request->steps) {
 		case STEP_WRITE: {
 			if(request->request_method == HTTP_POST) {
-				append_to_header(&header, "POST %s HTTP/1.0\r\n", request->uri);
+				append_to_header(&header, "POST %s HTTP/1.1\r\n", request->uri);
 				append_to_header(&header, "Host: %s\r\n", request->host);
 				if(request->auth64 != NULL) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
 				append_to_header(&header, "Content-Type: %s\r\n", request->mimetype);
+				append_to_header(&header, "Connection: %s\r\n", (request->keepalive == 1) ? "keep-alive" : "close");
 				append_to_header(&header, "Content-Length: %lu\r\n\r\n", request->content_len);
 				append_to_header(&header, "%s", request->content);
 			} else if(request->request_method == HTTP_GET) {
@@ -625,7 +1121,15 @@ static void write_cb(uv_poll_t *req) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
-				append_to_header(&header, "Connection: close\r\n\r\n");
+				if(request->cache == 1 && (entry = http_cache_find(request->url)) != NULL) {
+					if(entry->etag != NULL) {
+						append_to_header(&header, "If-None-Match: %s\r\n", entry->etag);
+					}
+					if(entry->modified != NULL) {
+						append_to_header(&header, "If-Modified-Since: %s\r\n", entry->modified);
+					}
+				}
+				append_to_header(&header, "Connection: %s\r\n\r\n", (request->keepalive == 1) ? "keep-alive" : "close");
 			}
 			iobuf_append(&custom_poll_data->send_iobuf, (void *)header, strlen(header));
 
@@ -640,13 +1144,7 @@ static void write_cb(uv_poll_t *req) {
 	}
 }
 
-char *http_process(int type, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
-	struct request_t *request = NULL;
-	struct uv_custom_poll_t *custom_poll_data = NULL;
-	struct sockaddr_in addr;
-	char ip[INET_ADDRSTRLEN+1], *p = ip;
-	int r = 0, sockfd = 0;
-
+static void http_lock_initialize(void) {
 	if(http_lock_init == 0) {
 		http_lock_init = 1;
 #ifdef _WIN32
@@ -656,91 +1154,133 @@ char *http_process(int type, char *url, const char *conttype, char *post, void (
 		pthread_mutexattr_settype(&http_attr, PTHREAD_MUTEX_RECURSIVE);
 		pthread_mutex_init(&http_lock, &http_attr);
 #endif
+		uv_mutex_init(&dns_lock);
 	}
+}
 
-#ifdef _WIN32
-	WSADATA wsa;
+static int dns_cache_get(char *host, char *ip) {
+	uint64_t now = uv_hrtime()/1000000000;
+	int i = 0, r = -1;
 
-	if(WSAStartup(0x202, &wsa) != 0) {
-		logprintf(LOG_ERR, "WSAStartup");
-		exit(EXIT_FAILURE);
+	uv_mutex_lock(&dns_lock);
+	for(i=0;i<DNS_CACHE_SIZE;i++) {
+		if(dns_cache[i].expires > now && strcmp(dns_cache[i].host, host) == 0) {
+			if((r = dns_cache[i].found) == 1) {
+				strcpy(ip, dns_cache[i].ip);
+			}
+			break;
+		}
 	}
-#endif
+	uv_mutex_unlock(&dns_lock);
 
-	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
-		r = host2ip(request->host, p);
-		
-		if(r != 0) {
-			logprintf(LOG_ERR, "host2ip");
-			goto freeuv;
-		}
+	return r;
+}
 
-		r = uv_ip4_addr(ip, request->port, &addr);
-		if(r != 0) {
-			logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
-			goto freeuv;
+static void dns_cache_set(char *host, char *ip) {
+	uint64_t now = uv_hrtime()/1000000000;
+	int i = 0, x = 0;
+
+	if(strlen(host) >= sizeof(dns_cache[0].host)) {
+		return;
+	}
+
+	/*
+	 * Reuse the entry of this host or
+	 * otherwise the one expiring first.
+	 */
+	uv_mutex_lock(&dns_lock);
+	for(i=0;i<DNS_CACHE_SIZE;i++) {
+		if(strcmp(dns_cache[i].host, host) == 0) {
+			x = i;
+			break;
 		}
-		/*
-		 * Partly bypass libuv in case of ssl connections
-		 */
-		if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
-			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "socket: %s", strerror(errno));
-			goto freeuv;
-			/*LCOV_EXCL_STOP*/
+		if(dns_cache[i].expires < dns_cache[x].expires) {
+			x = i;
 		}
+	}
+	strcpy(dns_cache[x].host, host);
+	if(ip != NULL) {
+		strcpy(dns_cache[x].ip, ip);
+		dns_cache[x].found = 1;
+		dns_cache[x].expires = now + DNS_TTL;
+	} else {
+		dns_cache[x].ip[0] = '\0';
+		dns_cache[x].found = 0;
+		dns_cache[x].expires = now + DNS_NEGATIVE_TTL;
+	}
+	uv_mutex_unlock(&dns_lock);
+}
+
+static void http_connect(struct request_t *request, char *ip) {
+	struct uv_custom_poll_t *custom_poll_data = NULL;
+	struct sockaddr_in addr;
+	int r = 0, sockfd = 0;
+
+	r = uv_ip4_addr(ip, request->port, &addr);
+	if(r != 0) {
+		logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
+		goto freeuv;
+	}
+	/*
+	 * Partly bypass libuv in case of ssl connections
+	 */
+	if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "socket: %s", strerror(errno));
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
+	}
 
 #ifdef _WIN32
-		unsigned long on = 1;
-		ioctlsocket(sockfd, FIONBIO, &on);
+	unsigned long on = 1;
+	ioctlsocket(sockfd, FIONBIO, &on);
 #else
-		long arg = fcntl(sockfd, F_GETFL, NULL);
-		fcntl(sockfd, F_SETFL, arg | O_NONBLOCK);
+	long arg = fcntl(sockfd, F_GETFL, NULL);
+	fcntl(sockfd, F_SETFL, arg | O_NONBLOCK);
 #endif
 
-		if(connect(sockfd, (const struct sockaddr *)&addr, sizeof(struct sockaddr)) < 0) {
+	if(connect(sockfd, (const struct sockaddr *)&addr, sizeof(struct sockaddr)) < 0) {
 #ifdef _WIN32
-			if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
+		if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
 #else
-			if(!(errno == EINPROGRESS || errno == EISCONN)) {
+		if(!(errno == EINPROGRESS || errno == EISCONN)) {
 #endif
-				/*LCOV_EXCL_START*/
-				logprintf(LOG_ERR, "connect: %s", strerror(errno));
-				goto freeuv;
-				/*LCOV_EXCL_STOP*/
-			}
-		}
-
-		uv_poll_t *poll_req = NULL;
-		if((poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		uv_custom_poll_init(&custom_poll_data, poll_req, (void *)request);
-		custom_poll_data->is_ssl = request->is_ssl;
-		custom_poll_data->write_cb = write_cb;
-		custom_poll_data->read_cb = read_cb;
-		custom_poll_data->close_cb = poll_close_cb;
-
-		r = uv_poll_init_socket(uv_default_loop(), poll_req, sockfd);
-		if(r != 0) {
 			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
-			FREE(poll_req);
+			logprintf(LOG_ERR, "connect: %s", strerror(errno));
 			goto freeuv;
 			/*LCOV_EXCL_STOP*/
 		}
+	}
 
-		http_client_add(poll_req, custom_poll_data);
-		request->steps = STEP_WRITE;
-		uv_custom_write(poll_req);		
+	uv_poll_t *poll_req = NULL;
+	if((poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_custom_poll_init(&custom_poll_data, poll_req, (void *)request);
+	custom_poll_data->is_ssl = request->is_ssl;
+	if(request->is_ssl == 1 && pool_timer != NULL) {
+		custom_poll_data->ssl.session = http_session_get(request);
+	}
+	custom_poll_data->write_cb = write_cb;
+	custom_poll_data->read_cb = read_cb;
+	custom_poll_data->close_cb = poll_close_cb;
+
+	r = uv_poll_init_socket(uv_default_loop(), poll_req, sockfd);
+	if(r != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
+		FREE(poll_req);
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
 	}
 
-	return NULL;
+	http_client_add(poll_req, custom_poll_data);
+	request->steps = STEP_WRITE;
+	uv_custom_write(poll_req);
+	return;
 
 freeuv:
-	FREE(request->uri);
-	FREE(request->host);
-	FREE(request);
+	free_request(request);
 
 	if(sockfd > 0) {
 #ifdef _WIN32
@@ -749,13 +1289,238 @@ freeuv:
 		close(sockfd);
 #endif
 	}
+}
+
+static void getaddrinfo_cb(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct request_t *request = req->data;
+	struct addrinfo *p = NULL;
+	char ip[INET_ADDRSTRLEN+1];
+
+	memset(ip, '\0', INET_ADDRSTRLEN+1);
+	if(status == 0) {
+		for(p=res;p!=NULL;p=p->ai_next) {
+			if(p->ai_family == AF_INET) {
+				uv_ip4_name((struct sockaddr_in *)p->ai_addr, ip, INET_ADDRSTRLEN+1);
+				break;
+			}
+		}
+	}
+	uv_freeaddrinfo(res);
+	FREE(req);
+
+	if(strlen(ip) == 0) {
+		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", request->host, (status == 0) ? "no ipv4 address" : uv_strerror(status));
+		dns_cache_set(request->host, NULL);
+		free_request(request);
+		return;
+	}
+
+	dns_cache_set(request->host, ip);
+	http_connect(request, ip);
+}
+
+static void http_resolve(struct request_t *request) {
+	struct http_cache_t *entry = NULL;
+	struct addrinfo hints;
+	struct in_addr inaddr;
+	uv_getaddrinfo_t *req = NULL;
+	uv_poll_t *poll_req = NULL;
+	char ip[INET_ADDRSTRLEN+1];
+	int r = 0;
+
+	if(request->cache == 1 && (entry = http_cache_find(request->url)) != NULL &&
+	   entry->expires > uv_hrtime()/1000000000) {
+		entry->used = uv_hrtime();
+		if(request->callback != NULL) {
+			request->callback(200, entry->content, entry->size, entry->mimetype, request->userdata);
+		}
+		free_request(request);
+		return;
+	}
+
+	if(request->keepalive == 1 && (poll_req = http_pool_get(request)) != NULL) {
+		struct uv_custom_poll_t *custom_poll_data = poll_req->data;
+		custom_poll_data->data = request;
+		request->reused = 1;
+		request->steps = STEP_WRITE;
+		uv_custom_write(poll_req);
+		return;
+	}
+
+	if(uv_inet_pton(AF_INET, request->host, &inaddr) == 0) {
+		http_connect(request, request->host);
+		return;
+	}
+
+	switch(dns_cache_get(request->host, ip)) {
+		case 1:
+			http_connect(request, ip);
+			return;
+		case 0:
+			logprintf(LOG_NOTICE, "getaddrinfo: %s, failed recently", request->host);
+			free_request(request);
+			return;
+	}
+
+	/*
+	 * Without http_init there is no way to get the
+	 * request to the main loop, so resolve it here.
+	 */
+	if(async_req == NULL) {
+		if(host2ip(request->host, ip) != 0) {
+			logprintf(LOG_ERR, "host2ip");
+			dns_cache_set(request->host, NULL);
+			free_request(request);
+			return;
+		}
+		dns_cache_set(request->host, ip);
+		http_connect(request, ip);
+		return;
+	}
+
+	if((req = MALLOC(sizeof(uv_getaddrinfo_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	req->data = request;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if((r = uv_getaddrinfo(uv_default_loop(), req, getaddrinfo_cb, request->host, NULL, &hints)) != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_getaddrinfo: %s", uv_strerror(r));
+		FREE(req);
+		free_request(request);
+		/*LCOV_EXCL_STOP*/
+	}
+}
+
+static void http_async(uv_async_t *handle) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct request_t *request = NULL, *next = NULL, *queue = NULL;
+
+	uv_mutex_lock(&dns_lock);
+	request = pending;
+	pending = NULL;
+	uv_mutex_unlock(&dns_lock);
+
+	/* Restore the order in which the requests were made */
+	while(request != NULL) {
+		next = request->next;
+		request->next = queue;
+		queue = request;
+		request = next;
+	}
+
+	while(queue != NULL) {
+		next = queue->next;
+		queue->next = NULL;
+		http_resolve(queue);
+		queue = next;
+	}
+}
+
+int http_init(void) {
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "http_init can only be called from the main thread");
+		return -1;
+		/*LCOV_EXCL_STOP*/
+	}
+
+	http_lock_initialize();
+
+	if(async_req == NULL) {
+		if((async_req = MALLOC(sizeof(uv_async_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		uv_async_init(uv_default_loop(), async_req, http_async);
+	}
+
+	if(pool_timer == NULL) {
+		if((pool_timer = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		uv_timer_init(uv_default_loop(), pool_timer);
+	}
+
+	return 0;
+}
+
+char *http_process(int type, int cache, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+	struct request_t *request = NULL;
+
+	http_lock_initialize();
+
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "WSAStartup");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
+		/*
+		 * Connections are only kept and responses only
+		 * cached when the main loop handles our requests.
+		 */
+		request->keepalive = (pool_timer != NULL);
+		if(cache == 1 && async_req != NULL) {
+			request->cache = 1;
+			request->maxage = -1;
+			if((request->url = STRDUP(url)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		}
+
+		/*
+		 * Resolving and connecting is done from the main
+		 * loop, so a slow resolver never blocks the caller
+		 * and libuv is only used from its own thread.
+		 */
+		const uv_thread_t pth_cur_id = uv_thread_self();
+		if(async_req != NULL && uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+			uv_mutex_lock(&dns_lock);
+			request->next = pending;
+			pending = request;
+			uv_mutex_unlock(&dns_lock);
+			uv_async_send(async_req);
+		} else {
+			http_resolve(request);
+		}
+	}
+
 	return NULL;
 }
 
 char *http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata) {
-	return http_process(HTTP_GET, url, NULL, NULL, callback, userdata);
+	return http_process(HTTP_GET, 0, url, NULL, NULL, callback, userdata);
+}
+
+/*
+ * Like http_get_content, but the response may be served from
+ * or revalidated against the cache. A 304 Not Modified is
+ * passed on as a 200 with the cached content.
+ */
+char *http_get_content_cached(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+	return http_process(HTTP_GET, 1, url, NULL, NULL, callback, userdata);
 }
 
 char *http_post_content(char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
-	return http_process(HTTP_POST, url, conttype, post, callback, userdata);
+	return http_process(HTTP_POST, 0, url, conttype, post, callback, userdata);
 }
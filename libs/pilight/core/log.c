@@ -449,6 +449,10 @@ int log_level_get(void) {
 	return loglevel;
 }
 
+int log_queue_size(void) {
+	return (int)logqueue_number;
+}
+
 void logerror(const char *format_str, ...) {
 	char line[1024];
 	va_list ap;
@@ -45,6 +45,7 @@ void log_shell_disable(void);
 int log_file_set(char *file);
 void log_level_set(int level);
 int log_level_get(void);
+int log_queue_size(void);
 int log_gc(void);
 void logerror(const char *format_str, ...);
 
@@ -0,0 +1,266 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+#include "../../libuv/uv.h"
+#include "../protocols/protocol.h"
+#include "../config/hardware.h"
+#ifdef EVENTS
+	#include "../config/rules.h"
+	#include "../events/events.h"
+#endif
+#include "eventpool.h"
+#include "metrics.h"
+#include "mem.h"
+#include "log.h"
+
+typedef struct metrics_gauge_t {
+	char *name;
+	char *help;
+	int (*value)(void);
+	struct metrics_gauge_t *next;
+} metrics_gauge_t;
+
+typedef struct metrics_buf_t {
+	char *buf;
+	size_t len;
+	size_t size;
+} metrics_buf_t;
+
+static struct metrics_gauge_t *gauges = NULL;
+static struct metrics_histogram_t eventpool[REASON_END];
+static const unsigned long bounds[METRICS_BUCKETS] = METRICS_BOUNDS;
+
+/* Indexed by hwtype+1 */
+#define METRICS_HWTYPES (API+2)
+static const char *hwtypes[METRICS_HWTYPES] = { "internal", "none", "433", "868", "ir", "zwave", "sensor", "relay", "api" };
+static struct metrics_histogram_t sendqueue[METRICS_HWTYPES];
+static unsigned long airtime[METRICS_HWTYPES];
+static unsigned long coalesced = 0;
+
+int metrics_gc(void) {
+	struct metrics_gauge_t *tmp = NULL;
+	while(gauges) {
+		tmp = gauges;
+		gauges = gauges->next;
+		FREE(tmp->name);
+		FREE(tmp->help);
+		FREE(tmp);
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected metrics library");
+	return 0;
+}
+
+/*
+ * Gauges should be registered from the main
+ * thread before the webserver is started.
+ */
+void metrics_gauge(const char *name, const char *help, int (*value)(void)) {
+	struct metrics_gauge_t *node = MALLOC(sizeof(struct metrics_gauge_t));
+	if(node == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->name = STRDUP(name)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->help = STRDUP(help)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->value = value;
+	node->next = gauges;
+	gauges = node;
+}
+
+void metrics_observe(struct metrics_histogram_t *histogram, unsigned long usec) {
+	int i = 0;
+
+	for(i=0;i<METRICS_BUCKETS;i++) {
+		if(usec <= bounds[i]) {
+			break;
+		}
+	}
+	metrics_add(&histogram->buckets[i], 1);
+	metrics_add(&histogram->count, 1);
+	metrics_add(&histogram->sum, usec);
+}
+
+void metrics_eventpool(int reason, unsigned long usec) {
+	if(reason >= 0 && reason < REASON_END) {
+		metrics_observe(&eventpool[reason], usec);
+	}
+}
+
+void metrics_send(int hwtype, unsigned long delay, unsigned long usec) {
+	if(hwtype+1 >= 0 && hwtype+1 < METRICS_HWTYPES) {
+		metrics_observe(&sendqueue[hwtype+1], delay);
+		metrics_add(&airtime[hwtype+1], usec);
+	}
+}
+
+void metrics_send_coalesced(void) {
+	metrics_add(&coalesced, 1);
+}
+
+static void metrics_printf(struct metrics_buf_t *b, const char *format, ...) {
+	va_list ap, apcpy;
+	int n = 0;
+
+	va_start(ap, format);
+	va_copy(apcpy, ap);
+	n = vsnprintf(NULL, 0, format, apcpy);
+	va_end(apcpy);
+
+	if(b->len+n+1 > b->size) {
+		while(b->len+n+1 > b->size) {
+			b->size = (b->size == 0) ? 4096 : b->size*2;
+		}
+		if((b->buf = REALLOC(b->buf, b->size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	vsnprintf(&b->buf[b->len], n+1, format, ap);
+	b->len += n;
+	va_end(ap);
+}
+
+static void metrics_print_histogram(struct metrics_buf_t *b, const char *name, const char *label, const char *value, struct metrics_histogram_t *histogram) {
+	unsigned long total = 0;
+	int i = 0;
+
+	for(i=0;i<METRICS_BUCKETS;i++) {
+		total += metrics_get(&histogram->buckets[i]);
+		metrics_printf(b, "%s_bucket{%s=\"%s\",le=\"%g\"} %lu\n", name, label, value, (double)bounds[i]/1000000.0, total);
+	}
+	total += metrics_get(&histogram->buckets[METRICS_BUCKETS]);
+	metrics_printf(b, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, label, value, total);
+	metrics_printf(b, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value, (double)metrics_get(&histogram->sum)/1000000.0);
+	metrics_printf(b, "%s_count{%s=\"%s\"} %lu\n", name, label, value, metrics_get(&histogram->count));
+}
+
+char *metrics_print(void) {
+	struct metrics_gauge_t *gtmp = gauges;
+	struct protocols_t *ptmp = protocols;
+	struct metrics_buf_t b;
+	unsigned int nrthreads = 0, nridle = 0;
+	uint64_t busy = 0, jobs = 0;
+	int i = 0;
+
+	memset(&b, 0, sizeof(struct metrics_buf_t));
+
+	while(gtmp) {
+		metrics_printf(&b, "# HELP %s %s\n# TYPE %s gauge\n%s %d\n", gtmp->name, gtmp->help, gtmp->name, gtmp->name, gtmp->value());
+		gtmp = gtmp->next;
+	}
+
+	metrics_printf(&b, "# HELP pilight_eventpool_dispatch_seconds Time between triggering an event and its listener being executed\n");
+	metrics_printf(&b, "# TYPE pilight_eventpool_dispatch_seconds histogram\n");
+	for(i=0;i<REASON_END;i++) {
+		if(metrics_get(&eventpool[i].count) > 0) {
+			metrics_print_histogram(&b, "pilight_eventpool_dispatch_seconds", "reason", eventpool_reason(i), &eventpool[i]);
+		}
+	}
+
+	uv_threadpool_stats(&nrthreads, &nridle, &busy, &jobs);
+	metrics_printf(&b, "# HELP pilight_threadpool_threads Number of threadpool workers\n# TYPE pilight_threadpool_threads gauge\n");
+	metrics_printf(&b, "pilight_threadpool_threads %u\n", nrthreads);
+	metrics_printf(&b, "# HELP pilight_threadpool_idle_threads Number of idle threadpool workers\n# TYPE pilight_threadpool_idle_threads gauge\n");
+	metrics_printf(&b, "pilight_threadpool_idle_threads %u\n", nridle);
+	metrics_printf(&b, "# HELP pilight_threadpool_busy_seconds_total Time spent by all workers executing jobs\n# TYPE pilight_threadpool_busy_seconds_total counter\n");
+	metrics_printf(&b, "pilight_threadpool_busy_seconds_total %.6f\n", (double)busy/1000000.0);
+	metrics_printf(&b, "# HELP pilight_threadpool_jobs_total Number of jobs executed by all workers\n# TYPE pilight_threadpool_jobs_total counter\n");
+	metrics_printf(&b, "pilight_threadpool_jobs_total %llu\n", (unsigned long long)jobs);
+
+	/*
+	 * The protocols and hardware are only added before the
+	 * webserver starts and removed after it stopped, so
+	 * those lists can be walked without a lock.
+	 */
+	metrics_printf(&b, "# HELP pilight_protocol_validate_total Number of times a pulse train was validated by a protocol\n# TYPE pilight_protocol_validate_total counter\n");
+	for(ptmp=protocols;ptmp!=NULL;ptmp=ptmp->next) {
+		if(metrics_get(&ptmp->listener->nrvalidate) > 0) {
+			metrics_printf(&b, "pilight_protocol_validate_total{protocol=\"%s\"} %lu\n", ptmp->listener->id, metrics_get(&ptmp->listener->nrvalidate));
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_protocol_validate_seconds_total Time spent validating pulse trains\n# TYPE pilight_protocol_validate_seconds_total counter\n");
+	for(ptmp=protocols;ptmp!=NULL;ptmp=ptmp->next) {
+		if(metrics_get(&ptmp->listener->nrvalidate) > 0) {
+			metrics_printf(&b, "pilight_protocol_validate_seconds_total{protocol=\"%s\"} %.6f\n", ptmp->listener->id, (double)metrics_get(&ptmp->listener->validatetime)/1000000.0);
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_protocol_parse_total Number of pulse trains parsed by a protocol\n# TYPE pilight_protocol_parse_total counter\n");
+	for(ptmp=protocols;ptmp!=NULL;ptmp=ptmp->next) {
+		if(metrics_get(&ptmp->listener->nrparse) > 0) {
+			metrics_printf(&b, "pilight_protocol_parse_total{protocol=\"%s\"} %lu\n", ptmp->listener->id, metrics_get(&ptmp->listener->nrparse));
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_protocol_parse_seconds_total Time spent parsing pulse trains\n# TYPE pilight_protocol_parse_seconds_total counter\n");
+	for(ptmp=protocols;ptmp!=NULL;ptmp=ptmp->next) {
+		if(metrics_get(&ptmp->listener->nrparse) > 0) {
+			metrics_printf(&b, "pilight_protocol_parse_seconds_total{protocol=\"%s\"} %.6f\n", ptmp->listener->id, (double)metrics_get(&ptmp->listener->parsetime)/1000000.0);
+		}
+	}
+
+	metrics_printf(&b, "# HELP pilight_send_queue_seconds Time a code waited in the send queue\n# TYPE pilight_send_queue_seconds histogram\n");
+	for(i=0;i<METRICS_HWTYPES;i++) {
+		if(metrics_get(&sendqueue[i].count) > 0) {
+			metrics_print_histogram(&b, "pilight_send_queue_seconds", "hwtype", hwtypes[i], &sendqueue[i]);
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_send_airtime_seconds_total Estimated time spent transmitting codes\n# TYPE pilight_send_airtime_seconds_total counter\n");
+	for(i=0;i<METRICS_HWTYPES;i++) {
+		if(metrics_get(&sendqueue[i].count) > 0) {
+			metrics_printf(&b, "pilight_send_airtime_seconds_total{hwtype=\"%s\"} %.6f\n", hwtypes[i], (double)metrics_get(&airtime[i])/1000000.0);
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_send_coalesced_total Number of queued codes replaced by a newer code for the same device\n# TYPE pilight_send_coalesced_total counter\n");
+	metrics_printf(&b, "pilight_send_coalesced_total %lu\n", metrics_get(&coalesced));
+
+	struct conf_hardware_t *htmp = NULL;
+	metrics_printf(&b, "# HELP pilight_receiver_frames_total Number of pulse trains received by a receiver\n# TYPE pilight_receiver_frames_total counter\n");
+	for(htmp=conf_hardware;htmp!=NULL;htmp=htmp->next) {
+		if(metrics_get(&htmp->hardware->nrframes) > 0) {
+			metrics_printf(&b, "pilight_receiver_frames_total{hardware=\"%s\"} %lu\n", htmp->hardware->id, metrics_get(&htmp->hardware->nrframes));
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_receiver_best_total Number of codes decoded from the copy of a receiver\n# TYPE pilight_receiver_best_total counter\n");
+	for(htmp=conf_hardware;htmp!=NULL;htmp=htmp->next) {
+		if(metrics_get(&htmp->hardware->nrframes) > 0) {
+			metrics_printf(&b, "pilight_receiver_best_total{hardware=\"%s\"} %lu\n", htmp->hardware->id, metrics_get(&htmp->hardware->nrbest));
+		}
+	}
+	metrics_printf(&b, "# HELP pilight_receiver_unique_total Number of codes only picked up by a single receiver\n# TYPE pilight_receiver_unique_total counter\n");
+	for(htmp=conf_hardware;htmp!=NULL;htmp=htmp->next) {
+		if(metrics_get(&htmp->hardware->nrframes) > 0) {
+			metrics_printf(&b, "pilight_receiver_unique_total{hardware=\"%s\"} %lu\n", htmp->hardware->id, metrics_get(&htmp->hardware->nrunique));
+		}
+	}
+
+	/* Rules are only timed where events_loop has a monotonic clock */
+#if defined(EVENTS) && !defined(WIN32)
+	struct rules_t *rtmp = NULL;
+	metrics_printf(&b, "# HELP pilight_rule_evaluation_seconds Time spent evaluating a rule\n# TYPE pilight_rule_evaluation_seconds histogram\n");
+	events_rules_lock();
+	for(rtmp=rules_get();rtmp!=NULL;rtmp=rtmp->next) {
+		if(metrics_get(&rtmp->evaluation.count) > 0) {
+			metrics_print_histogram(&b, "pilight_rule_evaluation_seconds", "rule", rtmp->name, &rtmp->evaluation);
+		}
+	}
+	events_rules_unlock();
+#endif
+
+	return b.buf;
+}
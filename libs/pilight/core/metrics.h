@@ -0,0 +1,46 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/*
+ * Upper bounds in microseconds of the histogram
+ * buckets. An implicit +Inf bucket follows.
+ */
+#define METRICS_BUCKETS	10
+#define METRICS_BOUNDS	{ 10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 1000000 }
+
+/*
+ * All counters are plain unsigned longs updated with
+ * atomic adds, so on 32-bit platforms the time sums
+ * wrap after ~71 minutes of accumulated time. That's
+ * regular counter reset behavior for prometheus.
+ */
+#ifdef _WIN32
+	#define metrics_add(a, b) InterlockedExchangeAdd((LONG *)(a), (LONG)(b))
+#else
+	#define metrics_add(a, b) __sync_add_and_fetch((a), (b))
+#endif
+#define metrics_get(a) (unsigned long)metrics_add((a), 0)
+
+typedef struct metrics_histogram_t {
+	unsigned long buckets[METRICS_BUCKETS+1];
+	unsigned long count;
+	unsigned long sum;
+} metrics_histogram_t;
+
+void metrics_gauge(const char *name, const char *help, int (*value)(void));
+void metrics_observe(struct metrics_histogram_t *histogram, unsigned long usec);
+void metrics_eventpool(int reason, unsigned long usec);
+void metrics_send(int hwtype, unsigned long delay, unsigned long airtime);
+void metrics_send_coalesced(void);
+char *metrics_print(void);
+int metrics_gc(void);
+
+#endif
@@ -89,12 +89,41 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <stdint.h>
 
+#include "../../libuv/uv.h"
+#include "pilight.h"
 #include "common.h"
 #include "network.h"
+#include "ping.h"
 #include "log.h"
 #include "mem.h"
 
+#if defined(__linux__) && !defined(ICMP_FILTER)
+	#define ICMP_FILTER	1
+#endif
+
+/*
+ * A probe without a reply within this
+ * many milliseconds counts as lost.
+ */
+#define PING_TIMEOUT		1000
+
+static struct ping_host_t *hosts = NULL;
+static uv_mutex_t hosts_lock;
+static int hosts_lock_init = 0;
+static uv_timer_t *timer_req = NULL;
+static uv_poll_t *poll_req = NULL;
+static int ping_fd = -1;
+static int ping_raw = 1;
+static unsigned short ping_id = 0;
+static unsigned short ping_seq = 0;
+static int ping_failed = 0;
+
+static int ping_open(void);
+
 #ifdef _WIN32
 	typedef unsigned char u_int8_t;
 	typedef unsigned short u_int16_t;
@@ -102,6 +131,7 @@
 
 	#define ICMP_ECHO		8
 	#define ICMP_ECHOREPLY		0
+	#define ICMP_MINLEN		8
 
 	struct icmp_ra_addr	{
 		u_int32_t ira_addr;
@@ -195,9 +225,9 @@
  *	Checksum routine for Internet Protocol family headers (C Version)
  *      From FreeBSD's ping.c
  */
-static int in_cksum(int *addr, int len) {
+static int in_cksum(unsigned short *addr, int len) {
 	register int nleft = len;
-	register int *w = addr;
+	register unsigned short *w = addr;
 	register int sum = 0;
 	int answer = 0;
 
@@ -303,7 +333,7 @@ int ping(char *addr) {
 	dst.sin_addr.s_addr = inet_addr(addr);
 	dst.sin_port = htons(0);
 	icmp->icmp_cksum = 0;
-	icmp->icmp_cksum = in_cksum((int *)icmp, icmplen);
+	icmp->icmp_cksum = in_cksum((unsigned short *)icmp, icmplen);
 	if(sendto(sockfd, buf, ip->ip_len, 0, (struct sockaddr *)&dst, sizeof(dst)) < 0) {
 		logperror(LOG_DEBUG, "sendto");
 		close(sockfd);
@@ -329,3 +359,332 @@ int ping(char *addr) {
 	close(sockfd);
 	return 0;
 }
+
+static void ping_result(struct ping_host_t *host, int status, uint64_t now) {
+	double rtt = 0.0;
+
+	if(status == 0) {
+		rtt = (double)(now - host->sent)/1000.0;
+		if(host->rtt == 0.0) {
+			host->rtt = rtt;
+		} else {
+			host->rtt = (host->rtt*7.0 + rtt)/8.0;
+		}
+	} else {
+		host->nrlost++;
+	}
+	host->sent = 0;
+
+	if(host->callback != NULL) {
+		host->callback(host, status, host->userdata);
+	}
+}
+
+static void ping_send(struct ping_host_t *host, uint64_t now) {
+	char packet[ICMP_MINLEN+8];
+	struct icmp *icmp = (struct icmp *)packet;
+
+	memset(packet, 0, sizeof(packet));
+	host->seq = ++ping_seq;
+	icmp->icmp_type = ICMP_ECHO;
+	icmp->icmp_code = 0;
+	icmp->icmp_id = htons(ping_id);
+	icmp->icmp_seq = htons(host->seq);
+	icmp->icmp_cksum = in_cksum((unsigned short *)icmp, sizeof(packet));
+
+	if(sendto(ping_fd, packet, sizeof(packet), 0, (struct sockaddr *)&host->addr, sizeof(struct sockaddr_in)) < 0) {
+#ifdef _WIN32
+		if(WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+#endif
+			/* Try again on the next sweep */
+			return;
+		}
+		host->sent = now;
+		host->nrsent++;
+		ping_result(host, -1, now);
+	} else {
+		host->sent = now;
+		host->nrsent++;
+	}
+}
+
+/*
+ * Probes are sent to all hosts that are due at the same
+ * time. The timer is then rearmed for the first probe
+ * to send or to time out.
+ */
+static void ping_sweep(uv_timer_t *req) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct ping_host_t *host = NULL;
+	uint64_t now = uv_hrtime()/1000, wakeup = now + 1000000;
+
+	uv_mutex_lock(&hosts_lock);
+	/*
+	 * Only open the ICMP socket once the first
+	 * host was added, so a daemon without ping
+	 * devices doesn't need the privileges.
+	 */
+	if(hosts != NULL && ping_fd < 0 && ping_failed == 0 && ping_open() != 0) {
+		ping_failed = 1;
+	}
+	for(host=hosts;host!=NULL;host=host->next) {
+		if(host->sent > 0 && now-host->sent >= PING_TIMEOUT*1000) {
+			ping_result(host, -1, now);
+		}
+		if(host->sent == 0 && host->due <= now) {
+			/* Don't try to catch up on missed probes */
+			host->due += (uint64_t)host->interval*1000;
+			if(host->due <= now) {
+				host->due = now + (uint64_t)host->interval*1000;
+			}
+			ping_send(host, now);
+		}
+		if(host->sent > 0 && host->sent+PING_TIMEOUT*1000 < wakeup) {
+			wakeup = host->sent+PING_TIMEOUT*1000;
+		}
+		if(host->sent == 0 && host->due < wakeup) {
+			wakeup = host->due;
+		}
+	}
+	uv_mutex_unlock(&hosts_lock);
+
+	uv_timer_start(req, ping_sweep, (wakeup-now+999)/1000, 0);
+}
+
+static void ping_read(uv_poll_t *req, int status, int events) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct ping_host_t *host = NULL;
+	struct sockaddr_in from;
+	struct icmp *icmp = NULL;
+	char buf[1500];
+	socklen_t fromlen = sizeof(from);
+	unsigned short seq = 0;
+	uint64_t now = 0;
+	int n = 0, hlen = 0;
+
+	if(status < 0) {
+		logprintf(LOG_ERR, "ping_read: %s", uv_strerror(status));
+		return;
+	}
+
+	while((n = (int)recvfrom(ping_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen)) > 0) {
+		now = uv_hrtime()/1000;
+		fromlen = sizeof(from);
+
+		/*
+		 * Raw sockets receive the IP header and all ICMP
+		 * traffic. Datagram sockets only get the replies
+		 * to our own probes, but with a rewritten id.
+		 */
+		if(ping_raw == 1) {
+			hlen = ((struct ip *)buf)->ip_hl << 2;
+		} else {
+			hlen = 0;
+		}
+		if(n < hlen+ICMP_MINLEN) {
+			continue;
+		}
+		icmp = (struct icmp *)&buf[hlen];
+		if(icmp->icmp_type != ICMP_ECHOREPLY || (ping_raw == 1 && ntohs(icmp->icmp_id) != ping_id)) {
+			continue;
+		}
+		seq = ntohs(icmp->icmp_seq);
+
+		uv_mutex_lock(&hosts_lock);
+		for(host=hosts;host!=NULL;host=host->next) {
+			if(host->sent > 0 && host->seq == seq && host->addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+				ping_result(host, 0, now);
+				break;
+			}
+		}
+		uv_mutex_unlock(&hosts_lock);
+	}
+}
+
+static int ping_open(void) {
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "could not initialize new socket");
+		return -1;
+	}
+#endif
+
+	if((ping_fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
+#ifndef _WIN32
+		/*
+		 * Linux allows unprivileged ICMP echo
+		 * sockets when ping_group_range permits.
+		 */
+		if((ping_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)) >= 0) {
+			ping_raw = 0;
+		}
+#endif
+	}
+	if(ping_fd < 0) {
+		logperror(LOG_ERR, "cannot create ICMP socket");
+		return -1;
+	}
+
+	/*
+	 * A sweep of many hosts makes all replies arrive at
+	 * once, so make room for them and keep other ICMP
+	 * traffic out of the receive buffer.
+	 */
+	int size = 256*1024;
+	setsockopt(ping_fd, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+#ifdef __linux__
+	if(ping_raw == 1) {
+		/* struct icmp_filter from linux/icmp.h */
+		uint32_t filter = ~(1U << ICMP_ECHOREPLY);
+		setsockopt(ping_fd, SOL_RAW, ICMP_FILTER, (const char *)&filter, sizeof(filter));
+	}
+#endif
+
+#ifdef _WIN32
+	unsigned long on = 1;
+	ioctlsocket(ping_fd, FIONBIO, &on);
+#else
+	long arg = fcntl(ping_fd, F_GETFL, NULL);
+	fcntl(ping_fd, F_SETFL, arg | O_NONBLOCK);
+#endif
+
+	if((poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_poll_init_socket(uv_default_loop(), poll_req, ping_fd);
+	uv_poll_start(poll_req, UV_READABLE, ping_read);
+
+	return 0;
+}
+
+int ping_init(void) {
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "ping_init can only be called from the main thread");
+		return -1;
+		/*LCOV_EXCL_STOP*/
+	}
+
+	if(hosts_lock_init == 0) {
+		uv_mutex_init(&hosts_lock);
+		hosts_lock_init = 1;
+	}
+	ping_id = (unsigned short)(getpid() & 0xFFFF);
+
+	if((timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_timer_init(uv_default_loop(), timer_req);
+	uv_timer_start(timer_req, ping_sweep, 0, 0);
+
+	return 0;
+}
+
+/*
+ * Hosts can be added from any thread. The callback is
+ * called from the main thread for every reply or lost
+ * probe while the host list is locked, so it must not
+ * add or remove hosts itself.
+ */
+struct ping_host_t *ping_add(char *ip, int interval, void (*callback)(struct ping_host_t *host, int status, void *userdata), void *userdata) {
+	struct ping_host_t *host = NULL;
+
+	if(hosts_lock_init == 0) {
+		logprintf(LOG_ERR, "ping_init should be called before ping_add");
+		return NULL;
+	}
+
+	if((host = MALLOC(sizeof(struct ping_host_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(host, 0, sizeof(struct ping_host_t));
+
+	if(uv_ip4_addr(ip, 0, &host->addr) != 0) {
+		logprintf(LOG_ERR, "invalid ip address: %s", ip);
+		FREE(host);
+		return NULL;
+	}
+	strncpy(host->ip, ip, INET_ADDRSTRLEN);
+	host->interval = (interval > 0) ? interval : 1;
+	host->due = uv_hrtime()/1000;
+	host->callback = callback;
+	host->userdata = userdata;
+
+	uv_mutex_lock(&hosts_lock);
+	host->next = hosts;
+	hosts = host;
+	uv_mutex_unlock(&hosts_lock);
+
+	return host;
+}
+
+void ping_remove(struct ping_host_t *host) {
+	struct ping_host_t *currP, *prevP;
+
+	prevP = NULL;
+
+	uv_mutex_lock(&hosts_lock);
+	for(currP = hosts; currP != NULL; prevP = currP, currP = currP->next) {
+		if(currP == host) {
+			if(prevP == NULL) {
+				hosts = currP->next;
+			} else {
+				prevP->next = currP->next;
+			}
+
+			FREE(currP);
+			break;
+		}
+	}
+	uv_mutex_unlock(&hosts_lock);
+}
+
+int ping_gc(void) {
+	struct ping_host_t *tmp = NULL;
+
+	if(hosts_lock_init == 0) {
+		return 0;
+	}
+
+	uv_mutex_lock(&hosts_lock);
+	while(hosts) {
+		tmp = hosts;
+		hosts = hosts->next;
+		FREE(tmp);
+	}
+	uv_mutex_unlock(&hosts_lock);
+
+	if(timer_req != NULL) {
+		uv_timer_stop(timer_req);
+	}
+	if(poll_req != NULL) {
+		uv_poll_stop(poll_req);
+	}
+	if(ping_fd > -1) {
+#ifdef _WIN32
+		closesocket(ping_fd);
+#else
+		close(ping_fd);
+#endif
+		ping_fd = -1;
+	}
+	ping_failed = 0;
+
+	logprintf(LOG_DEBUG, "garbage collected ping library");
+	return 0;
+}
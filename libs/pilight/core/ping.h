@@ -63,6 +63,40 @@
 #ifndef _LIBPROC_H_
 #define _LIBPROC_H_
 
+#include <stdint.h>
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+#endif
+
+typedef struct ping_host_t {
+	char ip[INET_ADDRSTRLEN+1];
+	struct sockaddr_in addr;
+
+	/* Milliseconds between probes */
+	int interval;
+	uint64_t due;
+	uint64_t sent;
+	unsigned short seq;
+
+	/* Smoothed round trip time in milliseconds */
+	double rtt;
+	unsigned long nrsent;
+	unsigned long nrlost;
+
+	void (*callback)(struct ping_host_t *host, int status, void *userdata);
+	void *userdata;
+
+	struct ping_host_t *next;
+} ping_host_t;
+
 int ping(char *addr);
+int ping_init(void);
+struct ping_host_t *ping_add(char *ip, int interval, void (*callback)(struct ping_host_t *host, int status, void *userdata), void *userdata);
+void ping_remove(struct ping_host_t *host);
+int ping_gc(void);
 
 #endif
@@ -42,6 +42,8 @@
 	#endif
 #else
 	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/un.h>
 	#include <sys/time.h>
 	#include <netinet/in.h>
 	#include <netinet/tcp.h>
@@ -54,6 +56,7 @@
 #include "log.h"
 #include "gc.h"
 #include "socket.h"
+#include "cbor.h"
 #include "../config/settings.h"
 
 static char recvBuff[BUFFER_SIZE];
@@ -62,8 +65,22 @@ static unsigned short socket_loop = 1;
 static unsigned int socket_port = 0;
 static int socket_loopback = 0;
 static int socket_server = 0;
+/* Listener for local clients */
+static int socket_unix = 0;
 static int socket_clients[MAX_CLIENTS];
 
+/*
+ * Data read ahead on the connection of socket_read_cbor, so
+ * small reads don't each need their own select and recv. Only
+ * one connection is buffered, which is all a client needs.
+ */
+static struct {
+	int sockfd;
+	unsigned char buf[BUFFER_SIZE];
+	size_t pos;
+	size_t len;
+} recvahead = { -1, { 0 }, 0, 0 };
+
 int socket_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -85,6 +102,14 @@ int socket_gc(void) {
 		socket_close(socket_loopback);
 	}
 
+#ifndef _WIN32
+	if(socket_unix > 0) {
+		close(socket_unix);
+		unlink(SOCKET_FILE);
+		socket_unix = 0;
+	}
+#endif
+
 	if(waitMessage != NULL) {
 		FREE(waitMessage);
 	}
@@ -93,6 +118,44 @@ int socket_gc(void) {
 	return EXIT_SUCCESS;
 }
 
+#ifndef _WIN32
+/*
+ * Local clients can skip the loopback TCP connection and the
+ * SSDP discovery by connecting to a unix socket with the same
+ * protocol. These clients are checked against the whitelist as
+ * 127.0.0.1. A failure isn't fatal, the TCP socket still works.
+ */
+static void socket_start_unix(const char *path) {
+	struct sockaddr_un address;
+
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		logprintf(LOG_WARNING, "unix socket path %s is too long", path);
+		return;
+	}
+
+	memset(&address, '\0', sizeof(struct sockaddr_un));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	if((socket_unix = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		logprintf(LOG_WARNING, "could not create unix socket");
+		socket_unix = 0;
+		return;
+	}
+
+	/* Remove a stale socket of a previous run */
+	unlink(path);
+	if(bind(socket_unix, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	   chmod(path, 0666) < 0 || listen(socket_unix, 3) < 0) {
+		logprintf(LOG_WARNING, "cannot listen to unix socket %s", path);
+		close(socket_unix);
+		socket_unix = 0;
+		return;
+	}
+	logprintf(LOG_INFO, "daemon listening to unix socket: %s", path);
+}
+#endif
+
 /* Start the socket server */
 int socket_start(unsigned short port) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -167,6 +230,10 @@ int socket_start(unsigned short port) {
 	socket_clients[0] = socket_loopback;
 	logprintf(LOG_INFO, "daemon listening to port: %d", socket_port);
 
+#ifndef _WIN32
+	socket_start_unix(SOCKET_FILE);
+#endif
+
 	return 0;
 }
 
@@ -311,6 +378,36 @@ int socket_connect(char *address, unsigned short port) {
 	}
 }
 
+int socket_connect_unix(const char *path) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+#ifdef _WIN32
+	return -1;
+#else
+	struct sockaddr_un address;
+	int sockfd = 0;
+
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		return -1;
+	}
+
+	memset(&address, '\0', sizeof(struct sockaddr_un));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	if((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	if(connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(sockfd);
+		return -1;
+	}
+	fcntl(sockfd, F_SETFL, O_NONBLOCK);
+
+	return sockfd;
+#endif
+}
+
 void socket_close(int sockfd) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -320,7 +417,11 @@ void socket_close(int sockfd) {
 	char buf[INET_ADDRSTRLEN+1];
 
 	if(sockfd > 0) {
-		if(getpeername(sockfd, (struct sockaddr*)&address, (socklen_t*)&addrlen) == 0) {
+		if(recvahead.sockfd == sockfd) {
+			recvahead.sockfd = -1;
+		}
+		if(getpeername(sockfd, (struct sockaddr*)&address, (socklen_t*)&addrlen) == 0 &&
+		   address.sin_family == AF_INET) {
 			memset(&buf, '\0', INET_ADDRSTRLEN+1);
 			inet_ntop(AF_INET, (void *)&(address.sin_addr), buf, INET_ADDRSTRLEN+1);
 			logprintf(LOG_DEBUG, "client disconnected, ip %s, port %d", buf, ntohs(address.sin_port));
@@ -399,6 +500,174 @@ int socket_write(int sockfd, const char *msg, ...) {
 	return n;
 }
 
+int socket_write_cbor(int sockfd, struct JsonNode *json) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned char *data = NULL, *sendBuff = NULL;
+	size_t len = 0, n = 0, ptr = 0;
+	int bytes = 0;
+
+	if(sockfd <= 0 || cbor_encode(json, &data, &len) != 0) {
+		return -1;
+	}
+
+	n = len+SOCKET_CBOR_HEADER;
+	if((sendBuff = MALLOC(n)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memcpy(sendBuff, SOCKET_CBOR_TAG, 3);
+	sendBuff[3] = (unsigned char)((len >> 24) & 0xff);
+	sendBuff[4] = (unsigned char)((len >> 16) & 0xff);
+	sendBuff[5] = (unsigned char)((len >> 8) & 0xff);
+	sendBuff[6] = (unsigned char)(len & 0xff);
+	memcpy(&sendBuff[SOCKET_CBOR_HEADER], data, len);
+	FREE(data);
+
+	while(ptr < n) {
+		if((bytes = (int)send(sockfd, (char *)&sendBuff[ptr], n-ptr, MSG_NOSIGNAL)) == -1) {
+			logprintf(LOG_DEBUG, "socket write failed");
+			FREE(sendBuff);
+			return -1;
+		}
+		ptr += (size_t)bytes;
+	}
+	FREE(sendBuff);
+
+	return (int)n;
+}
+
+static int socket_recv_all(int sockfd, unsigned char *buf, size_t len, time_t timeout) {
+	struct timeval tv;
+	fd_set fdsread;
+	size_t ptr = 0, x = 0;
+	int n = 0, bytes = 0;
+
+	if(recvahead.sockfd != sockfd) {
+		recvahead.sockfd = sockfd;
+		recvahead.pos = 0;
+		recvahead.len = 0;
+	}
+
+	while(ptr < len) {
+		if(recvahead.pos < recvahead.len) {
+			x = recvahead.len-recvahead.pos;
+			if(x > len-ptr) {
+				x = len-ptr;
+			}
+			memcpy(&buf[ptr], &recvahead.buf[recvahead.pos], x);
+			recvahead.pos += x;
+			ptr += x;
+			continue;
+		}
+		if(socket_loop == 0) {
+			return -1;
+		}
+		FD_ZERO(&fdsread);
+		FD_SET((unsigned long)sockfd, &fdsread);
+		tv.tv_sec = timeout;
+		tv.tv_usec = 0;
+		do {
+			n = select(sockfd+1, &fdsread, NULL, NULL, (timeout > 0) ? &tv : NULL);
+		} while(n == -1 && errno == EINTR && socket_loop);
+		if(n == 0) {
+			return 1;
+		} else if(n == -1) {
+			return -1;
+		}
+		/* Large reads go straight into the destination */
+		if(len-ptr >= BUFFER_SIZE) {
+			if((bytes = (int)recv(sockfd, (char *)&buf[ptr], len-ptr, 0)) <= 0) {
+				return -1;
+			}
+			ptr += (size_t)bytes;
+		} else {
+			if((bytes = (int)recv(sockfd, (char *)recvahead.buf, BUFFER_SIZE, 0)) <= 0) {
+				return -1;
+			}
+			recvahead.pos = 0;
+			recvahead.len = (size_t)bytes;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read a single message from a connection that negotiated binary
+ * frames. Messages that were still sent as JSON are decoded too.
+ */
+int socket_read_cbor(int sockfd, struct JsonNode **json, time_t timeout) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned char header[SOCKET_CBOR_HEADER], *data = NULL;
+	size_t len = 0, size = 0;
+	int r = 0, l = (int)strlen(EOSS);
+
+	*json = NULL;
+
+#ifdef _WIN32
+	unsigned long on = 1;
+	ioctlsocket(sockfd, FIONBIO, &on);
+#else
+	long arg = fcntl(sockfd, F_GETFL, NULL);
+	fcntl(sockfd, F_SETFL, arg | O_NONBLOCK);
+#endif
+
+	if((r = socket_recv_all(sockfd, header, 1, timeout)) != 0) {
+		return r;
+	}
+	if(header[0] == (unsigned char)SOCKET_CBOR_TAG[0]) {
+		if(socket_recv_all(sockfd, &header[1], SOCKET_CBOR_HEADER-1, 0) != 0 ||
+		   memcmp(header, SOCKET_CBOR_TAG, 3) != 0) {
+			return -1;
+		}
+		len = ((size_t)header[3] << 24) | ((size_t)header[4] << 16) | ((size_t)header[5] << 8) | (size_t)header[6];
+		if(len > SOCKET_MESSAGE_MAX) {
+			logprintf(LOG_ERR, "socket message of %lu bytes is too large", (unsigned long)len);
+			return -1;
+		}
+		if((data = MALLOC(len+1)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if(socket_recv_all(sockfd, data, len, 0) != 0) {
+			FREE(data);
+			return -1;
+		}
+		*json = cbor_decode(data, len, NULL);
+	} else {
+		/* A JSON message, read until the delimiter */
+		size = BUFFER_SIZE;
+		if((data = MALLOC(size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		data[len++] = header[0];
+		while(len < (size_t)l || memcmp(&data[len-(size_t)l], EOSS, (size_t)l) != 0) {
+			if(len+1 >= size) {
+				if(size > SOCKET_MESSAGE_MAX) {
+					logprintf(LOG_ERR, "socket message is too large");
+					FREE(data);
+					return -1;
+				}
+				size *= 2;
+				if((data = REALLOC(data, size)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+			}
+			if(socket_recv_all(sockfd, &data[len], 1, 0) != 0) {
+				FREE(data);
+				return -1;
+			}
+			len++;
+		}
+		data[len-(size_t)l] = '\0';
+		if(json_validate((char *)data) == true) {
+			*json = json_decode((char *)data);
+		}
+	}
+	FREE(data);
+
+	return (*json == NULL) ? -1 : 0;
+}
+
 void socket_rm_client(int i, struct socket_callback_t *socket_callback) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -408,10 +677,14 @@ void socket_rm_client(int i, struct socket_callback_t *socket_callback) {
 	char buf[INET_ADDRSTRLEN+1];
 
 	//Somebody disconnected, get his details and print
-	getpeername(sd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
-	memset(&buf, '\0', INET_ADDRSTRLEN+1);
-	inet_ntop(AF_INET, (void *)&(address.sin_addr), buf, INET_ADDRSTRLEN+1);
-	logprintf(LOG_DEBUG, "client disconnected, ip %s, port %d", buf, ntohs(address.sin_port));
+	if(getpeername(sd, (struct sockaddr*)&address, (socklen_t*)&addrlen) == 0 &&
+	   address.sin_family == AF_INET) {
+		memset(&buf, '\0', INET_ADDRSTRLEN+1);
+		inet_ntop(AF_INET, (void *)&(address.sin_addr), buf, INET_ADDRSTRLEN+1);
+		logprintf(LOG_DEBUG, "client disconnected, ip %s, port %d", buf, ntohs(address.sin_port));
+	} else {
+		logprintf(LOG_DEBUG, "local client disconnected");
+	}
 	if(socket_callback->client_disconnected_callback)
 		socket_callback->client_disconnected_callback(i);
 	//Close the socket and mark as 0 in list for reuse
@@ -514,6 +787,45 @@ int socket_read(int sockfd, char **message, time_t timeout) {
 	return -1;
 }
 
+static void socket_add_client(int socket_client, struct socket_callback_t *socket_callback) {
+	int i = 0;
+#ifdef _WIN32
+	unsigned long on = 1;
+#endif
+
+	logprintf(LOG_DEBUG, "client fd: %d", socket_client);
+	//send new connection accept message
+	//socket_write(socket_client, "{\"message\":\"accept connection\"}");
+
+	static struct linger linger = { 0, 0 };
+	socklen_t lsize = sizeof(struct linger);
+	setsockopt(socket_client, SOL_SOCKET, SO_LINGER, (void *)&linger, lsize);
+#ifdef _WIN32
+	int flags = ioctlsocket(socket_client, FIONBIO, &on);
+#else
+	int flags = fcntl(socket_client, F_GETFL, 0);
+#endif
+	if(flags != -1) {
+#ifdef _WIN32
+		ioctlsocket(socket_client, FIONBIO, &on);
+#else
+		fcntl(socket_client, F_SETFL, flags | O_NONBLOCK);
+#endif
+	}
+
+	//add new socket to array of sockets
+	for(i=0;i<MAX_CLIENTS;i++) {
+		//if position is empty
+		if(socket_clients[i] == 0) {
+			socket_clients[i] = socket_client;
+			if(socket_callback->client_connected_callback)
+				socket_callback->client_connected_callback(i);
+			logprintf(LOG_DEBUG, "client id: %d", i);
+			break;
+		}
+	}
+}
+
 void *socket_wait(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -527,9 +839,6 @@ void *socket_wait(void *param) {
 	int socket_client = 0;
 	int addrlen = sizeof(address);
 	fd_set readfds;
-#ifdef _WIN32
-	unsigned long on = 1;
-#endif
 
 	while(socket_loop) {
 		do {
@@ -539,6 +848,14 @@ void *socket_wait(void *param) {
 			//add master socket to set
 			FD_SET((unsigned long)socket_get_fd(), &readfds);
 			max_sd = socket_get_fd();
+#ifndef _WIN32
+			if(socket_unix > 0) {
+				FD_SET((unsigned long)socket_unix, &readfds);
+				if(socket_unix > max_sd) {
+					max_sd = socket_unix;
+				}
+			}
+#endif
 
 			//add child sockets to set
 			for(i=0;i<MAX_CLIENTS;i++) {
@@ -575,39 +892,28 @@ void *socket_wait(void *param) {
 			} else {
 				//inform user of socket number - used in send and receive commands
 				logprintf(LOG_INFO, "new client, ip: %s, port: %d", buf, ntohs(address.sin_port));
-				logprintf(LOG_DEBUG, "client fd: %d", socket_client);
-				//send new connection accept message
-				//socket_write(socket_client, "{\"message\":\"accept connection\"}");
-
-				static struct linger linger = { 0, 0 };
-				socklen_t lsize = sizeof(struct linger);
-				setsockopt(socket_client, SOL_SOCKET, SO_LINGER, (void *)&linger, lsize);
-#ifdef _WIN32
-				int flags = ioctlsocket(socket_client, FIONBIO, &on);
-#else
- 				int flags = fcntl(socket_client, F_GETFL, 0);
-#endif
- 				if(flags != -1) {
-#ifdef _WIN32
-					ioctlsocket(socket_client, FIONBIO, &on);
-#else
- 					fcntl(socket_client, F_SETFL, flags | O_NONBLOCK);
-#endif
-				}
-
-				//add new socket to array of sockets
-				for(i=0;i<MAX_CLIENTS;i++) {
-					//if position is empty
-					if(socket_clients[i] == 0) {
-						socket_clients[i] = socket_client;
-						if(socket_callback->client_connected_callback)
-							socket_callback->client_connected_callback(i);
-						logprintf(LOG_DEBUG, "client id: %d", i);
-						break;
-					}
-				}
+				socket_add_client(socket_client, socket_callback);
+			}
+		}
+#ifndef _WIN32
+		if(socket_unix > 0 && FD_ISSET((unsigned long)socket_unix, &readfds)) {
+			/*
+			 * Local clients get the same access as when
+			 * connecting to the loopback address.
+			 */
+			char localhost[16] = "127.0.0.1";
+			if((socket_client = accept(socket_unix, NULL, NULL)) < 0) {
+				logprintf(LOG_ERR, "failed to accept local client");
+			} else if(whitelist_check(localhost) != 0) {
+				logprintf(LOG_INFO, "rejected local client, ip: %s", localhost);
+				shutdown(socket_client, 2);
+				close(socket_client);
+			} else {
+				logprintf(LOG_INFO, "new local client");
+				socket_add_client(socket_client, socket_callback);
 			}
 		}
+#endif
 
 		//else its some IO operation on some other socket :)
 		for(i=1;i<MAX_CLIENTS;i++) {
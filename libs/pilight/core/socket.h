@@ -21,6 +21,18 @@
 
 #include <time.h>
 
+#include "json.h"
+
+/*
+ * Binary frames start with the CBOR self-describe tag, which
+ * can't start a JSON message, followed by the length of the
+ * CBOR data as 32-bit big endian.
+ */
+#define SOCKET_CBOR_TAG			"\xd9\xd9\xf7"
+#define SOCKET_CBOR_HEADER	7
+/* Largest message socket_read_cbor accepts */
+#define SOCKET_MESSAGE_MAX	(16*1024*1024)
+
 typedef struct socket_callback_t {
     void (*client_connected_callback)(int);
     void (*client_disconnected_callback)(int);
@@ -30,10 +42,13 @@ typedef struct socket_callback_t {
 /* Start the socket server */
 int socket_start(unsigned short port);
 int socket_connect(char *address, unsigned short port);
+int socket_connect_unix(const char *path);
 int socket_timeout_connect(int sockfd, struct sockaddr *serv_addr, int usec);
 void socket_close(int i);
 int socket_write(int sockfd, const char *msg, ...);
 int socket_read(int sockfd, char **out, time_t timeout);
+int socket_write_cbor(int sockfd, struct JsonNode *json);
+int socket_read_cbor(int sockfd, struct JsonNode **json, time_t timeout);
 void *socket_wait(void *param);
 int socket_gc(void);
 unsigned int socket_get_port(void);
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifdef _WIN32
 	#include <winsock2.h>
 	#include <ws2tcpip.h>
@@ -49,6 +50,207 @@
 static int ssdp_socket = 0;
 static int ssdp_loop = 1;
 
+/*
+ * Discovered daemons are cached in a small file, so tools that
+ * are started often don't have to wait for the ssdp responses.
+ * The entries expire with the max-age we announce. A daemon
+ * keeps its own entries fresh, and users of the cache call
+ * ssdp_reseek when they can't connect to an entry.
+ */
+#define SSDP_CACHE_TTL	900
+
+/* Whether the last ssdp_seek was answered from the cache */
+static int ssdp_cached = 0;
+static int ssdp_cache_stale = 0;
+
+/*
+ * Root, and so the daemon, uses the system wide cache. Other
+ * users get their own, so they can always replace it.
+ */
+static int ssdp_cache_file(char *path, size_t len) {
+#ifndef _WIN32
+	char *dir = NULL;
+
+	if(getuid() != 0) {
+		if((dir = getenv("XDG_RUNTIME_DIR")) != NULL && strlen(dir) > 0) {
+			snprintf(path, len, "%s/pilight.ssdp", dir);
+		} else if((dir = getenv("HOME")) != NULL && strlen(dir) > 0) {
+			snprintf(path, len, "%s/.pilight.ssdp", dir);
+		} else {
+			return -1;
+		}
+		return 0;
+	}
+#endif
+	snprintf(path, len, "%s", SSDP_CACHE_FILE);
+	return 0;
+}
+
+static FILE *ssdp_cache_open(const char *path) {
+	FILE *fp = NULL;
+
+	if((fp = fopen(path, "r")) == NULL) {
+		return NULL;
+	}
+#ifndef _WIN32
+	/* Only trust a cache nobody else could have tampered with */
+	struct stat st;
+	if(fstat(fileno(fp), &st) != 0 ||
+	   (st.st_uid != 0 && st.st_uid != getuid()) ||
+	   (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+		fclose(fp);
+		return NULL;
+	}
+#endif
+	return fp;
+}
+
+static int ssdp_list_find(struct ssdp_list_t *ssdp_list, const char *ip, unsigned short port) {
+	while(ssdp_list) {
+		if(ssdp_list->port == port && strcmp(ssdp_list->ip, ip) == 0) {
+			return 0;
+		}
+		ssdp_list = ssdp_list->next;
+	}
+	return -1;
+}
+
+static int ssdp_cache_read(struct ssdp_list_t **ssdp_list) {
+	struct ssdp_list_t *node = NULL, *tail = NULL;
+	char path[255], ip[17];
+	unsigned short port = 0;
+	long expires = 0;
+	time_t now = time(NULL);
+	FILE *fp = NULL;
+
+	if(ssdp_cache_file(path, sizeof(path)) != 0 || (fp = ssdp_cache_open(path)) == NULL) {
+		return -1;
+	}
+	while(fscanf(fp, "%16s %hu %ld\n", ip, &port, &expires) == 3) {
+		if((time_t)expires < now || port == 0) {
+			continue;
+		}
+		if((node = MALLOC(sizeof(struct ssdp_list_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		strcpy(node->ip, ip);
+		node->port = port;
+		node->next = NULL;
+		if(tail == NULL) {
+			*ssdp_list = node;
+		} else {
+			tail->next = node;
+		}
+		tail = node;
+	}
+	fclose(fp);
+
+	return (*ssdp_list == NULL) ? -1 : 0;
+}
+
+/*
+ * Merge the entries to add with the ones still valid in the
+ * cache and leave out the ones to drop. Other entries keep
+ * their own expiry, so another daemon or a client can't
+ * prolong them.
+ */
+static void ssdp_cache_write(struct ssdp_list_t *add, struct ssdp_list_t *drop) {
+	char path[255], tmp[255+16], ip[17];
+	unsigned short port = 0;
+	time_t now = time(NULL);
+	long expires = 0;
+	FILE *fp = NULL, *in = NULL;
+	int fd = 0;
+
+	if(ssdp_cache_file(path, sizeof(path)) != 0) {
+		return;
+	}
+	in = ssdp_cache_open(path);
+	if(in == NULL && add == NULL) {
+		return;
+	}
+
+	/* Write a new file and move it in place, so readers never see half a cache */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	unlink(tmp);
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
+		if(in != NULL) {
+			fclose(in);
+		}
+		return;
+	}
+	if((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		if(in != NULL) {
+			fclose(in);
+		}
+		return;
+	}
+	if(in != NULL) {
+		while(fscanf(in, "%16s %hu %ld\n", ip, &port, &expires) == 3) {
+			if((time_t)expires < now || port == 0 ||
+			   ssdp_list_find(add, ip, port) == 0 || ssdp_list_find(drop, ip, port) == 0) {
+				continue;
+			}
+			fprintf(fp, "%s %hu %ld\n", ip, port, expires);
+		}
+		fclose(in);
+	}
+	while(add) {
+		fprintf(fp, "%s %hu %ld\n", add->ip, add->port, (long)(now+SSDP_CACHE_TTL));
+		add = add->next;
+	}
+	fclose(fp);
+#ifdef _WIN32
+	unlink(path);
+#endif
+	if(rename(tmp, path) != 0) {
+		unlink(tmp);
+	}
+}
+
+void ssdp_cache_invalidate(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	char path[255];
+
+	ssdp_cache_stale = 1;
+	if(ssdp_cache_file(path, sizeof(path)) == 0) {
+		unlink(path);
+	}
+}
+
+/*
+ * Drop the first daemon of the list from the cache after
+ * it couldn't be reached. When the list came from the cache,
+ * a new search is done right away.
+ */
+int ssdp_reseek(struct ssdp_list_t **ssdp_list) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct ssdp_list_t failed;
+
+	if(*ssdp_list == NULL) {
+		return -1;
+	}
+	memcpy(&failed, *ssdp_list, sizeof(struct ssdp_list_t));
+	failed.next = NULL;
+
+	ssdp_cache_write(NULL, &failed);
+	ssdp_cache_stale = 1;
+
+	if(ssdp_cached == 0) {
+		return -1;
+	}
+	logprintf(LOG_DEBUG, "cached pilight daemon %s:%hu is gone, searching again", failed.ip, failed.port);
+
+	ssdp_free(*ssdp_list);
+	*ssdp_list = NULL;
+
+	return ssdp_seek(ssdp_list);
+}
+
 int ssdp_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -139,6 +341,13 @@ int ssdp_seek(struct ssdp_list_t **ssdp_list) {
 	socklen_t addrlen = sizeof(addr);
 	unsigned short int nip[4], port = 0;
 
+	if(ssdp_cache_stale == 0 && ssdp_cache_read(ssdp_list) == 0) {
+		logprintf(LOG_DEBUG, "ssdp using cached daemon %s:%hu", (*ssdp_list)->ip, (*ssdp_list)->port);
+		ssdp_cached = 1;
+		return 0;
+	}
+	ssdp_cached = 0;
+
 #ifndef _WIN32
 	struct timeval tv;
 	tv.tv_sec = 0;
@@ -232,6 +441,8 @@ end:
 			FREE(next);
 		}
 		*ssdp_list = prev;
+		ssdp_cache_write(*ssdp_list, NULL);
+		ssdp_cache_stale = 0;
 
 		return 0;
 	} else {
@@ -258,9 +469,11 @@ void *ssdp_wait(void *param) {
 
 	struct timeval tv;
 	struct sockaddr_in addr;
+	struct ssdp_list_t *own = NULL, *node = NULL;
 	char **devs = NULL, message[BUFFER_SIZE], **header = NULL, *id = NULL;
 	char host[INET_ADDRSTRLEN+1], *p = host, *distro = distroname(), *hname = hostname();
 	int nrdevs = 0, nrheader = 0, x = 0, n = 0;
+	time_t refreshed = 0;
 	ssize_t len = 0;
 	socklen_t addrlen = sizeof(addr);
 	fd_set fdsread;
@@ -295,6 +508,15 @@ void *ssdp_wait(void *param) {
 					"NTS:ssdp:alive\r\n"
 					"SERVER: %s UPnP/1.1 pilight (%s)/%s\r\n\r\n", host, socket_get_port(), id, distro, hname, PILIGHT_VERSION);
 				nrheader++;
+
+				if((node = MALLOC(sizeof(struct ssdp_list_t))) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				memset(node, 0, sizeof(struct ssdp_list_t));
+				strncpy(node->ip, host, sizeof(node->ip)-1);
+				node->port = (unsigned short)socket_get_port();
+				node->next = own;
+				own = node;
 			}
 		}
 	} else {
@@ -318,6 +540,12 @@ void *ssdp_wait(void *param) {
 #endif
 
 	while(ssdp_loop) {
+		/* Keep our own entries in the discovery cache from expiring */
+		if(own != NULL && time(NULL)-refreshed >= SSDP_CACHE_TTL/2) {
+			ssdp_cache_write(own, NULL);
+			refreshed = time(NULL);
+		}
+
 		FD_ZERO(&fdsread);
 		FD_SET((unsigned long)ssdp_socket, &fdsread);
 
@@ -363,6 +591,10 @@ clear:
 	}
 
 	FREE(header);
+	if(own != NULL) {
+		ssdp_cache_write(NULL, own);
+		ssdp_free(own);
+	}
 	return 0;
 }
 
@@ -33,6 +33,8 @@ int ssdp_gc(void);
 int ssdp_start(void);
 int ssdp_seek(struct ssdp_list_t **ssdp_list);
 void ssdp_free(struct ssdp_list_t *ssdp_list);
+void ssdp_cache_invalidate(void);
+int ssdp_reseek(struct ssdp_list_t **ssdp_list);
 void *ssdp_wait(void* param);
 void ssdp_close(int ssdp_socket);
 
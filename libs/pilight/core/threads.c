@@ -27,6 +27,7 @@
 	#endif
 #endif
 #include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include "threads.h"
@@ -125,6 +126,41 @@ void threads_create(pthread_t *thread, const pthread_attr_t *attr,  void *(*star
 #endif
 }
 
+/*
+ * Timed waits on a condition initialized here use the
+ * monotonic clock, so a step of the wall clock doesn't
+ * shorten or stretch them. Build the deadline with
+ * threads_cond_timeout.
+ */
+void threads_cond_init(pthread_cond_t *cond) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+#ifndef _WIN32
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void threads_cond_timeout(struct timespec *ts, unsigned long ms) {
+#ifdef _WIN32
+	struct timeval tp;
+
+	gettimeofday(&tp, NULL);
+	ts->tv_sec = tp.tv_sec;
+	ts->tv_nsec = tp.tv_usec * 1000;
+#else
+	clock_gettime(CLOCK_MONOTONIC, ts);
+#endif
+	ts->tv_sec += (time_t)(ms / 1000);
+	ts->tv_nsec += (long)((ms % 1000) * 1000000);
+	if(ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
 void thread_signal(char *id, int s) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
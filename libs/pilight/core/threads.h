@@ -23,6 +23,7 @@
 	#include "windows.h"
 #endif
 #include <pthread.h>
+#include <time.h>
 #include "proc.h"
 
 struct threadqueue_t {
@@ -42,6 +43,8 @@ struct threadqueue_t {
 
 struct threadqueue_t *threads_register(const char *id, void *(*function)(void* param), void *param, int force);
 void threads_create(pthread_t *pth, const pthread_attr_t *attr,  void *(*start_routine) (void *), void *arg);
+void threads_cond_init(pthread_cond_t *cond);
+void threads_cond_timeout(struct timespec *ts, unsigned long ms);
 void threads_start(void);
 void thread_stop(char *id);
 void threads_cpu_usage(int print);
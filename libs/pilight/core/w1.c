@@ -0,0 +1,348 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "threads.h"
+#include "mem.h"
+#include "log.h"
+#include "w1.h"
+
+#define W1_MASTER	"w1_bus_master"
+
+static void *w1_sensor_read(void *param);
+
+static unsigned long long w1_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000 + (unsigned long long)(ts.tv_nsec/1000000);
+}
+
+/*
+ * A bus is shared by all devices of a protocol, so
+ * sensors of different devices are read in the same
+ * pass. The callback is called with the userdata of
+ * the device the sensor was added for.
+ */
+struct w1_bus_t *w1_bus_init(const char *root, const char *family, void (*callback)(struct w1_sensor_t *sensor, void *userdata)) {
+	struct w1_bus_t *bus = MALLOC(sizeof(struct w1_bus_t));
+	if(bus == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(bus, 0, sizeof(struct w1_bus_t));
+
+	if((bus->root = STRDUP(root)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((bus->family = STRDUP(family)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	bus->rescan = 1;
+	bus->loop = 1;
+	bus->callback = callback;
+	pthread_mutex_init(&bus->lock, NULL);
+	pthread_cond_init(&bus->signal, NULL);
+	pthread_cond_init(&bus->done, NULL);
+
+	return bus;
+}
+
+/*
+ * Every sensor gets a reader thread that lives as long
+ * as the bus. Reads are aligned to a multiple of their
+ * interval, so sensors sharing an interval are read in
+ * the same pass.
+ */
+void w1_bus_add(struct w1_bus_t *bus, const char *id, int interval, void *userdata) {
+	struct w1_sensor_t *sensor = MALLOC(sizeof(struct w1_sensor_t));
+	unsigned long long now = w1_now();
+
+	if(sensor == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(sensor, 0, sizeof(struct w1_sensor_t));
+
+	if((sensor->id = STRDUP(id)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	sensor->interval = (interval > 0) ? (unsigned int)interval : 1;
+	sensor->due = now - (now % (sensor->interval*1000ULL)) + sensor->interval*1000ULL;
+	sensor->userdata = userdata;
+	sensor->bus = bus;
+
+	pthread_mutex_lock(&bus->lock);
+	sensor->next = bus->sensors;
+	bus->sensors = sensor;
+	bus->rescan = 1;
+	threads_create(&sensor->pth, NULL, w1_sensor_read, (void *)sensor);
+	pthread_mutex_unlock(&bus->lock);
+}
+
+static char *w1_path(struct w1_bus_t *bus, const char *dir, const char *file) {
+	char *path = MALLOC(strlen(bus->root)+strlen(dir)+strlen(file)+2);
+	if(path == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	sprintf(path, "%s%s/%s", bus->root, dir, file);
+	return path;
+}
+
+/*
+ * Concatenate the slave lists of all bus masters. The kernel
+ * updates these when it detects sensors being added or removed,
+ * so they tell us when the resolved sensor paths went stale.
+ */
+static char *w1_bus_slaves(struct w1_bus_t *bus) {
+	struct dirent *file = NULL;
+	DIR *d = NULL;
+	char *slaves = NULL, *path = NULL, buf[BUFSIZ];
+	size_t len = 0;
+	ssize_t n = 0;
+	int fd = 0;
+
+	if((d = opendir(bus->root)) == NULL) {
+		return NULL;
+	}
+	while((file = readdir(d)) != NULL) {
+		if(strncmp(file->d_name, W1_MASTER, strlen(W1_MASTER)) != 0) {
+			continue;
+		}
+		path = w1_path(bus, file->d_name, "w1_master_slaves");
+		if((fd = open(path, O_RDONLY)) >= 0) {
+			while((n = read(fd, buf, sizeof(buf))) > 0) {
+				if((slaves = REALLOC(slaves, len+(size_t)n+1)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				memcpy(&slaves[len], buf, (size_t)n);
+				len += (size_t)n;
+				slaves[len] = '\0';
+			}
+			close(fd);
+			if(slaves == NULL && (slaves = STRDUP("")) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		}
+		FREE(path);
+	}
+	closedir(d);
+
+	return slaves;
+}
+
+/*
+ * Must be called with the bus lock held
+ */
+static void w1_bus_scan(struct w1_bus_t *bus) {
+	struct w1_sensor_t *sensor = NULL;
+	char *slaves = w1_bus_slaves(bus), *dir = NULL;
+	int missing = 0;
+
+	if(bus->rescan == 0 && slaves != NULL && bus->slaves != NULL && strcmp(slaves, bus->slaves) == 0) {
+		FREE(slaves);
+		return;
+	}
+
+	for(sensor=bus->sensors;sensor!=NULL;sensor=sensor->next) {
+		if(sensor->path != NULL) {
+			FREE(sensor->path);
+		}
+		if((dir = MALLOC(strlen(bus->family)+strlen(sensor->id)+2)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		sprintf(dir, "%s-%s", bus->family, sensor->id);
+		sensor->path = w1_path(bus, dir, "w1_slave");
+		FREE(dir);
+
+		if(access(sensor->path, R_OK) != 0) {
+			logprintf(LOG_ERR, "1-wire device %s does not exist", sensor->path);
+			FREE(sensor->path);
+			missing = 1;
+		}
+	}
+
+	/*
+	 * Without a slave list we can't tell when a missing
+	 * sensor shows up, so keep looking for it.
+	 */
+	bus->rescan = (slaves == NULL && missing == 1);
+
+	if(bus->slaves != NULL) {
+		FREE(bus->slaves);
+	}
+	bus->slaves = slaves;
+}
+
+/*
+ * Newer kernels let us start the temperature conversion
+ * of all sensors on a bus master at once. The reads that
+ * follow then don't have to wait for their own conversion.
+ */
+static void w1_bus_convert(struct w1_bus_t *bus) {
+	struct dirent *file = NULL;
+	DIR *d = NULL;
+	char *path = NULL;
+	int fd = 0;
+
+	if((d = opendir(bus->root)) == NULL) {
+		return;
+	}
+	while((file = readdir(d)) != NULL) {
+		if(strncmp(file->d_name, W1_MASTER, strlen(W1_MASTER)) != 0) {
+			continue;
+		}
+		path = w1_path(bus, file->d_name, "therm_bulk_read");
+		if((fd = open(path, O_WRONLY)) >= 0) {
+			if(write(fd, "trigger\n", 8) != 8) {
+				logprintf(LOG_DEBUG, "could not trigger 1-wire bulk conversion: %s", path);
+			}
+			close(fd);
+		}
+		FREE(path);
+	}
+	closedir(d);
+}
+
+static void *w1_sensor_read(void *param) {
+	struct w1_sensor_t *sensor = param;
+	struct w1_bus_t *bus = sensor->bus;
+	char buf[256], *p = NULL;
+	ssize_t n = 0;
+	int fd = 0, rescan = 0;
+
+	pthread_mutex_lock(&bus->lock);
+	while(bus->loop == 1) {
+		if(sensor->read == 0) {
+			pthread_cond_wait(&bus->signal, &bus->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&bus->lock);
+
+		sensor->valid = 0;
+		rescan = 0;
+
+		if((fd = open(sensor->path, O_RDONLY)) < 0) {
+			logprintf(LOG_ERR, "cannot read w1 file: %s", sensor->path);
+			rescan = 1;
+			n = 0;
+		} else {
+			n = read(fd, buf, sizeof(buf)-1);
+			close(fd);
+		}
+
+		/*
+		 * 72 01 4b 46 7f ff 0e 10 57 : crc=57 YES
+		 * 72 01 4b 46 7f ff 0e 10 57 t=23125
+		 */
+		if(n > 0) {
+			buf[n] = '\0';
+			if((p = strchr(buf, '\n')) != NULL) {
+				*p = '\0';
+				if(strstr(buf, "YES") != NULL && (p = strstr(p+1, "t=")) != NULL) {
+					sensor->temperature = strtod(p+2, NULL)/1000;
+					sensor->valid = 1;
+				}
+			}
+		}
+
+		if(sensor->valid == 1 && bus->callback != NULL) {
+			bus->callback(sensor, sensor->userdata);
+		}
+
+		pthread_mutex_lock(&bus->lock);
+		if(rescan == 1) {
+			bus->rescan = 1;
+		}
+		sensor->read = 0;
+		bus->pending--;
+		pthread_cond_signal(&bus->done);
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	return NULL;
+}
+
+/*
+ * Each sensor read blocks for the duration of its
+ * conversion, so all sensors that are due are read
+ * concurrently by their reader threads. The callback
+ * is called from the reading thread as soon as a
+ * sensor returned a valid value. Returns when all
+ * reads finished.
+ */
+void w1_bus_read(struct w1_bus_t *bus) {
+	struct w1_sensor_t *sensor = NULL;
+	unsigned long long now = w1_now();
+	int nr = 0;
+
+	pthread_mutex_lock(&bus->lock);
+	for(sensor=bus->sensors;sensor!=NULL;sensor=sensor->next) {
+		if(sensor->due <= now) {
+			nr++;
+		}
+	}
+	if(nr == 0) {
+		pthread_mutex_unlock(&bus->lock);
+		return;
+	}
+
+	w1_bus_scan(bus);
+	w1_bus_convert(bus);
+
+	for(sensor=bus->sensors;sensor!=NULL;sensor=sensor->next) {
+		if(sensor->due > now) {
+			continue;
+		}
+		/* Don't try to catch up on missed reads */
+		sensor->due = now - (now % (sensor->interval*1000ULL)) + sensor->interval*1000ULL;
+		if(sensor->path != NULL) {
+			sensor->read = 1;
+			bus->pending++;
+		}
+	}
+	pthread_cond_broadcast(&bus->signal);
+	while(bus->pending > 0) {
+		pthread_cond_wait(&bus->done, &bus->lock);
+	}
+	pthread_mutex_unlock(&bus->lock);
+}
+
+void w1_bus_free(struct w1_bus_t *bus) {
+	struct w1_sensor_t *sensor = NULL;
+
+	pthread_mutex_lock(&bus->lock);
+	bus->loop = 0;
+	pthread_cond_broadcast(&bus->signal);
+	pthread_mutex_unlock(&bus->lock);
+
+	while((sensor = bus->sensors) != NULL) {
+		bus->sensors = sensor->next;
+		pthread_join(sensor->pth, NULL);
+		FREE(sensor->id);
+		if(sensor->path != NULL) {
+			FREE(sensor->path);
+		}
+		FREE(sensor);
+	}
+	if(bus->slaves != NULL) {
+		FREE(bus->slaves);
+	}
+	pthread_mutex_destroy(&bus->lock);
+	pthread_cond_destroy(&bus->signal);
+	pthread_cond_destroy(&bus->done);
+	FREE(bus->root);
+	FREE(bus->family);
+	FREE(bus);
+}
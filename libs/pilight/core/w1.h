@@ -0,0 +1,54 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _W1_H_
+#define _W1_H_
+
+#include <pthread.h>
+
+typedef struct w1_sensor_t {
+	char *id;
+	char *path;
+	int valid;
+	double temperature;
+	void *userdata;
+
+	/* Seconds between reads and next read in ms */
+	unsigned int interval;
+	unsigned long long due;
+
+	int read;
+	pthread_t pth;
+	struct w1_bus_t *bus;
+	struct w1_sensor_t *next;
+} w1_sensor_t;
+
+typedef struct w1_bus_t {
+	char *root;
+	char *family;
+	struct w1_sensor_t *sensors;
+
+	/* Last known list of slaves of all bus masters */
+	char *slaves;
+	int rescan;
+
+	int loop;
+	int pending;
+	pthread_mutex_t lock;
+	pthread_cond_t signal;
+	pthread_cond_t done;
+
+	void (*callback)(struct w1_sensor_t *sensor, void *userdata);
+} w1_bus_t;
+
+struct w1_bus_t *w1_bus_init(const char *root, const char *family, void (*callback)(struct w1_sensor_t *sensor, void *userdata));
+void w1_bus_add(struct w1_bus_t *bus, const char *id, int interval, void *userdata);
+void w1_bus_read(struct w1_bus_t *bus);
+void w1_bus_free(struct w1_bus_t *bus);
+
+#endif
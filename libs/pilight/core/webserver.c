@@ -61,6 +61,8 @@
 
 #include "eventpool.h"
 #include "sha256cache.h"
+#include "history.h"
+#include "metrics.h"
 #include "pilight.h"
 #include "network.h"
 #include "gc.h"
@@ -659,6 +661,128 @@ clear:
 	return MG_TRUE;
 }
 
+static void history_free(struct connection_t *conn) {
+	if(conn->history != NULL) {
+		if(conn->history->device != NULL) {
+			FREE(conn->history->device);
+		}
+		if(conn->history->name != NULL) {
+			FREE(conn->history->name);
+		}
+		FREE(conn->history);
+	}
+}
+
+/*
+ * Each write callback streams the next
+ * series as a separate chunk so we never
+ * build the complete history in memory.
+ */
+static void history_write(uv_poll_t *req) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct connection_t *conn = custom_poll_data->data;
+	char *out = NULL;
+	int ret = history_next(conn->history, &out);
+
+	if(ret == 1) {
+		if(conn->history->nr == 1) {
+			send_chunked_data(req, "[", 1);
+		} else {
+			write_chunk(req, ",", 1);
+		}
+		write_chunk(req, out, strlen(out));
+		json_free(out);
+		uv_custom_write(req);
+		return;
+	}
+
+	if(ret < 0) {
+		char *z = "{\"message\":\"failed\",\"error\":\"history is disabled\"}";
+		send_data(req, "application/json", z, strlen(z));
+	} else if(conn->history->nr == 0) {
+		send_data(req, "application/json", "[]", 2);
+	} else {
+		write_chunk(req, "]", 1);
+		iobuf_append(&custom_poll_data->send_iobuf, "0\r\n\r\n", 5);
+	}
+	history_free(conn);
+	uv_custom_close(req);
+	uv_custom_write(req);
+}
+
+static int parse_history(uv_poll_t *req) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct connection_t *conn = custom_poll_data->data;
+
+	struct history_query_t *query = NULL;
+	char **array = NULL, **array1 = NULL, *decoded = NULL;
+	int a = 0, b = 0, c = 0;
+
+	if((query = MALLOC(sizeof(struct history_query_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(query, 0, sizeof(struct history_query_t));
+	query->to = time(NULL);
+	query->tier = HISTORY_AUTO;
+
+	if(conn->query_string != NULL) {
+		if((decoded = MALLOC(strlen(conn->query_string)+1)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if(urldecode(conn->query_string, decoded) == -1) {
+			char *z = "{\"message\":\"failed\",\"error\":\"cannot decode url\"}";
+			send_data(req, "application/json", z, strlen(z));
+			FREE(decoded);
+			FREE(query);
+			return MG_TRUE;
+		}
+
+		a = explode(decoded, "&", &array);
+		for(b=0;b<a;b++) {
+			c = explode(array[b], "=", &array1);
+			if(c == 2) {
+				if(strcmp(array1[0], "device") == 0 && query->device == NULL) {
+					query->device = STRDUP(array1[1]);
+				} else if(strcmp(array1[0], "value") == 0 && query->name == NULL) {
+					query->name = STRDUP(array1[1]);
+				} else if(strcmp(array1[0], "from") == 0 && isNumeric(array1[1]) == 0) {
+					query->from = (time_t)atol(array1[1]);
+				} else if(strcmp(array1[0], "to") == 0 && isNumeric(array1[1]) == 0) {
+					query->to = (time_t)atol(array1[1]);
+				} else if(strcmp(array1[0], "tier") == 0) {
+					if(strcmp(array1[1], "raw") == 0) {
+						query->tier = HISTORY_RAW;
+					} else if(strcmp(array1[1], "minute") == 0) {
+						query->tier = HISTORY_MINUTE;
+					} else if(strcmp(array1[1], "hour") == 0) {
+						query->tier = HISTORY_HOUR;
+					}
+				}
+			}
+			array_free(&array1, c);
+		}
+		array_free(&array, a);
+		FREE(decoded);
+	}
+
+	conn->history = query;
+	history_write(req);
+
+	return MG_MORE;
+}
+
 static void close_cb(uv_handle_t *handle) {
 	/*
 	 * Make sure we execute in the main thread
@@ -783,6 +907,13 @@ static int request_handler(uv_poll_t *req) {
 				}
 				jsend = NULL;
 				return MG_TRUE;
+			} else if(strcmp(conn->uri, "/metrics") == 0) {
+				char *output = metrics_print();
+				send_data(req, "text/plain; version=0.0.4", output, strlen(output));
+				FREE(output);
+				return MG_TRUE;
+			} else if(strcmp(conn->uri, "/history") == 0) {
+				return parse_history(req);
 			} else if(strcmp(&conn->uri[(rstrstr(conn->uri, "/")-conn->uri)], "/") == 0) {
 				char indexes[2][11] = {"index.html","index.htm"};
 
@@ -1473,6 +1604,7 @@ static void poll_close_cb(uv_poll_t *req) {
 		if(conn->request != NULL) {
 			FREE(conn->request);
 		}
+		history_free(conn);
 	}
 
 	webserver_client_remove(req);
@@ -1506,6 +1638,8 @@ static void client_write_cb(uv_poll_t *req) {
 		if(file_read_cb(c->file_fd, req) != 0) {
 			uv_custom_close(req);
 		}
+	} else if(c->history != NULL) {
+		history_write(req);
 	}
 }
 
@@ -1660,6 +1794,7 @@ static void server_read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	c->flags = 0;
 	c->ping = 0;
 	c->file_fd = -1;
+	c->history = NULL;
 #ifdef WEBSERVER_HTTPS
 	c->is_ssl = custom_poll_data->is_ssl = server_poll_data->is_ssl;
 	custom_poll_data->is_server = 1;
@@ -41,6 +41,7 @@ typedef struct connection_t {
 	unsigned short timer;
 
 	int file_fd;
+	struct history_query_t *history;
 
 	char buffer[WEBSERVER_CHUNK_SIZE];
 
@@ -31,6 +31,7 @@
 	#include <dlfcn.h>
 #endif
 
+#include "../../libuv/uv.h"
 #include "../core/threads.h"
 #include "../core/pilight.h"
 #include "../core/common.h"
@@ -42,6 +43,31 @@
 #include "action.h"
 #include "actions/action_header.h"
 
+/*
+ * Hierarchical timer wheel with a resolution of one
+ * millisecond. Each level holds 64 slots, so five
+ * levels cover a little over twelve days. Timers
+ * further away are parked in the last level and
+ * cascaded down again until they are due.
+ */
+#define WHEEL_LEVELS	5
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE-1)
+
+static struct event_action_thread_t *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static struct event_action_thread_t *due = NULL;
+static struct event_action_thread_t *executing = NULL;
+static unsigned int pending[WHEEL_LEVELS];
+static unsigned int nrtimers = 0;
+static uint64_t wheel_time = 0;
+static int wheel_loop = 0;
+static int wheel_signal_init = 0;
+static pthread_t wheel_pth;
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wheel_signal;
+static pthread_cond_t wheel_done = PTHREAD_COND_INITIALIZER;
+
 #ifndef _WIN32
 void event_action_remove(char *name) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -168,6 +194,65 @@ void event_action_init(void) {
 #endif
 }
 
+static struct units_t {
+	char name[255];
+	int id;
+} duration_units[] = {
+	{ "MILLISECOND", 	1 },
+	{ "SECOND", 2 },
+	{ "MINUTE", 3 },
+	{ "HOUR", 4 },
+	{ "DAY", 5 }
+};
+
+/*
+ * Convert an argument like FOR 10 SECOND
+ * into milliseconds, or 0 when not given.
+ */
+uint64_t event_action_duration(struct JsonNode *json, const char *name) {
+	struct JsonNode *jduration = NULL;
+	struct JsonNode *jvalues = NULL;
+	struct JsonNode *jseconds = NULL;
+	char **array = NULL;
+	uint64_t msec = 0;
+	int	l = 0, i = 0, nrunits = (sizeof(duration_units)/sizeof(duration_units[0]));
+
+	if((jduration = json_find_member(json, name)) != NULL) {
+		if((jvalues = json_find_member(jduration, "value")) != NULL) {
+			jseconds = json_find_element(jvalues, 0);
+			if(jseconds != NULL && jseconds->tag == JSON_STRING) {
+				l = explode(jseconds->string_, " ", &array);
+				if(l == 2) {
+					for(i=0;i<nrunits;i++) {
+						if(strcmp(array[1], duration_units[i].name) == 0) {
+							msec = (uint64_t)atoi(array[0]);
+							switch(duration_units[i].id) {
+								case 2:
+									msec *= 1000;
+								break;
+								case 3:
+									msec *= 1000*60;
+								break;
+								case 4:
+									msec *= 1000*60*60;
+								break;
+								case 5:
+									msec *= 1000*60*60*24;
+								break;
+							}
+							break;
+						}
+					}
+				}
+				if(l > 0) {
+					array_free(&array, l);
+				}
+			}
+		}
+	}
+	return msec;
+}
+
 void event_action_register(struct event_actions_t **act, const char *name) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -190,10 +275,279 @@ void event_action_register(struct event_actions_t **act, const char *name) {
 	event_actions = (*act);
 }
 
+static uint64_t wheel_now(void) {
+	return uv_hrtime() / 1000000;
+}
+
+static void wheel_link(struct event_action_thread_t **slot, struct event_action_thread_t *node) {
+	node->slot = slot;
+	node->wprev = NULL;
+	node->wnext = *slot;
+	if(*slot != NULL) {
+		(*slot)->wprev = node;
+	}
+	*slot = node;
+}
+
+static void wheel_unlink(struct event_action_thread_t *node) {
+	int level = 0;
+
+	if(node->slot == NULL) {
+		return;
+	}
+	if(node->slot != &due) {
+		level = (int)((node->slot - &wheel[0][0]) / WHEEL_SIZE);
+		pending[level]--;
+		nrtimers--;
+	}
+	if(node->wprev != NULL) {
+		node->wprev->wnext = node->wnext;
+	} else {
+		*node->slot = node->wnext;
+	}
+	if(node->wnext != NULL) {
+		node->wnext->wprev = node->wprev;
+	}
+	node->slot = NULL;
+	node->wnext = NULL;
+	node->wprev = NULL;
+}
+
+static void wheel_insert(struct event_action_thread_t *node) {
+	uint64_t expires = 0, delta = 0;
+	int level = 0;
+
+	if(node->expires < wheel_time) {
+		node->expires = wheel_time;
+	}
+	expires = node->expires;
+	delta = expires - wheel_time;
+
+	for(level=0;level<WHEEL_LEVELS-1;level++) {
+		if(delta < ((uint64_t)1 << (WHEEL_BITS*(level+1)))) {
+			break;
+		}
+	}
+	if(delta >= ((uint64_t)1 << (WHEEL_BITS*WHEEL_LEVELS))) {
+		expires = wheel_time + ((uint64_t)1 << (WHEEL_BITS*WHEEL_LEVELS)) - 1;
+	}
+
+	wheel_link(&wheel[level][(expires >> (WHEEL_BITS*level)) & WHEEL_MASK], node);
+	pending[level]++;
+	nrtimers++;
+}
+
+/*
+ * Redistribute the current slot of a level. Timers
+ * that are due move to the due list, the others end
+ * up in a lower level.
+ */
+static void wheel_cascade(int level) {
+	int index = (int)((wheel_time >> (WHEEL_BITS*level)) & WHEEL_MASK);
+	struct event_action_thread_t *node = wheel[level][index], *next = NULL;
+
+	wheel[level][index] = NULL;
+	while(node) {
+		next = node->wnext;
+		pending[level]--;
+		nrtimers--;
+		node->slot = NULL;
+		if(node->expires <= wheel_time) {
+			wheel_link(&due, node);
+		} else {
+			wheel_insert(node);
+		}
+		node = next;
+	}
+}
+
+/*
+ * The first tick at which something has to happen:
+ * either a timer in the lowest level expires, or a
+ * higher level needs to be cascaded.
+ */
+static uint64_t wheel_next(void) {
+	uint64_t next = UINT64_MAX, mask = 0, boundary = 0;
+	int level = 0, i = 0;
+
+	if(pending[0] > 0) {
+		for(i=0;i<WHEEL_SIZE;i++) {
+			if(wheel[0][(wheel_time+i) & WHEEL_MASK] != NULL) {
+				next = wheel_time+i;
+				break;
+			}
+		}
+	}
+	for(level=1;level<WHEEL_LEVELS;level++) {
+		if(pending[level] > 0) {
+			mask = ((uint64_t)1 << (WHEEL_BITS*level))-1;
+			boundary = (wheel_time + mask) & ~mask;
+			if(boundary < next) {
+				next = boundary;
+			}
+		}
+	}
+	return next;
+}
+
+static void wheel_advance(uint64_t now) {
+	uint64_t next = 0;
+	int level = 0;
+
+	while(wheel_time <= now) {
+		/* Skip all ticks in which nothing happens */
+		if((next = wheel_next()) > wheel_time) {
+			wheel_time = (next > now) ? now+1 : next;
+			continue;
+		}
+		for(level=1;level<WHEEL_LEVELS;level++) {
+			if((wheel_time & (((uint64_t)1 << (WHEEL_BITS*level))-1)) != 0) {
+				break;
+			}
+			wheel_cascade(level);
+		}
+		wheel_cascade(0);
+		wheel_time++;
+	}
+}
+
+/*
+ * Needs to be called with the wheel lock held
+ */
+static void event_action_timer_finish(struct event_action_thread_t *thread) {
+	if(thread->gc != NULL && thread->userdata != NULL) {
+		thread->gc(thread->userdata);
+	}
+	thread->userdata = NULL;
+	thread->gc = NULL;
+	thread->step = NULL;
+	if(thread->running == 1) {
+		logprintf(LOG_INFO, "stopped \"%s\" action for device \"%s\"", thread->action, thread->device->id);
+		thread->running = 0;
+	}
+}
+
+/*
+ * Needs to be called with the wheel lock held
+ */
+static void event_action_timer_schedule(struct event_action_thread_t *thread, void (*step)(struct event_action_thread_t *), uint64_t msec) {
+	uint64_t now = wheel_now();
+
+	if(nrtimers == 0 && wheel_time < now) {
+		wheel_time = now;
+	}
+
+	wheel_unlink(thread);
+	thread->step = step;
+	thread->expires = now + msec;
+	wheel_insert(thread);
+
+	pthread_cond_signal(&wheel_signal);
+}
+
+/*
+ * Needs to be called with the wheel lock held
+ */
+static void event_action_timer_cancel(struct event_action_thread_t *thread) {
+	if(thread->step == NULL) {
+		return;
+	}
+
+	thread->loop = 0;
+	if(executing == thread) {
+		/*
+		 * A step aborting its own action is
+		 * finished by the timer thread itself.
+		 */
+		if(pthread_equal(pthread_self(), wheel_pth) == 0) {
+			while(executing == thread) {
+				pthread_cond_wait(&wheel_done, &wheel_lock);
+			}
+		}
+		return;
+	}
+
+	wheel_unlink(thread);
+	event_action_timer_finish(thread);
+}
+
+static void *event_action_timer_thread(void *param) {
+	struct event_action_thread_t *node = NULL;
+	struct timespec ts;
+	uint64_t now = 0, next = 0;
+
+	pthread_mutex_lock(&wheel_lock);
+	while(wheel_loop == 1) {
+		wheel_advance(wheel_now());
+
+		while((node = due) != NULL) {
+			wheel_unlink(node);
+			executing = node;
+			pthread_mutex_unlock(&wheel_lock);
+
+			node->step(node);
+
+			pthread_mutex_lock(&wheel_lock);
+			executing = NULL;
+			/* A step that didn't schedule a next step ends the action */
+			if(node->slot == NULL || node->loop == 0) {
+				wheel_unlink(node);
+				event_action_timer_finish(node);
+			}
+			pthread_cond_broadcast(&wheel_done);
+		}
+
+		if(wheel_loop == 0) {
+			break;
+		}
+
+		now = wheel_now();
+		if((next = wheel_next()) == UINT64_MAX) {
+			pthread_cond_wait(&wheel_signal, &wheel_lock);
+		} else if(next > now) {
+			threads_cond_timeout(&ts, (unsigned long)(next - now));
+			pthread_cond_timedwait(&wheel_signal, &wheel_lock, &ts);
+		}
+	}
+	pthread_mutex_unlock(&wheel_lock);
+
+	return (void *)NULL;
+}
+
+static void event_action_abort(struct event_action_thread_t *thread) {
+	pthread_mutex_lock(&wheel_lock);
+	event_action_timer_cancel(thread);
+	pthread_mutex_unlock(&wheel_lock);
+
+	if(thread->initialized == 1) {
+		thread->loop = 0;
+
+		pthread_mutex_unlock(&thread->mutex);
+		pthread_cond_signal(&thread->cond);
+
+		while(thread->running > 0) {
+			usleep(10);
+		}
+
+		pthread_join(thread->pth, NULL);
+		thread->initialized = 0;
+	}
+}
+
 int event_action_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct event_actions_t *tmp_action = NULL;
+
+	pthread_mutex_lock(&wheel_lock);
+	if(wheel_loop == 1) {
+		wheel_loop = 0;
+		pthread_cond_signal(&wheel_signal);
+		pthread_mutex_unlock(&wheel_lock);
+		pthread_join(wheel_pth, NULL);
+	} else {
+		pthread_mutex_unlock(&wheel_lock);
+	}
 	while(event_actions) {
 		tmp_action = event_actions;
 		if(tmp_action->nrthreads > 0) {
@@ -223,12 +577,20 @@ void event_action_thread_init(struct devices_t *dev) {
 	pthread_mutexattr_init(&dev->action_thread->attr);
 	pthread_mutexattr_settype(&dev->action_thread->attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&dev->action_thread->mutex, &dev->action_thread->attr);
-	pthread_cond_init(&dev->action_thread->cond, NULL);
+	threads_cond_init(&dev->action_thread->cond);
 	dev->action_thread->running = 0;
 	dev->action_thread->obj = NULL;
 	dev->action_thread->action = NULL;
 	dev->action_thread->loop = 0;
 	dev->action_thread->initialized = 0;
+	dev->action_thread->device = dev;
+	dev->action_thread->expires = 0;
+	dev->action_thread->step = NULL;
+	dev->action_thread->userdata = NULL;
+	dev->action_thread->gc = NULL;
+	dev->action_thread->slot = NULL;
+	dev->action_thread->wnext = NULL;
+	dev->action_thread->wprev = NULL;
 	memset(&dev->action_thread->pth, '\0', sizeof(pthread_t));
 }
 
@@ -239,19 +601,7 @@ void event_action_thread_start(struct devices_t *dev, char *name, void *(*func)(
 		logprintf(LOG_DEBUG, "aborting previous \"%s\" action for device \"%s\"", thread->action, dev->id);
 	}
 
-	thread->loop = 0;
-
-	pthread_mutex_unlock(&thread->mutex);
-	pthread_cond_signal(&thread->cond);
-
-	while(thread->running > 0) {
-		usleep(10);
-	}
-
-	if(thread->initialized == 1) {
-		pthread_join(thread->pth, NULL);
-		thread->initialized = 0;
-	}
+	event_action_abort(thread);
 
 	// if(thread->param != NULL) {
 		// json_delete(thread->param);
@@ -277,15 +627,11 @@ void event_action_thread_start(struct devices_t *dev, char *name, void *(*func)(
 int event_action_thread_wait(struct devices_t *dev, int interval) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct timeval tp;
 	struct timespec ts;
 
 	pthread_mutex_unlock(&dev->action_thread->mutex);
 
-	gettimeofday(&tp, NULL);
-	ts.tv_sec = tp.tv_sec;
-	ts.tv_nsec = tp.tv_usec * 1000;
-	ts.tv_sec += interval;
+	threads_cond_timeout(&ts, (unsigned long)interval*1000);
 
 	pthread_mutex_lock(&dev->action_thread->mutex);
 
@@ -301,19 +647,8 @@ void event_action_thread_stop(struct devices_t *dev) {
 		thread = dev->action_thread;
 		if(thread->running == 1) {
 			logprintf(LOG_DEBUG, "aborting running \"%s\" action for device \"%s\"", thread->action, dev->id);
-
-			thread->loop = 0;
-			pthread_mutex_unlock(&thread->mutex);
-			pthread_cond_signal(&thread->cond);
-
-			while(thread->running > 0) {
-				usleep(10);
-			}
-		}
-		if(thread->initialized == 1) {
-			pthread_join(thread->pth, NULL);
-			thread->initialized = 0;
 		}
+		event_action_abort(thread);
 	}
 }
 
@@ -326,14 +661,8 @@ void event_action_thread_free(struct devices_t *dev) {
 		thread = dev->action_thread;
 		if(thread->running == 1) {
 			logprintf(LOG_DEBUG, "aborting running \"%s\" action for device \"%s\"", thread->action, dev->id);
-
-			thread->loop = 0;
-			pthread_mutex_unlock(&thread->mutex);
-			pthread_cond_signal(&thread->cond);
-			while(thread->running > 0) {
-				usleep(10);
-			}
 		}
+		event_action_abort(thread);
 		if(thread->action != NULL) {
 			FREE(thread->action);
 		}
@@ -341,10 +670,6 @@ void event_action_thread_free(struct devices_t *dev) {
 			// json_delete(thread->param);
 			// thread->param = NULL;
 		// }
-		if(thread->initialized == 1) {
-			pthread_join(thread->pth, NULL);
-			thread->initialized = 0;
-		}
 		FREE(dev->action_thread);
 	}
 }
@@ -362,3 +687,58 @@ void event_action_stopped(struct event_action_thread_t *thread) {
 	thread->running = 0;
 	pthread_mutex_unlock(&thread->mutex);
 }
+
+/*
+ * Run an action as a sequence of steps on the timer
+ * wheel instead of in a thread of its own. The first
+ * step is executed after msec milliseconds. A step
+ * continues the action by calling
+ * event_action_timer_next, otherwise the action is
+ * stopped and the userdata is freed with gc.
+ *
+ * Just like with the action threads, starting a new
+ * action on a device aborts the one still running.
+ */
+void event_action_timer_start(struct devices_t *dev, char *name, struct rules_actions_t *obj, void (*step)(struct event_action_thread_t *), uint64_t msec, void *userdata, void (*gc)(void *)) {
+	struct event_action_thread_t *thread = dev->action_thread;
+
+	if(thread->running == 1) {
+		logprintf(LOG_DEBUG, "aborting previous \"%s\" action for device \"%s\"", thread->action, dev->id);
+	}
+
+	event_action_abort(thread);
+
+	pthread_mutex_lock(&wheel_lock);
+	thread->obj = obj;
+	thread->device = dev;
+	thread->loop = 1;
+	if((thread->action = REALLOC(thread->action, strlen(name)+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	strcpy(thread->action, name);
+	thread->userdata = userdata;
+	thread->gc = gc;
+	thread->running = 1;
+
+	logprintf(LOG_INFO, "started \"%s\" action for device \"%s\"", thread->action, dev->id);
+
+	if(wheel_signal_init == 0) {
+		threads_cond_init(&wheel_signal);
+		wheel_signal_init = 1;
+	}
+	if(wheel_loop == 0) {
+		wheel_loop = 1;
+		threads_create(&wheel_pth, NULL, event_action_timer_thread, NULL);
+	}
+
+	event_action_timer_schedule(thread, step, msec);
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+void event_action_timer_next(struct event_action_thread_t *thread, void (*step)(struct event_action_thread_t *), uint64_t msec) {
+	pthread_mutex_lock(&wheel_lock);
+	if(thread->loop == 1) {
+		event_action_timer_schedule(thread, step, msec);
+	}
+	pthread_mutex_unlock(&wheel_lock);
+}
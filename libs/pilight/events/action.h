@@ -19,6 +19,8 @@
 #ifndef _ACTION_H_
 #define _ACTION_H_
 
+#include <stdint.h>
+
 typedef struct event_action_thread_t event_action_thread_t;
 typedef struct event_actions_t event_actions_t;
 typedef struct rules_actions_t rules_actions_t;
@@ -49,12 +51,26 @@ struct event_action_thread_t {
 	pthread_mutexattr_t attr;
 	struct rules_actions_t *obj;
 	struct devices_t *device;
+
+	/*
+	 * Actions scheduled on the timer wheel don't
+	 * get their own thread. Instead, each step is
+	 * executed by the timer thread when expired.
+	 */
+	uint64_t expires;
+	void (*step)(struct event_action_thread_t *thread);
+	void *userdata;
+	void (*gc)(void *userdata);
+	struct event_action_thread_t **slot;
+	struct event_action_thread_t *wnext;
+	struct event_action_thread_t *wprev;
 };
 
 struct event_actions_t *event_actions;
 
 void event_action_init(void);
 void event_action_register(struct event_actions_t **act, const char *name);
+uint64_t event_action_duration(struct JsonNode *json, const char *name);
 int event_action_gc(void);
 void event_action_thread_init(struct devices_t *dev);
 int event_action_thread_wait(struct devices_t *dev, int interval);
@@ -63,5 +79,7 @@ void event_action_thread_stop(struct devices_t *dev);
 void event_action_thread_free(struct devices_t *dev);
 void event_action_stopped(struct event_action_thread_t *thread);
 void event_action_started(struct event_action_thread_t *thread);
+void event_action_timer_start(struct devices_t *dev, char *name, struct rules_actions_t *obj, void (*step)(struct event_action_thread_t *), uint64_t msec, void *userdata, void (*gc)(void *));
+void event_action_timer_next(struct event_action_thread_t *thread, void (*step)(struct event_action_thread_t *), uint64_t msec);
 
 #endif
@@ -443,374 +443,195 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
-	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
-	struct JsonNode *json = pth->obj->parsedargs;
-	struct JsonNode *jedimlevel = NULL;
-	struct JsonNode *jsdimlevel = NULL;
-	struct JsonNode *jto = NULL;
-	struct JsonNode *jafter = NULL;
-	struct JsonNode *jfor = NULL;
-	struct JsonNode *jfrom = NULL;
-	struct JsonNode *jin = NULL;
-	struct JsonNode *javalues = NULL;
-	struct JsonNode *jcvalues = NULL;
-	struct JsonNode *jdvalues = NULL;
-	struct JsonNode *jevalues = NULL;
-	struct JsonNode *jfvalues = NULL;
-	struct JsonNode *jaseconds = NULL;
-	struct JsonNode *jiseconds = NULL;
+typedef struct data_t {
+	char *old_state;
+	double cur_dimlevel;
+	int old_dimlevel;
+	int new_dimlevel;
+	int dimlevel;
+	int direction;
+	uint64_t msec_for;
+	uint64_t interval;
+} data_t;
+
+static void gc(void *param) {
+	struct data_t *data = param;
+
+	if(data->old_state != NULL) {
+		FREE(data->old_state);
+	}
+	FREE(data);
+}
+
+static void control(struct event_action_thread_t *pth, char *state, int dimlevel) {
 	struct JsonNode *jvalues = NULL;
-	char *old_state = NULL, **array = NULL;
-	double dimlevel = 0.0, old_dimlevel = 0.0, new_dimlevel = 0.0, cur_dimlevel = 0.0;
-	int seconds_after = 0, seconds_for = 0, seconds_in = 0, has_in = 0, dimdiff = 0;
-	int type_for = 0, type_after = 0, type_in = 0;
-	int direction = 0, interval = 0, timer = 0;
-	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	char state[3];
 
-	event_action_started(pth);
+	if(pilight.control != NULL) {
+		jvalues = json_mkobject();
+		json_append_member(jvalues, "dimlevel", json_mknumber(dimlevel, 0));
+		pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
+		json_delete(jvalues);
+	}
+}
 
-	if((jfor = json_find_member(json, "FOR")) != NULL) {
-		if((jcvalues = json_find_member(jfor, "value")) != NULL) {
-			jaseconds = json_find_element(jcvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_for = atoi(array[0]);
-								type_for = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
+/*
+ * We only need to restore the state if it was actually changed
+ */
+static int changed(struct data_t *data) {
+	return (data->old_state != NULL &&
+		(strcmp(data->old_state, "on") != 0 || (int)data->cur_dimlevel != data->new_dimlevel));
+}
+
+static void restore(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	if(strcmp(data->old_state, "off") == 0) {
+		control(pth, "on", (int)data->cur_dimlevel);
+		if(pilight.control != NULL) {
+			pilight.control(pth->device, data->old_state, NULL, ACTION);
 		}
+	} else {
+		control(pth, data->old_state, (int)data->cur_dimlevel);
 	}
+}
 
-	if((jafter = json_find_member(json, "AFTER")) != NULL) {
-		if((jdvalues = json_find_member(jafter, "value")) != NULL) {
-			jaseconds = json_find_element(jdvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_after = atoi(array[0]);
-								type_after = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
+/* We'll gently increase / decrease the dimlevel one step at a time. */
+static void fade(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	control(pth, "on", data->dimlevel);
+
+	if(data->dimlevel != data->new_dimlevel) {
+		if(data->direction == INCREASING) {
+			data->dimlevel++;
+		} else {
+			data->dimlevel--;
 		}
+		event_action_timer_next(pth, fade, data->interval);
+	} else if(data->msec_for > 0 && changed(data) == 1) {
+		event_action_timer_next(pth, restore, data->msec_for);
 	}
+}
 
-	if((jin = json_find_member(json, "IN")) != NULL) {
-		if((jfvalues = json_find_member(jin, "value")) != NULL) {
-			jiseconds = json_find_element(jfvalues, 0);
-			if(jiseconds != NULL) {
-				if(jiseconds->tag == JSON_STRING) {
-					l = explode(jiseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_in = atoi(array[0]);
-								type_in = units[i].id;
-								has_in = 1;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
+/*
+ * We'll switch from first dimlevel to second dimlevel after X seconds
+ * and switch back after X seconds.
+ */
+static void execute(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	if(data->old_state == NULL || changed(data) == 1) {
+		control(pth, "on", data->new_dimlevel);
+
+		if(data->msec_for > 0 && changed(data) == 1) {
+			event_action_timer_next(pth, restore, data->msec_for);
 		}
 	}
+}
 
-	switch(type_for) {
-		case 3:
-			seconds_for *= 60;
-		break;
-		case 4:
-			seconds_for *= (60*60);
-		break;
-		case 5:
-			seconds_for *= (60*60*24);
-		break;
-	}
-
-	switch(type_after) {
-		case 3:
-			seconds_after *= 60;
-		break;
-		case 4:
-			seconds_after *= (60*60);
-		break;
-		case 5:
-			seconds_after *= (60*60*24);
-		break;
-	}
-
-	switch(type_in) {
-		case 3:
-			seconds_in *= 60;
-		break;
-		case 4:
-			seconds_in *= (60*60);
-		break;
-		case 5:
-			seconds_in *= (60*60*24);
-		break;
+static void prepare(struct rules_actions_t *obj, struct devices_t *dev) {
+	struct JsonNode *json = obj->parsedargs;
+	struct JsonNode *jedimlevel = NULL;
+	struct JsonNode *jsdimlevel = NULL;
+	struct JsonNode *jto = NULL;
+	struct JsonNode *jfrom = NULL;
+	struct JsonNode *javalues = NULL;
+	struct JsonNode *jevalues = NULL;
+	struct data_t *data = NULL;
+	uint64_t msec_after = 0, msec_in = 0;
+	int has_in = 0, dimdiff = 0, match = 0;
+
+	if((jto = json_find_member(json, "TO")) == NULL ||
+		 (javalues = json_find_member(jto, "value")) == NULL ||
+		 (jedimlevel = json_find_element(javalues, 0)) == NULL ||
+		 jedimlevel->tag != JSON_NUMBER) {
+		return;
 	}
 
-	if(pilight.debuglevel == 1) {
-		fprintf(stderr, "action dim: for %d:%d, after %d:%d, in: %d:%d\n", seconds_for, type_for, seconds_after, type_after, seconds_in, type_in);
-	}
-	/* Store current state and dimlevel */
-	struct devices_t *tmp = pth->device;
-	int match1 = 0, match2 = 0;
-	while(tmp) {
-		struct devices_settings_t *opt = tmp->settings;
-		while(opt) {
-			if(strcmp(opt->name, "state") == 0) {
-				if(opt->values->type == JSON_STRING) {
-					if((old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					strcpy(old_state, opt->values->string_);
-					match1 = 1;
-				}
-			}
-			if(strcmp(opt->name, "dimlevel") == 0) {
-				if(opt->values->type == JSON_NUMBER) {
-					cur_dimlevel = opt->values->number_;
-					match2 = 1;
-				}
-			}
-			if(match1 == 1 && match2 == 1) {
-				break;
-			}
-			opt = opt->next;
-		}
-		if(match1 == 1 && match2 == 1) {
-			break;
-		}
-		tmp = tmp->next;
-	}
-	if(match1 == 0) {
-		logprintf(LOG_NOTICE, "could not store old state of \"%s\"", pth->device->id);
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-	if(match2 == 0) {
-		logprintf(LOG_NOTICE, "could not store old dimlevel of \"%s\"", pth->device->id);
+	memset(data, 0, sizeof(struct data_t));
+
+	data->new_dimlevel = (int)jedimlevel->number_;
+	data->msec_for = event_action_duration(json, "FOR");
+	msec_after = event_action_duration(json, "AFTER");
+	if(json_find_member(json, "IN") != NULL) {
+		msec_in = event_action_duration(json, "IN");
+		has_in = 1;
 	}
 
 	if((jfrom = json_find_member(json, "FROM")) != NULL) {
 		if((jevalues = json_find_member(jfrom, "value")) != NULL) {
 			jsdimlevel = json_find_element(jevalues, 0);
-			if(jsdimlevel != NULL) {
-				if(jsdimlevel->tag == JSON_NUMBER) {
-					old_dimlevel = (int)jsdimlevel->number_;
-				}
-			}
-		}
-	}
-
-	if((jto = json_find_member(json, "TO")) != NULL) {
-		if((javalues = json_find_member(jto, "value")) != NULL) {
-			jedimlevel = json_find_element(javalues, 0);
-			if(jedimlevel != NULL) {
-				if(jedimlevel->tag == JSON_NUMBER) {
-					new_dimlevel = (int)jedimlevel->number_;
-					dimlevel = (int)jedimlevel->number_;
-					strcpy(state,  "on");
-				}
+			if(jsdimlevel != NULL && jsdimlevel->tag == JSON_NUMBER) {
+				data->old_dimlevel = (int)jsdimlevel->number_;
 			}
 		}
 	}
 
 	if(pilight.debuglevel == 1) {
-		fprintf(stderr, "action dim: old %d, new %d, direction %d\n", (int)old_dimlevel, (int)new_dimlevel, direction);
-	}
-
-	if(has_in == 1) {
-		if(old_dimlevel < new_dimlevel) {
-			direction = INCREASING;
-			dimdiff = (int)(new_dimlevel - old_dimlevel);
-			interval = (int)(seconds_in / dimdiff);
-		} else if(old_dimlevel > new_dimlevel) {
-			direction = DECREASING;
-			dimdiff = (int)(old_dimlevel - new_dimlevel);
-			interval = (int)(seconds_in / dimdiff);
-		} else {
-			dimdiff = 0;
-			interval = 0;
-		}
+		fprintf(stderr, "action dim: for %llu, after %llu, in: %llu\n",
+			(unsigned long long)data->msec_for, (unsigned long long)msec_after, (unsigned long long)msec_in);
 	}
 
-	/*
-	 * We'll switch from first dimlevel to second dimlevel after X seconds
-	 * and switch back after X seconds.
-	 */
-	if(has_in == 0) {
-		if(old_state == NULL || ((strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel))) {
-			timer = 0;
-			while(pth->loop == 1) {
-				if(timer == seconds_after) {
-					jvalues = json_mkobject();
-					json_append_member(jvalues, "dimlevel", json_mknumber(dimlevel, 0));
-					if(pilight.control != NULL) {
-						pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-					}
-					json_delete(jvalues);
-					break;
-				}
-				timer++;
-				if(type_after > 1) {
-					sleep(1);
-				} else {
-					usleep(1000);
-				}
-			}
-
-			/*
-			 * We only need to restore the state if it was actually changed
-			 */
-			if(seconds_for > 0 && old_state != NULL && (strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel)) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(seconds_for == timer) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(cur_dimlevel, 0));
-						if(pilight.control != NULL) {
-							if(strcmp(old_state, "off") == 0) {
-								pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-								pilight.control(pth->device, old_state, NULL, ACTION);
-							} else {
-								pilight.control(pth->device, old_state, json_first_child(jvalues), ACTION);
-							}
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_for > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
+	/* Store current state and dimlevel */
+	struct devices_settings_t *opt = dev->settings;
+	while(opt) {
+		if(strcmp(opt->name, "state") == 0) {
+			if(opt->values->type == JSON_STRING && data->old_state == NULL) {
+				if((data->old_state = STRDUP(opt->values->string_)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 				}
 			}
 		}
-	/* We'll gently start increasing / decreasing the dimlevel after X seconds in X seconds. */
-	} else if(interval > 0) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(timer == seconds_after) {
-				break;
-			}
-			timer++;
-			if(type_after > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
-			}
-		}
-		if(direction == INCREASING) {
-			for(i=(int)old_dimlevel;i<=(int)new_dimlevel;i++) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(interval == timer || i == (int)old_dimlevel) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(i, 0));
-						if(pilight.control != NULL) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_in > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
-				}
-			}
-		} else {
-			for(i=(int)old_dimlevel;i>=(int)new_dimlevel;i--) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(interval == timer || i == (int)old_dimlevel) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(i, 0));
-						if(pilight.control != NULL) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_in > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
-				}
+		if(strcmp(opt->name, "dimlevel") == 0) {
+			if(opt->values->type == JSON_NUMBER) {
+				data->cur_dimlevel = opt->values->number_;
+				match = 1;
 			}
 		}
-		/*
-		 * We only need to restore the state if it was actually changed
-		 */
-		if(seconds_for > 0 && old_state != NULL &&
-			 (strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel)) {
-			timer = 0;
-			while(pth->loop == 1) {
-				if(timer == seconds_for) {
-					jvalues = json_mkobject();
-					json_append_member(jvalues, "dimlevel", json_mknumber(cur_dimlevel, 0));
-					if(pilight.control != NULL) {
-						if(strcmp(old_state, "off") == 0) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-							pilight.control(pth->device, old_state, NULL, ACTION);
-						} else {
-							pilight.control(pth->device, old_state, json_first_child(jvalues), ACTION);
-						}
-					}
-					json_delete(jvalues);
-					break;
-				}
-				timer++;
-				if(type_for > 1) {
-					sleep(1);
-				} else {
-					usleep(1000);
-				}
-			}
+		if(data->old_state != NULL && match == 1) {
+			break;
 		}
+		opt = opt->next;
+	}
+	if(data->old_state == NULL) {
+		logprintf(LOG_NOTICE, "could not store old state of \"%s\"", dev->id);
+	}
+	if(match == 0) {
+		logprintf(LOG_NOTICE, "could not store old dimlevel of \"%s\"", dev->id);
 	}
 
-	if(old_state != NULL) {
-		FREE(old_state);
+	if(has_in == 0) {
+		event_action_timer_start(dev, action_dim->name, obj, execute, msec_after, data, gc);
+		return;
 	}
 
-	event_action_stopped(pth);
+	if(data->old_dimlevel < data->new_dimlevel) {
+		data->direction = INCREASING;
+		dimdiff = data->new_dimlevel - data->old_dimlevel;
+	} else {
+		data->direction = DECREASING;
+		dimdiff = data->old_dimlevel - data->new_dimlevel;
+	}
+	data->dimlevel = data->old_dimlevel;
+
+	if(pilight.debuglevel == 1) {
+		fprintf(stderr, "action dim: old %d, new %d, direction %d\n", data->old_dimlevel, data->new_dimlevel, data->direction);
+	}
 
-	return (void *)NULL;
+	if(dimdiff > 0) {
+		data->interval = msec_in / dimdiff;
+	}
+
+	if(data->interval > 0) {
+		event_action_timer_start(dev, action_dim->name, obj, fade, msec_after, data, gc);
+	} else {
+		/* Nothing to fade, but still abort a previous action on this device */
+		event_action_thread_stop(dev);
+		gc(data);
+	}
 }
 
 static int run(struct rules_actions_t *obj) {
@@ -827,7 +648,7 @@ static int run(struct rules_actions_t *obj) {
 				if(jbchild->tag == JSON_STRING) {
 					struct devices_t *dev = NULL;
 					if(devices_get(jbchild->string_, &dev) == 0) {
-						event_action_thread_start(dev, action_dim->name, thread, obj);
+						prepare(obj, dev);
 					}
 				}
 				jbchild = jbchild->next;
@@ -857,7 +678,7 @@ void actionDimInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "dim";
-	module->version = "3.5";
+	module->version = "4.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "152";
 }
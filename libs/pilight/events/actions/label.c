@@ -265,259 +265,148 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
-	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
-	struct JsonNode *json = pth->obj->parsedargs;
-	struct JsonNode *jto = NULL;
-	struct JsonNode *jafter = NULL;
-	struct JsonNode *jfor = NULL;
-	struct JsonNode *jcolor = NULL;
-	struct JsonNode *javalues = NULL;
-	struct JsonNode *jcvalues = NULL;
-	struct JsonNode *jdvalues = NULL;
-	struct JsonNode *jevalues = NULL;
-	struct JsonNode *jlabel = NULL;
-	struct JsonNode *jaseconds = NULL;
-	struct JsonNode *jvalues = NULL;
-	char *new_label = NULL, *old_label = NULL, *label = NULL, **array = NULL;
-	char *new_color = NULL, *old_color = NULL, *color = NULL;
-	int seconds_after = 0, type_after = 0, free_label = 0;
-	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	int seconds_for = 0, type_for = 0, timer = 0;
+typedef struct data_t {
+	char *old_label;
+	char *new_label;
+	char *old_color;
+	char *new_color;
+	uint64_t msec_for;
+} data_t;
+
+static void gc(void *param) {
+	struct data_t *data = param;
+
+	if(data->old_label != NULL) {
+		FREE(data->old_label);
+	}
+	if(data->new_label != NULL) {
+		FREE(data->new_label);
+	}
+	if(data->old_color != NULL) {
+		FREE(data->old_color);
+	}
+	if(data->new_color != NULL) {
+		FREE(data->new_color);
+	}
+	FREE(data);
+}
 
-	event_action_started(pth);
+static void control(struct event_action_thread_t *pth, char *label, char *color) {
+	struct JsonNode *jvalues = NULL;
 
-	if((jcolor = json_find_member(json, "COLOR")) != NULL) {
-		if((jevalues = json_find_member(jcolor, "value")) != NULL) {
-			jcolor = json_find_element(jevalues, 0);
-			if(jcolor != NULL && jcolor->tag == JSON_STRING) {
-				color = jcolor->string_;
-				if((new_color = MALLOC(strlen(color)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(new_color, color);
-			}
+	if(pilight.control != NULL) {
+		jvalues = json_mkobject();
+		if(color != NULL) {
+			json_append_member(jvalues, "color", json_mkstring(color));
+		}
+		if(label != NULL) {
+			json_append_member(jvalues, "label", json_mkstring(label));
 		}
+		pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
+		json_delete(jvalues);
 	}
+}
 
-	if((jfor = json_find_member(json, "FOR")) != NULL) {
-		if((jcvalues = json_find_member(jfor, "value")) != NULL) {
-			jaseconds = json_find_element(jcvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_for = atoi(array[0]);
-								type_for = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
-		}
+static void restore(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	control(pth, data->old_label, data->old_color);
+}
+
+static void execute(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	/*
+	 * We're not switching when current label or is the same as
+	 * the old label or old color.
+	 */
+	if(data->old_label == NULL || strcmp(data->old_label, data->new_label) != 0 ||
+		(data->old_color != NULL && data->new_color != NULL && strcmp(data->old_color, data->new_color) != 0)) {
+		control(pth, data->new_label, data->new_color);
 	}
 
-	if((jafter = json_find_member(json, "AFTER")) != NULL) {
-		if((jdvalues = json_find_member(jafter, "value")) != NULL) {
-			jaseconds = json_find_element(jdvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_after = atoi(array[1]);
-								type_after = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
-		}
+	/*
+	 * We only need to restore the label if it was actually changed
+	 */
+	if(data->msec_for > 0 && ((data->old_label != NULL && strcmp(data->old_label, data->new_label) != 0) ||
+	   (data->old_color != NULL && data->new_color != NULL && strcmp(data->old_color, data->new_color) != 0))) {
+		event_action_timer_next(pth, restore, data->msec_for);
 	}
+}
 
-	switch(type_for) {
-		case 3:
-			seconds_for *= 60;
-		break;
-		case 4:
-			seconds_for *= (60*60);
-		break;
-		case 5:
-			seconds_for *= (60*60*24);
-		break;
+static void prepare(struct rules_actions_t *obj, struct devices_t *dev) {
+	struct JsonNode *json = obj->parsedargs;
+	struct JsonNode *jto = NULL;
+	struct JsonNode *jcolor = NULL;
+	struct JsonNode *javalues = NULL;
+	struct JsonNode *jevalues = NULL;
+	struct JsonNode *jlabel = NULL;
+	struct data_t *data = NULL;
+
+	if((jto = json_find_member(json, "TO")) == NULL ||
+		 (javalues = json_find_member(jto, "value")) == NULL ||
+		 (jlabel = json_find_element(javalues, 0)) == NULL ||
+		 (jlabel->tag != JSON_STRING && jlabel->tag != JSON_NUMBER)) {
+		return;
 	}
 
-	switch(type_after) {
-		case 3:
-			seconds_after *= 60;
-		break;
-		case 4:
-			seconds_after *= (60*60);
-		break;
-		case 5:
-			seconds_after *= (60*60*24);
-		break;
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
+	memset(data, 0, sizeof(struct data_t));
 
-	/* Store current label */
-	struct devices_t *tmp = pth->device;
-	int match1 = 0, match2 = 0;
-	while(tmp) {
-		struct devices_settings_t *opt = tmp->settings;
-		while(opt) {
-			if(strcmp(opt->name, "label") == 0) {
-				if(opt->values->type == JSON_STRING) {
-					if((old_label = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					strcpy(old_label, opt->values->string_);
-					match1 = 1;
-				}
-			}
-			if(strcmp(opt->name, "color") == 0) {
-				if(opt->values->type == JSON_STRING) {
-					if((old_color = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					strcpy(old_color, opt->values->string_);
-					match2 = 1;
-				}
-			}
-			opt = opt->next;
+	if(jlabel->tag == JSON_STRING) {
+		if((data->new_label = STRDUP(jlabel->string_)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 		}
-		if(match1 == 1 && match2 == 1) {
-			break;
+	} else {
+		int l = snprintf(NULL, 0, "%.*f", jlabel->decimals_, jlabel->number_);
+		if((data->new_label = MALLOC(l+1)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 		}
-		tmp = tmp->next;
-	}
-	if(match1 == 0) {
-		logprintf(LOG_NOTICE, "could not store old label of \"%s\"", pth->device->id);
-	}
-	if(match2 == 0) {
-		logprintf(LOG_NOTICE, "could not store old color of \"%s\"", pth->device->id);
+		snprintf(data->new_label, l+1, "%.*f", jlabel->decimals_, jlabel->number_);
 	}
 
-	timer = 0;
-	while(pth->loop == 1) {
-		if(timer == seconds_after) {
-			if((jto = json_find_member(json, "TO")) != NULL) {
-				if((javalues = json_find_member(jto, "value")) != NULL) {
-					jlabel = json_find_element(javalues, 0);
-					if(jlabel != NULL) {
-						if(jlabel->tag == JSON_STRING) {
-							label = jlabel->string_;
-						} else if(jlabel->tag == JSON_NUMBER) {
-							int l = snprintf(NULL, 0, "%.*f", jlabel->decimals_, jlabel->number_);
-							if((label = MALLOC(l+1)) == NULL) {
-								fprintf(stderr, "out of memory\n");
-								exit(EXIT_FAILURE);
-							}
-							memset(label, '\0', l);
-							free_label = 1;
-							snprintf(label, l, "%.*f", jlabel->decimals_, jlabel->number_);
-							label[l] = '\0';
-						}
-						if((new_label = MALLOC(strlen(label)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(new_label, label);
-						/*
-						 * We're not switching when current label or is the same as
-						 * the old label or old color.
-						 */
-						if(old_label == NULL || strcmp(old_label, new_label) != 0 ||
-							(old_color != NULL && new_color != NULL && strcmp(old_color, new_color) != 0)) {
-							if(pilight.control != NULL) {
-								jvalues = json_mkobject();
-								if(color != NULL) {
-									json_append_member(jvalues, "color", json_mkstring(color));
-								}
-								json_append_member(jvalues, "label", json_mkstring(label));
-								pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
-								json_delete(jvalues);
-								break;
-							}
-						}
-					}
+	if((jcolor = json_find_member(json, "COLOR")) != NULL) {
+		if((jevalues = json_find_member(jcolor, "value")) != NULL) {
+			jcolor = json_find_element(jevalues, 0);
+			if(jcolor != NULL && jcolor->tag == JSON_STRING) {
+				if((data->new_color = STRDUP(jcolor->string_)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 				}
 			}
-			break;
-		}
-		timer++;
-		if(type_after > 1) {
-			sleep(1);
-		} else {
-			usleep(1000);
 		}
 	}
 
-	/*
-	 * We only need to restore the label if it was actually changed
-	 */
-	if(seconds_for > 0 && ((old_label != NULL && new_label != NULL && strcmp(old_label, new_label) != 0) ||
-	   (old_color != NULL && new_color != NULL && strcmp(old_color, new_color) != 0))) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(seconds_for == timer) {
-				if(pilight.control != NULL) {
-					jvalues = json_mkobject();
-					if(old_color != NULL) {
-						json_append_member(jvalues, "color", json_mkstring(old_color));
-					}
-					json_append_member(jvalues, "label", json_mkstring(old_label));
-					pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
-					json_delete(jvalues);
-					break;
+	data->msec_for = event_action_duration(json, "FOR");
+
+	/* Store current label */
+	struct devices_settings_t *opt = dev->settings;
+	while(opt) {
+		if(strcmp(opt->name, "label") == 0) {
+			if(opt->values->type == JSON_STRING && data->old_label == NULL) {
+				if((data->old_label = STRDUP(opt->values->string_)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 				}
-				break;
 			}
-			timer++;
-			if(type_for > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
+		}
+		if(strcmp(opt->name, "color") == 0) {
+			if(opt->values->type == JSON_STRING && data->old_color == NULL) {
+				if((data->old_color = STRDUP(opt->values->string_)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
 			}
 		}
+		opt = opt->next;
 	}
-
-	if(free_label == 1) {
-		FREE(label);
+	if(data->old_label == NULL) {
+		logprintf(LOG_NOTICE, "could not store old label of \"%s\"", dev->id);
 	}
-
-	if(old_label != NULL) {
-		FREE(old_label);
+	if(data->old_color == NULL) {
+		logprintf(LOG_NOTICE, "could not store old color of \"%s\"", dev->id);
 	}
 
-	if(new_label != NULL) {
-		FREE(new_label);
-	}
-
-	if(old_color != NULL) {
-		FREE(old_color);
-	}
-
-	if(new_color != NULL) {
-		FREE(new_color);
-	}
-
-	event_action_stopped(pth);
-
-	return (void *)NULL;
+	event_action_timer_start(dev, action_label->name, obj, execute, event_action_duration(json, "AFTER"), data, gc);
 }
 
 static int run(struct rules_actions_t *obj) {
@@ -534,7 +423,7 @@ static int run(struct rules_actions_t *obj) {
 				if(jbchild->tag == JSON_STRING) {
 					struct devices_t *dev = NULL;
 					if(devices_get(jbchild->string_, &dev) == 0) {
-						event_action_thread_start(dev, action_label->name, thread, obj);
+						prepare(obj, dev);
 					}
 				}
 				jbchild = jbchild->next;
@@ -563,7 +452,7 @@ void actionLabelInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "label";
-	module->version = "2.2";
+	module->version = "3.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "152";
 }
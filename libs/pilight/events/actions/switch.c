@@ -249,189 +249,95 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
-	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
-	struct JsonNode *json = pth->obj->parsedargs;
-	struct JsonNode *jto = NULL;
-	struct JsonNode *jafter = NULL;
-	struct JsonNode *jfor = NULL;
-	struct JsonNode *javalues = NULL;
-	struct JsonNode *jcvalues = NULL;
-	struct JsonNode *jdvalues = NULL;
-	struct JsonNode *jstate = NULL;
-	struct JsonNode *jaseconds = NULL;
-	char *new_state = NULL, *old_state = NULL, *state = NULL, **array = NULL;
-	int seconds_after = 0, type_after = 0;
-	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	int seconds_for = 0, type_for = 0, timer = 0;
+typedef struct data_t {
+	char *old_state;
+	char *new_state;
+	uint64_t msec_for;
+} data_t;
 
-	event_action_started(pth);
+static void gc(void *param) {
+	struct data_t *data = param;
 
-	if((jfor = json_find_member(json, "FOR")) != NULL) {
-		if((jcvalues = json_find_member(jfor, "value")) != NULL) {
-			jaseconds = json_find_element(jcvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_for = atoi(array[0]);
-								type_for = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
-		}
+	if(data->old_state != NULL) {
+		FREE(data->old_state);
 	}
-
-	if((jafter = json_find_member(json, "AFTER")) != NULL) {
-		if((jdvalues = json_find_member(jafter, "value")) != NULL) {
-			jaseconds = json_find_element(jdvalues, 0);
-			if(jaseconds != NULL) {
-				if(jaseconds->tag == JSON_STRING) {
-					l = explode(jaseconds->string_, " ", &array);
-					if(l == 2) {
-						for(i=0;i<nrunits;i++) {
-							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_after = atoi(array[0]);
-								type_after = units[i].id;
-								break;
-							}
-						}
-					}
-					if(l > 0) {
-						array_free(&array, l);
-					}
-				}
-			}
-		}
+	if(data->new_state != NULL) {
+		FREE(data->new_state);
 	}
+	FREE(data);
+}
 
-	switch(type_for) {
-		case 3:
-			seconds_for *= 60;
-		break;
-		case 4:
-			seconds_for *= (60*60);
-		break;
-		case 5:
-			seconds_for *= (60*60*24);
-		break;
-	}
+static void restore(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
 
-	switch(type_after) {
-		case 3:
-			seconds_after *= 60;
-		break;
-		case 4:
-			seconds_after *= (60*60);
-		break;
-		case 5:
-			seconds_after *= (60*60*24);
-		break;
+	if(pilight.control != NULL) {
+		pilight.control(pth->device, data->old_state, NULL, ACTION);
 	}
+}
 
-	/* Store current state */
-	struct devices_t *tmp = pth->device;
-	int match = 0;
-	while(tmp) {
-		struct devices_settings_t *opt = tmp->settings;
-		while(opt) {
-			if(strcmp(opt->name, "state") == 0) {
-				if(opt->values->type == JSON_STRING) {
-					if((old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					strcpy(old_state, opt->values->string_);
-					match = 1;
-				}
-				break;
-			}
-			opt = opt->next;
+static void execute(struct event_action_thread_t *pth) {
+	struct data_t *data = pth->userdata;
+
+	/*
+	 * We're not switching when current state is the same as
+	 * the old state.
+	 */
+	if(data->old_state == NULL || strcmp(data->old_state, data->new_state) != 0) {
+		if(pilight.control != NULL) {
+			pilight.control(pth->device, data->new_state, NULL, ACTION);
 		}
-		if(match == 1) {
-			break;
+
+		/*
+		 * We only need to restore the state if it was actually changed
+		 */
+		if(data->msec_for > 0 && data->old_state != NULL) {
+			event_action_timer_next(pth, restore, data->msec_for);
 		}
-		tmp = tmp->next;
 	}
-	if(match == 0) {
-		logprintf(LOG_NOTICE, "could not store old state of \"%s\"\n", pth->device->id);
+}
+
+static void prepare(struct rules_actions_t *obj, struct devices_t *dev) {
+	struct JsonNode *json = obj->parsedargs;
+	struct JsonNode *jto = NULL;
+	struct JsonNode *javalues = NULL;
+	struct JsonNode *jstate = NULL;
+	struct data_t *data = NULL;
+
+	if((jto = json_find_member(json, "TO")) == NULL ||
+		 (javalues = json_find_member(jto, "value")) == NULL ||
+		 (jstate = json_find_element(javalues, 0)) == NULL ||
+		 jstate->tag != JSON_STRING) {
+		return;
 	}
 
-	timer = 0;
-	while(pth->loop == 1) {
-		if(timer == seconds_after) {
-			if((jto = json_find_member(json, "TO")) != NULL) {
-				if((javalues = json_find_member(jto, "value")) != NULL) {
-					jstate = json_find_element(javalues, 0);
-					if(jstate != NULL && jstate->tag == JSON_STRING) {
-						state = jstate->string_;
-						if((new_state = MALLOC(strlen(state)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(new_state, state);
-						/*
-						 * We're not switching when current state is the same as
-						 * the old state.
-						 */
-						if(old_state == NULL || strcmp(old_state, new_state) != 0) {
-							if(pilight.control != NULL) {
-								pilight.control(pth->device, new_state, NULL, ACTION);
-							}
-						}
-					}
-				}
-			}
-			break;
-		}
-		timer++;
-		if(type_after > 1) {
-			sleep(1);
-		} else {
-			usleep(1000);
-		}
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
+	memset(data, 0, sizeof(struct data_t));
 
-	/*
-	 * We only need to restore the state if it was actually changed
-	 */
-	if(seconds_for > 0 && old_state != NULL && new_state != NULL && strcmp(old_state, new_state) != 0) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(seconds_for == timer) {
-				if(pilight.control != NULL) {
-					pilight.control(pth->device, old_state, NULL, ACTION);
+	if((data->new_state = STRDUP(jstate->string_)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	data->msec_for = event_action_duration(json, "FOR");
+
+	/* Store current state */
+	struct devices_settings_t *opt = dev->settings;
+	while(opt) {
+		if(strcmp(opt->name, "state") == 0) {
+			if(opt->values->type == JSON_STRING) {
+				if((data->old_state = STRDUP(opt->values->string_)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 				}
-				break;
-			}
-			timer++;
-			if(type_for > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
 			}
+			break;
 		}
+		opt = opt->next;
 	}
-
-	if(old_state != NULL) {
-		FREE(old_state);
-	}
-
-	if(new_state != NULL) {
-		FREE(new_state);
+	if(data->old_state == NULL) {
+		logprintf(LOG_NOTICE, "could not store old state of \"%s\"\n", dev->id);
 	}
 
-	event_action_stopped(pth);
-
-	return (void *)NULL;
+	event_action_timer_start(dev, action_switch->name, obj, execute, event_action_duration(json, "AFTER"), data, gc);
 }
 
 static int run(struct rules_actions_t *obj) {
@@ -448,7 +354,7 @@ static int run(struct rules_actions_t *obj) {
 				if(jbchild->tag == JSON_STRING) {
 					struct devices_t *dev = NULL;
 					if(devices_get(jbchild->string_, &dev) == 0) {
-						event_action_thread_start(dev, action_switch->name, thread, obj);
+						prepare(obj, dev);
 					}
 				}
 				jbchild = jbchild->next;
@@ -476,7 +382,7 @@ void actionSwitchInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "switch";
-	module->version = "3.2";
+	module->version = "4.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "152";
 }
@@ -116,8 +116,7 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
-	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+static void execute(struct event_action_thread_t *pth) {
 	// struct rules_t *obj = pth->obj;
 	struct JsonNode *json = pth->obj->arguments;
 	struct devices_settings_t *tmp_settings = pth->device->settings;
@@ -127,8 +126,6 @@ static void *thread(void *param) {
 	struct JsonNode *jstate2 = NULL;
 	char *cstate = NULL, *state1 = NULL, *state2 = NULL;
 
-	event_action_started(pth);
-
 	while(tmp_settings) {
 		if(strcmp(tmp_settings->name, "state") == 0) {
 			if(tmp_settings->values->type == JSON_STRING) {
@@ -139,6 +136,10 @@ static void *thread(void *param) {
 		tmp_settings = tmp_settings->next;
 	}
 
+	if(cstate == NULL) {
+		return;
+	}
+
 	if((jbetween = json_find_member(json, "BETWEEN")) != NULL) {
 			if((jsvalues = json_find_member(jbetween, "value")) != NULL) {
 			jstate1 = json_find_element(jsvalues, 0);
@@ -158,10 +159,6 @@ static void *thread(void *param) {
 			}
 		}
 	}
-
-	event_action_stopped(pth);
-
-	return (void *)NULL;
 }
 
 static int run(struct rules_actions_t *obj) {
@@ -178,7 +175,7 @@ static int run(struct rules_actions_t *obj) {
 				if(jdchild->tag == JSON_STRING) {
 					struct devices_t *dev = NULL;
 					if(devices_get(jdchild->string_, &dev) == 0) {
-						event_action_thread_start(dev, action_toggle->name, thread, obj);
+						event_action_timer_start(dev, action_toggle->name, obj, execute, 0, NULL, NULL);
 					}
 				}
 				jdchild = jdchild->next;
@@ -204,7 +201,7 @@ void actionToggleInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "toggle";
-	module->version = "2.1";
+	module->version = "3.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "58";
 }
@@ -38,6 +38,7 @@
 #include "../core/common.h"
 #include "../core/config.h"
 #include "../core/log.h"
+#include "../core/metrics.h"
 #include "../core/options.h"
 #include "../core/json.h"
 #include "../core/ssdp.h"
@@ -1705,9 +1706,7 @@ close:
 	return error;
 }
 
-void *events_loop(void *param) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
-
+static void events_lock_init(void) {
 	if(eventslock_init == 0) {
 		pthread_mutexattr_init(&events_attr);
 		pthread_mutexattr_settype(&events_attr, PTHREAD_MUTEX_RECURSIVE);
@@ -1715,6 +1714,25 @@ void *events_loop(void *param) {
 		pthread_cond_init(&events_signal, NULL);
 		eventslock_init = 1;
 	}
+}
+
+/*
+ * The rules are evaluated with the events lock held, so
+ * others that walk or replace the rules take it as well.
+ */
+void events_rules_lock(void) {
+	events_lock_init();
+	pthread_mutex_lock(&events_lock);
+}
+
+void events_rules_unlock(void) {
+	pthread_mutex_unlock(&events_lock);
+}
+
+void *events_loop(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	events_lock_init();
 
 	struct devices_t *dev = NULL;
 	struct JsonNode *jdevices = NULL, *jchilds = NULL;
@@ -1797,6 +1815,9 @@ void *events_loop(void *param) {
 						logprintf(LOG_DEBUG, "rule #%d %s was parsed in %.6f seconds", tmp_rules->nr, tmp_rules->name,
 							((double)tmp_rules->timestamp.second.tv_sec + 1.0e-9*tmp_rules->timestamp.second.tv_nsec) -
 							((double)tmp_rules->timestamp.first.tv_sec + 1.0e-9*tmp_rules->timestamp.first.tv_nsec));
+						metrics_observe(&tmp_rules->evaluation,
+							(unsigned long)((tmp_rules->timestamp.second.tv_sec - tmp_rules->timestamp.first.tv_sec) * 1000000 +
+							(tmp_rules->timestamp.second.tv_nsec - tmp_rules->timestamp.first.tv_nsec) / 1000));
 #endif
 						tmp_rules->status = 0;
 					}
@@ -1827,6 +1848,11 @@ int events_running(void) {
 
 	return (running == 1) ? 0 : -1;
 }
+
+int events_queue_size(void) {
+	return eventsqueue_number;
+}
+
 static void events_queue(char *message) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -1886,7 +1912,8 @@ void *events_clientize(void *param) {
 				continue;
 			}
 		} else {
-			if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1) {
+			if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1 &&
+			   (ssdp_reseek(&ssdp_list) == -1 || (sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1)) {
 				logprintf(LOG_ERR, "could not connect to pilight-daemon");
 				continue;
 			}
@@ -39,5 +39,8 @@ void *events_clientize(void *param);
 int events_gc(void);
 void *events_loop(void *param);
 int events_running(void);
+int events_queue_size(void);
+void events_rules_lock(void);
+void events_rules_unlock(void);
 
 #endif
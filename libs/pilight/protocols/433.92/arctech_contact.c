@@ -67,25 +67,23 @@ static void createMessage(int id, int unit, int state, int all) {
 }
 
 static void parseCode(void) {
-	int binary[MAX_RAW_LENGTH/4], x = 0, i = 0;
+	struct bitstream_t bs;
+	int x = 0;
 
 	if(arctech_contact->rawlen>MAX_RAW_LENGTH) {
 		logprintf(LOG_ERR, "arctech_contact: parsecode - invalid parameter passed %d", arctech_contact->rawlen);
 		return;
 	}
 
+	bitstream_clear(&bs);
 	for(x=0;x<arctech_contact->rawlen;x+=4) {
-		if(arctech_contact->raw[x+3] > AVG_PULSE_LENGTH*PULSE_MULTIPLIER) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
+		bitstream_push(&bs, arctech_contact->raw[x+3] > AVG_PULSE_LENGTH*PULSE_MULTIPLIER);
 	}
 
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int unit = (int)bitstream_msb(&bs, 28, 31);
+	int state = bitstream_bit(&bs, 27);
+	int all = bitstream_bit(&bs, 26);
+	int id = (int)bitstream_msb(&bs, 0, 25);
 
 	createMessage(id, unit, state, all);
 }
@@ -121,7 +119,7 @@ void arctechContactInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "arctech_contact";
-	module->version = "2.2";
+	module->version = "2.3";
 	module->reqversion = "6.0";
 	module->reqcommit = "38";
 }
@@ -78,26 +78,24 @@ static void createMessage(int id, int unit, int state, int all, int dimlevel, in
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	struct bitstream_t bs;
+	int x = 0;
 
 	if(arctech_dimmer->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "arctech_dimmer: parsecode - invalid parameter passed %d", arctech_dimmer->rawlen);
 		return;
 	}
 
+	bitstream_clear(&bs);
 	for(x=0;x<arctech_dimmer->rawlen;x+=4) {
-		if(arctech_dimmer->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
+		bitstream_push(&bs, arctech_dimmer->frame->symbols[x+3]);
 	}
 
-	int dimlevel = binToDecRev(binary, 32, 35);
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int dimlevel = (int)bitstream_msb(&bs, 32, 35);
+	int unit = (int)bitstream_msb(&bs, 28, 31);
+	int state = bitstream_bit(&bs, 27);
+	int all = bitstream_bit(&bs, 26);
+	int id = (int)bitstream_msb(&bs, 0, 25);
 
 	createMessage(id, unit, state, all, dimlevel, 0);
 }
@@ -343,7 +341,7 @@ void arctechDimmerInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "arctech_dimmer";
-	module->version = "3.4";
+	module->version = "3.5";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
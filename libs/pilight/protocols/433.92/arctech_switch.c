@@ -75,25 +75,23 @@ static void createMessage(int id, int unit, int state, int all, int learn) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	struct bitstream_t bs;
+	int x = 0;
 
 	if(arctech_switch->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "arctech_switch: parsecode - invalid parameter passed %d", arctech_switch->rawlen);
 		return;
 	}
 
+	bitstream_clear(&bs);
 	for(x=0;x<arctech_switch->rawlen;x+=4) {
-		if(arctech_switch->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
+		bitstream_push(&bs, arctech_switch->frame->symbols[x+3]);
 	}
 
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int unit = (int)bitstream_msb(&bs, 28, 31);
+	int state = bitstream_bit(&bs, 27);
+	int all = bitstream_bit(&bs, 26);
+	int id = (int)bitstream_msb(&bs, 0, 25);
 
 	createMessage(id, unit, state, all, 0);
 }
@@ -270,7 +268,7 @@ void arctechSwitchInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "arctech_switch";
-	module->version = "3.4";
+	module->version = "3.5";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -396,6 +396,8 @@ void quiggGT1000Init(void) {
 	quigg_gt1000->devtype = SWITCH;
 	quigg_gt1000->hwtype = RF433;
 	quigg_gt1000->txrpt = NORMAL_REPEATS;
+	/* A random sequence is picked when none is given */
+	quigg_gt1000->txcache = 0;
 	quigg_gt1000->minrawlen = RAW_LENGTH;
 	quigg_gt1000->maxrawlen = RAW_LENGTH;
 	quigg_gt1000->maxgaplen = (int)PROG_SPACE*1.1;
@@ -419,7 +421,7 @@ void quiggGT1000Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "quigg_gt1000";
-	module->version = "1.0";
+	module->version = "1.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -45,15 +45,12 @@
 #include "cpu_temp.h"
 
 #ifndef _WIN32
-static unsigned short loop = 1;
-static unsigned short threads = 0;
 static char cpu_path[] = "/sys/class/thermal/thermal_zone0/temp";
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
+static void pollDev(struct protocol_threads_t *node) {
 	struct JsonNode *json = (struct JsonNode *)node->param;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
@@ -61,103 +58,82 @@ static void *thread(void *param) {
 
 	FILE *fp = NULL;
 	double itmp = 0;
-	int *id = MALLOC(sizeof(int));
 	char *content = NULL;
-	int nrloops = 0, nrid = 0, y = 0, interval = 0;
 	double temp_offset = 0.0;
 	size_t bytes = 0;
 
-	threads++;
-
-	if(id == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
-	}
+	json_find_number(json, "temperature-offset", &temp_offset);
 
+	pthread_mutex_lock(&lock);
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
-			if(json_find_number(jchild, "id", &itmp) == 0) {
-				id = REALLOC(id, (sizeof(int)*(size_t)(nrid+1)));
-				id[nrid] = (int)round(itmp);
-				nrid++;
+			if(json_find_number(jchild, "id", &itmp) != 0) {
+				jchild = jchild->next;
+				continue;
 			}
-			jchild = jchild->next;
-		}
-	}
+			if((fp = fopen(cpu_path, "rb"))) {
+				fstat(fileno(fp), &st);
+				bytes = (size_t)st.st_size;
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
+				if((content = REALLOC(content, bytes+1)) == NULL) {
+					fprintf(stderr, "out of memory\n");
+					exit(EXIT_FAILURE);
+				}
+				memset(content, '\0', bytes+1);
 
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for(y=0;y<nrid;y++) {
-				if((fp = fopen(cpu_path, "rb"))) {
-					fstat(fileno(fp), &st);
-					bytes = (size_t)st.st_size;
-
-					if((content = REALLOC(content, bytes+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					memset(content, '\0', bytes+1);
-
-					if(fread(content, sizeof(char), bytes, fp) == -1) {
-						logprintf(LOG_NOTICE, "cannot read file: %s", cpu_path);
-						fclose(fp);
-						break;
-					} else {
-						fclose(fp);
-						double temp = atof(content)+temp_offset;
-						FREE(content);
-
-						cpuTemp->message = json_mkobject();
-						JsonNode *code = json_mkobject();
-						json_append_member(code, "id", json_mknumber(id[y], 0));
-						json_append_member(code, "temperature", json_mknumber((temp/1000), 3));
-
-						json_append_member(cpuTemp->message, "message", code);
-						json_append_member(cpuTemp->message, "origin", json_mkstring("receiver"));
-						json_append_member(cpuTemp->message, "protocol", json_mkstring(cpuTemp->id));
-
-						if(pilight.broadcast != NULL) {
-							pilight.broadcast(cpuTemp->id, cpuTemp->message, PROTOCOL);
-						}
-						json_delete(cpuTemp->message);
-						cpuTemp->message = NULL;
-					}
+				if(fread(content, sizeof(char), bytes, fp) == -1) {
+					logprintf(LOG_NOTICE, "cannot read file: %s", cpu_path);
+					fclose(fp);
+					break;
 				} else {
-					logprintf(LOG_NOTICE, "CPU sysfs \"%s\" does not exist", cpu_path);
+					fclose(fp);
+					double temp = atof(content)+temp_offset;
+
+					cpuTemp->message = json_mkobject();
+					JsonNode *code = json_mkobject();
+					json_append_member(code, "id", json_mknumber((int)round(itmp), 0));
+					json_append_member(code, "temperature", json_mknumber((temp/1000), 3));
+
+					json_append_member(cpuTemp->message, "message", code);
+					json_append_member(cpuTemp->message, "origin", json_mkstring("receiver"));
+					json_append_member(cpuTemp->message, "protocol", json_mkstring(cpuTemp->id));
+
+					if(pilight.broadcast != NULL) {
+						pilight.broadcast(cpuTemp->id, cpuTemp->message, PROTOCOL);
+					}
+					json_delete(cpuTemp->message);
+					cpuTemp->message = NULL;
 				}
+			} else {
+				logprintf(LOG_NOTICE, "CPU sysfs \"%s\" does not exist", cpu_path);
 			}
-			pthread_mutex_unlock(&lock);
+			jchild = jchild->next;
 		}
 	}
 	pthread_mutex_unlock(&lock);
 
-	FREE(id);
-	threads--;
-	return (void *)NULL;
+	if(content != NULL) {
+		FREE(content);
+	}
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
 	char *output = json_stringify(jdevice, NULL);
 	JsonNode *json = json_decode(output);
 	json_free(output);
+	double itmp = 0;
+	int interval = 10;
 
-	struct protocol_threads_t *node = protocol_thread_init(cpuTemp, json);
-	return threads_register("cpu_temp", &thread, (void *)node, 0);
+	if(json_find_number(json, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
+
+	protocol_poll_init(cpuTemp, json, interval, pollDev);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(cpuTemp);
-	while(threads > 0) {
-		usleep(10);
-	}
+	protocol_poll_stop(cpuTemp);
 	protocol_thread_free(cpuTemp);
 }
 #endif
@@ -196,7 +172,7 @@ void cpuTempInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "cpu_temp";
-	module->version = "1.6";
+	module->version = "2.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -55,6 +55,8 @@ typedef struct settings_t {
 	time_t update;
 	int ointerval;
 	int interval;
+	int firstrun;
+	int timeout;
 	
 	struct settings_t *next;
 } settings_t;
@@ -64,7 +66,6 @@ static pthread_mutexattr_t attr;
 
 static struct settings_t *settings;
 static unsigned short loop = 1;
-static unsigned short threads = 0;
 
 
 static void callback(int code, char *data, int size, char *type, void *userdata) {
@@ -197,9 +198,43 @@ static void callback(int code, char *data, int size, char *type, void *userdata)
 	// }
 }
 
-static void *openweathermapParse(void *param) {
-	struct protocol_threads_t *thread = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)thread->param;
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *wnode = node->userdata;
+	char url[1024];
+
+	if(wnode == NULL || loop == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	wnode->timeout += INTERVAL;
+	if(wnode->timeout >= wnode->interval || node->triggered == 1 || wnode->firstrun == 1) {
+		wnode->timeout = 0;
+		wnode->interval = wnode->ointerval;
+
+		sprintf(url, "http://api.openweathermap.org/data/2.5/weather?q=%s,%s&APPID=8db24c4ac56251371c7ea87fd3115493", wnode->location, wnode->country);
+		http_get_content_cached(url, callback, wnode);
+	} else {
+		openweathermap->message = json_mkobject();
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "location", json_mkstring(wnode->location));
+		json_append_member(code, "country", json_mkstring(wnode->country));
+		json_append_member(code, "update", json_mknumber(1, 0));
+		json_append_member(openweathermap->message, "message", code);
+		json_append_member(openweathermap->message, "origin", json_mkstring("receiver"));
+		json_append_member(openweathermap->message, "protocol", json_mkstring(openweathermap->id));
+		if(pilight.broadcast != NULL) {
+			pilight.broadcast(openweathermap->id, openweathermap->message, PROTOCOL);
+		}
+		json_delete(openweathermap->message);
+		openweathermap->message = NULL;
+	}
+	wnode->firstrun = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	struct JsonNode *json = NULL;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
@@ -208,13 +243,12 @@ static void *openweathermapParse(void *param) {
 	wnode->ointerval = 86400;
 	wnode->interval = 86400;
 
-	int event = 0;
-	int firstrun = 1, nrloops = 0, timeout = 0;
 	double itmp = 0.0;
 
-	char url[1024];
-
-	threads++;
+	loop = 1;
+	char *output = json_stringify(jdevice, NULL);
+	json = json_decode(output);
+	json_free(output);
 
 	if(wnode == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -248,7 +282,7 @@ static void *openweathermapParse(void *param) {
 				jchild1 = jchild1->next;
 			}
 			if(has_country == 1 && has_location == 1) {
-				wnode->thread = thread;
+				wnode->thread = NULL;
 				wnode->next = settings;
 				settings = wnode;
 			} else {
@@ -266,59 +300,20 @@ static void *openweathermapParse(void *param) {
 	}
 
 	if(wnode == NULL) {
-		return 0;
+		json_delete(json);
+		return NULL;
 	}
 
 	if(json_find_number(json, "poll-interval", &itmp) == 0)
 		wnode->interval = (int)round(itmp);
 	wnode->ointerval = wnode->interval;
+	wnode->firstrun = 1;
+	wnode->timeout = 0;
 
-	while(loop) {
-		event = protocol_thread_wait(thread, INTERVAL, &nrloops);
-		pthread_mutex_lock(&lock);
-		if(loop == 0) {
-			break;
-		}
-		timeout += INTERVAL;
-		if(timeout >= wnode->interval || event != ETIMEDOUT || firstrun == 1) {
-			timeout = 0;
-			wnode->interval = wnode->ointerval;
-
-			sprintf(url, "http://api.openweathermap.org/data/2.5/weather?q=%s,%s&APPID=8db24c4ac56251371c7ea87fd3115493", wnode->location, wnode->country);
-			http_get_content(url, callback, wnode);
-		} else {
-			openweathermap->message = json_mkobject();
-			JsonNode *code = json_mkobject();
-			json_append_member(code, "location", json_mkstring(wnode->location));
-			json_append_member(code, "country", json_mkstring(wnode->country));
-			json_append_member(code, "update", json_mknumber(1, 0));
-			json_append_member(openweathermap->message, "message", code);
-			json_append_member(openweathermap->message, "origin", json_mkstring("receiver"));
-			json_append_member(openweathermap->message, "protocol", json_mkstring(openweathermap->id));
-			if(pilight.broadcast != NULL) {
-				pilight.broadcast(openweathermap->id, openweathermap->message, PROTOCOL);
-			}
-			json_delete(openweathermap->message);
-			openweathermap->message = NULL;
-		}
-		firstrun = 0;
-
-		pthread_mutex_unlock(&lock);
-	}
-	pthread_mutex_unlock(&lock);
+	wnode->thread = protocol_poll_init(openweathermap, json, INTERVAL, pollDev);
+	wnode->thread->userdata = wnode;
 
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
-
-	struct protocol_threads_t *node = protocol_thread_init(openweathermap, json);
-	return threads_register("openweathermap", &openweathermapParse, (void *)node, 0);
+	return NULL;
 }
 
 static int checkValues(JsonNode *code) {
@@ -353,9 +348,8 @@ static int createCode(JsonNode *code) {
 		while(wtmp) {
 			if(strcmp(wtmp->country, country) == 0
 			   && strcmp(wtmp->location, location) == 0) {
-				if((currenttime-wtmp->update) > INTERVAL) {
-					pthread_mutex_unlock(&wtmp->thread->mutex);
-					pthread_cond_signal(&wtmp->thread->cond);
+				if(wtmp->thread != NULL && (currenttime-wtmp->update) > INTERVAL) {
+					protocol_poll_trigger(wtmp->thread);
 					wtmp->update = time(NULL);
 				}
 			}
@@ -371,9 +365,7 @@ static int createCode(JsonNode *code) {
 static void threadGC(void) {
 	loop = 0;
 	protocol_thread_stop(openweathermap);
-	while(threads > 0) {
-		usleep(10);
-	}
+	protocol_poll_stop(openweathermap);
 	protocol_thread_free(openweathermap);
 
 	struct settings_t *wtmp = NULL;
@@ -440,7 +432,7 @@ void openweathermapInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "openweathermap";
-	module->version = "1.12";
+	module->version = "2.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -48,7 +48,6 @@
 
 #ifndef _WIN32
 static unsigned short loop = 1;
-static unsigned short threads = 0;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
@@ -70,19 +69,60 @@ typedef struct settings_t {
 
 static struct settings_t *settings = NULL;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *pnode = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)pnode->param;
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *lnode = node->userdata;
+	int pid = 0;
+
+	if(lnode == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(lnode->wait == 0) {
+		struct JsonNode *message = json_mkobject();
+
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "name", json_mkstring(lnode->name));
+
+		if((pid = (int)findproc(lnode->program, lnode->arguments, 0)) > 0) {
+			lnode->currentstate = 1;
+			json_append_member(code, "state", json_mkstring("running"));
+			json_append_member(code, "pid", json_mknumber((int)pid, 0));
+		} else {
+			lnode->currentstate = 0;
+			json_append_member(code, "state", json_mkstring("stopped"));
+			json_append_member(code, "pid", json_mknumber(0, 0));
+		}
+		json_append_member(message, "message", code);
+		json_append_member(message, "origin", json_mkstring("receiver"));
+		json_append_member(message, "protocol", json_mkstring(program->id));
+
+		if(lnode->currentstate != lnode->laststate) {
+			lnode->laststate = lnode->currentstate;
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(program->id, message, PROTOCOL);
+			}
+		}
+		json_delete(message);
+		message = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	struct JsonNode *json = NULL;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
 	char *prog = NULL, *args = NULL, *stopcmd = NULL, *startcmd = NULL;
 
-	int interval = 1, nrloops = 0;
-	int pid = 0;
+	int interval = 1;
 	double itmp = 0;
 
-	threads++;
+	loop = 1;
+	char *output = json_stringify(jdevice, NULL);
+	json = json_decode(output);
+	json_free(output);
 
 	json_find_string(json, "program", &prog);
 	json_find_string(json, "arguments", &args);
@@ -153,7 +193,6 @@ static void *thread(void *param) {
 		}
 	}
 
-	lnode->thread = pnode;
 	lnode->laststate = -1;
 
 	lnode->next = settings;
@@ -162,54 +201,10 @@ static void *thread(void *param) {
 	if(json_find_number(json, "poll-interval", &itmp) == 0)
 		interval = (int)round(itmp);
 
-	while(loop) {
-		if(protocol_thread_wait(pnode, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(lnode->wait == 0) {
-				struct JsonNode *message = json_mkobject();
-
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "name", json_mkstring(lnode->name));
-
-				if((pid = (int)findproc(lnode->program, lnode->arguments, 0)) > 0) {
-					lnode->currentstate = 1;
-					json_append_member(code, "state", json_mkstring("running"));
-					json_append_member(code, "pid", json_mknumber((int)pid, 0));
-				} else {
-					lnode->currentstate = 0;
-					json_append_member(code, "state", json_mkstring("stopped"));
-					json_append_member(code, "pid", json_mknumber(0, 0));
-				}
-				json_append_member(message, "message", code);
-				json_append_member(message, "origin", json_mkstring("receiver"));
-				json_append_member(message, "protocol", json_mkstring(program->id));
-
-				if(lnode->currentstate != lnode->laststate) {
-					lnode->laststate = lnode->currentstate;
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(program->id, message, PROTOCOL);
-					}
-				}
-				json_delete(message);
-				message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
-		}
-	}
-	pthread_mutex_unlock(&lock);
+	lnode->thread = protocol_poll_init(program, json, interval, pollDev);
+	lnode->thread->userdata = lnode;
 
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
-
-	struct protocol_threads_t *node = protocol_thread_init(program, json);
-	return threads_register("program", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static void *execute(void *param) {
@@ -238,8 +233,7 @@ static void *execute(void *param) {
 	p->hasthread = 0;
 	p->laststate = -1;
 
-	pthread_mutex_unlock(&p->thread->mutex);
-	pthread_cond_signal(&p->thread->cond);
+	protocol_poll_trigger(p->thread);
 
 	return NULL;
 }
@@ -331,9 +325,7 @@ static int createCode(JsonNode *code) {
 static void threadGC(void) {
 	loop = 0;
 	protocol_thread_stop(program);
-	while(threads > 0) {
-		usleep(10);
-	}
+	protocol_poll_stop(program);
 	protocol_thread_free(program);
 
 	struct settings_t *tmp;
@@ -402,7 +394,7 @@ void programInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "program";
-	module->version = "1.6";
+	module->version = "2.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -57,6 +57,8 @@ typedef struct settings_t {
 
 	char *stmp;
 	int interval;
+	int firstrun;
+	int timeout;
 	int ointerval;
 
 	time_t update;
@@ -69,7 +71,6 @@ static pthread_mutexattr_t attr;
 
 static struct settings_t *settings;
 static unsigned short loop = 1;
-static unsigned short threads = 0;
 
 static void callback1(int code, char *data, int size, char *type, void *userdata) {
 	struct settings_t *wnode = userdata;
@@ -221,7 +222,7 @@ static void callback(int code, char *data, int size, char *type, void *userdata)
 								printf("api.wunderground.com json has no temp_c key");
 							} else {
 								sprintf(url, "http://api.wunderground.com/api/%s/astronomy/q/%s/%s.json", wnode->api, wnode->country, wnode->location);
-								http_get_content(url, callback1, wnode);
+								http_get_content_cached(url, callback1, wnode);
 							}
 						}
 					} else {
@@ -242,9 +243,44 @@ static void callback(int code, char *data, int size, char *type, void *userdata)
 	}
 }
 
-static void *thread(void *param) {
-	struct protocol_threads_t *thread = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)thread->param;
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *wnode = node->userdata;
+	char url[1024];
+
+	if(wnode == NULL || loop == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	wnode->timeout += INTERVAL;
+	if(wnode->timeout >= wnode->interval || node->triggered == 1 || wnode->firstrun == 1) {
+		wnode->timeout = 0;
+		wnode->interval = wnode->ointerval;
+
+		sprintf(url, "http://api.wunderground.com/api/%s/geolookup/conditions/q/%s/%s.json", wnode->api, wnode->country, wnode->location);
+		http_get_content_cached(url, callback, wnode);
+	} else {
+		wunderground->message = json_mkobject();
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "api", json_mkstring(wnode->api));
+		json_append_member(code, "location", json_mkstring(wnode->location));
+		json_append_member(code, "country", json_mkstring(wnode->country));
+		json_append_member(code, "update", json_mknumber(1, 0));
+		json_append_member(wunderground->message, "message", code);
+		json_append_member(wunderground->message, "origin", json_mkstring("receiver"));
+		json_append_member(wunderground->message, "protocol", json_mkstring(wunderground->id));
+		if(pilight.broadcast != NULL) {
+			pilight.broadcast(wunderground->id, wunderground->message, PROTOCOL);
+		}
+		json_delete(wunderground->message);
+		wunderground->message = NULL;
+	}
+	wnode->firstrun = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	struct JsonNode *json = NULL;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
@@ -254,10 +290,6 @@ static void *thread(void *param) {
 	wnode->ointerval = 86400;
 	wnode->stmp = NULL;
 
-	int event = 0;
-	int firstrun = 1, nrloops = 0, timeout = 0;
-
-	char url[1024];
 	double itmp = -1;
 
 	if(wnode == NULL) {
@@ -265,7 +297,10 @@ static void *thread(void *param) {
 		exit(EXIT_FAILURE);
 	}
 
-	threads++;
+	loop = 1;
+	char *output = json_stringify(jdevice, NULL);
+	json = json_decode(output);
+	json_free(output);
 
 	int has_country = 0, has_api = 0, has_location = 0;
 	if((jid = json_find_member(json, "id"))) {
@@ -302,7 +337,7 @@ static void *thread(void *param) {
 				jchild1 = jchild1->next;
 			}
 			if(has_country == 1 && has_api == 1 && has_location == 1) {
-				wnode->thread = thread;
+				wnode->thread = NULL;
 				wnode->next = settings;
 				settings = wnode;
 			} else {
@@ -322,60 +357,21 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(!wnode) {
-		return 0;
+	if(wnode == NULL) {
+		json_delete(json);
+		return NULL;
 	}
 
 	if(json_find_number(json, "poll-interval", &itmp) == 0)
 		wnode->interval = (int)round(itmp);
 	wnode->ointerval = wnode->interval;
+	wnode->firstrun = 1;
+	wnode->timeout = 0;
 
-	while(loop) {
-		event = protocol_thread_wait(thread, INTERVAL, &nrloops);
-		pthread_mutex_lock(&lock);
-		if(loop == 0) {
-			break;
-		}
-		timeout += INTERVAL;
-		if(timeout >= wnode->interval || event != ETIMEDOUT || firstrun == 1) {
-			timeout = 0;
-			wnode->interval = wnode->ointerval;
-
-			sprintf(url, "http://api.wunderground.com/api/%s/geolookup/conditions/q/%s/%s.json", wnode->api, wnode->country, wnode->location);
-			http_get_content(url, callback, wnode);
-		} else {
-			wunderground->message = json_mkobject();
-			JsonNode *code = json_mkobject();
-			json_append_member(code, "api", json_mkstring(wnode->api));
-			json_append_member(code, "location", json_mkstring(wnode->location));
-			json_append_member(code, "country", json_mkstring(wnode->country));
-			json_append_member(code, "update", json_mknumber(1, 0));
-			json_append_member(wunderground->message, "message", code);
-			json_append_member(wunderground->message, "origin", json_mkstring("receiver"));
-			json_append_member(wunderground->message, "protocol", json_mkstring(wunderground->id));
-			if(pilight.broadcast != NULL) {
-				pilight.broadcast(wunderground->id, wunderground->message, PROTOCOL);
-			}
-			json_delete(wunderground->message);
-			wunderground->message = NULL;
-		}
-		firstrun = 0;
-		pthread_mutex_unlock(&lock);
-	}
-	pthread_mutex_unlock(&lock);
-
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+	wnode->thread = protocol_poll_init(wunderground, json, INTERVAL, pollDev);
+	wnode->thread->userdata = wnode;
 
-	struct protocol_threads_t *node = protocol_thread_init(wunderground, json);
-	return threads_register("wunderground", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static int checkValues(JsonNode *code) {
@@ -413,9 +409,8 @@ static int createCode(JsonNode *code) {
 			if(strcmp(wtmp->country, country) == 0
 			   && strcmp(wtmp->location, location) == 0
 			   && strcmp(wtmp->api, api) == 0) {
-				if((currenttime-wtmp->update) > INTERVAL) {
-					pthread_mutex_unlock(&wtmp->thread->mutex);
-					pthread_cond_signal(&wtmp->thread->cond);
+				if(wtmp->thread != NULL && (currenttime-wtmp->update) > INTERVAL) {
+					protocol_poll_trigger(wtmp->thread);
 					wtmp->update = time(NULL);
 				}
 			}
@@ -431,9 +426,7 @@ static int createCode(JsonNode *code) {
 static void threadGC(void) {
 	loop = 0;
 	protocol_thread_stop(wunderground);
-	while(threads > 0) {
-		usleep(10);
-	}
+	protocol_poll_stop(wunderground);
 	protocol_thread_free(wunderground);
 
 	struct settings_t *wtmp = NULL;
@@ -503,7 +496,7 @@ void wundergroundInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "wunderground";
-	module->version = "1.13";
+	module->version = "2.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -66,10 +66,12 @@ typedef struct settings_t {
 	short *mb;
 	short *mc;
 	short *md;
+	double temp_offset;
+	double pressure_offset;
+	unsigned char oversampling;
 } settings_t;
 
 static unsigned short loop = 1;
-static int threads = 0;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
@@ -81,16 +83,13 @@ static int readReg16(int fd, int reg) {
 	return ((res << 8) & 0xFF00) | ((res >> 8) & 0xFF);
 }
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *) param;
-	struct JsonNode *json = (struct JsonNode *) node->param;
+static struct settings_t *setup(struct JsonNode *json) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct settings_t *bmp180data = MALLOC(sizeof(struct settings_t));
-	int y = 0, interval = 10, nrloops = 0;
+	int y = 0;
 	char *stmp = NULL;
-	double itmp = -1, temp_offset = 0, pressure_offset = 0;
-	unsigned char oversampling = 1;
+	double itmp = -1;
 
 	if(bmp180data == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -111,8 +110,9 @@ static void *thread(void *param) {
 	bmp180data->mb = 0;
 	bmp180data->mc = 0;
 	bmp180data->md = 0;
-
-	threads++;
+	bmp180data->temp_offset = 0;
+	bmp180data->pressure_offset = 0;
+	bmp180data->oversampling = 1;
 
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
@@ -136,12 +136,10 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int) round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
-	json_find_number(json, "pressure-offset", &pressure_offset);
+	json_find_number(json, "temperature-offset", &bmp180data->temp_offset);
+	json_find_number(json, "pressure-offset", &bmp180data->pressure_offset);
 	if(json_find_number(json, "oversampling", &itmp) == 0) {
-		oversampling = (unsigned char) itmp;
+		bmp180data->oversampling = (unsigned char) itmp;
 	}
 
 	// resize the memory blocks pointed to by the different pointers
@@ -216,103 +214,116 @@ static void *thread(void *param) {
 		}
 	}
 
-	while (loop) {
-		if (protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for (y = 0; y < bmp180data->nrid; y++) {
-				if (bmp180data->fd[y] > 0) {
-					// uncompensated temperature value
-					unsigned short ut = 0;
-
-					// write 0x2E into Register 0xF4 to request a temperature reading.
-					wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4, 0x2E);
-
-					// wait at least 4.5ms: we suspend execution for 5000 microseconds.
-					usleep(5000);
-
-					// read the two byte result from address 0xF6.
-					ut = (unsigned short) readReg16(bmp180data->fd[y], 0xF6);
-
-					// calculate temperature (in units of 0.1 deg C) given uncompensated value
-					int x1, x2;
-					x1 = (((int) ut - (int) bmp180data->ac6[y])) * (int) bmp180data->ac5[y] >> 15;
-					x2 = ((int) bmp180data->mc[y] << 11) / (x1 + bmp180data->md[y]);
-					int b5 = x1 + x2;
-					int temp = ((b5 + 8) >> 4);
-
-					// uncompensated pressure value
-					unsigned int up = 0;
-
-					// write 0x34+(BMP085_OVERSAMPLING_SETTING<<6) into register 0xF4
-					// request a pressure reading with specified oversampling setting
-					wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4,
-							0x34 + (oversampling << 6));
-
-					// wait for conversion, delay time dependent on oversampling setting
-					unsigned int delay = (unsigned int) ((2 + (3 << oversampling)) * 1000);
-					usleep(delay);
-
-					// read the three byte result (block data): 0xF6 = MSB, 0xF7 = LSB and 0xF8 = XLSB
-					int msb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF6);
-					int lsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF7);
-					int xlsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF8);
-					up = (((unsigned int) msb << 16) | ((unsigned int) lsb << 8) | (unsigned int) xlsb)
-							>> (8 - oversampling);
-
-					// calculate pressure (in Pa) given uncompensated value
-					int x3, b3, b6, pressure;
-					unsigned int b4, b7;
-
-					// calculate B6
-					b6 = b5 - 4000;
-
-					// calculate B3
-					x1 = (bmp180data->b2[y] * (b6 * b6) >> 12) >> 11;
-					x2 = (bmp180data->ac2[y] * b6) >> 11;
-					x3 = x1 + x2;
-					b3 = (((bmp180data->ac1[y] * 4 + x3) << oversampling) + 2) >> 2;
-
-					// calculate B4
-					x1 = (bmp180data->ac3[y] * b6) >> 13;
-					x2 = (bmp180data->b1[y] * ((b6 * b6) >> 12)) >> 16;
-					x3 = ((x1 + x2) + 2) >> 2;
-					b4 = (bmp180data->ac4[y] * (unsigned int) (x3 + 32768)) >> 15;
-
-					// calculate B7
-					b7 = ((up - (unsigned int) b3) * ((unsigned int) 50000 >> oversampling));
-
-					// calculate pressure in Pa
-					pressure = b7 < 0x80000000 ? (int) ((b7 << 1) / b4) : (int) ((b7 / b4) << 1);
-					x1 = (pressure >> 8) * (pressure >> 8);
-					x1 = (x1 * 3038) >> 16;
-					x2 = (-7357 * pressure) >> 16;
-					pressure += (x1 + x2 + 3791) >> 4;
-
-					bmp180->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "id", json_mkstring(bmp180data->id[y]));
-					json_append_member(code, "temperature", json_mknumber(((double) temp / 10) + temp_offset, 1)); // in deg C
-					json_append_member(code, "pressure", json_mknumber(((double) pressure / 100) + pressure_offset, 1)); // in hPa
-
-					json_append_member(bmp180->message, "message", code);
-					json_append_member(bmp180->message, "origin", json_mkstring("receiver"));
-					json_append_member(bmp180->message, "protocol", json_mkstring(bmp180->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(bmp180->id, bmp180->message, PROTOCOL);
-					}
-					json_delete(bmp180->message);
-					bmp180->message = NULL;
-				} else {
-					logprintf(LOG_NOTICE, "error connecting to bmp180");
-					logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
-					logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
-					protocol_thread_wait(node, 1, &nrloops);
-				}
+	return bmp180data;
+}
+
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *bmp180data = node->userdata;
+	int y = 0, nrloops = 0;
+
+	if(bmp180data == NULL) {
+		bmp180data = node->userdata = setup(node->param);
+	}
+
+	pthread_mutex_lock(&lock);
+	for (y = 0; y < bmp180data->nrid; y++) {
+		if (bmp180data->fd[y] > 0) {
+			// uncompensated temperature value
+			unsigned short ut = 0;
+
+			// write 0x2E into Register 0xF4 to request a temperature reading.
+			wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4, 0x2E);
+
+			// wait at least 4.5ms: we suspend execution for 5000 microseconds.
+			usleep(5000);
+
+			// read the two byte result from address 0xF6.
+			ut = (unsigned short) readReg16(bmp180data->fd[y], 0xF6);
+
+			// calculate temperature (in units of 0.1 deg C) given uncompensated value
+			int x1, x2;
+			x1 = (((int) ut - (int) bmp180data->ac6[y])) * (int) bmp180data->ac5[y] >> 15;
+			x2 = ((int) bmp180data->mc[y] << 11) / (x1 + bmp180data->md[y]);
+			int b5 = x1 + x2;
+			int temp = ((b5 + 8) >> 4);
+
+			// uncompensated pressure value
+			unsigned int up = 0;
+
+			// write 0x34+(BMP085_OVERSAMPLING_SETTING<<6) into register 0xF4
+			// request a pressure reading with specified oversampling setting
+			wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4,
+					0x34 + (bmp180data->oversampling << 6));
+
+			// wait for conversion, delay time dependent on oversampling setting
+			unsigned int delay = (unsigned int) ((2 + (3 << bmp180data->oversampling)) * 1000);
+			usleep(delay);
+
+			// read the three byte result (block data): 0xF6 = MSB, 0xF7 = LSB and 0xF8 = XLSB
+			int msb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF6);
+			int lsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF7);
+			int xlsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF8);
+			up = (((unsigned int) msb << 16) | ((unsigned int) lsb << 8) | (unsigned int) xlsb)
+					>> (8 - bmp180data->oversampling);
+
+			// calculate pressure (in Pa) given uncompensated value
+			int x3, b3, b6, pressure;
+			unsigned int b4, b7;
+
+			// calculate B6
+			b6 = b5 - 4000;
+
+			// calculate B3
+			x1 = (bmp180data->b2[y] * (b6 * b6) >> 12) >> 11;
+			x2 = (bmp180data->ac2[y] * b6) >> 11;
+			x3 = x1 + x2;
+			b3 = (((bmp180data->ac1[y] * 4 + x3) << bmp180data->oversampling) + 2) >> 2;
+
+			// calculate B4
+			x1 = (bmp180data->ac3[y] * b6) >> 13;
+			x2 = (bmp180data->b1[y] * ((b6 * b6) >> 12)) >> 16;
+			x3 = ((x1 + x2) + 2) >> 2;
+			b4 = (bmp180data->ac4[y] * (unsigned int) (x3 + 32768)) >> 15;
+
+			// calculate B7
+			b7 = ((up - (unsigned int) b3) * ((unsigned int) 50000 >> bmp180data->oversampling));
+
+			// calculate pressure in Pa
+			pressure = b7 < 0x80000000 ? (int) ((b7 << 1) / b4) : (int) ((b7 / b4) << 1);
+			x1 = (pressure >> 8) * (pressure >> 8);
+			x1 = (x1 * 3038) >> 16;
+			x2 = (-7357 * pressure) >> 16;
+			pressure += (x1 + x2 + 3791) >> 4;
+
+			bmp180->message = json_mkobject();
+			JsonNode *code = json_mkobject();
+			json_append_member(code, "id", json_mkstring(bmp180data->id[y]));
+			json_append_member(code, "temperature", json_mknumber(((double) temp / 10) + bmp180data->temp_offset, 1)); // in deg C
+			json_append_member(code, "pressure", json_mknumber(((double) pressure / 100) + bmp180data->pressure_offset, 1)); // in hPa
+
+			json_append_member(bmp180->message, "message", code);
+			json_append_member(bmp180->message, "origin", json_mkstring("receiver"));
+			json_append_member(bmp180->message, "protocol", json_mkstring(bmp180->id));
+
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(bmp180->id, bmp180->message, PROTOCOL);
+			}
+			json_delete(bmp180->message);
+			bmp180->message = NULL;
+		} else {
+			logprintf(LOG_NOTICE, "error connecting to bmp180");
+			logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
+			logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
+			if(loop == 1) {
+				protocol_thread_wait(node, 1, &nrloops);
 			}
-			pthread_mutex_unlock(&lock);
 		}
 	}
+	pthread_mutex_unlock(&lock);
+}
+
+static void cleanup(struct settings_t *bmp180data) {
+	int y = 0;
 
 	if (bmp180data->id) {
 		for (y = 0; y < bmp180data->nrid; y++) {
@@ -362,13 +373,13 @@ static void *thread(void *param) {
 		FREE(bmp180data->fd);
 	}
 	FREE(bmp180data);
-	threads--;
-
-	return (void *) NULL;
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	char *platform = GPIO_PLATFORM;
+	double itmp = 0;
+	int interval = 10;
+
 	if(settings_find_string("gpio-platform", &platform) != 0 || strcmp(platform, "none") == 0) {
 		logprintf(LOG_ERR, "gpio_switch: no gpio-platform configured");
 		exit(EXIT_FAILURE);
@@ -379,18 +390,26 @@ static struct threadqueue_t *initDev(JsonNode *jdevice) {
 		JsonNode *json = json_decode(output);
 		json_free(output);
 
-		struct protocol_threads_t *node = protocol_thread_init(bmp180, json);
-		return threads_register("bmp180", &thread, (void *) node, 0);
-	} else {
-		return NULL;
+		if(json_find_number(json, "poll-interval", &itmp) == 0)
+			interval = (int) round(itmp);
+
+		protocol_poll_init(bmp180, json, interval, pollDev);
 	}
+	return NULL;
 }
 
 static void threadGC(void) {
+	struct protocol_threads_t *tmp = NULL;
+
 	loop = 0;
 	protocol_thread_stop(bmp180);
-	while (threads > 0) {
-		usleep(10);
+	protocol_poll_stop(bmp180);
+
+	for(tmp=bmp180->threads;tmp!=NULL;tmp=tmp->next) {
+		if(tmp->userdata != NULL) {
+			cleanup(tmp->userdata);
+			tmp->userdata = NULL;
+		}
 	}
 	protocol_thread_free(bmp180);
 }
@@ -437,7 +456,7 @@ void bmp180Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "bmp180";
-	module->version = "2.2";
+	module->version = "3.0";
 	module->reqversion = "7.0";
 	module->reqcommit = "186";
 }
@@ -52,7 +52,6 @@
 #if !defined(__FreeBSD__) && !defined(_WIN32)
 
 static unsigned short loop = 1;
-static unsigned short threads = 0;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
@@ -68,17 +67,14 @@ static uint8_t sizecvt(const int read_value) {
 	return (uint8_t)read_value;
 }
 
-static void *dht11Parse(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
+static void pollDev(struct protocol_threads_t *node) {
 	struct JsonNode *json = (struct JsonNode *)node->param;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	int *id = 0;
-	int nrid = 0, y = 0, interval = 10, nrloops = 0, x = 0;
+	int nrid = 0, y = 0, nrloops = 0, x = 0;
 	double temp_offset = 0.0, humi_offset = 0.0, itmp = 0.0;
 
-	threads++;
-
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
@@ -91,107 +87,101 @@ static void *dht11Parse(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
 	json_find_number(json, "temperature-offset", &temp_offset);
 	json_find_number(json, "humidity-offset", &humi_offset);
 
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for(y=0;y<nrid;y++) {
-				int tries = 5;
-				unsigned short got_correct_date = 0;
-				while(tries && !got_correct_date && loop) {
-
-					uint8_t laststate = HIGH;
-					uint8_t counter = 0;
-					uint8_t j = 0, i = 0;
-
-					int dht11_dat[5] = {0,0,0,0,0};
-
-					// pull pin down for 18 milliseconds
-					pinMode(id[y], PINMODE_OUTPUT);
-					digitalWrite(id[y], HIGH);
-					usleep(500000);  // 500 ms
-					// then pull it up for 40 microseconds
-					digitalWrite(id[y], LOW);
-					usleep(20000);
-					// prepare to read the pin
-					pinMode(id[y], PINMODE_INPUT);
-
-					// detect change and read data
-					for(i=0; (i<MAXTIMINGS && loop); i++) {
-						counter = 0;
-						delayMicroseconds(10);
-
-						while((x = sizecvt(digitalRead(id[y]))) == laststate && x != -1 && loop) {
-							counter++;
-							delayMicroseconds(1);
-							if(counter == 255) {
-								break;
-							}
-						}
-						laststate = sizecvt(digitalRead(id[y]));
-
-						if(counter == 255) {
-							break;
-						}
-
-						// ignore first 3 transitions
-						if((i >= 4) && (i%2 == 0)) {
-
-							// shove each bit into the storage bytes
-							dht11_dat[(int)((double)j/8)] <<= 1;
-							if(counter > 16)
-								dht11_dat[(int)((double)j/8)] |= 1;
-							j++;
-						}
+	pthread_mutex_lock(&lock);
+	for(y=0;y<nrid;y++) {
+		int tries = 5;
+		unsigned short got_correct_date = 0;
+		while(tries && !got_correct_date && loop) {
+
+			uint8_t laststate = HIGH;
+			uint8_t counter = 0;
+			uint8_t j = 0, i = 0;
+
+			int dht11_dat[5] = {0,0,0,0,0};
+
+			// pull pin down for 18 milliseconds
+			pinMode(id[y], PINMODE_OUTPUT);
+			digitalWrite(id[y], HIGH);
+			usleep(500000);  // 500 ms
+			// then pull it up for 40 microseconds
+			digitalWrite(id[y], LOW);
+			usleep(20000);
+			// prepare to read the pin
+			pinMode(id[y], PINMODE_INPUT);
+
+			// detect change and read data
+			for(i=0; (i<MAXTIMINGS && loop); i++) {
+				counter = 0;
+				delayMicroseconds(10);
+
+				while((x = sizecvt(digitalRead(id[y]))) == laststate && x != -1 && loop) {
+					counter++;
+					delayMicroseconds(1);
+					if(counter == 255) {
+						break;
 					}
+				}
+				laststate = sizecvt(digitalRead(id[y]));
 
-					// check we read 40 bits (8bit x 5 ) + verify checksum in the last byte
-					// print it out if data is good
-					if((j >= 40) && (dht11_dat[4] == ((dht11_dat[0] + dht11_dat[1] + dht11_dat[2] + dht11_dat[3]) & 0xFF))) {
-						got_correct_date = 1;
-
-						double h = dht11_dat[0];
-						double t = dht11_dat[2];
-						t += temp_offset;
-						h += humi_offset;
-
-						dht11->message = json_mkobject();
-						JsonNode *code = json_mkobject();
-						json_append_member(code, "gpio", json_mknumber(id[y], 0));
-						json_append_member(code, "temperature", json_mknumber(t, 1));
-						json_append_member(code, "humidity", json_mknumber(h, 1));
-
-						json_append_member(dht11->message, "message", code);
-						json_append_member(dht11->message, "origin", json_mkstring("receiver"));
-						json_append_member(dht11->message, "protocol", json_mkstring(dht11->id));
-
-						if(pilight.broadcast != NULL) {
-							pilight.broadcast(dht11->id, dht11->message, PROTOCOL);
-						}
-						json_delete(dht11->message);
-						dht11->message = NULL;
-					} else {
-						logprintf(LOG_DEBUG, "dht11 data checksum was wrong");
-						tries--;
-						protocol_thread_wait(node, 1, &nrloops);
-					}
+				if(counter == 255) {
+					break;
+				}
+
+				// ignore first 3 transitions
+				if((i >= 4) && (i%2 == 0)) {
+
+					// shove each bit into the storage bytes
+					dht11_dat[(int)((double)j/8)] <<= 1;
+					if(counter > 16)
+						dht11_dat[(int)((double)j/8)] |= 1;
+					j++;
 				}
 			}
-			pthread_mutex_unlock(&lock);
+
+			// check we read 40 bits (8bit x 5 ) + verify checksum in the last byte
+			// print it out if data is good
+			if((j >= 40) && (dht11_dat[4] == ((dht11_dat[0] + dht11_dat[1] + dht11_dat[2] + dht11_dat[3]) & 0xFF))) {
+				got_correct_date = 1;
+
+				double h = dht11_dat[0];
+				double t = dht11_dat[2];
+				t += temp_offset;
+				h += humi_offset;
+
+				dht11->message = json_mkobject();
+				JsonNode *code = json_mkobject();
+				json_append_member(code, "gpio", json_mknumber(id[y], 0));
+				json_append_member(code, "temperature", json_mknumber(t, 1));
+				json_append_member(code, "humidity", json_mknumber(h, 1));
+
+				json_append_member(dht11->message, "message", code);
+				json_append_member(dht11->message, "origin", json_mkstring("receiver"));
+				json_append_member(dht11->message, "protocol", json_mkstring(dht11->id));
+
+				if(pilight.broadcast != NULL) {
+					pilight.broadcast(dht11->id, dht11->message, PROTOCOL);
+				}
+				json_delete(dht11->message);
+				dht11->message = NULL;
+			} else {
+				logprintf(LOG_DEBUG, "dht11 data checksum was wrong");
+				tries--;
+				protocol_thread_wait(node, 1, &nrloops);
+			}
 		}
 	}
 	pthread_mutex_unlock(&lock);
 
 	FREE(id);
-	threads--;
-	return (void *)NULL;
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	double itmp = 0.0;
+	int interval = 10;
+
 	char *platform = GPIO_PLATFORM;
 	if(settings_find_string("gpio-platform", &platform) != 0 || strcmp(platform, "none") == 0) {
 		logprintf(LOG_ERR, "gpio_switch: no gpio-platform configured");
@@ -203,8 +193,11 @@ static struct threadqueue_t *initDev(JsonNode *jdevice) {
 		JsonNode *json = json_decode(output);
 		json_free(output);
 
-		struct protocol_threads_t *node = protocol_thread_init(dht11, json);
-		return threads_register("dht11", &dht11Parse, (void *)node, 0);
+		if(json_find_number(json, "poll-interval", &itmp) == 0)
+			interval = (int)round(itmp);
+
+		protocol_poll_init(dht11, json, interval, pollDev);
+		return NULL;
 	} else {
 		return NULL;
 	}
@@ -213,9 +206,7 @@ static struct threadqueue_t *initDev(JsonNode *jdevice) {
 static void threadGC(void) {
 	loop = 0;
 	protocol_thread_stop(dht11);
-	while(threads > 0) {
-		usleep(10);
-	}
+	protocol_poll_stop(dht11);
 	protocol_thread_free(dht11);
 }
 
@@ -287,7 +278,7 @@ void dht11Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "dht11";
-	module->version = "2.5";
+	module->version = "3.0";
 	module->reqversion = "7.0";
 	module->reqcommit = "186";
 }
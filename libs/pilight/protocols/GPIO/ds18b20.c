@@ -42,178 +42,111 @@
 #include "../../core/binary.h"
 #include "../../core/json.h"
 #include "../../core/gc.h"
+#include "../../core/w1.h"
 #include "ds18b20.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+typedef struct settings_t {
+	double temp_offset;
+} settings_t;
+
 static char source_path[21];
 
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
+/*
+ * All devices share a single bus, so the sensors of
+ * all devices due at the same time are read in the
+ * same pass.
+ */
+static struct w1_bus_t *bus = NULL;
+
+/*
+ * Called from the thread reading the sensor, so
+ * the message can't be shared between sensors.
+ */
+static void report(struct w1_sensor_t *sensor, void *userdata) {
+	struct settings_t *settings = userdata;
+	struct JsonNode *message = json_mkobject();
+	struct JsonNode *code = json_mkobject();
+
+	json_append_member(code, "id", json_mkstring(sensor->id));
+	json_append_member(code, "temperature", json_mknumber(sensor->temperature+settings->temp_offset, 3));
+
+	json_append_member(message, "message", code);
+	json_append_member(message, "origin", json_mkstring("receiver"));
+	json_append_member(message, "protocol", json_mkstring(ds18b20->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(ds18b20->id, message, PROTOCOL);
+	}
+	json_delete(message);
+}
+
+static void pollDev(struct protocol_threads_t *node) {
+	w1_bus_read(bus);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	double itmp = 0.0;
+	int interval = 10;
+
+	char *output = json_stringify(jdevice, NULL);
+	JsonNode *json = json_decode(output);
+	json_free(output);
+
+	if(json_find_number(json, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
 
-static void *ds18b20Parse(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+	struct protocol_threads_t *node = protocol_thread_init(ds18b20, json);
+	struct settings_t *settings = MALLOC(sizeof(struct settings_t));
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
+	char *stmp = NULL;
 
-#ifndef _WIN32
-	struct dirent *file = NULL;
-	struct stat st;
-
-	DIR *d = NULL;
-	FILE *fp = NULL;
-	char crcVar[5];
-	int w1valid = 0;
-	double w1temp = 0.0;
-	size_t bytes = 0;
-#endif
-	char **id = NULL, *stmp = NULL, *content = NULL;
-	char *ds18b20_sensor = NULL;
-	int nrid = 0, interval = 10, nrloops = 0, y = 0;
-	double temp_offset = 0.0, itmp = 0.0;
-
-	threads++;
+	if(settings == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	settings->temp_offset = 0.0;
+	json_find_number(json, "temperature-offset", &settings->temp_offset);
+	node->userdata = settings;
+
+	/*
+	 * The bus decides which sensors are due, so
+	 * check it every second.
+	 */
+	if(bus == NULL) {
+		bus = w1_bus_init(source_path, "28", report);
+		protocol_poll_init(ds18b20, NULL, 1, pollDev);
+	}
 
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			if(json_find_string(jchild, "id", &stmp) == 0) {
-				if((id = REALLOC(id, (sizeof(char *)*(size_t)(nrid+1)))) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				if((id[nrid] = MALLOC(strlen(stmp)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(id[nrid], stmp);
-				nrid++;
+				w1_bus_add(bus, stmp, interval, settings);
 			}
 			jchild = jchild->next;
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-#ifndef _WIN32
-			pthread_mutex_lock(&lock);
-			for(y=0;y<nrid;y++) {
-				if((ds18b20_sensor = REALLOC(ds18b20_sensor, strlen(source_path)+strlen(id[y])+5)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				sprintf(ds18b20_sensor, "%s28-%s/", source_path, id[y]);
-				if((d = opendir(ds18b20_sensor))) {
-					while((file = readdir(d)) != NULL) {
-						if(file->d_type == DT_REG) {
-							if(strcmp(file->d_name, "w1_slave") == 0) {
-								size_t w1slavelen = strlen(ds18b20_sensor)+10;
-								char ds18b20_w1slave[w1slavelen];
-								memset(ds18b20_w1slave, '\0', w1slavelen);
-								strncpy(ds18b20_w1slave, ds18b20_sensor, strlen(ds18b20_sensor));
-								strcat(ds18b20_w1slave, "w1_slave");
-
-								if(!(fp = fopen(ds18b20_w1slave, "rb"))) {
-									logprintf(LOG_ERR, "cannot read w1 file: %s", ds18b20_w1slave);
-									break;
-								}
-
-								fstat(fileno(fp), &st);
-								bytes = (size_t)st.st_size;
-
-								if((content = REALLOC(content, bytes+1)) == NULL) {
-									fprintf(stderr, "out of memory\n");
-									fclose(fp);
-									break;
-								}
-								memset(content, '\0', bytes+1);
-
-								if(fread(content, sizeof(char), bytes, fp) == -1) {
-									logprintf(LOG_ERR, "cannot read config file: %s", ds18b20_w1slave);
-									fclose(fp);
-									break;
-								}
-								fclose(fp);
-								w1valid = 0;
-
-								char **array = NULL;
-								unsigned int n = explode(content, "\n", &array);
-								if(n > 0) {
-									sscanf(array[0], "%*x %*x %*x %*x %*x %*x %*x %*x %*x : crc=%*x %s", crcVar);
-									if(strncmp(crcVar, "YES", 3) == 0 && n > 1) {
-										w1valid = 1;
-										sscanf(array[1], "%*x %*x %*x %*x %*x %*x %*x %*x %*x t=%lf", &w1temp);
-										w1temp = (w1temp/1000)+temp_offset;
-									}
-								}
-								array_free(&array, n);
-
-								if(w1valid) {
-									ds18b20->message = json_mkobject();
-
-									JsonNode *code = json_mkobject();
-
-									json_append_member(code, "id", json_mkstring(id[y]));
-									json_append_member(code, "temperature", json_mknumber(w1temp, 3));
-
-									json_append_member(ds18b20->message, "message", code);
-									json_append_member(ds18b20->message, "origin", json_mkstring("receiver"));
-									json_append_member(ds18b20->message, "protocol", json_mkstring(ds18b20->id));
-
-									if(pilight.broadcast != NULL) {
-										pilight.broadcast(ds18b20->id, ds18b20->message, PROTOCOL);
-									}
-									json_delete(ds18b20->message);
-									ds18b20->message = NULL;
-								}
-							}
-						}
-					}
-					closedir(d);
-				} else {
-					logprintf(LOG_ERR, "1-wire device %s does not exist", ds18b20_sensor);
-				}
-			}
-#endif
-			pthread_mutex_unlock(&lock);
-		}
-	}
-	pthread_mutex_unlock(&lock);
-
-	if(ds18b20_sensor) {
-		FREE(ds18b20_sensor);
-	}
-	if(content) {
-		FREE(content);
-	}
-	for(y=0;y<nrid;y++) {
-		FREE(id[y]);
-	}
-	FREE(id);
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
-
-	struct protocol_threads_t *node = protocol_thread_init(ds18b20, json);
-	return threads_register("ds18b20", &ds18b20Parse, (void *)node, 0);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
+	struct protocol_threads_t *tmp = NULL;
+	struct settings_t *settings = NULL;
+
 	protocol_thread_stop(ds18b20);
-	while(threads > 0) {
-		usleep(10);
+	protocol_poll_stop(ds18b20);
+
+	if(bus != NULL) {
+		w1_bus_free(bus);
+		bus = NULL;
+	}
+	for(tmp=ds18b20->threads;tmp!=NULL;tmp=tmp->next) {
+		if((settings = tmp->userdata) != NULL) {
+			FREE(settings);
+			tmp->userdata = NULL;
+		}
 	}
 	protocol_thread_free(ds18b20);
 }
@@ -222,10 +155,6 @@ static void threadGC(void) {
 __attribute__((weak))
 #endif
 void ds18b20Init(void) {
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&lock, &attr);
-
 	protocol_register(&ds18b20);
 	protocol_set_id(ds18b20, "ds18b20");
 	protocol_device_add(ds18b20, "ds18b20", "1-wire Temperature Sensor");
@@ -251,7 +180,7 @@ void ds18b20Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "ds18b20";
-	module->version = "2.0";
+	module->version = "3.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
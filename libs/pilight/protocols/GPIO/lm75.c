@@ -53,23 +53,20 @@ typedef struct settings_t {
 	char path[PATH_MAX];
 	int nrid;
 	int *fd;
+	double temp_offset;
 } settings_t;
 
 static unsigned short loop = 1;
-static int threads = 0;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+static struct settings_t *setup(struct JsonNode *json) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct settings_t *lm75data = MALLOC(sizeof(struct settings_t));
-	int y = 0, interval = 10, nrloops = 0;
+	int y = 0;
 	char *stmp = NULL;
-	double itmp = -1, temp_offset = 0.0;
 
 	if(lm75data == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -79,8 +76,7 @@ static void *thread(void *param) {
 	lm75data->nrid = 0;
 	lm75data->id = NULL;
 	lm75data->fd = 0;
-
-	threads++;
+	lm75data->temp_offset = 0.0;
 
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
@@ -104,9 +100,7 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
+	json_find_number(json, "temperature-offset", &lm75data->temp_offset);
 
 	if((lm75data->fd = REALLOC(lm75data->fd, (sizeof(int)*(size_t)(lm75data->nrid+1)))) == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -116,62 +110,54 @@ static void *thread(void *param) {
 		lm75data->fd[y] = wiringXI2CSetup(lm75data->path, (int)strtol(lm75data->id[y], NULL, 16));
 	}
 
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for(y=0;y<lm75data->nrid;y++) {
-				if(lm75data->fd[y] > 0) {
-					int raw = wiringXI2CReadReg16(lm75data->fd[y], 0x00);
-					float temp = ((float)((raw&0x00ff)+((raw>>15)?0:0.5))*10);
-
-					lm75->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "id", json_mkstring(lm75data->id[y]));
-					json_append_member(code, "temperature", json_mknumber((temp+temp_offset)/10, 1));
-
-					json_append_member(lm75->message, "message", code);
-					json_append_member(lm75->message, "origin", json_mkstring("receiver"));
-					json_append_member(lm75->message, "protocol", json_mkstring(lm75->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(lm75->id, lm75->message, PROTOCOL);
-					}
-					json_delete(lm75->message);
-					lm75->message = NULL;
-				} else {
-					logprintf(LOG_NOTICE, "error connecting to lm75");
-					logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
-					logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
-					protocol_thread_wait(node, 1, &nrloops);
-				}
-			}
-			pthread_mutex_unlock(&lock);
-		}
-	}
-	pthread_mutex_unlock(&lock);
+	return lm75data;
+}
 
-	if(lm75data->id) {
-		for(y=0;y<lm75data->nrid;y++) {
-			FREE(lm75data->id[y]);
-		}
-		FREE(lm75data->id);
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *lm75data = node->userdata;
+	int y = 0, nrloops = 0;
+
+	if(lm75data == NULL) {
+		lm75data = node->userdata = setup(node->param);
 	}
-	if(lm75data->fd) {
-		for(y=0;y<lm75data->nrid;y++) {
-			if(lm75data->fd[y] > 0) {
-				close(lm75data->fd[y]);
+
+	pthread_mutex_lock(&lock);
+	for(y=0;y<lm75data->nrid;y++) {
+		if(lm75data->fd[y] > 0) {
+			int raw = wiringXI2CReadReg16(lm75data->fd[y], 0x00);
+			float temp = ((float)((raw&0x00ff)+((raw>>15)?0:0.5))*10);
+
+			lm75->message = json_mkobject();
+			JsonNode *code = json_mkobject();
+			json_append_member(code, "id", json_mkstring(lm75data->id[y]));
+			json_append_member(code, "temperature", json_mknumber((temp+lm75data->temp_offset)/10, 1));
+
+			json_append_member(lm75->message, "message", code);
+			json_append_member(lm75->message, "origin", json_mkstring("receiver"));
+			json_append_member(lm75->message, "protocol", json_mkstring(lm75->id));
+
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(lm75->id, lm75->message, PROTOCOL);
+			}
+			json_delete(lm75->message);
+			lm75->message = NULL;
+		} else {
+			logprintf(LOG_NOTICE, "error connecting to lm75");
+			logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
+			logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
+			if(loop == 1) {
+				protocol_thread_wait(node, 1, &nrloops);
 			}
 		}
-		FREE(lm75data->fd);
 	}
-	FREE(lm75data);
-	threads--;
-
-	return (void *)NULL;
+	pthread_mutex_unlock(&lock);
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	char *platform = GPIO_PLATFORM;
+	double itmp = 0;
+	int interval = 10;
+
 	if(settings_find_string("gpio-platform", &platform) != 0 || strcmp(platform, "none") == 0) {
 		logprintf(LOG_ERR, "lm75: no gpio-platform configured");
 		exit(EXIT_FAILURE);
@@ -182,18 +168,43 @@ static struct threadqueue_t *initDev(JsonNode *jdevice) {
 		JsonNode *json = json_decode(output);
 		json_free(output);
 
-		struct protocol_threads_t *node = protocol_thread_init(lm75, json);
-		return threads_register("lm75", &thread, (void *)node, 0);
-	} else {
-		return NULL;
+		if(json_find_number(json, "poll-interval", &itmp) == 0)
+			interval = (int)round(itmp);
+
+		protocol_poll_init(lm75, json, interval, pollDev);
 	}
+	return NULL;
 }
 
 static void threadGC(void) {
+	struct protocol_threads_t *tmp = NULL;
+	struct settings_t *lm75data = NULL;
+	int y = 0;
+
 	loop = 0;
 	protocol_thread_stop(lm75);
-	while(threads > 0) {
-		usleep(10);
+	protocol_poll_stop(lm75);
+
+	for(tmp=lm75->threads;tmp!=NULL;tmp=tmp->next) {
+		if((lm75data = tmp->userdata) == NULL) {
+			continue;
+		}
+		if(lm75data->id) {
+			for(y=0;y<lm75data->nrid;y++) {
+				FREE(lm75data->id[y]);
+			}
+			FREE(lm75data->id);
+		}
+		if(lm75data->fd) {
+			for(y=0;y<lm75data->nrid;y++) {
+				if(lm75data->fd[y] > 0) {
+					close(lm75data->fd[y]);
+				}
+			}
+			FREE(lm75data->fd);
+		}
+		FREE(lm75data);
+		tmp->userdata = NULL;
 	}
 	protocol_thread_free(lm75);
 }
@@ -232,7 +243,7 @@ void lm75Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "lm75";
-	module->version = "2.2";
+	module->version = "3.0";
 	module->reqversion = "7.0";
 	module->reqcommit = "186";
 }
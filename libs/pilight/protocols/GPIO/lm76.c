@@ -53,23 +53,20 @@ typedef struct settings_t {
 	char path[PATH_MAX];
 	int nrid;
 	int *fd;
+	double temp_offset;
 } settings_t;
 
 static unsigned short loop = 1;
-static int threads = 0;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+static struct settings_t *setup(struct JsonNode *json) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct settings_t *lm76data = MALLOC(sizeof(struct settings_t));
-	int y = 0, interval = 10, nrloops = 0;
+	int y = 0;
 	char *stmp = NULL;
-	double itmp = -1, temp_offset = 0;
 
 	if(lm76data == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -79,8 +76,7 @@ static void *thread(void *param) {
 	lm76data->nrid = 0;
 	lm76data->id = NULL;
 	lm76data->fd = 0;
-
-	threads++;
+	lm76data->temp_offset = 0.0;
 
 	if((jid = json_find_member(json, "id"))) {
 		jchild = json_first_child(jid);
@@ -104,9 +100,7 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
+	json_find_number(json, "temperature-offset", &lm76data->temp_offset);
 
 	if((lm76data->fd = REALLOC(lm76data->fd, (sizeof(int)*(size_t)(lm76data->nrid+1)))) == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -116,85 +110,101 @@ static void *thread(void *param) {
 		lm76data->fd[y] = wiringXI2CSetup(lm76data->path, (int)strtol(lm76data->id[y], NULL, 16));
 	}
 
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for(y=0;y<lm76data->nrid;y++) {
-				if(lm76data->fd[y] > 0) {
-					int raw = wiringXI2CReadReg16(lm76data->fd[y], 0x00);
-					float temp = ((float)((raw&0x00ff)+((raw>>12)*0.0625)));
-
-					lm76->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "id", json_mkstring(lm76data->id[y]));
-					json_append_member(code, "temperature", json_mknumber(temp+temp_offset, 3));
-
-					json_append_member(lm76->message, "message", code);
-					json_append_member(lm76->message, "origin", json_mkstring("receiver"));
-					json_append_member(lm76->message, "protocol", json_mkstring(lm76->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(lm76->id, lm76->message, PROTOCOL);
-					}
-					json_delete(lm76->message);
-					lm76->message = NULL;
-				} else {
-					logprintf(LOG_NOTICE, "error connecting to lm76");
-					logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
-					logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
-					protocol_thread_wait(node, 1, &nrloops);
-				}
-			}
-			pthread_mutex_unlock(&lock);
-		}
-	}
-	pthread_mutex_unlock(&lock);
+	return lm76data;
+}
 
-	if(lm76data->id) {
-		for(y=0;y<lm76data->nrid;y++) {
-			FREE(lm76data->id[y]);
-		}
-		FREE(lm76data->id);
+static void pollDev(struct protocol_threads_t *node) {
+	struct settings_t *lm76data = node->userdata;
+	int y = 0, nrloops = 0;
+
+	if(lm76data == NULL) {
+		lm76data = node->userdata = setup(node->param);
 	}
-	if(lm76data->fd) {
-		for(y=0;y<lm76data->nrid;y++) {
-			if(lm76data->fd[y] > 0) {
-				close(lm76data->fd[y]);
+
+	pthread_mutex_lock(&lock);
+	for(y=0;y<lm76data->nrid;y++) {
+		if(lm76data->fd[y] > 0) {
+			int raw = wiringXI2CReadReg16(lm76data->fd[y], 0x00);
+			float temp = ((float)((raw&0x00ff)+((raw>>12)*0.0625)));
+
+			lm76->message = json_mkobject();
+			JsonNode *code = json_mkobject();
+			json_append_member(code, "id", json_mkstring(lm76data->id[y]));
+			json_append_member(code, "temperature", json_mknumber(temp+lm76data->temp_offset, 3));
+
+			json_append_member(lm76->message, "message", code);
+			json_append_member(lm76->message, "origin", json_mkstring("receiver"));
+			json_append_member(lm76->message, "protocol", json_mkstring(lm76->id));
+
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(lm76->id, lm76->message, PROTOCOL);
+			}
+			json_delete(lm76->message);
+			lm76->message = NULL;
+		} else {
+			logprintf(LOG_NOTICE, "error connecting to lm76");
+			logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
+			logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
+			if(loop == 1) {
+				protocol_thread_wait(node, 1, &nrloops);
 			}
 		}
-		FREE(lm76data->fd);
 	}
-	FREE(lm76data);
-	threads--;
-
-	return (void *)NULL;
+	pthread_mutex_unlock(&lock);
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	char *platform = GPIO_PLATFORM;
+	double itmp = 0;
+	int interval = 10;
+
 	if(settings_find_string("gpio-platform", &platform) != 0 || strcmp(platform, "none") == 0) {
-		logprintf(LOG_ERR, "lm75: no gpio-platform configured");
+		logprintf(LOG_ERR, "lm76: no gpio-platform configured");
 		exit(EXIT_FAILURE);
 	}
 	if(wiringXSetup(platform, logprintf1) == 0) {
 		loop = 1;
-
 		char *output = json_stringify(jdevice, NULL);
 		JsonNode *json = json_decode(output);
 		json_free(output);
 
-		struct protocol_threads_t *node = protocol_thread_init(lm76, json);
-		return threads_register("lm76", &thread, (void *)node, 0);
-	} else {
-		return NULL;
+		if(json_find_number(json, "poll-interval", &itmp) == 0)
+			interval = (int)round(itmp);
+
+		protocol_poll_init(lm76, json, interval, pollDev);
 	}
+	return NULL;
 }
 
 static void threadGC(void) {
+	struct protocol_threads_t *tmp = NULL;
+	struct settings_t *lm76data = NULL;
+	int y = 0;
+
 	loop = 0;
 	protocol_thread_stop(lm76);
-	while(threads > 0) {
-		usleep(10);
+	protocol_poll_stop(lm76);
+
+	for(tmp=lm76->threads;tmp!=NULL;tmp=tmp->next) {
+		if((lm76data = tmp->userdata) == NULL) {
+			continue;
+		}
+		if(lm76data->id) {
+			for(y=0;y<lm76data->nrid;y++) {
+				FREE(lm76data->id[y]);
+			}
+			FREE(lm76data->id);
+		}
+		if(lm76data->fd) {
+			for(y=0;y<lm76data->nrid;y++) {
+				if(lm76data->fd[y] > 0) {
+					close(lm76data->fd[y]);
+				}
+			}
+			FREE(lm76data->fd);
+		}
+		FREE(lm76data);
+		tmp->userdata = NULL;
 	}
 	protocol_thread_free(lm76);
 }
@@ -233,7 +243,7 @@ void lm76Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "lm76";
-	module->version = "2.1";
+	module->version = "3.0";
 	module->reqversion = "7.0";
 	module->reqcommit = "186";
 }
@@ -27,7 +27,6 @@
 #include <sys/stat.h>
 #include <math.h>
 #ifdef _WIN32
-	#define WPCAP
 	#include <winsock2.h>
 	#include <ws2tcpip.h>
 	#include <iphlpapi.h>
@@ -40,9 +39,8 @@
 	#include <sys/wait.h>
 	#include <net/if.h>
 	#include <ifaddrs.h>
-	#include <ctype.h>
 #endif
-#include <pcap.h>
+#include <ctype.h>
 
 #include "../../core/threads.h"
 #include "../../core/pilight.h"
@@ -55,167 +53,113 @@
 #include "../../core/gc.h"
 #include "arping.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+#define CONNECTED				1
+#define DISCONNECTED 		0
+#define INTERVAL				5
+
+typedef struct settings_t {
+	char *mac;
+	struct arp_device_t *dev;
+	struct settings_t *next;
+} settings_t;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-#define CONNECTED				1
-#define DISCONNECTED 		0
-#define INTERVAL				5
+static struct settings_t *settings = NULL;
+
+static void callback(struct arp_device_t *dev, int status, void *userdata) {
+	struct settings_t *wnode = userdata;
+
+	pthread_mutex_lock(&lock);
+	if(status == ARP_CHANGED) {
+		logprintf(LOG_NOTICE, "ip address of %s changed to %s", wnode->mac, dev->ip);
+	}
+
+	arping->message = json_mkobject();
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "mac", json_mkstring(wnode->mac));
+	if(status == ARP_LOST) {
+		json_append_member(code, "ip", json_mkstring("0.0.0.0"));
+		json_append_member(code, "state", json_mkstring("disconnected"));
+	} else {
+		json_append_member(code, "ip", json_mkstring(dev->ip));
+		json_append_member(code, "state", json_mkstring("connected"));
+	}
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+	json_append_member(arping->message, "message", code);
+	json_append_member(arping->message, "origin", json_mkstring("receiver"));
+	json_append_member(arping->message, "protocol", json_mkstring(arping->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(arping->id, arping->message, PROTOCOL);
+	}
+	json_delete(arping->message);
+	arping->message = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	char *dstmac = NULL, srcmac[ETH_ALEN], *a = srcmac;
-	char *tmpip[INET_ADDRSTRLEN+1], dstip[INET_ADDRSTRLEN+1];
-	char ip[INET_ADDRSTRLEN+1], *p = ip, **devs = NULL;
+	struct settings_t *wnode = NULL;
+	char *mac = NULL;
 	double itmp = 0.0;
-	int state = 0, nrloops = 0, interval = INTERVAL, i = 0, srcip[4], nrdevs = 0;
+	int interval = INTERVAL, i = 0;
 
-	threads++;
-
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
-			if(json_find_string(jchild, "mac", &dstmac) == 0) {
+			if(json_find_string(jchild, "mac", &mac) == 0) {
 				break;
 			}
 			jchild = jchild->next;
 		}
 	}
-
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-
-	memset(dstip, '\0', INET_ADDRSTRLEN+1);
-	memset(tmpip, '\0', INET_ADDRSTRLEN+1);
-
-	for(i=0;i<strlen(dstmac);i++) {
-		if(isNumeric(&dstmac[i]) != 0) {
-			dstmac[i] = (char)tolower(dstmac[i]);
-		}
-	}
-
-	if((nrdevs = inetdevs(&devs)) == 0) {
-		logprintf(LOG_ERR, "could not determine default network interface");
-		array_free(&devs, nrdevs);
+	if(mac == NULL) {
 		return NULL;
 	}
 
-	memset(&ip, '\0', INET_ADDRSTRLEN+1);
-	if(dev2ip(devs[0], &p, AF_INET) != 0) {
-		logprintf(LOG_ERR, "could not determine host ip address");
-		array_free(&devs, nrdevs);
-		return NULL;
-	}
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
 
-	memset(&srcmac, '\0', ETH_ALEN);
-	if(dev2mac(devs[0], &a) != 0 || (srcmac[0] == 0 && srcmac[1] == 0 &&
-		srcmac[2] == 0 && srcmac[3] == 0 &&
-		srcmac[4] == 0 && srcmac[5] == 0)) {
-		logprintf(LOG_ERR, "could not obtain MAC address for interface %s", devs[0]);
-		array_free(&devs, nrdevs);
-		return NULL;
+	if((wnode = MALLOC(sizeof(struct settings_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-
-	if(sscanf(ip, "%d.%d.%d.%d", &srcip[0], &srcip[1], &srcip[2], &srcip[3]) != 4) {
-		logprintf(LOG_ERR, "could not extract ip address");
-		array_free(&devs, nrdevs);
-		return NULL;
+	memset(wnode, 0, sizeof(struct settings_t));
+	if((wnode->mac = STRDUP(mac)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(strlen(dstip) == 0) {
-				for(i=0;i<255;i++) {
-					memset(ip, '\0', INET_ADDRSTRLEN+1);
-					snprintf(ip, sizeof(ip), "%d.%d.%d.%d", srcip[0], srcip[1], srcip[2], i);
-					arp_add_host(ip);
-				}
-			} else {
-				arp_add_host(dstip);
-			}
-
-			if(arp_resolv(devs[0], srcmac, dstmac, &p) == 0) {
-				if(strlen(dstip) == 0) {
-					strcpy(dstip, ip);
-				}
-				if(strcmp(dstip, ip) != 0) {
-					memset(dstip, '\0', INET_ADDRSTRLEN+1);
-					logprintf(LOG_NOTICE, "ip address changed from %s to %s", dstip, ip);
-					strcpy(dstip, ip);
-				}
-				if(state == DISCONNECTED) {
-					state = CONNECTED;
-					arping->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "mac", json_mkstring(dstmac));
-					json_append_member(code, "ip", json_mkstring(ip));
-					json_append_member(code, "state", json_mkstring("connected"));
-
-					json_append_member(arping->message, "message", code);
-					json_append_member(arping->message, "origin", json_mkstring("receiver"));
-					json_append_member(arping->message, "protocol", json_mkstring(arping->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(arping->id, arping->message, PROTOCOL);
-					}
-					json_delete(arping->message);
-					arping->message = NULL;
-				}
-			} else if(state == CONNECTED) {
-				state = DISCONNECTED;
-
-				arping->message = json_mkobject();
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "mac", json_mkstring(dstmac));
-				json_append_member(code, "ip", json_mkstring("0.0.0.0"));
-				json_append_member(code, "state", json_mkstring("disconnected"));
-
-				json_append_member(arping->message, "message", code);
-				json_append_member(arping->message, "origin", json_mkstring("receiver"));
-				json_append_member(arping->message, "protocol", json_mkstring(arping->id));
-
-				if(pilight.broadcast != NULL) {
-					pilight.broadcast(arping->id, arping->message, PROTOCOL);
-				}
-				json_delete(arping->message);
-				arping->message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
-		}
+	for(i=0;i<strlen(wnode->mac);i++) {
+		wnode->mac[i] = (char)tolower(wnode->mac[i]);
 	}
-	pthread_mutex_unlock(&lock);
-
-	array_free(&devs, nrdevs);
-
-	threads--;
 
-	return (void *)NULL;
-}
+	pthread_mutex_lock(&lock);
+	wnode->next = settings;
+	settings = wnode;
+	pthread_mutex_unlock(&lock);
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+	/*
+	 * All devices share one capture handle and
+	 * one address table in the main loop.
+	 */
+	wnode->dev = arp_add(wnode->mac, interval*1000, callback, wnode);
 
-	struct protocol_threads_t *node = protocol_thread_init(arping, json);
-	return threads_register("arping", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(arping);
-	while(threads > 0) {
-		usleep(10);
+	struct settings_t *tmp = NULL;
+
+	while(settings) {
+		tmp = settings;
+		if(tmp->dev != NULL) {
+			arp_remove(tmp->dev);
+		}
+		settings = settings->next;
+		FREE(tmp->mac);
+		FREE(tmp);
 	}
-	protocol_thread_free(arping);
 }
 
 static int checkValues(JsonNode *code) {
@@ -262,7 +206,7 @@ void arpingInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "arping";
-	module->version = "2.2";
+	module->version = "3.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "158";
 }
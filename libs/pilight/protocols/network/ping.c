@@ -44,28 +44,56 @@
 #include "../../core/gc.h"
 #include "ping.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+#define CONNECTED				1
+#define DISCONNECTED 		0
+
+typedef struct settings_t {
+	char *ip;
+	int state;
+	struct ping_host_t *host;
+	struct settings_t *next;
+} settings_t;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-#define CONNECTED				1
-#define DISCONNECTED 		0
+static struct settings_t *settings = NULL;
+
+static void callback(struct ping_host_t *host, int status, void *userdata) {
+	struct settings_t *wnode = userdata;
+	int state = (status == 0) ? CONNECTED : DISCONNECTED;
+
+	pthread_mutex_lock(&lock);
+	if(state != wnode->state) {
+		wnode->state = state;
+
+		pping->message = json_mkobject();
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "ip", json_mkstring(wnode->ip));
+		json_append_member(code, "state", json_mkstring((state == CONNECTED) ? "connected" : "disconnected"));
+
+		json_append_member(pping->message, "message", code);
+		json_append_member(pping->message, "origin", json_mkstring("receiver"));
+		json_append_member(pping->message, "protocol", json_mkstring(pping->id));
+
+		if(pilight.broadcast != NULL) {
+			pilight.broadcast(pping->id, pping->message, PROTOCOL);
+		}
+		json_delete(pping->message);
+		pping->message = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+}
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	char *ip = NULL;
-	char *pstate = NULL;
+	struct settings_t *wnode = NULL;
+	char *ip = NULL, *pstate = NULL;
 	double itmp = 0.0;
-	int state = 0, nrloops = 0, interval = 1;
-
-	threads++;
+	int interval = 1;
 
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			if(json_find_string(jchild, "ip", &ip) == 0) {
@@ -74,80 +102,54 @@ static void *thread(void *param) {
 			jchild = jchild->next;
 		}
 	}
+	if(ip == NULL) {
+		return NULL;
+	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
 		interval = (int)round(itmp);
 
-   if(json_find_string(json, "state", &pstate) == 0) {
-      if(strcmp(pstate,"connected") == 0) state = CONNECTED;
-      if(strcmp(pstate,"disconnected") == 0) state = DISCONNECTED;
-      }
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(ping(ip) == 0) {
-				if(state == DISCONNECTED) {
-					state = CONNECTED;
-					pping->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "ip", json_mkstring(ip));
-					json_append_member(code, "state", json_mkstring("connected"));
-
-					json_append_member(pping->message, "message", code);
-					json_append_member(pping->message, "origin", json_mkstring("receiver"));
-					json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(pping->id, pping->message, PROTOCOL);
-					}
-					json_delete(pping->message);
-					pping->message = NULL;
-				}
-			} else if(state == CONNECTED) {
-				state = DISCONNECTED;
-
-				pping->message = json_mkobject();
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "ip", json_mkstring(ip));
-				json_append_member(code, "state", json_mkstring("disconnected"));
-
-				json_append_member(pping->message, "message", code);
-				json_append_member(pping->message, "origin", json_mkstring("receiver"));
-				json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-				if(pilight.broadcast != NULL) {
-					pilight.broadcast(pping->id, pping->message, PROTOCOL);
-				}
-				json_delete(pping->message);
-				pping->message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
+	if((wnode = MALLOC(sizeof(struct settings_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(wnode, 0, sizeof(struct settings_t));
+	if((wnode->ip = STRDUP(ip)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	wnode->state = DISCONNECTED;
+	if(json_find_string(jdevice, "state", &pstate) == 0) {
+		if(strcmp(pstate, "connected") == 0) {
+			wnode->state = CONNECTED;
 		}
 	}
-	pthread_mutex_unlock(&lock);
 
-	threads--;
-	return (void *)NULL;
-}
+	pthread_mutex_lock(&lock);
+	wnode->next = settings;
+	settings = wnode;
+	pthread_mutex_unlock(&lock);
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+	/*
+	 * All devices share the ICMP socket of the
+	 * main loop instead of blocking a thread each.
+	 */
+	wnode->host = ping_add(wnode->ip, interval*1000, callback, wnode);
 
-	struct protocol_threads_t *node = protocol_thread_init(pping, json);
-	return threads_register("ping", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(pping);
-	while(threads > 0) {
-		usleep(10);
+	struct settings_t *tmp = NULL;
+
+	while(settings) {
+		tmp = settings;
+		if(tmp->host != NULL) {
+			ping_remove(tmp->host);
+		}
+		settings = settings->next;
+		FREE(tmp->ip);
+		FREE(tmp);
 	}
-	protocol_thread_free(pping);
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
@@ -179,7 +181,7 @@ void pingInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "ping";
-	module->version = "2.0";
+	module->version = "3.0";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
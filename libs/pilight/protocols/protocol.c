@@ -29,6 +29,7 @@
 #endif
 #include <pthread.h>
 
+#include "../../libuv/uv.h"
 #include "../core/pilight.h"
 #include "../core/common.h"
 #include "../core/dso.h"
@@ -40,8 +41,32 @@
 #include "protocol.h"
 #include "protocol_header.h"
 
+/*
+ * Sensors that are periodically polled share a pool
+ * of workers instead of each having a thread of their
+ * own. The workers take turns waiting for the first
+ * sensor due in a heap ordered by a monotonic clock.
+ * Reading a sensor can block for a long time, so
+ * another worker is started whenever all of them are
+ * busy, up to one per polled sensor.
+ */
+#define POLL_STAGGER	250
+
 struct protocols_t *protocols;
 
+static struct protocol_threads_t **heap = NULL;
+static int heapsize = 0;
+static int nrheap = 0;
+static int nrpolls = 0;
+static int poll_loop = 0;
+static int poll_signal_init = 0;
+static pthread_t *poll_workers = NULL;
+static int nrworkers = 0;
+static int nridle = 0;
+static pthread_mutex_t poll_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poll_signal;
+static pthread_cond_t poll_done = PTHREAD_COND_INITIALIZER;
+
 #ifndef _WIN32
 void protocol_remove(char *name) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -208,10 +233,15 @@ void protocol_register(protocol_t **proto) {
 	(*proto)->maxgaplen = 0;
 	(*proto)->txrpt = 10;
 	(*proto)->rxrpt = 1;
+	(*proto)->txcache = 1;
 	(*proto)->hwtype = NONE;
 	(*proto)->multipleId = 1;
 	(*proto)->config = 1;
 	(*proto)->masterOnly = 0;
+	(*proto)->nrvalidate = 0;
+	(*proto)->nrparse = 0;
+	(*proto)->validatetime = 0;
+	(*proto)->parsetime = 0;
 	(*proto)->parseCode = NULL;
 	(*proto)->parseCommand = NULL;
 	(*proto)->createCode = NULL;
@@ -228,6 +258,7 @@ void protocol_register(protocol_t **proto) {
 	(*proto)->second = 0;
 
 	(*proto)->raw = NULL;
+	(*proto)->frame = NULL;
 
 	struct protocols_t *pnode = MALLOC(sizeof(struct protocols_t));
 	if(pnode == NULL) {
@@ -252,30 +283,290 @@ struct protocol_threads_t *protocol_thread_init(protocol_t *proto, struct JsonNo
 	pthread_mutexattr_init(&node->attr);
 	pthread_mutexattr_settype(&node->attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&node->mutex, &node->attr);
-	pthread_cond_init(&node->cond, NULL);
+	threads_cond_init(&node->cond);
+	node->poll = NULL;
+	node->userdata = NULL;
+	node->due = 0;
+	node->interval = 0;
+	node->index = -1;
+	node->running = 0;
+	node->trigger = 0;
+	node->triggered = 0;
 	node->next = proto->threads;
 	proto->threads = node;
 
 	return node;
 }
 
+static uint64_t poll_now(void) {
+	return uv_hrtime() / 1000000;
+}
+
+static void heap_swap(int a, int b) {
+	struct protocol_threads_t *tmp = heap[a];
+	heap[a] = heap[b];
+	heap[b] = tmp;
+	heap[a]->index = a;
+	heap[b]->index = b;
+}
+
+static void heap_up(int i) {
+	while(i > 0 && heap[(i-1)/2]->due > heap[i]->due) {
+		heap_swap(i, (i-1)/2);
+		i = (i-1)/2;
+	}
+}
+
+static void heap_down(int i) {
+	int x = 0;
+	while((x = (2*i)+1) < nrheap) {
+		if(x+1 < nrheap && heap[x+1]->due < heap[x]->due) {
+			x++;
+		}
+		if(heap[i]->due <= heap[x]->due) {
+			break;
+		}
+		heap_swap(i, x);
+		i = x;
+	}
+}
+
+static void heap_push(struct protocol_threads_t *node) {
+	if(nrheap == heapsize) {
+		heapsize = (heapsize == 0) ? 8 : heapsize*2;
+		if((heap = REALLOC(heap, sizeof(struct protocol_threads_t *)*(size_t)heapsize)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	node->index = nrheap;
+	heap[nrheap++] = node;
+	heap_up(node->index);
+}
+
+static void heap_remove(struct protocol_threads_t *node) {
+	int i = node->index;
+
+	if(i < 0) {
+		return;
+	}
+	node->index = -1;
+	nrheap--;
+	if(i != nrheap) {
+		heap[i] = heap[nrheap];
+		heap[i]->index = i;
+		heap_down(i);
+		heap_up(i);
+	}
+}
+
+static void *protocol_poll_worker(void *param);
+
+/*
+ * Must be called with the poll lock held. A new
+ * worker counts as idle right away so we don't
+ * start another one before it got to run.
+ */
+static void protocol_poll_spawn(void) {
+	if((poll_workers = REALLOC(poll_workers, sizeof(pthread_t)*(size_t)(nrworkers+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	nridle++;
+	threads_create(&poll_workers[nrworkers++], NULL, protocol_poll_worker, NULL);
+}
+
+static void *protocol_poll_worker(void *param) {
+	struct protocol_threads_t *node = NULL;
+	struct timespec ts;
+	uint64_t now = 0;
+
+	pthread_mutex_lock(&poll_lock);
+	while(poll_loop == 1) {
+		if(nrheap == 0) {
+			pthread_cond_wait(&poll_signal, &poll_lock);
+			continue;
+		}
+		now = poll_now();
+		node = heap[0];
+		if(node->due > now) {
+			threads_cond_timeout(&ts, (unsigned long)(node->due - now));
+			pthread_cond_timedwait(&poll_signal, &poll_lock, &ts);
+			continue;
+		}
+
+		heap_remove(node);
+		node->running = 1;
+		node->triggered = node->trigger;
+		node->trigger = 0;
+		if(--nridle == 0 && nrworkers < nrpolls) {
+			protocol_poll_spawn();
+		}
+		pthread_mutex_unlock(&poll_lock);
+
+		/*
+		 * Polls are free to use protocol_thread_wait
+		 * for short retries, which expects the node
+		 * mutex to be held.
+		 */
+		pthread_mutex_lock(&node->mutex);
+		node->poll(node);
+		pthread_mutex_unlock(&node->mutex);
+
+		pthread_mutex_lock(&poll_lock);
+		nridle++;
+		node->running = 0;
+		node->triggered = 0;
+		if(node->interval > 0) {
+			/*
+			 * Keep a fixed rate, but don't try to catch
+			 * up when a poll took longer than its interval.
+			 */
+			now = poll_now();
+			if(node->trigger == 1) {
+				node->due = now;
+			} else {
+				node->due += node->interval;
+				if(node->due <= now) {
+					node->due = now + node->interval;
+				}
+			}
+			heap_push(node);
+			pthread_cond_signal(&poll_signal);
+		}
+		pthread_cond_broadcast(&poll_done);
+	}
+	pthread_mutex_unlock(&poll_lock);
+
+	return (void *)NULL;
+}
+
+/*
+ * Poll a sensor every interval seconds. The poll
+ * callback is executed by one of the poll workers.
+ * The first poll is staggered so sensors configured
+ * with the same interval don't all fire at once.
+ */
+struct protocol_threads_t *protocol_poll_init(protocol_t *proto, struct JsonNode *param, int interval, void (*poll)(struct protocol_threads_t *node)) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct protocol_threads_t *node = protocol_thread_init(proto, param);
+
+	if(interval <= 0) {
+		interval = 1;
+	}
+
+	pthread_mutex_lock(&poll_lock);
+	node->poll = poll;
+	node->interval = (unsigned int)interval*1000;
+	node->due = poll_now() + 1000 + ((unsigned int)(nrpolls++ * POLL_STAGGER) % node->interval);
+	heap_push(node);
+
+	if(poll_signal_init == 0) {
+		threads_cond_init(&poll_signal);
+		poll_signal_init = 1;
+	}
+	if(poll_loop == 0) {
+		poll_loop = 1;
+		protocol_poll_spawn();
+	}
+	pthread_cond_signal(&poll_signal);
+	pthread_mutex_unlock(&poll_lock);
+
+	return node;
+}
+
+/*
+ * Poll a sensor as soon as possible. The callback
+ * can tell it was triggered from node->triggered.
+ */
+void protocol_poll_trigger(struct protocol_threads_t *node) {
+	pthread_mutex_lock(&poll_lock);
+	node->trigger = 1;
+	if(node->index >= 0) {
+		node->due = poll_now();
+		heap_up(node->index);
+		pthread_cond_signal(&poll_signal);
+	}
+	pthread_mutex_unlock(&poll_lock);
+}
+
+/*
+ * Stop polling all sensors of a protocol and wait
+ * for polls that are still running.
+ */
+void protocol_poll_stop(protocol_t *proto) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct protocol_threads_t *tmp = NULL;
+	int running = 0;
+
+	if(proto == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&poll_lock);
+	do {
+		running = 0;
+		for(tmp=proto->threads;tmp!=NULL;tmp=tmp->next) {
+			if(tmp->poll == NULL) {
+				continue;
+			}
+			tmp->interval = 0;
+			heap_remove(tmp);
+			if(tmp->running == 1) {
+				running = 1;
+			}
+		}
+		if(running == 1) {
+			pthread_cond_wait(&poll_done, &poll_lock);
+		}
+	} while(running == 1);
+	pthread_mutex_unlock(&poll_lock);
+}
+
+static void protocol_poll_gc(void) {
+	int i = 0;
+
+	pthread_mutex_lock(&poll_lock);
+	if(poll_loop == 0) {
+		pthread_mutex_unlock(&poll_lock);
+		return;
+	}
+	poll_loop = 0;
+	pthread_cond_broadcast(&poll_signal);
+	pthread_mutex_unlock(&poll_lock);
+
+	/* No new workers are started once the loop stopped */
+	for(i=0;i<nrworkers;i++) {
+		pthread_join(poll_workers[i], NULL);
+	}
+
+	pthread_mutex_lock(&poll_lock);
+	if(poll_workers != NULL) {
+		FREE(poll_workers);
+	}
+	nrworkers = 0;
+	nridle = 0;
+	if(heap != NULL) {
+		FREE(heap);
+	}
+	heapsize = 0;
+	nrheap = 0;
+	nrpolls = 0;
+	pthread_mutex_unlock(&poll_lock);
+}
+
 int protocol_thread_wait(struct protocol_threads_t *node, int interval, int *nrloops) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct timeval tp;
 	struct timespec ts;
 
 	pthread_mutex_unlock(&node->mutex);
 
-	gettimeofday(&tp, NULL);
-	ts.tv_sec = tp.tv_sec;
-	ts.tv_nsec = tp.tv_usec * 1000;
-
 	if(*nrloops == 0) {
-		ts.tv_sec += 1;
+		threads_cond_timeout(&ts, 1000);
 		*nrloops = 1;
 	} else {
-		ts.tv_sec += interval;
+		threads_cond_timeout(&ts, (unsigned long)interval*1000);
 	}
 
 	pthread_mutex_lock(&node->mutex);
@@ -325,6 +616,32 @@ void protocol_set_id(protocol_t *proto, const char *id) {
 	strcpy(proto->id, id);
 }
 
+void protocol_frame(struct protocol_frame_t *frame, int *raw, int rawlen, int plslen) {
+	uint64_t hash = 14695981039346656037ULL;
+	int len = (plslen > 0) ? plslen : 1;
+	int i = 0, x = 0;
+
+	if(rawlen > MAXPULSESTREAMLENGTH) {
+		rawlen = MAXPULSESTREAMLENGTH;
+	}
+	frame->plslen = plslen;
+	frame->rawlen = rawlen;
+
+	/*
+	 * Kept free of dependencies between the pulses
+	 * so the compiler can vectorize it.
+	 */
+	for(i=0;i<rawlen;i++) {
+		frame->symbols[i] = (raw[i] > 2*len);
+	}
+
+	for(i=0;i<rawlen;i++) {
+		x = ((raw[i]*2)+(len/2))/len;
+		hash = (hash ^ (uint64_t)x) * 1099511628211ULL;
+	}
+	frame->hash = hash;
+}
+
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -406,6 +723,8 @@ int protocol_gc(void) {
 		FREE(protocols);
 	}
 
+	protocol_poll_gc();
+
 	logprintf(LOG_DEBUG, "garbage collected protocol library");
 	return EXIT_SUCCESS;
 }
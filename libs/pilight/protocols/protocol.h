@@ -27,6 +27,7 @@
 	#endif
 #endif
 #include <pthread.h>
+#include <stdint.h>
 
 #include "defines.h"
 #include "../core/options.h"
@@ -70,8 +71,31 @@ typedef struct protocol_threads_t {
 	pthread_mutexattr_t attr;
 	JsonNode *param;
 	struct protocol_threads_t *next;
+
+	/* Only used by sensors polled by the poll scheduler */
+	void (*poll)(struct protocol_threads_t *node);
+	void *userdata;
+	uint64_t due;
+	unsigned int interval;
+	int index;
+	int running;
+	int trigger;
+	int triggered;
 } protocol_threads_t;
 
+/*
+ * A received pulse train quantized once for all decoders.
+ * A pulse is long when it exceeds twice the base pulse
+ * derived from the footer. The hash rounds each pulse to
+ * half the base pulse, so repeats of a code share it.
+ */
+typedef struct protocol_frame_t {
+	int plslen;
+	int rawlen;
+	uint64_t hash;
+	unsigned char symbols[MAXPULSESTREAMLENGTH];
+} protocol_frame_t;
+
 typedef struct protocol_t {
 	char *id;
 	int rawlen;
@@ -109,6 +133,23 @@ typedef struct protocol_t {
 	void (*printHelp)(void);
 	void (*gc)(void);
 	void (*threadGC)(void);
+
+	/*
+	 * Members below were added later, they are kept at
+	 * the end so modules built against an older header
+	 * still find the members above at the same offset.
+	 */
+
+	/* Receiver statistics in microseconds */
+	unsigned long nrvalidate;
+	unsigned long nrparse;
+	unsigned long validatetime;
+	unsigned long parsetime;
+
+	/* Same option values always create the same code */
+	short txcache;
+
+	struct protocol_frame_t *frame;
 } protocol_t;
 
 typedef struct protocols_t {
@@ -124,8 +165,12 @@ struct protocol_threads_t *protocol_thread_init(protocol_t *proto, struct JsonNo
 int protocol_thread_wait(struct protocol_threads_t *node, int interval, int *nrloops);
 void protocol_thread_free(protocol_t *proto);
 void protocol_thread_stop(protocol_t *proto);
+struct protocol_threads_t *protocol_poll_init(protocol_t *proto, struct JsonNode *param, int interval, void (*poll)(struct protocol_threads_t *node));
+void protocol_poll_trigger(struct protocol_threads_t *node);
+void protocol_poll_stop(protocol_t *proto);
 void protocol_set_id(protocol_t *proto, const char *id);
 void protocol_plslen_add(protocol_t *proto, int plslen);
+void protocol_frame(struct protocol_frame_t *frame, int *raw, int rawlen, int plslen);
 void protocol_register(protocol_t **proto);
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc);
 int protocol_device_exists(protocol_t *proto, const char *id);
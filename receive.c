@@ -37,6 +37,73 @@ static char *recvBuff = NULL;
 char **filters = NULL;
 unsigned int m = 0;
 
+/* Add a comma separated list of a server side filter */
+static void filter_list(struct JsonNode *jfilter, const char *key, char *list) {
+	struct JsonNode *jarray = json_mkarray();
+	char **array = NULL;
+	unsigned int n = explode(list, ",", &array), i = 0;
+
+	for(i=0;i<n;i++) {
+		json_append_element(jarray, json_mkstring(array[i]));
+	}
+	array_free(&array, n);
+	json_append_member(jfilter, key, jarray);
+}
+
+/* Split value expressions like "temperature>=20" into key and predicate */
+static int filter_values(struct JsonNode *jfilter, char *list) {
+	struct JsonNode *jvalues = json_mkobject();
+	char **array = NULL, *op = NULL;
+	unsigned int n = explode(list, ",", &array), i = 0;
+
+	for(i=0;i<n;i++) {
+		if((op = strpbrk(array[i], "!<>=")) == NULL || op == array[i]) {
+			logprintf(LOG_ERR, "invalid value filter: %s", array[i]);
+			array_free(&array, n);
+			json_delete(jvalues);
+			return -1;
+		}
+		char *predicate = STRDUP(op);
+		if(predicate == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		*op = '\0';
+		json_append_member(jvalues, array[i], json_mkstring(predicate));
+		FREE(predicate);
+	}
+	array_free(&array, n);
+	json_append_member(jfilter, "values", jvalues);
+	return 0;
+}
+
+static void print_content(struct JsonNode *jcontent, unsigned short filteropt) {
+	char *protocol = NULL;
+	struct JsonNode *jtype = json_find_member(jcontent, "type");
+	if(jtype != NULL) {
+		json_remove_from_parent(jtype);
+		json_delete(jtype);
+	}
+	if(filteropt == 1) {
+		int filtered = 0, j = 0;
+		json_find_string(jcontent, "protocol", &protocol);
+		for(j=0;j<m;j++) {
+			if(strcmp(filters[j], protocol) == 0) {
+				filtered = 1;
+				break;
+			}
+		}
+		if(filtered == 0) {
+			char *content = json_stringify(jcontent, "\t");
+			printf("%s\n", content);
+			json_free(content);
+		}
+	} else {
+		char *content = json_stringify(jcontent, "\t");
+		printf("%s\n", content);
+		json_free(content);
+	}
+}
+
 int main_gc(void) {
 	main_loop = 0;
 	sleep(1);
@@ -85,6 +152,8 @@ int main(int argc, char **argv) {
 	unsigned short port = 0;
 	unsigned short stats = 0;
 	unsigned short filteropt = 0;
+	unsigned short cbor = 0;
+	struct JsonNode *jfilter = json_mkobject();
 
 	char *args = NULL;
 
@@ -94,6 +163,11 @@ int main(int argc, char **argv) {
 	options_add(&options, 'P', "port", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, 's', "stats", OPTION_NO_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, 'F', "filter", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
+	options_add(&options, 'C', "cbor", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'p', "protocol", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
+	options_add(&options, 'D', "device", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
+	options_add(&options, 'O', "origin", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
+	options_add(&options, 'W', "where", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
 
 	/* Store all CLI arguments for later usage
 	   and also check if the CLI arguments where
@@ -114,6 +188,11 @@ int main(int argc, char **argv) {
 				printf("\t -P --port=xxxx\t\t\tconnect to server port\n");
 				printf("\t -s --stats\t\t\tshow CPU and RAM statistics\n");
 				printf("\t -F --filter=protocol\t\tfilter out protocol(s)\n");
+				printf("\t -C --cbor\t\t\treceive the messages CBOR encoded\n");
+				printf("\t -p --protocol=protocol\t\tonly receive protocol(s)\n");
+				printf("\t -D --device=device\t\tonly receive updates of device(s)\n");
+				printf("\t -O --origin=origin\t\tonly receive messages from origin(s)\n");
+				printf("\t -W --where=value<op>x\t\tonly receive messages with matching value(s)\n");
 				exit(EXIT_SUCCESS);
 			break;
 			case 'V':
@@ -133,6 +212,23 @@ int main(int argc, char **argv) {
 			case 's':
 				stats = 1;
 			break;
+			case 'C':
+				cbor = 1;
+			break;
+			case 'p':
+				filter_list(jfilter, "protocol", args);
+			break;
+			case 'D':
+				filter_list(jfilter, "device", args);
+			break;
+			case 'O':
+				filter_list(jfilter, "origin", args);
+			break;
+			case 'W':
+				if(filter_values(jfilter, args) != 0) {
+					exit(EXIT_FAILURE);
+				}
+			break;
 			case 'F':
 				if((filter = REALLOC(filter, strlen(args)+1)) == NULL) {
 					fprintf(stderr, "out of memory\n");
@@ -181,11 +277,14 @@ int main(int argc, char **argv) {
 			logprintf(LOG_ERR, "could not connect to pilight-daemon");
 			return EXIT_FAILURE;
 		}
+	} else if((sockfd = socket_connect_unix(SOCKET_FILE)) != -1) {
+		logprintf(LOG_DEBUG, "connected to the local pilight-daemon");
 	} else if(ssdp_seek(&ssdp_list) == -1) {
 		logprintf(LOG_NOTICE, "no pilight ssdp connections found");
 		goto close;
 	} else {
-		if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1) {
+		if((sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1 &&
+		   (ssdp_reseek(&ssdp_list) == -1 || (sockfd = socket_connect(ssdp_list->ip, ssdp_list->port)) == -1)) {
 			logprintf(LOG_ERR, "could not connect to pilight-daemon");
 			goto close;
 		}
@@ -202,7 +301,16 @@ int main(int argc, char **argv) {
 	json_append_member(jclient, "action", json_mkstring("identify"));
 	json_append_member(joptions, "receiver", json_mknumber(1, 0));
 	json_append_member(joptions, "stats", json_mknumber(stats, 0));
+	if(json_first_child(jfilter) != NULL) {
+		json_append_member(joptions, "filter", jfilter);
+	} else {
+		json_delete(jfilter);
+	}
+	jfilter = NULL;
 	json_append_member(jclient, "options", joptions);
+	if(cbor == 1) {
+		json_append_member(jclient, "encoding", json_mkstring("cbor"));
+	}
 	char *out = json_stringify(jclient, NULL);
 	socket_write(sockfd, out);
 	json_free(out);
@@ -214,45 +322,33 @@ int main(int argc, char **argv) {
 	}
 
 	while(main_loop) {
+		if(cbor == 1) {
+			struct JsonNode *jcontent = NULL;
+			if(socket_read_cbor(sockfd, &jcontent, 0) != 0) {
+				goto close;
+			}
+			print_content(jcontent, filteropt);
+			json_delete(jcontent);
+			continue;
+		}
 		if(socket_read(sockfd, &recvBuff, 0) != 0) {
 			goto close;
 		}
-		char *protocol = NULL;
 		char **array = NULL;
 		unsigned int n = explode(recvBuff, "\n", &array), i = 0;
 
 		for(i=0;i<n;i++) {
 			struct JsonNode *jcontent = json_decode(array[i]);
-			struct JsonNode *jtype = json_find_member(jcontent, "type");
-			if(jtype != NULL) {
-				json_remove_from_parent(jtype);
-				json_delete(jtype);
-			}
-			if(filteropt == 1) {
-				int filtered = 0, j = 0;
-				json_find_string(jcontent, "protocol", &protocol);
-				for(j=0;j<m;j++) {
-					if(strcmp(filters[j], protocol) == 0) {
-						filtered = 1;
-						break;
-					}
-				}
-				if(filtered == 0) {
-					char *content = json_stringify(jcontent, "\t");
-					printf("%s\n", content);
-					json_free(content);
-				}
-			} else {
-				char *content = json_stringify(jcontent, "\t");
-				printf("%s\n", content);
-				json_free(content);
-			}
+			print_content(jcontent, filteropt);
 			json_delete(jcontent);
 		}
 		array_free(&array, n);
 	}
 
 close:
+	if(jfilter != NULL) {
+		json_delete(jfilter);
+	}
 	if(sockfd > 0) {
 		socket_close(sockfd);
 	}